@@ -0,0 +1,106 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace benchmarks
+{
+  using clock = std::chrono::steady_clock;
+
+  struct options
+  {
+    std::string filter; // Only run benchmarks whose name contains this
+    int repetitions = 5;
+    double scale = 1; // Multiplier for the number of operations per repetition
+  };
+
+  // Prevent the compiler from optimizing away a value or assuming it is unchanged
+  template<class T>
+  inline auto do_not_optimize(T& value) -> void
+  {
+#if defined(__GNUC__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    static volatile void* sink;
+    sink = &value;
+#endif
+  }
+
+  // Counts down to zero and lets one thread wait for it by spinning
+  class latch
+  {
+  public:
+    explicit latch(std::int64_t count) : _count(count) { }
+
+    auto count_down(std::int64_t n = 1) noexcept -> void { _count.fetch_sub(n, std::memory_order_release); }
+    auto add(std::int64_t n) noexcept -> void { _count.fetch_add(n, std::memory_order_relaxed); }
+    auto reset(std::int64_t count) noexcept -> void { _count.store(count, std::memory_order_relaxed); }
+
+    auto wait() const noexcept -> void
+    {
+      while(_count.load(std::memory_order_acquire) > 0)
+      {
+        std::this_thread::yield();
+      }
+    }
+
+  private:
+    std::atomic<std::int64_t> _count;
+  };
+
+  /**
+   Runs `f(n)` for the configured number of repetitions and prints the median as one JSON object per line.
+
+   `f` must perform `n` operations and return the elapsed time. Nothing is printed if `name` doesn't match the filter.
+   */
+  template<class F>
+  auto run(const options& opts, const char* name, const std::string& scheduler, unsigned threads, std::int64_t n, F&& f) -> void
+  {
+    if(std::string(name).find(opts.filter) == std::string::npos)
+    {
+      return;
+    }
+    n = std::max<std::int64_t>(1, static_cast<std::int64_t>(n * opts.scale));
+
+    f(n); // warm-up
+    std::vector<double> samples;
+    for(int i = 0; i < opts.repetitions; ++i)
+    {
+      const auto elapsed = f(n);
+      samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / n);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::printf("{\"benchmark\": \"%s\", \"scheduler\": \"%s\", \"threads\": %u, \"operations\": %lld, \"ns_per_op_median\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f}\n",
+                name, scheduler.c_str(), threads, static_cast<long long>(n),
+                samples[samples.size() / 2], samples.front(), samples.back());
+    std::fflush(stdout);
+  }
+
+  template<class F>
+  auto time(F&& f) -> clock::duration
+  {
+    const auto start = clock::now();
+    f();
+    return clock::now() - start;
+  }
+}
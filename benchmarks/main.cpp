@@ -0,0 +1,415 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+// Prints one JSON object per line and measurement. Usage:
+//   schedulers-benchmarks [--filter=<substring>] [--repetitions=<n>] [--scale=<factor>]
+
+#include "benchmark_tools.hpp"
+#include "schedulers/elastic_thread_pool.hpp"
+#include "schedulers/package_task_as_c_callback.hpp"
+#include "schedulers/schedulers.hpp"
+#include "schedulers/serial_scheduler.hpp"
+#include "schedulers/task_graph.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+using namespace benchmarks;
+
+namespace
+{
+  ////////////////////////////////////////////////////////////////////////////////
+  // scheduler benchmarks
+  //
+
+  // Schedule empty tasks from one thread as fast as possible
+  template<class Scheduler>
+  auto submit_throughput(const Scheduler& s, std::int64_t n)
+  {
+    latch done{n};
+    return time([&]
+    {
+      for(std::int64_t i = 0; i < n; ++i)
+      {
+        s([&done] { done.count_down(); });
+      }
+      done.wait();
+    });
+  }
+
+  constexpr unsigned concurrent_submitters = 4;
+
+  // Like submit_throughput but from several threads outside the scheduler at once, which contend on the scheduler's shared state
+  template<class Scheduler>
+  auto concurrent_submit_throughput(const Scheduler& s, std::int64_t n)
+  {
+    latch done{n};
+    return time([&]
+    {
+      std::vector<std::thread> submitters;
+      for(unsigned t = 0; t < concurrent_submitters; ++t)
+      {
+        submitters.emplace_back([&, t]
+        {
+          for(std::int64_t i = t; i < n; i += concurrent_submitters)
+          {
+            s([&done] { done.count_down(); });
+          }
+        });
+      }
+      for(auto& t : submitters)
+      {
+        t.join();
+      }
+      done.wait();
+    });
+  }
+
+  // Schedule one empty task and wait for it to run before scheduling the next
+  template<class Scheduler>
+  auto round_trip_latency(const Scheduler& s, std::int64_t n)
+  {
+    std::atomic<bool> ran{false};
+    return time([&]
+    {
+      for(std::int64_t i = 0; i < n; ++i)
+      {
+        ran.store(false, std::memory_order_relaxed);
+        s([&ran] { ran.store(true, std::memory_order_release); });
+        while(!ran.load(std::memory_order_acquire))
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  constexpr std::int64_t fan_out_width = 1000;
+
+  // Schedule a batch of tasks and wait for all of them before starting the next batch
+  template<class Scheduler>
+  auto fan_out_fan_in(const Scheduler& s, std::int64_t n)
+  {
+    latch done{0};
+    return time([&]
+    {
+      for(std::int64_t i = 0; i < n; i += fan_out_width)
+      {
+        done.reset(fan_out_width);
+        for(std::int64_t j = 0; j < fan_out_width; ++j)
+        {
+          s([&done] { done.count_down(); });
+        }
+        done.wait();
+      }
+    });
+  }
+
+  // Same as fan_out_fan_in but using bulk submission
+  template<class Scheduler>
+  auto fan_out_fan_in_bulk(const Scheduler& s, std::int64_t n)
+  {
+    latch done{0};
+    return time([&]
+    {
+      for(std::int64_t i = 0; i < n; i += fan_out_width)
+      {
+        done.reset(fan_out_width);
+        s.bulk(fan_out_width, [&done] (std::size_t) { done.count_down(); });
+        done.wait();
+      }
+    });
+  }
+
+  // Every task with n >= 2 spawns two children, the leaves add up to fib(n)
+  template<class Scheduler>
+  auto fib_task(const Scheduler& s, latch& outstanding, std::atomic<std::int64_t>& sum, int n) -> void
+  {
+    if(n < 2)
+    {
+      sum.fetch_add(n, std::memory_order_relaxed);
+      outstanding.count_down();
+      return;
+    }
+    // This task is replaced by two children
+    outstanding.add(1);
+    s([&s, &outstanding, &sum, n] { fib_task(s, outstanding, sum, n - 1); });
+    s([&s, &outstanding, &sum, n] { fib_task(s, outstanding, sum, n - 2); });
+  }
+
+  constexpr int fib_n = 20;
+  constexpr std::int64_t fib_tasks = 21891; // Number of calls for fib(20)
+
+  template<class Scheduler>
+  auto recursive_fib(const Scheduler& s, std::int64_t n)
+  {
+    return time([&]
+    {
+      for(std::int64_t i = 0; i < n; i += fib_tasks)
+      {
+        latch outstanding{1};
+        std::atomic<std::int64_t> sum{0};
+        s([&] { fib_task(s, outstanding, sum, fib_n); });
+        outstanding.wait();
+        do_not_optimize(sum);
+      }
+    });
+  }
+
+  // Schedule tasks with delays spread over 10ms and wait until all of them ran
+  template<class Scheduler>
+  auto delayed_throughput(const Scheduler& s, std::int64_t n)
+  {
+    latch done{n};
+    return time([&]
+    {
+      const auto now = clock::now();
+      for(std::int64_t i = 0; i < n; ++i)
+      {
+        s.schedule_at(now + std::chrono::microseconds(i % 10'000), [&done] { done.count_down(); });
+      }
+      done.wait();
+    });
+  }
+
+  constexpr std::int64_t graph_layers = 10;
+  constexpr std::int64_t graph_width = 100;
+
+  // Build a graph of layers depending on their neighbours in the previous layer once and run it like a frame
+  template<class Scheduler>
+  auto task_graph_frames(const Scheduler& s, std::int64_t n)
+  {
+    std::atomic<std::int64_t> counter{0};
+    schedulers::task_graph graph;
+    graph.reserve(graph_layers * graph_width, graph_layers * graph_width * 3);
+    std::vector<schedulers::task_graph::node> previous;
+    for(std::int64_t l = 0; l < graph_layers; ++l)
+    {
+      std::vector<schedulers::task_graph::node> current;
+      for(std::int64_t i = 0; i < graph_width; ++i)
+      {
+        current.push_back(graph.emplace([&counter] { counter.fetch_add(1, std::memory_order_relaxed); }));
+        for(auto j = std::max<std::int64_t>(i - 1, 0); j < std::min(i + 2, static_cast<std::int64_t>(previous.size())); ++j)
+        {
+          graph.precede(previous[j], current.back());
+        }
+      }
+      previous = std::move(current);
+    }
+    const auto elapsed = time([&]
+    {
+      for(std::int64_t i = 0; i < n; i += graph_layers * graph_width)
+      {
+        schedulers::run(graph, s);
+      }
+    });
+    do_not_optimize(counter);
+    return elapsed;
+  }
+
+  template<class Scheduler>
+  auto run_scheduler(const options& opts, const std::string& name, unsigned threads, const Scheduler& s)
+  {
+    run(opts, "submit_throughput", name, threads, 200'000, [&] (auto n) { return submit_throughput(s, n); });
+    run(opts, "concurrent_submit_throughput", name, threads, 200'000, [&] (auto n) { return concurrent_submit_throughput(s, n); });
+    run(opts, "round_trip_latency", name, threads, 20'000, [&] (auto n) { return round_trip_latency(s, n); });
+    run(opts, "fan_out_fan_in", name, threads, 200'000, [&] (auto n) { return fan_out_fan_in(s, n); });
+    run(opts, "fan_out_fan_in_bulk", name, threads, 200'000, [&] (auto n) { return fan_out_fan_in_bulk(s, n); });
+    run(opts, "recursive_fib", name, threads, fib_tasks * 10, [&] (auto n) { return recursive_fib(s, n); });
+    run(opts, "task_graph_frames", name, threads, 200'000, [&] (auto n) { return task_graph_frames(s, n); });
+  }
+
+  template<class Pool>
+  auto run_pool(const options& opts, const std::string& name, const std::vector<unsigned>& thread_counts)
+  {
+    for(auto threads : thread_counts)
+    {
+      Pool pool{static_cast<int>(threads)};
+      run_scheduler(opts, name, threads, pool);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  // work_item and package_task_as_c_callback
+  //
+
+  struct small_task
+  {
+    std::int64_t* counter;
+    auto operator()() const noexcept { ++*counter; }
+  };
+
+  struct large_task
+  {
+    explicit large_task(std::int64_t* counter) noexcept : counter(counter) { }
+
+    std::int64_t* counter;
+    // Too big to be stored inline by a work_item
+    void* padding[7] = {};
+    auto operator()() const noexcept { ++*counter; }
+  };
+
+  template<class Task, class Alloc>
+  auto work_item_cycle(const Alloc& alloc, std::int64_t n)
+  {
+    std::int64_t counter = 0;
+    const auto elapsed = time([&]
+    {
+      for(std::int64_t i = 0; i < n; ++i)
+      {
+        schedulers::detail::work_item wi{std::allocator_arg, alloc, Task{&counter}};
+        do_not_optimize(wi);
+        std::move(wi)();
+      }
+    });
+    do_not_optimize(counter);
+    return elapsed;
+  }
+
+  template<class Task, class Alloc>
+  auto c_callback_cycle(const Alloc& alloc, std::int64_t n)
+  {
+    std::int64_t counter = 0;
+    const auto elapsed = time([&]
+    {
+      for(std::int64_t i = 0; i < n; ++i)
+      {
+        auto cb = schedulers::package_task_as_c_callback(alloc, Task{&counter});
+        auto data = cb.release();
+        do_not_optimize(data);
+        data.callback(data.data);
+      }
+    });
+    do_not_optimize(counter);
+    return elapsed;
+  }
+
+  // Wrap and run a task with tracing_instrumentation, with or without an installed recorder
+  auto traced_task_cycle(bool installed, std::int64_t n)
+  {
+    schedulers::trace_recorder recorder;
+    if(installed)
+    {
+      recorder.install();
+    }
+    schedulers::tracing_instrumentation<> instrumentation;
+    std::int64_t counter = 0;
+    const auto elapsed = time([&]
+    {
+      for(std::int64_t i = 0; i < n; ++i)
+      {
+        auto task = instrumentation.wrap(schedulers::labeled("task", small_task{&counter}));
+        do_not_optimize(task);
+        task();
+      }
+    });
+    do_not_optimize(counter);
+    return elapsed;
+  }
+
+  auto run_single_threaded(const options& opts)
+  {
+    const auto n = 2'000'000;
+    run(opts, "work_item_embedded", "none", 1, n, [] (auto n) { return work_item_cycle<small_task>(std::allocator<char>{}, n); });
+    run(opts, "work_item_heap_std_allocator", "none", 1, n, [] (auto n) { return work_item_cycle<large_task>(std::allocator<char>{}, n); });
+    run(opts, "work_item_heap_task_allocator", "none", 1, n, [] (auto n) { return work_item_cycle<large_task>(schedulers::task_allocator<char>{}, n); });
+    run(opts, "c_callback_no_allocation", "none", 1, n, [] (auto n) { return c_callback_cycle<small_task>(schedulers::task_allocator<char>{}, n); });
+    run(opts, "c_callback_std_allocator", "none", 1, n, [] (auto n) { return c_callback_cycle<large_task>(std::allocator<char>{}, n); });
+    run(opts, "c_callback_task_allocator", "none", 1, n, [] (auto n) { return c_callback_cycle<large_task>(schedulers::task_allocator<char>{}, n); });
+    run(opts, "traced_task_uninstalled", "none", 1, n, [] (auto n) { return traced_task_cycle(false, n); });
+    run(opts, "traced_task_recorded", "none", 1, n, [] (auto n) { return traced_task_cycle(true, n); });
+  }
+
+  auto parse_options(int argc, char** argv)
+  {
+    options opts;
+    for(int i = 1; i < argc; ++i)
+    {
+      const auto arg = argv[i];
+      if(std::strncmp(arg, "--filter=", 9) == 0)
+      {
+        opts.filter = arg + 9;
+      }
+      else if(std::strncmp(arg, "--repetitions=", 14) == 0)
+      {
+        opts.repetitions = std::max(1, std::atoi(arg + 14));
+      }
+      else if(std::strncmp(arg, "--scale=", 8) == 0)
+      {
+        opts.scale = std::atof(arg + 8);
+      }
+      else
+      {
+        std::fprintf(stderr, "usage: %s [--filter=<substring>] [--repetitions=<n>] [--scale=<factor>]\n", argv[0]);
+        std::exit(EXIT_FAILURE);
+      }
+    }
+    return opts;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const auto opts = parse_options(argc, argv);
+
+  const auto hw = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<unsigned> thread_counts;
+  for(unsigned n = 1; n < hw; n *= 2)
+  {
+    thread_counts.push_back(n);
+  }
+  thread_counts.push_back(hw);
+
+  run_single_threaded(opts);
+
+  run_pool<schedulers::thread_pool>(opts, "thread_pool", thread_counts);
+  run_pool<schedulers::work_stealing_thread_pool>(opts, "work_stealing_thread_pool", thread_counts);
+  run_pool<schedulers::sized_thread_pool<64>>(opts, "sized_thread_pool<64>", thread_counts);
+  run_pool<schedulers::bounded_thread_pool<4096>>(opts, "bounded_thread_pool<4096>", thread_counts);
+  run_pool<schedulers::priority_thread_pool>(opts, "priority_thread_pool", thread_counts);
+
+  for(auto threads : thread_counts)
+  {
+    schedulers::thread_pool pool{static_cast<int>(threads)};
+    run(opts, "delayed_throughput", "thread_pool", threads, 200'000, [&] (auto n) { return delayed_throughput(pool, n); });
+    schedulers::work_stealing_thread_pool stealing{static_cast<int>(threads)};
+    run(opts, "delayed_throughput", "work_stealing_thread_pool", threads, 200'000, [&] (auto n) { return delayed_throughput(stealing, n); });
+  }
+
+  {
+    schedulers::elastic_thread_pool pool;
+    run_scheduler(opts, "elastic_thread_pool", hw, pool);
+  }
+  {
+    schedulers::pinned_thread_pool pool;
+    run_scheduler(opts, "pinned_thread_pool", static_cast<unsigned>(schedulers::cpu_topology::detect().cpus.size()), pool);
+  }
+  {
+    // One strand serializing everything on a pool of hw threads
+    schedulers::thread_pool pool{static_cast<int>(hw)};
+    schedulers::serial_scheduler<schedulers::thread_pool> strand{pool};
+    run(opts, "submit_throughput", "serial_scheduler<thread_pool>", hw, 200'000, [&] (auto n) { return submit_throughput(strand, n); });
+    run(opts, "round_trip_latency", "serial_scheduler<thread_pool>", hw, 20'000, [&] (auto n) { return round_trip_latency(strand, n); });
+  }
+
+  // Whatever the platform's native pool is: libdispatch, Win32 thread pool, or thread_pool
+  schedulers::default_scheduler s;
+#if defined(__APPLE__)
+  run_scheduler(opts, "libdispatch_global_default", hw, s);
+#elif defined(_WIN32)
+  run_scheduler(opts, "win32_default_pool", hw, s);
+#else
+  run_scheduler(opts, "default_scheduler", hw, s);
+#endif
+}
@@ -0,0 +1,183 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/task_allocator.hpp"
+#include "schedulers/utils.hpp"
+#include <atomic>
+#include <new>
+#include <utility>
+
+namespace schedulers
+{
+  /**
+   Revokes a task scheduled with `schedule_cancellable()` as long as it hasn't started.
+
+   Cancelling is O(1) and destroys the task's callable right away on the cancelling thread, releasing everything it captured instead of keeping it alive until the scheduler reaches the task. The scheduler only holds a placeholder the size of a pointer which does nothing once it is popped, and queues which know about cancellation (like main_thread_task_queue) drop it without running it at all.
+
+   Copies refer to the same task. A default constructed token refers to no task.
+   */
+  class cancellation_token;
+
+  template<class Derived>
+  struct available_scheduler;
+
+  namespace detail
+  {
+    /**
+     The state shared between a cancellation_token and the placeholder task in the scheduler.
+
+     Whoever moves the status away from pending first owns the callable: the placeholder runs it, cancel() destroys it.
+     */
+    class cancellable_state;
+    /**
+     The move-only placeholder for a cancellable task which is actually scheduled.
+     */
+    class cancellable_task;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::cancellable_state
+//
+
+class schedulers::detail::cancellable_state
+{
+public:
+  template<class Alloc, class F>
+  static auto make(const Alloc& alloc, F&& f) -> cancellable_state*;
+
+  cancellable_state(const cancellable_state&) = delete;
+  cancellable_state& operator=(const cancellable_state&) = delete;
+
+  /// Run the callable unless the task was cancelled.
+  auto run() -> void;
+  /// Destroy the callable unless the task already started. Returns `true` if it did.
+  auto cancel() noexcept -> bool;
+  auto cancelled() const noexcept -> bool
+  {
+    return _status.load(std::memory_order_acquire) == cancelled_status;
+  }
+
+  auto acquire() noexcept -> cancellable_state*
+  {
+    _refs.fetch_add(1, std::memory_order_relaxed);
+    return this;
+  }
+  auto release() noexcept -> void;
+
+private:
+  enum : int { pending_status, started_status, cancelled_status };
+
+  template<class Alloc, class F>
+  cancellable_state(const Alloc& alloc, F&& f)
+  : _work(std::allocator_arg, alloc, forward<F>(f))
+  { }
+  ~cancellable_state() = default;
+
+  std::atomic<unsigned> _refs{1};
+  std::atomic<int> _status{pending_status};
+  work_item _work;
+};
+
+template<class Alloc, class F>
+auto schedulers::detail::cancellable_state::make(const Alloc& alloc, F&& f) -> cancellable_state*
+{
+  static_assert(sizeof(cancellable_state) <= task_allocator_max_block_size, "cancellable_state must fit into the task_allocator caches");
+  auto memory = task_allocator_allocate(sizeof(cancellable_state));
+  try
+  {
+    return ::new(memory) cancellable_state(alloc, forward<F>(f));
+  }
+  catch(...)
+  {
+    task_allocator_deallocate(memory);
+    throw;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::cancellable_task
+//
+
+class schedulers::detail::cancellable_task
+{
+public:
+  explicit cancellable_task(cancellable_state* state) noexcept : _state(state->acquire()) { }
+  cancellable_task(cancellable_task&& other) noexcept : _state(std::exchange(other._state, nullptr)) { }
+  cancellable_task& operator=(cancellable_task&&) = delete;
+  ~cancellable_task()
+  {
+    if(_state)
+    {
+      _state->release();
+    }
+  }
+
+  auto operator()() -> void { _state->run(); }
+
+  auto state() const noexcept -> const cancellable_state& { return *_state; }
+
+private:
+  cancellable_state* _state;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// cancellation_token
+//
+
+class schedulers::cancellation_token
+{
+public:
+  cancellation_token() = default;
+  cancellation_token(const cancellation_token& other) noexcept
+  : _state(other._state ? other._state->acquire() : nullptr)
+  { }
+  cancellation_token(cancellation_token&& other) noexcept
+  : _state(std::exchange(other._state, nullptr))
+  { }
+  cancellation_token& operator=(cancellation_token other) noexcept
+  {
+    std::swap(_state, other._state);
+    return *this;
+  }
+  ~cancellation_token()
+  {
+    if(_state)
+    {
+      _state->release();
+    }
+  }
+
+  /**
+   Prevent the task from running and destroy its callable.
+
+   \return `true` if this call cancelled the task, `false` if it has already started, was cancelled before, or the token is empty.
+   */
+  auto cancel() noexcept -> bool
+  {
+    return _state && _state->cancel();
+  }
+
+  explicit operator bool() const noexcept { return _state != nullptr; }
+
+private:
+  template<class Derived>
+  friend struct available_scheduler;
+
+  // Adopts the reference of a state created with cancellable_state::make()
+  explicit cancellation_token(detail::cancellable_state* state) noexcept : _state(state) { }
+
+  detail::cancellable_state* _state = nullptr;
+};
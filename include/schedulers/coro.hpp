@@ -0,0 +1,392 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/parallel.hpp"
+#include "schedulers/utils.hpp"
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#if !defined(__cpp_impl_coroutine)
+#error "schedulers/coro.hpp requires C++20 coroutines"
+#endif
+
+namespace schedulers
+{
+  /**
+   Returns an awaitable which resumes the awaiting coroutine on `s`.
+
+   ~~~{.cpp}
+   schedulers::task<> load(const schedulers::thread_pool& pool)
+   {
+     co_await schedulers::schedule_on(pool);
+     // Now running on one of pool's threads
+   }
+   ~~~
+
+   The continuation is scheduled as a callable holding nothing but the `std::coroutine_handle`, so hopping onto a basic_thread_pool never allocates. This is checked at compile time including what the pool's instrumentation policy adds, so instrumented pools need room for it like instrumented_thread_pool has. `s` must outlive the suspension.
+   */
+  template<class Scheduler>
+  auto schedule_on(const Scheduler& s) noexcept;
+
+  /**
+   A lazily started coroutine producing a value of type `T`.
+
+   The body starts running when the task is awaited and the awaiting coroutine is resumed by symmetric transfer on whatever thread the body completes. Exceptions escaping the body are rethrown from `co_await`. Use sync_wait() to run a task from non-coroutine code.
+   */
+  template<class T = void>
+  class task;
+
+  /**
+   Run `t` and block until it is done, returning its result or rethrowing its exception.
+
+   If `s` has a `try_run_one()` member (as basic_thread_pool does) the calling thread helps running pending tasks of `s` while it waits, so this can be called from a task running on `s` without deadlocking. Otherwise it blocks.
+   */
+  template<class Scheduler, class T>
+  auto sync_wait(const Scheduler& s, task<T> t) -> T;
+  template<class T>
+  auto sync_wait(task<T> t) -> T;
+
+  namespace detail
+  {
+    struct resume_coroutine
+    {
+      auto operator()() const -> void { handle.resume(); }
+      std::coroutine_handle<> handle;
+    };
+
+    // Whether Scheduler stores resume_coroutine without allocating. Only checked for the work items of basic_thread_pool, everything else only has to fit into a default sized work_item.
+    template<class Scheduler, class = void_t<>>
+    struct stores_continuation_inline : bool_constant<work_item::stores_inline<resume_coroutine>()> { };
+
+    template<class Scheduler>
+    struct stores_continuation_inline<Scheduler, void_t<decltype(Scheduler::work_t::template stores_inline<typename Scheduler::template wrapped_task_t<resume_coroutine>>())>>
+    : bool_constant<Scheduler::work_t::template stores_inline<typename Scheduler::template wrapped_task_t<resume_coroutine>>()> { };
+
+    template<class Scheduler>
+    class schedule_awaitable;
+
+    // Continuation and exception handling shared by all task_promise specializations
+    class task_promise_base;
+    template<class T>
+    class task_promise;
+
+    // Signals sync_wait() once the coroutine it runs reaches its final suspension point
+    class sync_wait_event;
+    class sync_wait_task;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// schedule_on
+//
+
+template<class Scheduler>
+class schedulers::detail::schedule_awaitable
+{
+public:
+  explicit schedule_awaitable(const Scheduler& s) noexcept : _scheduler(s) { }
+
+  auto await_ready() const noexcept -> bool { return false; }
+  auto await_suspend(std::coroutine_handle<> h) const -> void
+  {
+    static_assert(stores_continuation_inline<Scheduler>::value,
+                  "continuations must be stored inline, use a thread pool with larger work items like instrumented_thread_pool");
+    _scheduler(resume_coroutine{h});
+  }
+  auto await_resume() const noexcept -> void { }
+
+private:
+  const Scheduler& _scheduler;
+};
+
+template<class Scheduler>
+auto schedulers::schedule_on(const Scheduler& s) noexcept
+{
+  return detail::schedule_awaitable<Scheduler>{s};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// task
+//
+
+class schedulers::detail::task_promise_base
+{
+public:
+  auto initial_suspend() const noexcept -> std::suspend_always { return {}; }
+  auto final_suspend() const noexcept
+  {
+    struct final_awaiter
+    {
+      auto await_ready() const noexcept -> bool { return false; }
+      auto await_suspend(std::coroutine_handle<>) const noexcept -> std::coroutine_handle<>
+      {
+        return continuation ? continuation : std::noop_coroutine();
+      }
+      auto await_resume() const noexcept -> void { }
+      std::coroutine_handle<> continuation;
+    };
+    return final_awaiter{_continuation};
+  }
+  auto unhandled_exception() noexcept -> void { _exception = std::current_exception(); }
+
+  auto set_continuation(std::coroutine_handle<> continuation) noexcept -> void { _continuation = continuation; }
+
+protected:
+  auto rethrow_if_failed() const -> void
+  {
+    if(_exception)
+    {
+      std::rethrow_exception(_exception);
+    }
+  }
+
+private:
+  std::coroutine_handle<> _continuation;
+  std::exception_ptr _exception;
+};
+
+template<class T>
+class schedulers::detail::task_promise : public task_promise_base
+{
+public:
+  auto get_return_object() noexcept -> task<T>;
+
+  template<class U>
+  auto return_value(U&& value) -> void { _value.emplace(forward<U>(value)); }
+
+  auto result() -> T
+  {
+    rethrow_if_failed();
+    return move(*_value);
+  }
+
+private:
+  std::optional<T> _value;
+};
+
+template<>
+class schedulers::detail::task_promise<void> : public task_promise_base
+{
+public:
+  auto get_return_object() noexcept -> task<void>;
+
+  auto return_void() const noexcept -> void { }
+
+  auto result() const -> void { rethrow_if_failed(); }
+};
+
+template<class T>
+class schedulers::task
+{
+public:
+  using promise_type = detail::task_promise<T>;
+
+  task(task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) { }
+  task& operator=(task other) noexcept
+  {
+    std::swap(_handle, other._handle);
+    return *this;
+  }
+  ~task()
+  {
+    if(_handle)
+    {
+      _handle.destroy();
+    }
+  }
+
+  auto operator co_await() && noexcept
+  {
+    struct awaiter
+    {
+      auto await_ready() const noexcept -> bool { return false; }
+      auto await_suspend(std::coroutine_handle<> continuation) const noexcept -> std::coroutine_handle<>
+      {
+        handle.promise().set_continuation(continuation);
+        return handle;
+      }
+      auto await_resume() const -> T { return handle.promise().result(); }
+      std::coroutine_handle<promise_type> handle;
+    };
+    return awaiter{_handle};
+  }
+  auto operator co_await() & noexcept { return move(*this).operator co_await(); }
+
+private:
+  friend promise_type;
+
+  explicit task(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) { }
+
+  std::coroutine_handle<promise_type> _handle;
+};
+
+template<class T>
+auto schedulers::detail::task_promise<T>::get_return_object() noexcept -> task<T>
+{
+  return task<T>{std::coroutine_handle<task_promise>::from_promise(*this)};
+}
+
+inline auto schedulers::detail::task_promise<void>::get_return_object() noexcept -> task<void>
+{
+  return task<void>{std::coroutine_handle<task_promise>::from_promise(*this)};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// sync_wait
+//
+
+class schedulers::detail::sync_wait_event
+{
+public:
+  auto set() -> void
+  {
+    // Notify under the lock, otherwise the waiting thread might destroy us before notify_all() returns
+    std::lock_guard<std::mutex> lock{_mutex};
+    _done = true;
+    _cv.notify_all();
+  }
+
+  template<class Scheduler>
+  auto wait(const Scheduler& s) -> void
+  {
+    wait_helping(s, _mutex, _cv, [this] { return _done; });
+  }
+
+private:
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _done = false;
+};
+
+class schedulers::detail::sync_wait_task
+{
+public:
+  struct promise_type
+  {
+    auto get_return_object() noexcept -> sync_wait_task
+    {
+      return sync_wait_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    auto initial_suspend() const noexcept -> std::suspend_always { return {}; }
+    auto final_suspend() const noexcept
+    {
+      struct final_awaiter
+      {
+        auto await_ready() const noexcept -> bool { return false; }
+        auto await_suspend(std::coroutine_handle<promise_type> h) const noexcept -> void { h.promise().event->set(); }
+        auto await_resume() const noexcept -> void { }
+      };
+      return final_awaiter{};
+    }
+    // The awaited task's exception is rethrown by the code storing the result, which catches it
+    auto unhandled_exception() const noexcept -> void { std::terminate(); }
+    auto return_void() const noexcept -> void { }
+
+    sync_wait_event* event = nullptr;
+  };
+
+  sync_wait_task(sync_wait_task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) { }
+  sync_wait_task& operator=(sync_wait_task&&) = delete;
+  ~sync_wait_task()
+  {
+    if(_handle)
+    {
+      _handle.destroy();
+    }
+  }
+
+  template<class Scheduler>
+  auto run(const Scheduler& s) -> void
+  {
+    sync_wait_event event;
+    _handle.promise().event = &event;
+    _handle.resume();
+    event.wait(s);
+  }
+
+private:
+  explicit sync_wait_task(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) { }
+
+  std::coroutine_handle<promise_type> _handle;
+};
+
+namespace schedulers
+{
+  namespace detail
+  {
+    // Has no try_run_one() so sync_wait() without a scheduler just blocks
+    struct no_scheduler { };
+
+    template<class T>
+    auto make_sync_wait_task(task<T>& t, std::optional<T>& result, std::exception_ptr& exception) -> sync_wait_task
+    {
+      try
+      {
+        result.emplace(co_await t);
+      }
+      catch(...)
+      {
+        exception = std::current_exception();
+      }
+    }
+
+    inline auto make_sync_wait_task(task<void>& t, std::exception_ptr& exception) -> sync_wait_task
+    {
+      try
+      {
+        co_await t;
+      }
+      catch(...)
+      {
+        exception = std::current_exception();
+      }
+    }
+  }
+}
+
+template<class Scheduler, class T>
+auto schedulers::sync_wait(const Scheduler& s, task<T> t) -> T
+{
+  std::exception_ptr exception;
+  if constexpr(std::is_void<T>::value)
+  {
+    detail::make_sync_wait_task(t, exception).run(s);
+    if(exception)
+    {
+      std::rethrow_exception(exception);
+    }
+  }
+  else
+  {
+    std::optional<T> result;
+    detail::make_sync_wait_task(t, result, exception).run(s);
+    if(exception)
+    {
+      std::rethrow_exception(exception);
+    }
+    return move(*result);
+  }
+}
+
+template<class T>
+auto schedulers::sync_wait(task<T> t) -> T
+{
+  return sync_wait(detail::no_scheduler{}, move(t));
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/schedulers.hpp"
+#include <chrono>
+#include <functional>
+
+namespace schedulers
+{
+  /**
+   Configures how an elastic_thread_pool grows and shrinks.
+   */
+  struct elastic_pool_options
+  {
+    /// Threads started up front and never retired.
+    unsigned min_threads = 1;
+    /// Upper limit on the number of threads including those inside a blocking_region.
+    unsigned max_threads = 4 * std::max(1u, std::thread::hardware_concurrency());
+    /// New threads are started on demand while fewer than this many threads are running outside a blocking_region.
+    unsigned concurrency = std::max(1u, std::thread::hardware_concurrency());
+    /// If the oldest queued task waits longer than this yet another thread is started, up to max_threads, assuming the running tasks block without saying so.
+    std::chrono::microseconds spawn_delay = std::chrono::milliseconds(5);
+    /// Threads idle for this long exit unless there are only min_threads left.
+    std::chrono::microseconds idle_timeout = std::chrono::seconds(10);
+  };
+
+  /**
+   A thread pool starting threads when there is more work than running threads and retiring them when they have been idle for a while.
+
+   All threads share one FIFO queue. A task scheduled while no thread is idle starts a new thread if fewer than `concurrency` threads are running. Tasks which are about to block should announce it with a blocking_region so the pool can start a replacement thread right away. Tasks blocking without a blocking_region are detected by a monitor thread which starts another thread whenever the oldest task waited longer than `spawn_delay`. The monitor only wakes up while there are queued tasks.
+
+   Threads are created by the factory given to the constructor which is called with the thread's slot index in `[0, max_threads)` and a `Callable<void()>` the thread must call. Slots are reused once their thread retired.
+
+   The destructor runs all pending tasks and blocks until all threads have exited.
+   */
+  class elastic_thread_pool;
+
+  /**
+   Announce that the current task is about to block, e.g. waiting for I/O, for the lifetime of this object.
+
+   If the current thread belongs to an elastic_thread_pool with pending work another thread may be started to keep the pool's concurrency level. Otherwise this does nothing, so libraries can use it without knowing the scheduler they run on.
+   */
+  class blocking_region;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// elastic_thread_pool
+//
+
+class schedulers::elastic_thread_pool : public available_scheduler<elastic_thread_pool>
+{
+public:
+  using default_allocator_type = task_allocator<char>;
+  using thread_factory = std::function<std::thread(unsigned index, std::function<void()> f)>;
+
+  explicit elastic_thread_pool(elastic_pool_options options = {});
+  elastic_thread_pool(thread_factory factory, elastic_pool_options options);
+  ~elastic_thread_pool();
+
+  /// The number of threads currently alive, excluding the monitor.
+  auto num_threads() const -> unsigned;
+
+  /**
+   Run one pending task of the pool on the calling thread if there is one.
+
+   \return `false` if no task could be found.
+   */
+  auto try_run_one() const -> bool;
+
+  /// Whether the calling thread is one of the workers of this pool.
+  auto running_in_this_thread() const noexcept -> bool;
+
+private:
+  friend available_scheduler<elastic_thread_pool>;
+  friend blocking_region;
+
+  using clock = std::chrono::steady_clock;
+  using lock_t = std::unique_lock<std::mutex>;
+
+  struct entry
+  {
+    detail::work_item work;
+    clock::time_point enqueued;
+  };
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    push({std::allocator_arg, alloc, forward<F>(f)});
+  }
+
+  auto push(detail::work_item&& f) const -> void;
+  // Start a thread if there is a free slot. Must be called with the mutex locked and may unlock it while joining the slot's retired thread.
+  auto spawn(lock_t& lock) const -> bool;
+  auto run(unsigned index) const -> void;
+  auto monitor() const -> void;
+  auto enter_blocking() const -> void;
+  auto leave_blocking() const -> void;
+
+  const elastic_pool_options _options;
+  const thread_factory _factory;
+
+  mutable std::mutex _mutex;
+  mutable std::condition_variable _work_ready;
+  mutable std::condition_variable _monitor_ready;
+  mutable std::deque<entry> _queue;
+  // One slot per possible thread, a retired thread stays in its slot until the slot is reused or the pool is destroyed
+  mutable std::vector<std::thread> _threads;
+  mutable std::vector<unsigned> _free_slots;
+  mutable unsigned _num_threads = 0;
+  mutable unsigned _num_idle = 0;
+  mutable unsigned _num_blocked = 0;
+  mutable bool _monitor_sleeping = false;
+  mutable bool _done = false;
+  std::thread _monitor;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// blocking_region
+//
+
+class schedulers::blocking_region
+{
+public:
+  blocking_region();
+  blocking_region(const blocking_region&) = delete;
+  blocking_region& operator=(const blocking_region&) = delete;
+  ~blocking_region();
+
+private:
+  const elastic_thread_pool* _pool;
+};
@@ -0,0 +1,221 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace schedulers
+{
+  /**
+   The default instrumentation policy of basic_thread_pool. All hooks are empty and optimized away.
+
+   An instrumentation policy must be `DefaultConstructible` and provide all the hooks below. They are called concurrently from all threads using the pool. A worker index of `num_threads` identifies a thread not belonging to the pool.
+
+   - `init(num_threads)` is called once from the pool's constructor before any threads are started.
+   - `on_worker_start(worker)` is called by every worker thread before it starts looking for work.
+   - `on_push(worker, queue, n)` when `n` tasks were pushed to `queue`.
+   - `on_pop(worker, queue)` when a task was popped from `queue`. If `worker == queue` this is a local pop and a steal otherwise.
+   - `on_failed_steal(worker, queue)` when trying to steal from `queue` came up empty.
+   - `on_park(worker)` and `on_wake(worker)` when a worker blocks in `WorkQueue::pop()` and returns from it.
+   - `wrap(f)` is applied to every callable before it is stored in the queue. The returned callable is scheduled instead.
+   - `wrap_overhead` is how many bytes the callable returned by `wrap(f)` is larger than `f`. This is only required by instrumented_thread_pool which makes room for it in its work items.
+
+   If the policy has a `snapshot()` method its result is available through `basic_thread_pool::stats()`.
+   */
+  struct no_instrumentation
+  {
+    auto init(unsigned /*num_threads*/) noexcept -> void { }
+    auto on_worker_start(unsigned /*worker*/) const noexcept -> void { }
+    auto on_push(unsigned /*worker*/, unsigned /*queue*/, std::size_t /*n*/) const noexcept -> void { }
+    auto on_pop(unsigned /*worker*/, unsigned /*queue*/) const noexcept -> void { }
+    auto on_failed_steal(unsigned /*worker*/, unsigned /*queue*/) const noexcept -> void { }
+    auto on_park(unsigned /*worker*/) const noexcept -> void { }
+    auto on_wake(unsigned /*worker*/) const noexcept -> void { }
+    template<class F>
+    auto wrap(F&& f) const noexcept -> F&& { return forward<F>(f); }
+    static constexpr std::size_t wrap_overhead = 0;
+  };
+
+  /**
+   A snapshot of the counters collected by counting_instrumentation.
+   */
+  struct thread_pool_stats
+  {
+    struct worker
+    {
+      std::uint64_t pushes; ///< Tasks scheduled from this thread
+      std::uint64_t local_pops; ///< Tasks taken from the thread's own queue
+      std::uint64_t steals; ///< Tasks taken from another thread's queue
+      std::uint64_t failed_steals; ///< Attempts to take from another thread's queue that found it empty
+      std::uint64_t parks; ///< How often the thread blocked waiting for work
+      std::uint64_t wakeups; ///< How often it woke up again
+    };
+
+    struct queue
+    {
+      std::uint64_t depth; ///< Tasks pushed but not yet popped when the snapshot was taken
+      std::uint64_t max_depth; ///< The highest depth observed so far
+    };
+
+    /**
+     A histogram of durations with power-of-two buckets.
+
+     Bucket `i` counts the durations in the range `[2^i, 2^(i+1))` nanoseconds, except for the first bucket which also includes zero and the last bucket which also includes everything longer.
+     */
+    struct histogram
+    {
+      static constexpr std::size_t num_buckets = 32;
+      std::uint64_t buckets[num_buckets];
+
+      /// Total number of recorded durations.
+      auto count() const noexcept -> std::uint64_t;
+      /// Upper bound of the bucket containing the given quantile in `[0, 1]`.
+      auto quantile(double q) const noexcept -> std::chrono::nanoseconds;
+    };
+
+    /// One entry per worker plus a last one for all threads not belonging to the pool.
+    std::vector<worker> workers;
+    std::vector<queue> queues;
+    /// Time between scheduling a task and the start of its execution.
+    histogram queue_latency;
+    /// Time it took to execute a task.
+    histogram run_time;
+  };
+
+  /**
+   An instrumentation policy for basic_thread_pool gathering per-worker counters, per-queue depths, and task timing histograms.
+
+   All counters use relaxed atomic operations and are kept in separate cache lines per worker. To measure timing every task is wrapped into a callable holding an additional pointer and time stamp. Use instrumented_thread_pool so that doesn't change which tasks fit into the work item's inline buffer.
+
+   \see thread_pool_stats
+   */
+  class counting_instrumentation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// counting_instrumentation
+//
+
+class schedulers::counting_instrumentation
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  auto init(unsigned num_threads) -> void;
+  auto on_worker_start(unsigned worker) const noexcept -> void;
+  auto on_push(unsigned worker, unsigned queue, std::size_t n) const noexcept -> void;
+  auto on_pop(unsigned worker, unsigned queue) const noexcept -> void;
+  auto on_failed_steal(unsigned worker, unsigned /*queue*/) const noexcept -> void
+  {
+    add((*_workers)[worker].failed_steals);
+  }
+  auto on_park(unsigned worker) const noexcept -> void
+  {
+    add((*_workers)[worker].parks);
+  }
+  auto on_wake(unsigned worker) const noexcept -> void
+  {
+    add((*_workers)[worker].wakeups);
+  }
+  template<class F>
+  auto wrap(F&& f) const
+  {
+    return timed_task<std::decay_t<F>>{this, clock::now(), forward<F>(f)};
+  }
+  static constexpr std::size_t wrap_overhead = sizeof(void*) + sizeof(clock::time_point);
+
+  auto snapshot() const -> thread_pool_stats;
+
+private:
+  using counter = std::atomic<std::uint64_t>;
+
+  struct histogram
+  {
+    counter buckets[thread_pool_stats::histogram::num_buckets];
+  };
+
+  struct worker_counters
+  {
+    counter pushes;
+    counter local_pops;
+    counter steals;
+    counter failed_steals;
+    counter parks;
+    counter wakeups;
+    histogram queue_latency;
+    histogram run_time;
+  };
+
+  struct queue_counters
+  {
+    counter pushes;
+    counter pops;
+    counter max_depth;
+  };
+
+  template<class F>
+  struct timed_task
+  {
+    const counting_instrumentation* owner;
+    clock::time_point enqueued;
+    F f;
+
+    auto operator()() -> void
+    {
+      const auto started = clock::now();
+      auto& w = owner->current_worker();
+      record(w.queue_latency, started - enqueued);
+      move(f)();
+      record(w.run_time, clock::now() - started);
+    }
+  };
+  static_assert(sizeof(timed_task<void*>) == wrap_overhead + sizeof(void*), "wrap_overhead must match the size of timed_task");
+
+  static auto add(counter& c, std::uint64_t n = 1) noexcept -> void
+  {
+    c.fetch_add(n, std::memory_order_relaxed);
+  }
+  static auto record(histogram& h, clock::duration d) noexcept -> void;
+  auto current_worker() const noexcept -> worker_counters&;
+
+  unsigned _num_threads = 0;
+  // The extra last entry is shared by all threads outside the pool
+  std::unique_ptr<detail::cache_aligned_array<worker_counters>> _workers;
+  std::unique_ptr<detail::cache_aligned_array<queue_counters>> _queues;
+};
+
+inline auto schedulers::counting_instrumentation::on_push(unsigned worker, unsigned queue, std::size_t n) const noexcept -> void
+{
+  add((*_workers)[worker].pushes, n);
+  auto& q = (*_queues)[queue];
+  const auto pushes = q.pushes.fetch_add(n, std::memory_order_relaxed) + n;
+  const auto pops = q.pops.load(std::memory_order_relaxed);
+  // The matching pops may have been counted first
+  const auto depth = pushes > pops ? pushes - pops : 0;
+  auto max = q.max_depth.load(std::memory_order_relaxed);
+  while(depth > max && !q.max_depth.compare_exchange_weak(max, depth, std::memory_order_relaxed))
+  {
+  }
+}
+
+inline auto schedulers::counting_instrumentation::on_pop(unsigned worker, unsigned queue) const noexcept -> void
+{
+  add(worker == queue ? (*_workers)[worker].local_pops : (*_workers)[worker].steals);
+  add((*_queues)[queue].pops);
+}
@@ -13,7 +13,9 @@
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 #pragma once
+#include "schedulers/task_allocator.hpp"
 #include "schedulers/utils.hpp"
+#include <cstring>
 #include <tuple>
 
 namespace schedulers
@@ -38,6 +40,10 @@ namespace schedulers
    The returned type is always `MoveConstructible` and optionally `CopyConstructible`. The function pointer is created in such a fashion that it automatically takes care of all cleanup after invoking `callback` with `data` as parameter, even in the presence of an exception. As a consequence it is undefined behavior to invoke the callback multiple times.
    
    The returned type is itself a function object callable as `void()`. Calling it implies a call to `.release()`.
+
+   Callables which are trivially copyable and no larger than a pointer are stored directly in the `void*` data value and never allocate. All others are copied into a block from task_allocator, whose per-thread caches recycle fixed size blocks instead of going to the heap for every submission.
+
+   The block is released on whichever thread runs the callback. Threads owned by the C API, like those of Grand Central Dispatch or the Win32 thread pool, never call `detail::task_allocator_flush()`, so the blocks they release wait in that thread's batch until the batch is full or the thread exits. Meanwhile the allocating thread carves new blocks instead, but none of them are leaked.
    
    \tparam FunctionPointerType
     The exact type of function pointer used as C callback. It defaults to `void(*)(void*)` but can be specified manually if needed (must still conform to the `void(void*)` signature). This is necessary for some APIs which have special qualifiers on their function pointers. For example all Win32 callbacks must have the `__stdcall` calling convention. These APIs usually provide typedefs like `LPTHREAD_START_ROUTINE` in which case you would call `package_task_as_c_callback<LPTHREAD_START_ROUTINE>(...)`. Likewise if wrapping callables for Grand Central Dispatch one would use `package_task_as_c_callback<dispatch_function_t>(...)`.
@@ -47,6 +53,8 @@ namespace schedulers
 
   /**
    This overload is identical to the single-parameter version except it allows you to control how memory is allocated if necessary.
+
+   `alloc` is only used for callables which don't fit into the `void*` data value. Stateless allocators don't take up any space in the allocated block.
    */
   template<class FunctionPointerType = void(*)(void*), class Alloc, class F>
   auto package_task_as_c_callback(const Alloc& alloc, F&& f);
@@ -107,7 +115,7 @@ namespace schedulers
 template<class FunctionPointerType, class F>
 auto schedulers::package_task_as_c_callback(F&& f)
 {
-  return schedulers::package_task_as_c_callback(std::allocator<char>{}, forward<F>(f));
+  return schedulers::package_task_as_c_callback<FunctionPointerType>(task_allocator<char>{}, forward<F>(f));
 }
 
 template<class FunctionPointerType, class Alloc, class F>
@@ -201,13 +209,13 @@ auto schedulers::detail::package_task_as_c_callback_impl(std::true_type /* valid
     // We have to ensure the object we call is properly aligned.
     // Therefore we cannot just reinterpret "&data".
     alignas(converter_t) char converter[sizeof(converter_t)];
-    memcpy(converter, &data, sizeof(data));
+    std::memcpy(converter, &data, sizeof(data));
     auto* f = reinterpret_cast<function_t*>(converter);
     move(*f)();
   };
 
   alignas(converter_t) char converter[sizeof(converter_t)];
-  memcpy(converter, &f, sizeof(f));
+  std::memcpy(converter, &f, sizeof(f));
   return make_c_callback(f_ptr, data_t{*reinterpret_cast<void**>(converter)});
 }
 
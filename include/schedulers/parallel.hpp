@@ -0,0 +1,291 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+namespace schedulers
+{
+  /**
+   Call `f(i)` for every `i` in `[first, last)` using `s` to run the iterations in parallel and block until all are done.
+
+   The range is split lazily: every task processes its range in chunks of `grain` iterations and only splits off the upper half of what is left as a new task when no previously split off task is still waiting to be picked up by the scheduler. This way the range is only split as far as there are idle threads to work on it.
+
+   The calling thread always processes part of the range itself. If `s` has a `try_run_one()` member (as basic_thread_pool does) the calling thread then helps running pending tasks until the loop is done, otherwise it blocks.
+
+   If any invocation of `f` throws the remaining iterations are abandoned and one of the exceptions is rethrown once all running tasks are done.
+
+   \warning Unless `s` provides `try_run_one()` calling this from a task running on `s` can deadlock if all threads of `s` end up blocked waiting.
+   */
+  template<class Scheduler, class Integer, class F>
+  auto parallel_for(const Scheduler& s, Integer first, Integer last, Integer grain, F&& f) -> void;
+
+  /**
+   Reduce `map(i)` for every `i` in `[first, last)` using `reduce` and starting with `identity` using `s` to run the iterations in parallel, and block until the result is known.
+
+   The range is split in the same way as in parallel_for(). Every task accumulates its own result which is combined with the others once it is done. As the order in which tasks complete is unspecified `reduce` must be associative and commutative.
+   */
+  template<class Scheduler, class Integer, class T, class Map, class Reduce>
+  auto parallel_reduce(const Scheduler& s, Integer first, Integer last, Integer grain, T identity, Map&& map, Reduce&& reduce) -> T;
+
+  namespace detail
+  {
+    /**
+     Runs the lazily split loop.
+
+     MakeBody is called once per task to create the object processing this task's chunks. It must be callable as `body(first, last)` with the bounds of a chunk and have a `finish()` method called once the task is done.
+     */
+    template<class Scheduler, class Integer, class MakeBody>
+    class parallel_loop;
+
+    template<class Scheduler>
+    auto can_run_one(const Scheduler& s, int) -> decltype(bool(s.try_run_one()), std::true_type());
+    template<class Scheduler>
+    auto can_run_one(const Scheduler& s, long) -> std::false_type;
+
+    /**
+     Block until `done()` returns `true`, running pending tasks of `s` on the calling thread in the meantime if it has a `try_run_one()` member.
+
+     `done()` is only called with `mutex` locked and whoever makes it `true` must notify `cv` with `mutex` locked. Once `s` has nothing left to run the calling thread sleeps until it is notified.
+     */
+    template<class Scheduler, class Predicate>
+    auto wait_helping(const Scheduler& s, std::mutex& mutex, std::condition_variable& cv, Predicate done) -> void;
+    template<class Scheduler, class Predicate>
+    auto wait_helping(const Scheduler& s, std::mutex& mutex, std::condition_variable& cv, Predicate& done, std::true_type) -> void;
+    template<class Scheduler, class Predicate>
+    auto wait_helping(const Scheduler& s, std::mutex& mutex, std::condition_variable& cv, Predicate& done, std::false_type) -> void;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::wait_helping
+//
+
+template<class Scheduler, class Predicate>
+auto schedulers::detail::wait_helping(const Scheduler& s, std::mutex& mutex, std::condition_variable& cv, Predicate done) -> void
+{
+  wait_helping(s, mutex, cv, done, decltype(can_run_one(s, 0)){});
+}
+
+template<class Scheduler, class Predicate>
+auto schedulers::detail::wait_helping(const Scheduler& s, std::mutex& mutex, std::condition_variable& cv, Predicate& done, std::true_type) -> void
+{
+  std::unique_lock<std::mutex> lock{mutex};
+  while(!done())
+  {
+    lock.unlock();
+    const auto helped = s.try_run_one();
+    lock.lock();
+    if(!helped)
+    {
+      // Nothing to steal, the remaining work is already running elsewhere and notifies us when it is done
+      cv.wait(lock, done);
+    }
+  }
+}
+
+template<class Scheduler, class Predicate>
+auto schedulers::detail::wait_helping(const Scheduler& /*s*/, std::mutex& mutex, std::condition_variable& cv, Predicate& done, std::false_type) -> void
+{
+  std::unique_lock<std::mutex> lock{mutex};
+  cv.wait(lock, done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::parallel_loop
+//
+
+template<class Scheduler, class Integer, class MakeBody>
+class schedulers::detail::parallel_loop
+{
+public:
+  parallel_loop(const Scheduler& s, Integer grain, MakeBody make_body)
+  : _scheduler(s)
+  , _grain(std::max(grain, Integer(1)))
+  , _make_body(move(make_body))
+  { }
+
+  auto run(Integer first, Integer last) -> void
+  {
+    process(first, last);
+    wait_helping(_scheduler, _mutex, _done, [this] { return _finished; });
+    if(_exception)
+    {
+      std::rethrow_exception(_exception);
+    }
+  }
+
+private:
+  using lock_t = std::unique_lock<std::mutex>;
+
+  auto process(Integer first, Integer last) -> void
+  {
+    try
+    {
+      auto body = _make_body();
+      while(first < last && !_failed.load(std::memory_order_relaxed))
+      {
+        // Only split if everything we split off before has been picked up already
+        while(last - first > _grain && _pending.load(std::memory_order_relaxed) == 0)
+        {
+          const auto middle = first + (last - first) / 2;
+          if(!spawn(middle, last))
+          {
+            break;
+          }
+          last = middle;
+        }
+        const auto chunk_end = first + std::min(_grain, last - first);
+        body(first, chunk_end);
+        first = chunk_end;
+      }
+      body.finish();
+    }
+    catch(...)
+    {
+      lock_t lock{_mutex};
+      if(!_exception)
+      {
+        _exception = std::current_exception();
+      }
+      _failed = true;
+    }
+    complete();
+  }
+
+  auto spawn(Integer first, Integer last) -> bool
+  {
+    ++_pending;
+    ++_outstanding;
+    try
+    {
+      _scheduler([this, first, last]
+      {
+        --_pending;
+        process(first, last);
+      });
+      return true;
+    }
+    catch(...)
+    {
+      // Couldn't schedule, so just do it ourselves
+      --_pending;
+      --_outstanding;
+      return false;
+    }
+  }
+
+  auto complete() -> void
+  {
+    if(--_outstanding == 0)
+    {
+      // This must happen under the lock, otherwise the waiting thread might destroy us before notify_all() returns
+      lock_t lock{_mutex};
+      _finished = true;
+      _done.notify_all();
+    }
+  }
+
+  const Scheduler& _scheduler;
+  const Integer _grain;
+  const MakeBody _make_body;
+  std::atomic<int> _pending{0}; // Tasks scheduled but not yet started
+  std::atomic<int> _outstanding{1}; // Tasks not yet finished, including the calling thread
+  std::atomic<bool> _failed{false};
+  std::mutex _mutex;
+  std::condition_variable _done;
+  std::exception_ptr _exception;
+  bool _finished = false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// parallel_for
+//
+
+template<class Scheduler, class Integer, class F>
+auto schedulers::parallel_for(const Scheduler& s, Integer first, Integer last, Integer grain, F&& f) -> void
+{
+  if(!(first < last))
+  {
+    return;
+  }
+
+  struct body
+  {
+    auto operator()(Integer first, Integer last) const
+    {
+      for(; first < last; ++first)
+      {
+        (*f)(first);
+      }
+    }
+    auto finish() const noexcept { }
+    std::remove_reference_t<F>* f;
+  };
+  auto make_body = [&f] { return body{std::addressof(f)}; };
+
+  detail::parallel_loop<Scheduler, Integer, decltype(make_body)> loop{s, grain, make_body};
+  loop.run(first, last);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// parallel_reduce
+//
+
+template<class Scheduler, class Integer, class T, class Map, class Reduce>
+auto schedulers::parallel_reduce(const Scheduler& s, Integer first, Integer last, Integer grain, T identity, Map&& map, Reduce&& reduce) -> T
+{
+  if(!(first < last))
+  {
+    return identity;
+  }
+
+  struct shared_t
+  {
+    const T& identity;
+    std::remove_reference_t<Map>& map;
+    std::remove_reference_t<Reduce>& reduce;
+    std::mutex mutex;
+    T result;
+  };
+  shared_t shared{identity, map, reduce, {}, identity};
+
+  struct body
+  {
+    auto operator()(Integer first, Integer last)
+    {
+      for(; first < last; ++first)
+      {
+        value = shared->reduce(move(value), shared->map(first));
+      }
+    }
+    auto finish()
+    {
+      std::lock_guard<std::mutex> lock{shared->mutex};
+      shared->result = shared->reduce(move(shared->result), move(value));
+    }
+    shared_t* shared;
+    T value;
+  };
+  auto make_body = [&shared] { return body{&shared, shared.identity}; };
+
+  detail::parallel_loop<Scheduler, Integer, decltype(make_body)> loop{s, grain, make_body};
+  loop.run(first, last);
+  return move(shared.result);
+}
@@ -14,9 +14,27 @@
 
 #pragma once
 
+#include "schedulers/cancellation.hpp"
+#include "schedulers/instrumentation.hpp"
 #include "schedulers/package_task_as_c_callback.hpp"
+#include "schedulers/task_allocator.hpp"
+#include "schedulers/timer_wheel.hpp"
+#include "schedulers/topology.hpp"
+#include "schedulers/tracing.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #if defined(_WIN32)
@@ -24,13 +42,19 @@
 #include <windows.h>
 
 #elif defined(__APPLE__)
+#include <CoreFoundation/CoreFoundation.h>
 #include <dispatch/dispatch.h>
+#include <pthread.h>
 
 #elif defined(__EMSCRIPTEN__)
 #include <emscripten.h>
 
 #endif
 
+#if defined(SCHEDULERS_FOR_ANDROID)
+#include <android/api-level.h>
+#endif
+
 namespace schedulers
 {
   /**
@@ -51,19 +75,188 @@ namespace schedulers
 
    The thread pool implements task stealing between the per-thread queues using the `try_push()` and `try_pop()` methods of `WorkQueue`. If the queues do not support task stealing these methods should always return `false` and do nothing.
 
+   Tasks scheduled from outside the pool are distributed round-robin over the per-thread queues. Tasks scheduled from one of the pool's own threads go to that thread's queue for better cache locality, unless another thread of the pool is currently idle in which case it is handed to the idle thread instead.
+
    The number of threads is fixed upon creation of the pool.
 
+   If the thread factory has a method `node_of(index)` returning the NUMA node of each worker (like pinned_thread_factory) workers look for work on the queues of workers on their own node before trying other nodes.
+
+   If `WorkQueue` has the method `pop_until(f, deadline)` the pool supports schedule_at() and schedule_after(). Delayed tasks are kept in a detail::timer_wheel with millisecond ticks which the workers service between tasks, and one parked worker only waits for work until the next deadline so there is no separate timer thread. Expired tasks are scheduled like tasks from inside the pool. Tasks which have not expired when the pool is destroyed are discarded without running.
+
    \tparam WorkQueue The type used for the per-thread work queue. Must be `DefaultConstructible`. All calls to the queues (except the constructor and destructor) must be data race free. The nested type `work_t` must have one of these constructor signatures: `work_t(std::allocator_arg_t, Alloc, F)`, or `work_t(F, Alloc)` if `std::uses_allocator<work_t, Alloc>::value` is `true`, or `work_t(F)` otherwise. The queue must have the method `done()` to signal its associated thread that it should stop processing work and exit as soon as possible.
    \tparam ThreadHandle The type used to own the system threads. The factory provided in the constructor is called to create and launch each thread. The type must have `join()` method with the same semantics as `std::thread::join()`.
+   \tparam Instrumentation Receives notifications about everything happening in the pool, see no_instrumentation for the required interface and counting_instrumentation or tracing_instrumentation for implementations.
    */
-  template<class WorkQueue, class ThreadHandle>
+  template<class WorkQueue, class ThreadHandle, class Instrumentation = no_instrumentation>
   class basic_thread_pool;
+  /**
+   Determines how long an idle thread of a basic_thread_pool keeps looking for work before it blocks in `WorkQueue::pop()`.
+
+   Each round is one attempt to pop from every queue of the pool. The spinning rounds are separated by an exponentially growing number of CPU pause instructions, the yielding rounds by a `std::this_thread::yield()`. Spinning trades CPU time for lower latency on short tasks since waking up a parked thread requires a round-trip through the OS.
+   */
+  struct thread_pool_idle_policy
+  {
+    unsigned spin_rounds = 8;
+    unsigned yield_rounds = 4;
+  };
+  /**
+   Functions every worker of a basic_thread_pool calls on its own thread with its zero-based index.
+
+   `on_start` runs before the worker takes its first task and `on_stop` after it took its last one, so together with current_worker() they can set up per-thread state like scratch arenas, random number generators or connection handles once instead of lazily on the hot path. Neither may throw. Empty functions are skipped.
+   */
+  struct thread_pool_hooks
+  {
+    std::function<void(unsigned index)> on_start;
+    std::function<void(unsigned index)> on_stop;
+  };
+  /**
+   Identifies the basic_thread_pool and worker index the calling thread belongs to.
+
+   \see current_worker()
+   */
+  struct thread_pool_worker
+  {
+    /// The pool the thread belongs to, or `nullptr` if it isn't a worker of any basic_thread_pool.
+    const void* pool;
+    unsigned index;
+
+    explicit operator bool() const noexcept { return pool != nullptr; }
+  };
+  /**
+   The pool and index of the calling thread, if it is a worker of a basic_thread_pool.
+
+   ~~~{.cpp}
+   std::vector<scratch_arena> arenas(pool.num_threads());
+   pool([&] {
+     auto& arena = arenas[schedulers::current_worker().index];
+   });
+   ~~~
+   */
+  auto current_worker() noexcept -> thread_pool_worker;
+
+  namespace detail
+  {
+    // The value current_worker() returns on this thread, set by basic_thread_pool workers when they start and stop
+    auto current_worker_slot() noexcept -> thread_pool_worker&;
+  }
+  /**
+   What basic_thread_pool::shutdown() does with tasks which haven't started yet.
+   */
+  enum class shutdown_mode
+  {
+    /// Run everything already scheduled before the workers exit.
+    drain,
+    /// Let the workers finish their current task and destroy the rest without running it.
+    discard,
+  };
   /**
    Schedules tasks to a user-created thread pool.
    
    \note If your application uses Java you will not be able to call Java methods via JNI from tasks on this scheduler unless your thread factory makes the necessary precautions.
    */
   class thread_pool;
+  /**
+   Like thread_pool but with work items capable of storing callables of up to `InlineBytes` bytes (including one vtbl pointer) without allocating.
+
+   Use this if your tasks regularly capture more than two pointers worth of state, e.g. `sized_thread_pool<64>` for one cache line per task.
+   */
+  template<std::size_t InlineBytes>
+  class sized_thread_pool;
+  /**
+   Like thread_pool but reporting to the given instrumentation policy, for example counting_instrumentation or tracing_instrumentation.
+
+   The work items have room for what `Instrumentation::wrap()` adds to every task on top of the default inline buffer, so every task stored without allocating by thread_pool is stored without allocating here as well.
+   */
+  template<class Instrumentation>
+  class instrumented_thread_pool;
+  /**
+   What a bounded_task_queue does when a task is pushed while it is full.
+   */
+  enum class queue_full_policy
+  {
+    /// Block the pushing thread until there is space in the queue.
+    block,
+    /// Throw queue_full_error.
+    reject,
+    /// Run the task on the pushing thread instead.
+    run_on_caller,
+  };
+  /**
+   Thrown when scheduling to a full bounded_task_queue with queue_full_policy::reject.
+   */
+  class queue_full_error;
+  /**
+   Like thread_pool but every thread's queue is a bounded_task_queue of the given capacity.
+
+   `Policy` only applies once the queues of all threads are full. Use basic_thread_pool::try_schedule() to drop tasks instead.
+   */
+  template<std::size_t Capacity, queue_full_policy Policy = queue_full_policy::block, std::size_t InlineBytes = detail::default_work_item_size>
+  class bounded_thread_pool;
+  /**
+   The priority lanes of schedulers supporting prioritized tasks.
+
+   Tasks of a higher priority are started before tasks of a lower priority whenever both are pending. Tasks of the same priority start in the order the scheduler normally uses. There is no aging, a steady stream of high priority work can starve low priority work indefinitely.
+   */
+  enum class task_priority
+  {
+    high,
+    normal,
+    low,
+  };
+  constexpr std::size_t num_task_priorities = 3;
+  /**
+   A scheduler adaptor assigning a priority to every task scheduled through it.
+
+   It calls `s.schedule_with_priority(alloc, priority, f)` if the wrapped scheduler supports priorities and ignores the priority otherwise. The adaptor only holds a pointer to `s` which must outlive it.
+
+   \see with_priority()
+   */
+  template<class Scheduler>
+  class prioritized_scheduler;
+  /**
+   Create a scheduler which schedules all tasks to `s` with the given priority.
+
+   ~~~{.cpp}
+   schedulers::priority_thread_pool pool;
+   auto interactive = schedulers::with_priority(pool, schedulers::task_priority::high);
+   interactive([] { handle_input(); });
+   ~~~
+   */
+  template<class Scheduler>
+  auto with_priority(const Scheduler& s, task_priority priority) -> prioritized_scheduler<Scheduler>;
+  /**
+   A scheduler adaptor running tasks immediately if the calling thread already belongs to the wrapped scheduler.
+
+   It checks `s.running_in_this_thread()`, so a continuation scheduled from one of the workers of a basic_thread_pool or from the UI thread for libdispatch_main and android_main_looper runs right away instead of paying for a work item, a queue round-trip and possibly a wake-up. Otherwise, or once tasks run inline have nested `max_depth` levels deep on the current thread, it schedules to `s` as usual. The depth bound keeps long continuation chains from overflowing the stack.
+
+   A task run inline executes before everything already queued on `s` and any exception it throws propagates to the caller. Bulk tasks always go to `s`. The adaptor only holds a pointer to `s` which must outlive it.
+
+   \see inline_or_schedule()
+   */
+  template<class Scheduler>
+  class inlining_scheduler;
+  /**
+   Create a scheduler which runs tasks inline when already on one of the threads of `s`.
+
+   ~~~{.cpp}
+   auto continuation = schedulers::inline_or_schedule(pool);
+   continuation([] { finish_request(); }); // Runs immediately on workers of pool
+   ~~~
+   */
+  template<class Scheduler>
+  auto inline_or_schedule(const Scheduler& s, unsigned max_depth = 16) -> inlining_scheduler<Scheduler>;
+  /**
+   Like thread_pool but with one thread per CPU of the given topology, each pinned to its CPU, and stealing from the same NUMA node first.
+
+   Since task_allocator caches are per-thread every worker also allocates task storage local to its node.
+
+   \see pinned_thread_factory
+   */
+  class pinned_thread_pool;
+  /**
+   Like thread_pool but every thread's queue is a priority_task_queue, with workers always taking the highest priority task available from any queue.
+   */
+  class priority_thread_pool;
   /**
    Schedules tasks to a user-provided `libdispatch` queue.
    */
@@ -75,11 +268,15 @@ namespace schedulers
   /**
    Schedules to `libdispatch`'s global queue with default priority.
 
+   Prioritized tasks go to the global queues of the matching `DISPATCH_QUEUE_PRIORITY_*` instead.
+
    \note Avoid using this class directly and use default_scheduler instead as it will automatically adjust to the platform you're on.
    */
   class libdispatch_global_default;
   /**
-   Schedules tasks to a Win32 message queue.
+   Schedules tasks to the Win32 message queue of the thread which created it.
+
+   The scheduler owns a message-only window and drains a main_thread_task_queue whenever that window receives its message, so the thread has to run a message loop. Whatever doesn't fit into one batch is continued from a `WM_TIMER` message, which lets input and paint messages go first.
    */
   class win32_message_queue;
   /**
@@ -88,6 +285,12 @@ namespace schedulers
    \note Avoid using this class directly and use default_scheduler instead as it will automatically adjust to the platform you're on.
    */
   class win32_default_pool;
+  /**
+   Schedules to a private Vista-style Win32 thread pool.
+
+   Every priority has one reusable `TP_WORK` object and a queue of tasks, and every task only submits that object once more, so scheduling needs no allocation for small callables and bulk() submits all its chunks under one lock. All work objects belong to one cleanup group which shutdown() closes to cancel pending callbacks at once.
+   */
+  class win32_thread_pool;
   /**
    Schedules on `emscripten_async_call`.
 
@@ -104,6 +307,28 @@ namespace schedulers
    Schedules to Android's main thread `ALooper`.
    */
   class android_main_looper;
+  /**
+   Runs tasks and I/O handlers on a Linux thread which runs an `epoll` event loop, like the network thread of a server.
+
+   Scheduling pushes to a main_thread_task_queue and only signals the loop's `eventfd` if the queue isn't already waiting to be drained, so a burst of tasks wakes the loop once. Every iteration of the loop first calls the handlers of ready file descriptors and then runs a batch of the pending tasks, so work posted to the loop doesn't need a second queue or an extra thread hop.
+   */
+  class linux_event_loop;
+  /**
+   Runs tasks on Android's main thread from `AChoreographer` frame callbacks, spending at most a fixed budget per frame.
+
+   The budget counts from the frame's vsync and whatever doesn't fit carries over to the next frame, so bursts of tasks don't cause dropped frames. Requires API level 24.
+   */
+  class android_choreographer;
+  /**
+   Runs tasks on the main `CFRunLoop` of Apple platforms, spending at most a fixed budget every time the run loop is about to wait.
+
+   Whatever doesn't fit into the budget carries over to the next run loop iteration, so other sources like input and display updates are processed in between.
+   */
+  class cf_main_run_loop;
+  /**
+   Queues tasks for a custom event loop which runs them with drain_for() or drain_until(), e.g. once per frame.
+   */
+  class frame_scheduler;
   /**
    Turns a scheduler into one with reference semantics.
    
@@ -129,6 +354,8 @@ namespace schedulers
      void schedule(const Alloc& alloc, F&& f) const { ... }
    };
    ```
+
+   Schedulers with native timers additionally provide a private `schedule_timed(alloc, deadline, f)` taking a `std::chrono::steady_clock::time_point` to enable schedule_at() and schedule_after().
    */
   template<class Derived>
   struct available_scheduler;
@@ -153,15 +380,40 @@ namespace schedulers
   /**
    Special type of queue for "main thread"-type schedulers integrating into external systems.
    
-   The difference to a normal task queue is that the main thread never waits on the queue if it isn't empty, that is the job of the OS/UI event loop. Instead we have to signal the system that we have a task ready, and when it's our turn we pop one item from the queue and return control to the system.
+   The difference to a normal task queue is that the main thread never waits on the queue if it isn't empty, that is the job of the OS/UI event loop. Instead we have to signal the system that we have a task ready, and when it's our turn we run some of the queued tasks and return control to the system.
+
+   Signals are coalesced: push() returns `true` only if the queue has no signal outstanding, and only then does the scheduler have to signal the system. The signal's callback calls drain(), which runs tasks until the queue is empty, a batch limit is hit or a time budget is used up, so a burst of tasks costs one event loop iteration per batch instead of one per task. If drain() stops early it returns `true` and the callback signals again, which lets the event loop process other events between batches.
+
+   Tasks are kept in one lane per task_priority and try_pop() always takes from the highest lane first. Cancellable tasks pushed as detail::cancellable_task are dropped by try_pop() once they are cancelled.
    */
   class main_thread_task_queue
   {
   public:
     /// Call from "main thread" scheduler's destructors to cleanup any pending tasks.
     auto clear() const noexcept -> void;
-    auto push(detail::work_item&& f) const -> void;
+    /// Returns `true` if the caller has to signal the event loop.
+    auto push(detail::work_item&& f, task_priority priority = task_priority::normal) const -> bool;
+    auto push(detail::cancellable_task&& task, task_priority priority = task_priority::normal) const -> bool;
     auto try_pop(detail::work_item& f) const -> bool;
+    /**
+     Run queued tasks until the queue is empty, `max_tasks` have run or `budget` has passed.
+
+     Call from the callback of the signal requested by push(). Returns `true` if tasks are left and the caller has to signal the event loop again. If a task throws the outstanding signal is forgotten and the next push() requests a new one.
+     */
+    auto drain(std::size_t max_tasks = default_batch_size, std::chrono::nanoseconds budget = default_batch_budget) const -> bool;
+    /**
+     Run queued tasks until the queue is empty or `deadline` has passed.
+
+     At least one task is run if there is any so the queue makes progress even if the deadline is already over. Returns `true` if tasks are left for the next call.
+     */
+    auto drain_until(std::chrono::steady_clock::time_point deadline) const -> bool;
+    auto drain_for(std::chrono::nanoseconds budget) const -> bool
+    {
+      return drain_until(std::chrono::steady_clock::now() + budget);
+    }
+
+    static constexpr std::size_t default_batch_size = 64;
+    static constexpr std::chrono::milliseconds default_batch_budget{4};
 
     static auto get() noexcept -> const main_thread_task_queue&
     {
@@ -174,15 +426,67 @@ namespace schedulers
     // It's OK to have this a global because you cannot use any "main thread" scheduling before a OS/UI specific mechanism is started in main(). It's also important this queue outlives any scheduler objects using it because we cannot remove entries from the OS/UI event loop that might still be referencing it *after* we destroy the main thread scheduler.
     static const main_thread_task_queue _instance;
 
+    struct entry
+    {
+      detail::work_item work;
+      // Only set for cancellable tasks, points into the state kept alive by work
+      const detail::cancellable_state* cancel;
+    };
+
+    auto push_entry(entry&& e, task_priority priority) const -> bool;
+    auto drain(std::size_t max_tasks, std::chrono::steady_clock::time_point deadline) const -> bool;
+
     mutable std::mutex _mutex;
-    mutable std::deque<detail::work_item> _queue;
+    mutable std::deque<entry> _queues[num_task_priorities];
+    // Set by the push() that requested a signal, reset once drain() finds the queue empty
+    mutable bool _signaled = false;
   };
   /**
    The default task queue used in the thread_pool class.
    
    This also provides the minimum interface required for user-defined queues.
+
+   \tparam InlineBytes The inline buffer size of the stored detail::basic_work_item.
+   */
+  template<std::size_t InlineBytes>
+  class basic_thread_pool_task_queue;
+  using thread_pool_task_queue = basic_thread_pool_task_queue<detail::default_work_item_size>;
+  /**
+   A task queue for basic_thread_pool holding at most `Capacity` tasks in a fixed ring buffer.
+
+   No memory is allocated by the queue itself after construction. What happens when pushing to a full queue is determined by `Policy`. try_push() fails if the queue is full regardless of the policy.
+
+   If the thread consuming the queue pushes to it while it is full the task is run immediately even with queue_full_policy::block as it would otherwise wait for itself forever.
+   */
+  template<std::size_t Capacity, queue_full_policy Policy = queue_full_policy::block, std::size_t InlineBytes = detail::default_work_item_size>
+  class bounded_task_queue;
+  /**
+   A task queue for basic_thread_pool with one FIFO lane per task_priority.
+
+   pop() and try_pop() without a priority take from the highest non-empty lane. The overloads with a priority only look at that lane and check a lock-free summary first, so probing the empty lanes of all queues is cheap. If a queue has these overloads basic_thread_pool searches all its queues for high priority work before it takes anything of a lower priority.
+   */
+  class priority_task_queue;
+  /**
+   A lock-free work-stealing task queue for use with basic_thread_pool.
+
+   Work pushed by the thread owning the queue goes into a Chase-Lev deque where the owner pops in LIFO order and other threads steal in FIFO order. Work pushed from any other thread goes through a lock-free FIFO injection queue which is picked up by the owner and thieves alike. A worker only parks on the queue once both are empty.
    */
-  class thread_pool_task_queue;
+  class work_stealing_task_queue;
+  /**
+   Schedules tasks to a user-created thread pool using work_stealing_task_queue for the per-thread queues.
+   */
+  class work_stealing_thread_pool;
+
+  namespace detail
+  {
+    /**
+     The Chase-Lev work-stealing deque as described in "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al. 2013).
+
+     Only the owning thread may call push() and take(), any thread may call steal(). The stored values must be pointers which are transferred as-is, the deque does not own them.
+     */
+    template<class T>
+    class work_stealing_deque;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -196,10 +500,15 @@ struct schedulers::available_scheduler
 
   using result_type = void;
 
+  /**
+   Schedule `f` using the scheduler's preferred allocator.
+
+   This is `Derived::default_allocator_type` if it exists and `std::allocator<char>` otherwise.
+   */
   template<class F>
   void operator()(F&& f) const
   {
-    self().schedule(std::allocator<char>{}, forward<F>(f));
+    self().schedule(default_allocator(0), forward<F>(f));
   }
 
   template<class Alloc, class F>
@@ -208,453 +517,3217 @@ struct schedulers::available_scheduler
     self().schedule(alloc, forward<F>(f));
   }
 
-private:
-  auto self() const -> const Derived& { return *static_cast<const Derived*>(this); }
-};
-
-struct schedulers::unavailable_scheduler
-{
-  static constexpr std::false_type available{};
+  /**
+   Schedule `n` invocations of `f(i)` for every `i` in `[0, n)`.
 
-  using result_type = void;
+   The indices are split into contiguous chunks and each chunk is scheduled as a single task, so the scheduling overhead is paid per chunk and not per index. Only one copy of `f` is made and it is invoked concurrently from multiple threads.
 
+   Schedulers can customize this by providing a private `schedule_bulk(alloc, n, f)`, otherwise the indices are split into `std::thread::hardware_concurrency()` chunks.
+   */
   template<class F>
-  void operator()(F&& f) const = delete;
+  void bulk(std::size_t n, F&& f) const
+  {
+    bulk(default_allocator(0), n, forward<F>(f));
+  }
 
   template<class Alloc, class F>
-  void operator()(const Alloc& alloc, F&& f) const = delete;
-};
+  void bulk(const Alloc& alloc, std::size_t n, F&& f) const
+  {
+    if(n > 0)
+    {
+      bulk_impl(alloc, n, forward<F>(f), 0);
+    }
+  }
 
-////////////////////////////////////////////////////////////////////////////////
-// libdispatch queues
-//
+  /**
+   Schedule a copy of every callable in `[first, last)`.
 
-#if defined(__APPLE__)
-class schedulers::libdispatch_queue : public available_scheduler<libdispatch_queue>
-{
-public:
-  explicit libdispatch_queue(dispatch_queue_t queue) : _queue(queue) { }
+   Use `std::make_move_iterator` to move the callables instead.
 
-private:
-  friend available_scheduler<libdispatch_queue>;
-  friend objcpp::default_scheduler;
+   Schedulers can customize this by providing a private `schedule_bulk(alloc, first, last)`, otherwise every callable is scheduled individually.
+   */
+  template<class InputIt>
+  void bulk(InputIt first, InputIt last) const
+  {
+    bulk(default_allocator(0), first, last);
+  }
 
-  template<class Alloc, class F>
-  void schedule(const Alloc& alloc, F&& f) const
+  template<class Alloc, class InputIt>
+  void bulk(const Alloc& alloc, InputIt first, InputIt last) const
   {
-    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, forward<F>(f));
-    dispatch_async_f(_queue, callback.get().data, callback.get().callback);
-    callback.release();
+    if(first != last)
+    {
+      bulk_impl(alloc, first, last, 0);
+    }
   }
 
-  dispatch_queue_t _queue;
-};
+  /**
+   Schedule `f` to run once `deadline` has been reached.
 
-class schedulers::libdispatch_main : public available_scheduler<libdispatch_main>
-{
-public:
-  libdispatch_main() = default;
-  libdispatch_main(const libdispatch_main&) = delete;
-  libdispatch_main(libdispatch_main&&) = delete;
-  ~libdispatch_main()
+   Only available if the scheduler supports timers by providing a private `schedule_timed(alloc, deadline, f)`. A task never starts before its deadline but may start later depending on the scheduler's timer resolution and how busy it is. Tasks scheduled for a deadline in the past are scheduled immediately.
+   */
+  // The private default_allocator() is not declared yet, the check just needs some allocator
+  template<class F, class D = Derived>
+  auto schedule_at(std::chrono::steady_clock::time_point deadline, F&& f) const
+  -> decltype(std::declval<const D&>().schedule_timed(std::allocator<char>(), deadline, forward<F>(f)))
   {
-    main_thread_task_queue::get().clear();
+    self().schedule_timed(default_allocator(0), deadline, forward<F>(f));
   }
 
-private:
-  friend available_scheduler<libdispatch_main>;
+  template<class Alloc, class F, class D = Derived>
+  auto schedule_at(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+  -> decltype(std::declval<const D&>().schedule_timed(alloc, deadline, forward<F>(f)))
+  {
+    self().schedule_timed(alloc, deadline, forward<F>(f));
+  }
 
-  template<class Alloc, class F>
-  auto schedule(const Alloc& alloc, F&& f) const
+  /**
+   Schedule `f` to run once `delay` has passed, measured with `std::chrono::steady_clock`.
+
+   \see schedule_at()
+   */
+  template<class Rep, class Period, class F, class D = Derived>
+  auto schedule_after(const std::chrono::duration<Rep, Period>& delay, F&& f) const
+  -> decltype(std::declval<const D&>().schedule_timed(std::allocator<char>(), std::chrono::steady_clock::now(), forward<F>(f)))
   {
-    main_thread_task_queue::get().push({std::allocator_arg, alloc, forward<F>(f)});
-    dispatch_async_f(dispatch_get_main_queue(), nullptr, [] (void*)
-                     {
-                       detail::work_item f;
-                       if(main_thread_task_queue::get().try_pop(f))
-                       {
-                         move(f)();
-                       }
-                     });
+    self().schedule_timed(default_allocator(0), deadline_after(delay), forward<F>(f));
   }
-};
 
-class schedulers::libdispatch_global_default : public libdispatch_queue
-{
-public:
-  libdispatch_global_default()
-  : libdispatch_queue{dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)}
-  { }
-};
+  template<class Alloc, class Rep, class Period, class F, class D = Derived>
+  auto schedule_after(const Alloc& alloc, const std::chrono::duration<Rep, Period>& delay, F&& f) const
+  -> decltype(std::declval<const D&>().schedule_timed(alloc, std::chrono::steady_clock::now(), forward<F>(f)))
+  {
+    self().schedule_timed(alloc, deadline_after(delay), forward<F>(f));
+  }
 
-#else
-class schedulers::libdispatch_queue : public unavailable_scheduler { };
-class schedulers::libdispatch_main : public unavailable_scheduler { };
-class schedulers::libdispatch_global_default : public unavailable_scheduler { };
-#endif
+  /**
+   Schedule `f` and return a cancellation_token which can revoke it until it starts.
 
-////////////////////////////////////////////////////////////////////////////////
-// win32_default_pool
-//
+   `f` is stored in a separately allocated block shared with the token and the scheduler only receives a pointer sized placeholder. Cancelling destroys `f` immediately, the placeholder stays in the scheduler until it is popped and then does nothing.
 
-#if defined(_WIN32)
-class schedulers::win32_default_pool : public available_scheduler<win32_default_pool>
-{
-private:
-  friend available_scheduler<win32_system_pool>;
+   Schedulers can customize this by providing a private `schedule_cancellable_task(alloc, task)` taking a `detail::cancellable_task&&`, for example to drop cancelled placeholders without running them.
+   */
+  template<class F>
+  auto schedule_cancellable(F&& f) const -> cancellation_token
+  {
+    return schedule_cancellable(default_allocator(0), forward<F>(f));
+  }
 
   template<class Alloc, class F>
-  void schedule(const Alloc& alloc, F&& f) const
+  auto schedule_cancellable(const Alloc& alloc, F&& f) const -> cancellation_token
   {
-    auto callback = package_task_as_c_callback<LPTHREAD_START_ROUTINE>(alloc, forward<F>(f));
-    ::QueueUserWorkItem(callback.get().callback, callback.get().data, WT_EXECUTEDEFAULT);
-    callback.release();
+    auto token = cancellation_token{detail::cancellable_state::make(alloc, forward<F>(f))};
+    schedule_cancellable_impl(alloc, detail::cancellable_task{token._state}, 0);
+    return token;
   }
-};
-#else
-class schedulers::win32_default_pool : public unavailable_scheduler { };
-#endif
-
-////////////////////////////////////////////////////////////////////////////////
-// emscripten_async
-//
 
-#if defined(__EMSCRIPTEN__)
-class schedulers::emscripten_async : public available_scheduler<emscripten_async>
-{
 private:
-  friend available_scheduler<emscripten_async>;
+  auto self() const -> const Derived& { return *static_cast<const Derived*>(this); }
 
-  template<class Alloc, class F>
-  void schedule(const Alloc& alloc, F&& f) const
+  template<class D = Derived>
+  static auto default_allocator(int) -> typename D::default_allocator_type { return {}; }
+  static auto default_allocator(long) -> std::allocator<char> { return {}; }
+
+  template<class Rep, class Period>
+  static auto deadline_after(const std::chrono::duration<Rep, Period>& delay) -> std::chrono::steady_clock::time_point
   {
-    auto callback = package_task_as_c_callback<em_arg_callback_func>(alloc, forward<F>(f));
-    ::emscripten_async_call(callback.get().callback, callback.get().data, 0);
-    callback.release();
+    return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
   }
-};
-#else
-class schedulers::emscripten_async : public unavailable_scheduler { };
-#endif
-
-////////////////////////////////////////////////////////////////////////////////
-// shared_scheduler
-//
 
-namespace schedulers
-{
-  namespace detail
+  // Prefer Derived::schedule_bulk() if it exists. D delays the lookup until Derived is complete.
+  template<class Alloc, class F, class D = Derived>
+  auto bulk_impl(const Alloc& alloc, std::size_t n, F&& f, int) const
+  -> decltype(std::declval<const D&>().schedule_bulk(alloc, n, forward<F>(f)))
   {
-    template<class Scheduler, bool = Scheduler::available()>
-    class shared_scheduler_base;
+    self().schedule_bulk(alloc, n, forward<F>(f));
   }
-}
 
-template<class Scheduler>
-class schedulers::detail::shared_scheduler_base<Scheduler, true>
+  template<class Alloc, class F>
+  auto bulk_impl(const Alloc& alloc, std::size_t n, F&& f, long) const -> void;
+
+  template<class Alloc, class InputIt, class D = Derived>
+  auto bulk_impl(const Alloc& alloc, InputIt first, InputIt last, int) const
+  -> decltype(std::declval<const D&>().schedule_bulk(alloc, first, last))
+  {
+    self().schedule_bulk(alloc, first, last);
+  }
+
+  template<class Alloc, class InputIt>
+  auto bulk_impl(const Alloc& alloc, InputIt first, InputIt last, long) const -> void
+  {
+    for(; first != last; ++first)
+    {
+      self().schedule(alloc, *first);
+    }
+  }
+
+  template<class Alloc, class D = Derived>
+  auto schedule_cancellable_impl(const Alloc& alloc, detail::cancellable_task&& task, int) const
+  -> decltype(std::declval<const D&>().schedule_cancellable_task(alloc, move(task)))
+  {
+    self().schedule_cancellable_task(alloc, move(task));
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_impl(const Alloc& alloc, detail::cancellable_task&& task, long) const -> void
+  {
+    self().schedule(alloc, move(task));
+  }
+};
+
+struct schedulers::unavailable_scheduler
+{
+  static constexpr std::false_type available{};
+
+  using result_type = void;
+
+  template<class F>
+  void operator()(F&& f) const = delete;
+
+  template<class Alloc, class F>
+  void operator()(const Alloc& alloc, F&& f) const = delete;
+
+  template<class F>
+  void bulk(std::size_t n, F&& f) const = delete;
+
+  template<class Alloc, class F>
+  void bulk(const Alloc& alloc, std::size_t n, F&& f) const = delete;
+
+  template<class InputIt>
+  void bulk(InputIt first, InputIt last) const = delete;
+
+  template<class Alloc, class InputIt>
+  void bulk(const Alloc& alloc, InputIt first, InputIt last) const = delete;
+
+  template<class F>
+  void schedule_at(std::chrono::steady_clock::time_point deadline, F&& f) const = delete;
+
+  template<class Alloc, class F>
+  void schedule_at(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const = delete;
+
+  template<class Rep, class Period, class F>
+  void schedule_after(const std::chrono::duration<Rep, Period>& delay, F&& f) const = delete;
+
+  template<class Alloc, class Rep, class Period, class F>
+  void schedule_after(const Alloc& alloc, const std::chrono::duration<Rep, Period>& delay, F&& f) const = delete;
+
+  template<class F>
+  void schedule_cancellable(F&& f) const = delete;
+
+  template<class Alloc, class F>
+  void schedule_cancellable(const Alloc& alloc, F&& f) const = delete;
+};
+
+namespace schedulers
+{
+  namespace detail
+  {
+    // The time left until `deadline` or zero if it has passed, for schedulers with relative timeouts
+    inline auto time_until(std::chrono::steady_clock::time_point deadline) -> std::chrono::nanoseconds
+    {
+      const auto left = deadline - std::chrono::steady_clock::now();
+      return left > std::chrono::steady_clock::duration::zero() ? std::chrono::duration_cast<std::chrono::nanoseconds>(left) : std::chrono::nanoseconds::zero();
+    }
+
+#if defined(_WIN32)
+    inline auto win32_callback_priority(task_priority priority) noexcept -> TP_CALLBACK_PRIORITY
+    {
+      switch(priority)
+      {
+        case task_priority::high: return TP_CALLBACK_PRIORITY_HIGH;
+        case task_priority::low: return TP_CALLBACK_PRIORITY_LOW;
+        default: return TP_CALLBACK_PRIORITY_NORMAL;
+      }
+    }
+#endif
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// bulk scheduling
+//
+
+namespace schedulers
+{
+  namespace detail
+  {
+    // Shared by all chunks of one bulk() call, destroys itself when the last chunk is destroyed
+    template<class Alloc, class F>
+    class bulk_state;
+
+    // The task scheduled for every chunk of a bulk() call
+    template<class State>
+    class bulk_chunk;
+
+    template<class Alloc, class F>
+    auto make_bulk_state(const Alloc& alloc, std::size_t n, std::size_t chunks, F&& f);
+  }
+}
+
+template<class Alloc, class F>
+class schedulers::detail::bulk_state
+{
+public:
+  template<class G>
+  bulk_state(const Alloc& alloc, std::size_t n, std::size_t chunks, G&& f)
+  : _data{alloc, forward<G>(f)}
+  , _n(n)
+  , _chunks(chunks)
+  , _refs(chunks)
+  { }
+
+  auto chunks() const noexcept { return _chunks; }
+
+  auto run_chunk(std::size_t chunk) -> void
+  {
+    const auto size = _n / _chunks;
+    const auto remainder = _n % _chunks;
+    const auto first = chunk * size + std::min(chunk, remainder);
+    const auto last = first + size + (chunk < remainder ? 1 : 0);
+    for(auto i = first; i < last; ++i)
+    {
+      std::get<1>(_data)(i);
+    }
+  }
+
+  auto release() noexcept -> void
+  {
+    if(--_refs == 0)
+    {
+      make_allocator_deleter<bulk_state>(std::get<0>(_data))(this);
+    }
+  }
+
+private:
+  std::tuple<Alloc, F> _data;
+  const std::size_t _n;
+  const std::size_t _chunks;
+  std::atomic<std::size_t> _refs;
+};
+
+template<class State>
+class schedulers::detail::bulk_chunk
+{
+public:
+  bulk_chunk(State* state, std::size_t chunk) noexcept
+  : _state(state), _chunk(chunk)
+  { }
+  bulk_chunk(bulk_chunk&& other) noexcept
+  : _state(std::exchange(other._state, nullptr)), _chunk(other._chunk)
+  { }
+  ~bulk_chunk()
+  {
+    if(_state)
+    {
+      _state->release();
+    }
+  }
+
+  auto operator()() -> void { _state->run_chunk(_chunk); }
+
+private:
+  State* _state;
+  std::size_t _chunk;
+};
+
+template<class Alloc, class F>
+auto schedulers::detail::make_bulk_state(const Alloc& alloc, std::size_t n, std::size_t chunks, F&& f)
+{
+  using state_t = bulk_state<Alloc, std::decay_t<F>>;
+  return allocate_unique<state_t>(alloc, alloc, n, chunks, forward<F>(f)).release();
+}
+
+template<class Derived>
+template<class Alloc, class F>
+auto schedulers::available_scheduler<Derived>::bulk_impl(const Alloc& alloc, std::size_t n, F&& f, long) const
+-> void
+{
+  const auto chunks = std::min<std::size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+  auto state = detail::make_bulk_state(alloc, n, chunks, forward<F>(f));
+  using chunk_t = detail::bulk_chunk<std::remove_pointer_t<decltype(state)>>;
+
+  std::size_t i = 0;
+  try
+  {
+    for(; i < chunks; ++i)
+    {
+      self().schedule(alloc, chunk_t{state, i});
+    }
+  }
+  catch(...)
+  {
+    // The chunk that failed has already released its reference
+    while(++i < chunks)
+    {
+      state->release();
+    }
+    throw;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// prioritized_scheduler
+//
+
+namespace schedulers
+{
+  namespace detail
+  {
+    // The allocator available_scheduler uses for Scheduler when none is given
+    template<class Scheduler>
+    auto default_allocator_of(int) -> typename Scheduler::default_allocator_type;
+    template<class Scheduler>
+    auto default_allocator_of(long) -> std::allocator<char>;
+
+    // Whether a basic_thread_pool work queue can pop from a specific priority lane
+    template<class Queue, class = void_t<>>
+    struct has_priority_lanes : std::false_type { };
+
+    template<class Queue>
+    struct has_priority_lanes<Queue, void_t<decltype(std::declval<const Queue&>().try_pop(std::declval<typename Queue::work_t&>(), task_priority::normal))>> : std::true_type { };
+
+    // Whether a basic_thread_pool work queue can wait for work with a deadline
+    template<class Queue, class = void_t<>>
+    struct has_pop_until : std::false_type { };
+
+    template<class Queue>
+    struct has_pop_until<Queue, void_t<decltype(std::declval<const Queue&>().pop_until(std::declval<typename Queue::work_t&>(), std::chrono::steady_clock::time_point()))>> : std::true_type { };
+
+    // Whether a basic_thread_pool work queue has a capacity and can refuse work because it is full
+    template<class Queue, class = void_t<>>
+    struct has_push_unless_full : std::false_type { };
+
+    template<class Queue>
+    struct has_push_unless_full<Queue, void_t<decltype(bool(std::declval<const Queue&>().push_unless_full(std::declval<typename Queue::work_t&>())))>> : std::true_type { };
+  }
+}
+
+template<class Scheduler>
+class schedulers::prioritized_scheduler : public available_scheduler<prioritized_scheduler<Scheduler>>
+{
+public:
+  using default_allocator_type = decltype(detail::default_allocator_of<Scheduler>(0));
+
+  prioritized_scheduler(const Scheduler& s, task_priority priority) : _scheduler(&s), _priority(priority) { }
+
+  auto priority() const noexcept -> task_priority { return _priority; }
+
+  /// Overrides the adaptor's priority so adaptors can be nested.
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    schedule_impl(alloc, priority, forward<F>(f), 0);
+  }
+
+private:
+  friend available_scheduler<prioritized_scheduler<Scheduler>>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_impl(alloc, _priority, forward<F>(f), 0);
+  }
+
+  // Prefer Scheduler::schedule_with_priority() if it exists. S delays the lookup until it is used.
+  template<class Alloc, class F, class S = Scheduler>
+  auto schedule_impl(const Alloc& alloc, task_priority priority, F&& f, int) const
+  -> decltype(std::declval<const S&>().schedule_with_priority(alloc, priority, forward<F>(f)))
+  {
+    _scheduler->schedule_with_priority(alloc, priority, forward<F>(f));
+  }
+
+  template<class Alloc, class F>
+  auto schedule_impl(const Alloc& alloc, task_priority /*priority*/, F&& f, long) const -> void
+  {
+    (*_scheduler)(alloc, forward<F>(f));
+  }
+
+  const Scheduler* _scheduler;
+  task_priority _priority;
+};
+
+template<class Scheduler>
+auto schedulers::with_priority(const Scheduler& s, task_priority priority) -> prioritized_scheduler<Scheduler>
+{
+  return {s, priority};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// inlining_scheduler
+//
+
+namespace schedulers
+{
+  namespace detail
+  {
+    // How many tasks run by inlining_scheduler are currently nested on this thread
+    auto inline_depth() noexcept -> unsigned&;
+  }
+}
+
+template<class Scheduler>
+class schedulers::inlining_scheduler : public available_scheduler<inlining_scheduler<Scheduler>>
+{
+public:
+  using default_allocator_type = decltype(detail::default_allocator_of<Scheduler>(0));
+
+  inlining_scheduler(const Scheduler& s, unsigned max_depth) : _scheduler(&s), _max_depth(max_depth) { }
+
+  auto max_depth() const noexcept -> unsigned { return _max_depth; }
+
+private:
+  friend available_scheduler<inlining_scheduler<Scheduler>>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    auto& depth = detail::inline_depth();
+    if(depth < _max_depth && _scheduler->running_in_this_thread())
+    {
+      struct depth_guard
+      {
+        ~depth_guard() { --depth; }
+        unsigned& depth;
+      };
+      ++depth;
+      depth_guard guard{depth};
+      forward<F>(f)();
+    }
+    else
+    {
+      (*_scheduler)(alloc, forward<F>(f));
+    }
+  }
+
+  template<class Alloc, class F>
+  auto schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const -> void
+  {
+    _scheduler->bulk(alloc, n, forward<F>(f));
+  }
+
+  const Scheduler* _scheduler;
+  unsigned _max_depth;
+};
+
+template<class Scheduler>
+auto schedulers::inline_or_schedule(const Scheduler& s, unsigned max_depth) -> inlining_scheduler<Scheduler>
+{
+  return {s, max_depth};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// libdispatch queues
+//
+
+#if defined(__APPLE__)
+class schedulers::libdispatch_queue : public available_scheduler<libdispatch_queue>
+{
+public:
+  using default_allocator_type = task_allocator<char>;
+
+  explicit libdispatch_queue(dispatch_queue_t queue) : _queue(queue) { }
+
+private:
+  friend available_scheduler<libdispatch_queue>;
+  friend objcpp::default_scheduler;
+
+  template<class Alloc, class F>
+  void schedule(const Alloc& alloc, F&& f) const
+  {
+    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, detail::trace(forward<F>(f)));
+    dispatch_async_f(_queue, callback.get().data, callback.get().callback);
+    callback.release();
+  }
+
+  template<class Alloc, class F>
+  void schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const
+  {
+    // dispatch_apply_f() blocks until all iterations are done so it is called from an asynchronous task. That task runs on a global queue because applying to a serial queue from within itself deadlocks.
+    using function_t = std::decay_t<F>;
+    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, [queue = _queue, n, f = function_t(forward<F>(f))] () mutable
+    {
+      dispatch_apply_f(n, queue, &f, [] (void* context, std::size_t i)
+      {
+        (*static_cast<function_t*>(context))(i);
+      });
+    });
+    dispatch_async_f(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), callback.get().data, callback.get().callback);
+    callback.release();
+  }
+
+  template<class Alloc, class F>
+  void schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+  {
+    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, forward<F>(f));
+    dispatch_after_f(dispatch_time(DISPATCH_TIME_NOW, detail::time_until(deadline).count()), _queue, callback.get().data, callback.get().callback);
+    callback.release();
+  }
+
+  dispatch_queue_t _queue;
+};
+
+class schedulers::libdispatch_main : public available_scheduler<libdispatch_main>
+{
+public:
+  using default_allocator_type = task_allocator<char>;
+
+  libdispatch_main() = default;
+  libdispatch_main(const libdispatch_main&) = delete;
+  libdispatch_main(libdispatch_main&&) = delete;
+  ~libdispatch_main()
+  {
+    main_thread_task_queue::get().clear();
+  }
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    if(main_thread_task_queue::get().push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority))
+    {
+      signal();
+    }
+  }
+
+  auto running_in_this_thread() const noexcept -> bool { return pthread_main_np() != 0; }
+
+private:
+  friend available_scheduler<libdispatch_main>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    if(main_thread_task_queue::get().push(move(task)))
+    {
+      signal();
+    }
+  }
+
+  static auto signal() -> void
+  {
+    dispatch_async_f(dispatch_get_main_queue(), nullptr, [] (void*)
+                     {
+                       // Going back through the main queue lets other main thread work run between batches
+                       if(main_thread_task_queue::get().drain())
+                       {
+                         signal();
+                       }
+                     });
+  }
+
+  // Delayed tasks go directly to the main queue. They own their state so they don't need main_thread_task_queue.
+  template<class Alloc, class F>
+  auto schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const -> void
+  {
+    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, forward<F>(f));
+    dispatch_after_f(dispatch_time(DISPATCH_TIME_NOW, detail::time_until(deadline).count()), dispatch_get_main_queue(), callback.get().data, callback.get().callback);
+    callback.release();
+  }
+};
+
+class schedulers::libdispatch_global_default : public libdispatch_queue
+{
+public:
+  libdispatch_global_default()
+  : libdispatch_queue{dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0)}
+  { }
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, detail::trace(forward<F>(f)));
+    dispatch_async_f(dispatch_get_global_queue(dispatch_priority(priority), 0), callback.get().data, callback.get().callback);
+    callback.release();
+  }
+
+private:
+  static auto dispatch_priority(task_priority priority) noexcept -> long
+  {
+    switch(priority)
+    {
+      case task_priority::high: return DISPATCH_QUEUE_PRIORITY_HIGH;
+      case task_priority::low: return DISPATCH_QUEUE_PRIORITY_LOW;
+      default: return DISPATCH_QUEUE_PRIORITY_DEFAULT;
+    }
+  }
+};
+
+#else
+class schedulers::libdispatch_queue : public unavailable_scheduler { };
+class schedulers::libdispatch_main : public unavailable_scheduler { };
+class schedulers::libdispatch_global_default : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// cf_main_run_loop
+//
+
+#if defined(__APPLE__)
+class schedulers::cf_main_run_loop : public available_scheduler<cf_main_run_loop>
+{
+public:
+  /// Construct and destroy on the main thread.
+  explicit cf_main_run_loop(std::chrono::nanoseconds budget = main_thread_task_queue::default_batch_budget)
+  : _budget(budget)
+  {
+    CFRunLoopObserverContext context = {0, this, nullptr, nullptr, nullptr};
+    _observer = CFRunLoopObserverCreate(kCFAllocatorDefault, kCFRunLoopBeforeWaiting, true, 0, &before_waiting, &context);
+    if(!_observer)
+    {
+      throw std::bad_alloc{};
+    }
+    CFRunLoopAddObserver(CFRunLoopGetMain(), _observer, kCFRunLoopCommonModes);
+  }
+  cf_main_run_loop(const cf_main_run_loop&) = delete;
+  cf_main_run_loop(cf_main_run_loop&&) = delete;
+  ~cf_main_run_loop()
+  {
+    CFRunLoopObserverInvalidate(_observer);
+    CFRelease(_observer);
+    _queue.clear();
+  }
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    if(_queue.push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority))
+    {
+      CFRunLoopWakeUp(CFRunLoopGetMain());
+    }
+  }
+
+  auto running_in_this_thread() const noexcept -> bool { return pthread_main_np() != 0; }
+
+private:
+  friend available_scheduler<cf_main_run_loop>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    if(_queue.push(move(task)))
+    {
+      CFRunLoopWakeUp(CFRunLoopGetMain());
+    }
+  }
+
+  // A wake-up before the run loop goes to sleep makes it return immediately, so leftover tasks get the next iteration after other sources had their turn
+  static auto before_waiting(CFRunLoopObserverRef, CFRunLoopActivity, void* info) -> void
+  {
+    auto self = static_cast<const cf_main_run_loop*>(info);
+    if(self->_queue.drain_for(self->_budget))
+    {
+      CFRunLoopWakeUp(CFRunLoopGetMain());
+    }
+  }
+
+  std::chrono::nanoseconds _budget;
+  main_thread_task_queue _queue;
+  CFRunLoopObserverRef _observer;
+};
+#else
+class schedulers::cf_main_run_loop : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// win32_default_pool
+//
+
+#if defined(_WIN32)
+class schedulers::win32_default_pool : public available_scheduler<win32_default_pool>
+{
+public:
+  using default_allocator_type = task_allocator<char>;
+
+  /**
+   Submit `f` to the process's default thread pool with the matching `TP_CALLBACK_PRIORITY_*`.
+
+   \note Callback priorities require Windows 7 or later.
+   */
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    TP_CALLBACK_ENVIRON environment;
+    ::InitializeThreadpoolEnvironment(&environment);
+    ::SetThreadpoolCallbackPriority(&environment, detail::win32_callback_priority(priority));
+    try
+    {
+      submit(alloc, forward<F>(f), &environment);
+    }
+    catch(...)
+    {
+      ::DestroyThreadpoolEnvironment(&environment);
+      throw;
+    }
+    ::DestroyThreadpoolEnvironment(&environment);
+  }
+
+private:
+  friend available_scheduler<win32_default_pool>;
+
+  template<class Alloc, class F>
+  void schedule(const Alloc& alloc, F&& f) const
+  {
+    submit(alloc, forward<F>(f), nullptr);
+  }
+
+  // All chunks share one work object which is submitted once per chunk instead of creating a callback for each
+  template<class Alloc, class F>
+  auto schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const -> void
+  {
+    const auto chunks = std::min<std::size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    auto state = detail::make_bulk_state(alloc, n, chunks, forward<F>(f));
+    using state_t = std::remove_pointer_t<decltype(state)>;
+
+    std::unique_ptr<bulk_work<state_t>> bulk;
+    try
+    {
+      bulk = std::make_unique<bulk_work<state_t>>(state);
+    }
+    catch(...)
+    {
+      for(std::size_t i = 0; i < chunks; ++i)
+      {
+        state->release();
+      }
+      throw;
+    }
+    bulk->work = ::CreateThreadpoolWork(&run_bulk_chunk<state_t>, bulk.get(), nullptr);
+    if(!bulk->work)
+    {
+      throw std::system_error{static_cast<int>(::GetLastError()), std::system_category(), "Unable to create Win32 thread pool work."};
+    }
+    for(std::size_t i = 0; i < chunks; ++i)
+    {
+      ::SubmitThreadpoolWork(bulk->work);
+    }
+    bulk.release();
+  }
+
+  // The simple callback has an additional instance parameter so we cannot use package_task_as_c_callback()
+  template<class Alloc, class F>
+  static auto submit(const Alloc& alloc, F&& f, PTP_CALLBACK_ENVIRON environment) -> void
+  {
+    // The work item comes from a recycled block and embeds small callables, so most tasks don't touch the heap
+    auto work = allocate_unique<detail::work_item>(task_allocator<detail::work_item>{}, std::allocator_arg, alloc, detail::trace(forward<F>(f)));
+    if(!::TrySubmitThreadpoolCallback(&run_work_item, work.get(), environment))
+    {
+      throw std::system_error{static_cast<int>(::GetLastError()), std::system_category(), "Unable to submit Win32 thread pool callback."};
+    }
+    work.release();
+  }
+
+  // Every delayed task gets its own thread pool timer which is closed once it fired
+  template<class Alloc, class F>
+  auto schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const -> void
+  {
+    auto work = std::make_unique<timed_work_item>(detail::work_item{std::allocator_arg, alloc, forward<F>(f)});
+    work->timer = ::CreateThreadpoolTimer(&run_timed_work_item, work.get(), nullptr);
+    if(!work->timer)
+    {
+      throw std::system_error{static_cast<int>(::GetLastError()), std::system_category(), "Unable to create Win32 thread pool timer."};
+    }
+    // Negative due times are relative and in units of 100 nanoseconds, rounded up so we don't fire early
+    ULARGE_INTEGER due;
+    due.QuadPart = static_cast<ULONGLONG>(-((detail::time_until(deadline).count() + 99) / 100));
+    FILETIME due_time;
+    due_time.dwLowDateTime = due.LowPart;
+    due_time.dwHighDateTime = due.HighPart;
+    ::SetThreadpoolTimer(work->timer, &due_time, 0, 0);
+    work.release();
+  }
+
+  struct timed_work_item
+  {
+    explicit timed_work_item(detail::work_item&& f) : work(move(f)) { }
+
+    PTP_TIMER timer = nullptr;
+    detail::work_item work;
+  };
+
+  // The work object of a bulk() call. Every callback claims the next chunk and the last one to finish frees it.
+  template<class State>
+  struct bulk_work
+  {
+    explicit bulk_work(State* state) noexcept : state(state), chunks(state->chunks()) { }
+    ~bulk_work()
+    {
+      // Only chunks which never ran are left if the work object couldn't be created
+      for(auto i = next.load(); i < chunks; ++i)
+      {
+        state->release();
+      }
+    }
+
+    State* const state;
+    const std::size_t chunks;
+    PTP_WORK work = nullptr;
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> finished{0};
+  };
+
+  static auto CALLBACK run_work_item(PTP_CALLBACK_INSTANCE, PVOID context) -> void
+  {
+    struct deleter
+    {
+      detail::work_item* ptr;
+      ~deleter()
+      {
+        make_allocator_deleter<detail::work_item>(task_allocator<detail::work_item>{})(ptr);
+      }
+    };
+    deleter work{static_cast<detail::work_item*>(context)};
+    move(*work.ptr)();
+  }
+
+  template<class State>
+  static auto CALLBACK run_bulk_chunk(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK work) -> void
+  {
+    auto bulk = static_cast<bulk_work<State>*>(context);
+    {
+      detail::bulk_chunk<State> chunk{bulk->state, bulk->next++};
+      chunk();
+    }
+    if(++bulk->finished == bulk->chunks)
+    {
+      // Like timers the work object is released once this callback returns
+      ::CloseThreadpoolWork(work);
+      delete bulk;
+    }
+  }
+
+  static auto CALLBACK run_timed_work_item(PTP_CALLBACK_INSTANCE, PVOID context, PTP_TIMER timer) -> void
+  {
+    auto work = std::unique_ptr<timed_work_item>{static_cast<timed_work_item*>(context)};
+    // Closing a timer from its own callback is allowed, it is released once the callback returns
+    ::CloseThreadpoolTimer(timer);
+    move(work->work)();
+  }
+};
+#else
+class schedulers::win32_default_pool : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// win32_thread_pool
+//
+
+#if defined(_WIN32)
+class schedulers::win32_thread_pool : public available_scheduler<win32_thread_pool>
+{
+public:
+  /**
+   Create a private thread pool.
+
+   \param max_threads The number of threads the system may create at most.
+   \param min_threads The number of threads kept alive even if there is no work.
+   */
+  explicit win32_thread_pool(unsigned max_threads = std::thread::hardware_concurrency(), unsigned min_threads = 1);
+  win32_thread_pool(const win32_thread_pool&) = delete;
+  win32_thread_pool& operator=(const win32_thread_pool&) = delete;
+  /**
+   Equivalent to `shutdown(shutdown_mode::drain)` unless the pool is already shut down.
+
+   \warning The destructor must not run in a task of the pool otherwise it will deadlock.
+   */
+  ~win32_thread_pool();
+
+  /**
+   Submit `f` to the lane with the matching `TP_CALLBACK_PRIORITY_*`.
+
+   \note Callback priorities require Windows 7 or later.
+   */
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    push(priority, {std::allocator_arg, alloc, detail::trace(forward<F>(f))});
+  }
+
+  /**
+   Block until every scheduled task has finished, including the tasks they schedule in turn.
+
+   \warning Must not be called by a task of the pool as it would wait for itself.
+   */
+  auto wait_idle() const -> void;
+  /**
+   Wait for the running callbacks and release the pool's system resources.
+
+   With shutdown_mode::drain the pool first waits until it is idle. With shutdown_mode::discard all queued tasks are destroyed without running and the cleanup group cancels their pending callbacks. Tasks scheduled after the call never run. Calling it again or destroying the pool afterwards does nothing more.
+
+   \warning Must not be called by a task of the pool or concurrently with itself.
+   */
+  auto shutdown(shutdown_mode mode = shutdown_mode::drain) -> void;
+
+private:
+  friend available_scheduler<win32_thread_pool>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    push(task_priority::normal, {std::allocator_arg, alloc, detail::trace(forward<F>(f))});
+  }
+
+  template<class Alloc, class F>
+  auto schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const -> void
+  {
+    // One chunk per thread the pool may run at the same time
+    const auto chunks = static_cast<unsigned>(std::min<std::size_t>(n, _max_threads));
+    std::vector<detail::work_item> work;
+    work.reserve(chunks);
+    auto state = detail::make_bulk_state(alloc, n, chunks, forward<F>(f));
+    using chunk_t = detail::bulk_chunk<std::remove_pointer_t<decltype(state)>>;
+
+    unsigned i = 0;
+    try
+    {
+      for(; i < chunks; ++i)
+      {
+        work.emplace_back(std::allocator_arg, alloc, chunk_t{state, i});
+      }
+    }
+    catch(...)
+    {
+      // The chunk that failed has already released its reference
+      while(++i < chunks)
+      {
+        state->release();
+      }
+      throw;
+    }
+    push_bulk(work.data(), work.data() + work.size());
+  }
+
+  // A queue of tasks and the work object which is submitted once for each of them
+  struct lane
+  {
+    const win32_thread_pool* pool;
+    std::mutex mutex;
+    std::deque<detail::work_item> queue;
+    // Set by shutdown(), submitting to a closed work object isn't allowed
+    bool closed = false;
+    TP_CALLBACK_ENVIRON environment;
+    PTP_WORK work = nullptr;
+  };
+
+  auto push(task_priority priority, detail::work_item&& f) const -> void;
+  // Push to the lane of normal priority
+  auto push_bulk(detail::work_item* first, detail::work_item* last) const -> void;
+  // Release whatever the constructor managed to create, waiting for running callbacks
+  auto close(BOOL cancel_pending) noexcept -> void;
+  static auto CALLBACK run_lane(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK) -> void;
+
+  const unsigned _max_threads;
+  PTP_POOL _pool = nullptr;
+  PTP_CLEANUP_GROUP _cleanup = nullptr;
+  mutable lane _lanes[num_task_priorities];
+  // Tasks pushed to a lane which haven't finished yet
+  mutable std::atomic<std::size_t> _outstanding{0};
+};
+#else
+class schedulers::win32_thread_pool : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// win32_message_queue
+//
+
+#if defined(_WIN32)
+class schedulers::win32_message_queue : public available_scheduler<win32_message_queue>
+{
+public:
+  /// Construct and destroy on the thread running the message loop.
+  explicit win32_message_queue(std::chrono::nanoseconds budget = main_thread_task_queue::default_batch_budget);
+  win32_message_queue(const win32_message_queue&) = delete;
+  win32_message_queue& operator=(const win32_message_queue&) = delete;
+  ~win32_message_queue();
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    if(_queue.push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority))
+    {
+      post();
+    }
+  }
+
+  auto running_in_this_thread() const noexcept -> bool { return ::GetCurrentThreadId() == _thread; }
+
+private:
+  friend available_scheduler<win32_message_queue>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    if(_queue.push(move(task)))
+    {
+      post();
+    }
+  }
+
+  // Signal the window that the queue has to be drained
+  auto post() const -> void;
+  static auto CALLBACK window_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam) -> LRESULT;
+
+  std::chrono::nanoseconds _budget;
+  main_thread_task_queue _queue;
+  DWORD _thread;
+  HWND _window;
+};
+#else
+class schedulers::win32_message_queue : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// emscripten_async
+//
+
+#if defined(__EMSCRIPTEN__)
+class schedulers::emscripten_async : public available_scheduler<emscripten_async>
+{
+public:
+  using default_allocator_type = task_allocator<char>;
+
+private:
+  friend available_scheduler<emscripten_async>;
+
+  template<class Alloc, class F>
+  void schedule(const Alloc& alloc, F&& f) const
+  {
+    auto callback = package_task_as_c_callback<em_arg_callback_func>(alloc, detail::trace(forward<F>(f)));
+    ::emscripten_async_call(callback.get().callback, callback.get().data, 0);
+    callback.release();
+  }
+
+  template<class Alloc, class F>
+  void schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+  {
+    // Rounded up to whole milliseconds so we don't fire early
+    const auto millis = static_cast<int>((detail::time_until(deadline).count() + 999999) / 1000000);
+    auto callback = package_task_as_c_callback<em_arg_callback_func>(alloc, forward<F>(f));
+    ::emscripten_async_call(callback.get().callback, callback.get().data, millis);
+    callback.release();
+  }
+};
+#else
+class schedulers::emscripten_async : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// shared_scheduler
+//
+
+namespace schedulers
+{
+  namespace detail
+  {
+    template<class Scheduler, bool = Scheduler::available()>
+    class shared_scheduler_base;
+  }
+}
+
+template<class Scheduler>
+class schedulers::detail::shared_scheduler_base<Scheduler, true>
 : public available_scheduler<shared_scheduler_base<Scheduler, true>>
 {
-public:
-  shared_scheduler_base() = default;
+public:
+  shared_scheduler_base() = default;
+
+  template<class... Args>
+  shared_scheduler_base(Args&&... args)
+  : _ptr(std::make_shared<const Scheduler>(forward<Args>(args)...))
+  { }
+
+  template<class Alloc, class... Args>
+  shared_scheduler_base(std::allocator_arg_t, const Alloc& alloc, Args&&... args)
+  : _ptr(std::allocate_shared<const Scheduler>(alloc, forward<Args>(args)...))
+  { }
+
+private:
+  friend available_scheduler<shared_scheduler_base<Scheduler, true>>;
+
+  template<class Alloc, class F>
+  void schedule(const Alloc& alloc, F&& f) const
+  {
+    (*_ptr)(alloc, forward<F>(f));
+  }
+
+  template<class Alloc, class F>
+  void schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const
+  {
+    _ptr->bulk(alloc, n, forward<F>(f));
+  }
+
+  template<class Alloc, class InputIt>
+  void schedule_bulk(const Alloc& alloc, InputIt first, InputIt last) const
+  {
+    _ptr->bulk(alloc, first, last);
+  }
+
+  // Only available if Scheduler supports timers. S delays the lookup until it is used.
+  template<class Alloc, class F, class S = Scheduler>
+  auto schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+  -> decltype(std::declval<const S&>().schedule_at(alloc, deadline, forward<F>(f)))
+  {
+    _ptr->schedule_at(alloc, deadline, forward<F>(f));
+  }
+
+  std::shared_ptr<const Scheduler> _ptr;
+};
+
+template<class Scheduler>
+class schedulers::detail::shared_scheduler_base<Scheduler, false>
+: public unavailable_scheduler
+{ };
+
+template<class Scheduler>
+class schedulers::shared_scheduler
+: public detail::shared_scheduler_base<Scheduler>
+{
+public:
+  using detail::shared_scheduler_base<Scheduler>::shared_scheduler_base;
+};
+
+template<class Scheduler, class... Args>
+auto schedulers::make_shared_scheduler(Args&&... args)
+{
+  return shared_scheduler<std::decay_t<Scheduler>>{forward<Args>(args)...};
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// custom_thread_pool
+//
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+class schedulers::basic_thread_pool
+: public available_scheduler<basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>>
+{
+public:
+  using work_t = typename WorkQueue::work_t;
+  // Used when scheduling without an explicit allocator
+  using default_allocator_type = task_allocator<char>;
+  // The callable stored in a work_t for a task of type F once Instrumentation wrapped it
+  template<class F>
+  using wrapped_task_t = std::decay_t<decltype(std::declval<const Instrumentation&>().wrap(std::declval<F>()))>;
+  static_assert(std::is_default_constructible<work_t>(), "Work item of work queue must be default constructible");
+  static_assert(std::is_convertible<decltype(!std::declval<work_t>()), bool>(), "Work item of work queue must be contextually convertible to bool");
+
+  /**
+   Create a thread pool with the given thread factory and number of threads.
+   
+   \param f A factory for threads. It is called with the zero-based thread index, a reference to the thread's own work queue, and a `Callable<void()>`. The thread owned by the returned handle must call a copy of the provided function in the context of the new thread and exit in a timely fashion once it returns.
+   \param num_threads Determines how many threads are created for the pool.
+   \param idle Determines how idle threads look for work before they block.
+   \param hooks Called by every worker when it starts and stops.
+   */
+  template<class ThreadFactory>
+  basic_thread_pool(ThreadFactory f,
+                    unsigned num_threads = std::thread::hardware_concurrency(),
+                    thread_pool_idle_policy idle = {},
+                    thread_pool_hooks hooks = {});
+  /**
+   The destructor blocks until all threads in the pool exit.
+
+   What happens to any scheduled but not yet executed tasks is the responsibility of `WorkQueue`. Call shutdown() first to decide yourself.
+
+   \warning The destructor must not run on a thread belonging to the thread pool otherwise it will deadlock.
+   */
+  ~basic_thread_pool();
+
+  /**
+   Block until every task pushed to a queue of the pool has finished, including the tasks they schedule in turn.
+
+   Tasks scheduled with schedule_at() or schedule_after() only count once they are due. If other threads keep scheduling work this returns the first time the pool runs out of it. Returns right away once the pool is shut down.
+
+   \warning Must not be called by a worker of the pool as it would wait for itself.
+   */
+  auto wait_idle() const -> void;
+  /**
+   Like wait_idle() but run pending tasks on the calling thread while the workers are busy.
+   */
+  auto drain() const -> void;
+  /**
+   Stop and join all workers without destroying the pool.
+
+   With shutdown_mode::drain the pool first waits until it is idle. With shutdown_mode::discard the workers only finish the task they are running and all queued tasks are destroyed in bulk without running, so shutting down takes as long as the longest running task instead of the whole backlog. Delayed tasks which aren't due yet never run in either mode, and neither do tasks scheduled after the call. Calling it again or destroying the pool afterwards does nothing more.
+
+   \warning Must not be called by a worker of the pool or concurrently with itself.
+   */
+  auto shutdown(shutdown_mode mode = shutdown_mode::drain) -> void;
+
+  /**
+   Schedule `f` unless all queues are full.
+
+   Only available if `WorkQueue` has a capacity, which it indicates with a `push_unless_full(f)` method like bounded_task_queue. Every queue is tried once without blocking. This also fails if the queues with space left are locked by other threads at the same time.
+
+   \return `false` if `f` was not scheduled, in which case it has been destroyed. Pass an lvalue if you need to keep it for another attempt.
+   */
+  template<class F, class Q = WorkQueue>
+  auto try_schedule(F&& f) const -> std::enable_if_t<detail::has_push_unless_full<Q>::value, bool>
+  {
+    return try_schedule(default_allocator_type{}, forward<F>(f));
+  }
+  template<class Alloc, class F, class Q = WorkQueue>
+  auto try_schedule(const Alloc& alloc, F&& f) const -> std::enable_if_t<detail::has_push_unless_full<Q>::value, bool>;
+
+  /**
+   Schedule `f` in the lane of the given priority.
+
+   Only available if `WorkQueue` has the overloads `push(f, priority)`, `try_push(f, priority)` and `try_pop(f, priority)` like priority_task_queue. Tasks scheduled without a priority go to the queue's default lane. Use with_priority() to get a scheduler for a single priority.
+   */
+  template<class Alloc, class F, class P = detail::has_priority_lanes<WorkQueue>>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> std::enable_if_t<P::value>
+  {
+    submit(make_work(alloc, _instrumentation.wrap(forward<F>(f))), priority);
+  }
+
+  /**
+   Run one pending task of the pool on the calling thread if there is one.
+
+   This allows threads waiting for work scheduled on the pool to help complete it instead of blocking.
+
+   \return `false` if no task could be found.
+   */
+  auto try_run_one() const -> bool;
+
+  /// Whether the calling thread is one of the workers of this pool.
+  auto running_in_this_thread() const noexcept -> bool { return detail::current_worker_slot().pool == this; }
+  /// The index of the calling thread in the pool, or num_threads() if it doesn't belong to the pool.
+  auto current_worker() const noexcept -> unsigned;
+  auto num_threads() const noexcept -> unsigned { return _num_threads; }
+
+  /**
+   Get a snapshot of the statistics collected by `Instrumentation`.
+
+   Only available if `Instrumentation` has a `snapshot()` method.
+   */
+  template<class I = Instrumentation>
+  auto stats() const -> decltype(std::declval<const I&>().snapshot())
+  {
+    return _instrumentation.snapshot();
+  }
+
+private:
+  friend available_scheduler<basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>>;
+  using f_is_ok = std::true_type;
+  using f_is_not_ok = std::false_type;
+  using work_t_ctor_has_allocator_arg = std::true_type;
+  using work_t_ctor_has_no_allocator_arg = std::false_type;
+  using work_t_uses_allocator = std::true_type;
+  using work_t_uses_no_allocator = std::false_type;
+  using work_t_uses_allocator_dont_care = dont_care_t;
+
+  template<class ThreadFactory>
+  auto start(ThreadFactory& f, f_is_ok) -> void;
+
+  template<class ThreadFactory>
+  auto start(ThreadFactory& f, f_is_not_ok) -> void;
+
+  // Use ThreadFactory::node_of() to build a NUMA-aware steal order if it exists
+  template<class ThreadFactory>
+  auto init_steal_order(const ThreadFactory& f, int) -> decltype(unsigned(f.node_of(0u)), void());
+  template<class ThreadFactory>
+  auto init_steal_order(const ThreadFactory& /*f*/, long) -> void { }
+  // The i-th queue worker index looks at for work, starting with its own
+  auto victim(unsigned index, unsigned i) const noexcept -> unsigned
+  {
+    return _steal_order.empty() ? (index + i) % _num_threads : _steal_order[index * _num_threads + i];
+  }
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void;
+  template<class Alloc, class F, class Q = WorkQueue>
+  auto schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+  -> std::enable_if_t<detail::has_pop_until<Q>::value>;
+  // The optional priority is forwarded to the queue's push methods
+  template<class... Priority>
+  auto submit(work_t&& work, Priority... priority) const -> void;
+
+  template<class Alloc, class F>
+  auto schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const -> void;
+  template<class Alloc, class InputIt>
+  auto schedule_bulk(const Alloc& alloc, InputIt first, InputIt last) const -> void;
+
+  // A little dance to figure out how to construct work_t
+  template<class Alloc, class F>
+  auto make_work(const Alloc& alloc, F&& f) const -> work_t;
+  // Supports (allocator_arg, alloc, f)
+  template<class Alloc, class F>
+  auto make_work(const Alloc& alloc,
+                 F&& f,
+                 work_t_ctor_has_allocator_arg,
+                 work_t_uses_allocator_dont_care) const -> work_t;
+  // Supports (f, alloc)
+  template<class Alloc, class F>
+  auto make_work(const Alloc& alloc,
+                 F&& f,
+                 work_t_ctor_has_no_allocator_arg,
+                 work_t_uses_allocator) const -> work_t;
+  template<class Alloc, class F>
+  // No allocator support
+  auto make_work(const Alloc& alloc,
+                 F&& f,
+                 work_t_ctor_has_no_allocator_arg,
+                 work_t_uses_no_allocator) const -> work_t;
+
+  // Push directly into the given queue
+  template<class... Priority>
+  auto push_to(unsigned index, work_t&& f, Priority... priority) const -> void;
+  // Use WorkQueue::push_bulk() if available
+  auto push_to(unsigned index, work_t* first, work_t* last) const -> void;
+  template<class Queue>
+  auto push_bulk(unsigned worker, const Queue& q, work_t* first, work_t* last, int) const -> decltype(q.push_bulk(first, last));
+  template<class Queue>
+  auto push_bulk(unsigned worker, const Queue& q, work_t* first, work_t* last, long) const -> void;
+  // Every push goes through these to count the task for wait_idle(). `worker` is the calling thread's current_worker(). A push leaving `f` behind didn't queue it.
+  template<class... Priority>
+  auto try_push_counted(unsigned worker, const WorkQueue& q, work_t& f, Priority... priority) const -> bool;
+  template<class... Priority>
+  auto push_counted(unsigned worker, const WorkQueue& q, work_t& f, Priority... priority) const -> void;
+  // Wait for the lock of every queue in turn, starting at `first`, and push to the first one which isn't full if WorkQueue has push_unless_full(). Returns the queue or _num_threads.
+  template<class Slot, class... Priority>
+  auto push_unless_full(const detail::cache_aligned_array<Slot>& workers, unsigned worker, unsigned first, work_t& f, int, Priority... priority) const
+  -> decltype(bool(workers[first].queue.push_unless_full(f, priority...)), unsigned());
+  template<class Slot, class... Priority>
+  auto push_unless_full(const detail::cache_aligned_array<Slot>& /*workers*/, unsigned /*worker*/, unsigned /*first*/, work_t& /*f*/, long, Priority... /*priority*/) const -> unsigned { return _num_threads; }
+  // Tasks must be counted as pushed before they are queued, or a worker could finish one and see the pool idle while its parent still runs
+  auto count_pushed(unsigned worker, std::size_t n) const -> void;
+  auto count_finished(unsigned worker, std::size_t n) const -> void;
+  // Whether every task counted as pushed has also been counted as finished
+  auto idle() const -> bool;
+  // Wake up wait_idle() if the pool is idle. Called by workers before they park and by other threads after they finished a task.
+  auto notify_if_idle() const -> void;
+  // Counts a task as finished when it goes out of scope after the work item itself, even if it throws
+  struct finish_guard
+  {
+    const basic_thread_pool* pool;
+    unsigned worker;
+    std::size_t n;
+    ~finish_guard()
+    {
+      if(n > 0)
+      {
+        pool->count_finished(worker, n);
+      }
+    }
+  };
+  // Use WorkQueue::bind_owner() if available
+  template<class Queue>
+  static auto bind_owner(const Queue& q, int) -> decltype(q.bind_owner());
+  template<class Queue>
+  static auto bind_owner(const Queue& /*q*/, long) -> void { }
+  // Use WorkQueue::clear() if available, otherwise pop everything
+  template<class Queue>
+  static auto clear_queue(const Queue& q, int) -> decltype(q.clear());
+  template<class Queue>
+  static auto clear_queue(const Queue& q, long) -> void;
+  // Determine the first queue of a bulk submission with the given number of chunks
+  auto first_bulk_queue(unsigned chunks) const -> unsigned;
+
+  auto run(int index) const -> void;
+  enum class park_result { popped, timed_out, done };
+  // Block in WorkQueue::pop(), or pop_until() the next timer deadline if no other worker waits for it
+  auto park(unsigned index, work_t& f) const -> park_result;
+  template<class Queue>
+  static auto pop_until(const Queue& q, work_t& f, std::chrono::steady_clock::time_point deadline, int) -> decltype(q.pop_until(f, deadline));
+  template<class Queue>
+  static auto pop_until(const Queue& q, work_t& f, std::chrono::steady_clock::time_point /*deadline*/, long) -> bool { return q.pop(f); }
+  // Schedule all expired timers
+  auto fire_timers() const -> void;
+  // Pick a parked worker to wait for the next timer if no one does. Must be called with _timer_mutex locked and returns the worker to wake or _num_threads.
+  auto elect_timer_keeper() const -> unsigned;
+  // Make a worker blocked in WorkQueue::pop() reconsider its deadline
+  auto wake(unsigned index) const -> void;
+  // Use WorkQueue::interrupt() if available, otherwise push an empty task
+  template<class Queue>
+  static auto wake(const Queue& q, unsigned index, int) -> decltype(q.interrupt());
+  template<class Queue>
+  auto wake(const Queue& q, unsigned index, long) const -> void;
+  auto try_pop_any(unsigned index, work_t& f) const -> bool;
+  // Search all queues for high priority tasks before looking at lower priorities if WorkQueue supports it
+  template<class Slot>
+  auto try_pop_any(const detail::cache_aligned_array<Slot>& workers, unsigned index, work_t& f, int) const
+  -> decltype(workers[index].queue.try_pop(f, task_priority::normal));
+  // Otherwise take the first task from the queues in order, starting at index
+  template<class Slot>
+  auto try_pop_any(const detail::cache_aligned_array<Slot>& workers, unsigned index, work_t& f, long) const -> bool;
+
+  // Tasks pushed and finished by some threads. Both only ever grow, so summing them up in the right order cannot miss tasks in flight.
+  struct task_counters
+  {
+    std::atomic<std::size_t> pushed{0};
+    std::atomic<std::size_t> finished{0};
+  };
+  struct worker_slot
+  {
+    WorkQueue queue;
+    // Set while the worker is blocked in WorkQueue::pop() so local work can be handed to it instead
+    mutable std::atomic<bool> parked{false};
+    // Only written by the worker itself
+    mutable task_counters tasks;
+  };
+
+  const unsigned _num_threads;
+  const thread_pool_idle_policy _idle;
+  const thread_pool_hooks _hooks;
+  // Every worker has cache lines of its own so workers locking their queues don't slow down their neighbours
+  detail::cache_aligned_array<worker_slot> _workers{_num_threads};
+  std::vector<ThreadHandle> _threads;
+  // Row i contains the queues in the order worker i visits them, empty if all workers are equally close
+  std::vector<unsigned> _steal_order;
+  // Set by shutdown(), workers stop before their next task if they still run
+  std::atomic<bool> _stopped{false};
+  // Set before the queues are done so workers can tell it apart from being interrupted
+  std::atomic<bool> _queues_done{false};
+  // Written by every submission from outside the pool and every park, so they are kept off the lines of the read-mostly members
+  detail::cache_line_padding _submit_padding;
+  mutable std::atomic<unsigned> _next_thread{0}; // Must be unsigned because it can overflow
+  detail::cache_line_padding _park_padding;
+  mutable std::atomic<unsigned> _num_parked{0};
+  // Tasks pushed and finished by threads outside the pool, the workers count theirs in _workers
+  detail::cache_line_padding _external_padding;
+  mutable task_counters _external_tasks;
+  mutable std::atomic<unsigned> _idle_waiters{0};
+  detail::cache_line_padding _timer_padding;
+  // Tasks scheduled with schedule_at() or schedule_after()
+  mutable std::mutex _timer_mutex;
+  mutable detail::timer_wheel<work_t> _timers;
+  // The next deadline of _timers as a steady_clock count so workers can check it between tasks without locking
+  mutable std::atomic<std::chrono::steady_clock::rep> _next_timer{std::chrono::steady_clock::time_point::max().time_since_epoch().count()};
+  // The worker parked until _keeper_deadline, or _num_threads if none. Only changed with _timer_mutex locked.
+  mutable std::atomic<unsigned> _timer_keeper{_num_threads};
+  mutable std::chrono::steady_clock::time_point _keeper_deadline;
+  // Notified when the pool becomes idle while someone waits in wait_idle()
+  mutable std::mutex _idle_mutex;
+  mutable std::condition_variable _became_idle;
+  Instrumentation _instrumentation;
+};
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class ThreadFactory>
+schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::basic_thread_pool(ThreadFactory f,
+                                                                          unsigned num_threads,
+                                                                          thread_pool_idle_policy idle,
+                                                                          thread_pool_hooks hooks)
+: _num_threads(std::max(1u, num_threads))
+, _idle(idle)
+, _hooks(move(hooks))
+{
+  _instrumentation.init(_num_threads);
+  init_steal_order(f, 0);
+  auto thread_proc = [this, i = 0] {};
+  constexpr auto thread_factory_ok = std::is_constructible<ThreadHandle, std::result_of_t<ThreadFactory&(unsigned, WorkQueue&, decltype(thread_proc))>>();
+
+  static_assert(thread_factory_ok, "ThreadFactory must be Callable<R(unsigned, WorkQueue&, F)> with F a Callable<void()> and R convertible to ThreadHandle");
+
+  start(f, thread_factory_ok);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::~basic_thread_pool()
+{
+  _queues_done.store(true, std::memory_order_relaxed);
+  for(std::size_t i = 0; i < _workers.size(); ++i)
+  {
+    _workers[i].queue.done();
+  }
+  for(auto&& t : _threads)
+  {
+    t.join();
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::wait_idle() const -> void
+{
+  assert(!running_in_this_thread() && "wait_idle() on a worker of the same pool never returns");
+  _idle_waiters.fetch_add(1, std::memory_order_relaxed);
+  // Pairs with the fence in notify_if_idle(): either it sees us waiting or we see the tasks it finished
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  {
+    std::unique_lock<std::mutex> lock{_idle_mutex};
+    _became_idle.wait(lock, [this] { return _stopped.load(std::memory_order_relaxed) || idle(); });
+  }
+  _idle_waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::drain() const -> void
+{
+  assert(!running_in_this_thread() && "drain() on a worker of the same pool never returns");
+  while(!_stopped.load(std::memory_order_relaxed) && try_run_one())
+  {
+  }
+  wait_idle();
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::shutdown(shutdown_mode mode) -> void
+{
+  assert(!running_in_this_thread() && "shutdown() on a worker of the same pool would join itself");
+  if(_threads.empty())
+  {
+    return;
+  }
+  if(mode == shutdown_mode::drain)
+  {
+    drain();
+  }
+  else
+  {
+    _stopped.store(true, std::memory_order_relaxed);
+  }
+  _queues_done.store(true, std::memory_order_relaxed);
+  for(std::size_t i = 0; i < _workers.size(); ++i)
+  {
+    _workers[i].queue.done();
+  }
+  for(auto&& t : _threads)
+  {
+    t.join();
+  }
+  _threads.clear();
+  if(mode == shutdown_mode::discard)
+  {
+    for(std::size_t i = 0; i < _workers.size(); ++i)
+    {
+      clear_queue(_workers[i].queue, 0);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock{_idle_mutex};
+    _stopped.store(true, std::memory_order_relaxed);
+  }
+  _became_idle.notify_all();
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::clear_queue(const Queue& q, int) -> decltype(q.clear())
+{
+  q.clear();
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::clear_queue(const Queue& q, long) -> void
+{
+  while(true)
+  {
+    work_t f;
+    if(!q.try_pop(f))
+    {
+      break;
+    }
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::bind_owner(const Queue& q, int) -> decltype(q.bind_owner())
+{
+  q.bind_owner();
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class ThreadFactory>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::init_steal_order(const ThreadFactory& f, int) -> decltype(unsigned(f.node_of(0u)), void())
+{
+  std::vector<unsigned> nodes(_num_threads);
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    nodes[i] = f.node_of(i);
+  }
+  if(std::any_of(nodes.begin(), nodes.end(), [&nodes] (unsigned node) { return node != nodes.front(); }))
+  {
+    _steal_order = detail::steal_order_by_node(nodes);
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class ThreadFactory>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::start(ThreadFactory& f, f_is_ok)
+-> void
+{
+  assert(_num_threads > 0 && "invalid number of threads");
+
+  _threads.reserve(_num_threads);
+  for(int i = 0; i < _num_threads; ++i)
+  {
+    _threads.emplace_back(f(i, _workers[i].queue, [this, i] { run(i); }));
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::schedule(const Alloc& alloc, F&& f) const
+-> void
+{
+  submit(make_work(alloc, _instrumentation.wrap(forward<F>(f))));
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F, class Q>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+-> std::enable_if_t<detail::has_pop_until<Q>::value>
+{
+  auto work = make_work(alloc, _instrumentation.wrap(forward<F>(f)));
+  auto keeper = _num_threads;
+  {
+    std::unique_lock<std::mutex> lock{_timer_mutex};
+    if(!_timers.insert(deadline, work))
+    {
+      lock.unlock();
+      submit(move(work));
+      return;
+    }
+    const auto next = _timers.next_deadline();
+    _next_timer.store(next.time_since_epoch().count(), std::memory_order_relaxed);
+    keeper = _timer_keeper.load(std::memory_order_relaxed);
+    if(keeper == _num_threads)
+    {
+      keeper = elect_timer_keeper();
+    }
+    else if(next < _keeper_deadline)
+    {
+      // The keeper is waiting for a later deadline
+      _keeper_deadline = next;
+    }
+    else
+    {
+      keeper = _num_threads;
+    }
+  }
+  wake(keeper);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::make_work(const Alloc& alloc, F&& f) const
+-> work_t
+{
+  constexpr auto has_allocator_arg = std::is_constructible<work_t, std::allocator_arg_t, Alloc, F&&>::value;
+  constexpr auto uses_alloc = std::uses_allocator<work_t, Alloc>::value;
+
+  return make_work(alloc, forward<F>(f), bool_constant<has_allocator_arg>(), bool_constant<uses_alloc>());
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::make_work(const Alloc& alloc,
+                                                                       F&& f,
+                                                                       work_t_ctor_has_allocator_arg,
+                                                                       work_t_uses_allocator_dont_care) const
+-> work_t
+{
+  return work_t{std::allocator_arg, alloc, forward<F>(f)};
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::make_work(const Alloc& alloc,
+                                                                       F&& f,
+                                                                       work_t_ctor_has_no_allocator_arg,
+                                                                       work_t_uses_allocator) const
+-> work_t
+{
+  return work_t{forward<F>(f), alloc};
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::make_work(const Alloc& /*alloc*/,
+                                                                       F&& f,
+                                                                       work_t_ctor_has_no_allocator_arg,
+                                                                       work_t_uses_no_allocator) const
+-> work_t
+{
+  return work_t{forward<F>(f)};
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class... Priority>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::push_to(unsigned index, work_t&& f, Priority... priority) const -> void
+{
+  const auto worker = current_worker();
+  if(!try_push_counted(worker, _workers[index].queue, f, priority...))
+  {
+    push_counted(worker, _workers[index].queue, f, priority...);
+  }
+  _instrumentation.on_push(worker, index, 1);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::push_to(unsigned index, work_t* first, work_t* last) const
+-> void
+{
+  const auto worker = current_worker();
+  push_bulk(worker, _workers[index].queue, first, last, 0);
+  _instrumentation.on_push(worker, index, last - first);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::push_bulk(unsigned worker, const Queue& q, work_t* first, work_t* last, int) const
+-> decltype(q.push_bulk(first, last))
+{
+  count_pushed(worker, last - first);
+  try
+  {
+    q.push_bulk(first, last);
+  }
+  catch(...)
+  {
+    count_finished(worker, std::count_if(first, last, [] (const work_t& f) { return static_cast<bool>(f); }));
+    throw;
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::push_bulk(unsigned worker, const Queue& q, work_t* first, work_t* last, long) const
+-> void
+{
+  for(; first != last; ++first)
+  {
+    if(!try_push_counted(worker, q, *first))
+    {
+      push_counted(worker, q, *first);
+    }
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class... Priority>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::try_push_counted(unsigned worker, const WorkQueue& q, work_t& f, Priority... priority) const -> bool
+{
+  count_pushed(worker, 1);
+  if(q.try_push(f, priority...))
+  {
+    return true;
+  }
+  count_finished(worker, 1);
+  return false;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class... Priority>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::push_counted(unsigned worker, const WorkQueue& q, work_t& f, Priority... priority) const -> void
+{
+  count_pushed(worker, 1);
+  try
+  {
+    q.push(move(f), priority...);
+  }
+  catch(...)
+  {
+    count_finished(worker, 1);
+    throw;
+  }
+  // Ran on the caller or dropped by a queue which is done
+  if(f)
+  {
+    count_finished(worker, 1);
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Slot, class... Priority>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::push_unless_full(const detail::cache_aligned_array<Slot>& workers, unsigned worker, unsigned first, work_t& f, int, Priority... priority) const
+-> decltype(bool(workers[first].queue.push_unless_full(f, priority...)), unsigned())
+{
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    const auto queue = (first + i) % _num_threads;
+    count_pushed(worker, 1);
+    if(workers[queue].queue.push_unless_full(f, priority...))
+    {
+      return queue;
+    }
+    count_finished(worker, 1);
+  }
+  return _num_threads;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::count_pushed(unsigned worker, std::size_t n) const -> void
+{
+  if(worker < _num_threads)
+  {
+    // Nobody else writes the worker's counters, so it doesn't need a read-modify-write
+    auto& pushed = _workers[worker].tasks.pushed;
+    pushed.store(pushed.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  else
+  {
+    _external_tasks.pushed.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::count_finished(unsigned worker, std::size_t n) const -> void
+{
+  // Release so idle() sees every push that happened before the tasks finished, including those of the tasks they scheduled
+  if(worker < _num_threads)
+  {
+    // The worker checks for waiters once it runs out of work and parks
+    auto& finished = _workers[worker].tasks.finished;
+    finished.store(finished.load(std::memory_order_relaxed) + n, std::memory_order_release);
+  }
+  else
+  {
+    _external_tasks.finished.fetch_add(n, std::memory_order_release);
+    notify_if_idle();
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::idle() const -> bool
+{
+  // All finished counts first, so every task counted there has its push counted in the sums read afterwards
+  auto finished = _external_tasks.finished.load(std::memory_order_acquire);
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    finished += _workers[i].tasks.finished.load(std::memory_order_acquire);
+  }
+  auto pushed = _external_tasks.pushed.load(std::memory_order_relaxed);
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    pushed += _workers[i].tasks.pushed.load(std::memory_order_relaxed);
+  }
+  return pushed == finished;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::notify_if_idle() const -> void
+{
+  // Pairs with the fence in wait_idle()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(_idle_waiters.load(std::memory_order_relaxed) > 0 && idle())
+  {
+    {
+      std::lock_guard<std::mutex> lock{_idle_mutex};
+    }
+    _became_idle.notify_all();
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::first_bulk_queue(unsigned chunks) const -> unsigned
+{
+  const auto worker = current_worker();
+  if(worker < _num_threads)
+  {
+    return worker;
+  }
+  return _next_thread.fetch_add(chunks);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const
+-> void
+{
+  // One chunk per queue, so every worker is woken at most once
+  const auto chunks = static_cast<unsigned>(std::min<std::size_t>(n, _num_threads));
+  auto state = detail::make_bulk_state(alloc, n, chunks, forward<F>(f));
+  using chunk_t = detail::bulk_chunk<std::remove_pointer_t<decltype(state)>>;
+
+  const auto first = first_bulk_queue(chunks);
+  unsigned i = 0;
+  try
+  {
+    for(; i < chunks; ++i)
+    {
+      push_to((first + i) % _num_threads, make_work(alloc, _instrumentation.wrap(chunk_t{state, i})));
+    }
+  }
+  catch(...)
+  {
+    // The chunk that failed has already released its reference
+    while(++i < chunks)
+    {
+      state->release();
+    }
+    throw;
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class InputIt>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::schedule_bulk(const Alloc& alloc, InputIt first, InputIt last) const
+-> void
+{
+  std::vector<work_t> work;
+  for(; first != last; ++first)
+  {
+    work.push_back(make_work(alloc, _instrumentation.wrap(*first)));
+  }
+
+  // Split into contiguous chunks, one per queue, so every queue is locked and woken at most once
+  const auto n = work.size();
+  const auto chunks = static_cast<unsigned>(std::min<std::size_t>(n, _num_threads));
+  const auto size = n / chunks;
+  const auto remainder = n % chunks;
+  const auto queue = first_bulk_queue(chunks);
+  auto begin = work.data();
+  for(unsigned i = 0; i < chunks; ++i)
+  {
+    const auto end = begin + size + (i < remainder ? 1 : 0);
+    push_to((queue + i) % _num_threads, begin, end);
+    begin = end;
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class... Priority>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::submit(work_t&& f, Priority... priority) const -> void
+{
+  const auto index = current_worker();
+  if(index < _num_threads)
+  {
+    // Work submitted from inside the pool stays on the submitting worker's queue unless other workers are idle
+    if(_num_parked.load(std::memory_order_relaxed) > 0)
+    {
+      for(unsigned i = 1; i < _num_threads; ++i)
+      {
+        const auto other = victim(index, i);
+        if(_workers[other].parked.load(std::memory_order_relaxed) && try_push_counted(index, _workers[other].queue, f, priority...))
+        {
+          _instrumentation.on_push(index, other, 1);
+          return;
+        }
+      }
+    }
+    if(!try_push_counted(index, _workers[index].queue, f, priority...))
+    {
+      // Only apply the full queue policy if no queue has space left
+      const auto queue = push_unless_full(_workers, index, index, f, 0, priority...);
+      if(queue < _num_threads)
+      {
+        _instrumentation.on_push(index, queue, 1);
+        return;
+      }
+      push_counted(index, _workers[index].queue, f, priority...);
+    }
+    _instrumentation.on_push(index, index, 1);
+    return;
+  }
+
+  auto thread = _next_thread++;
+
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    const auto queue = (thread + i) % _num_threads;
+    if(try_push_counted(_num_threads, _workers[queue].queue, f, priority...))
+    {
+      _instrumentation.on_push(_num_threads, queue, 1);
+      return;
+    }
+  }
+  // The queues may only have been locked by other threads, so wait for their locks before applying the full queue policy
+  const auto queue = push_unless_full(_workers, _num_threads, thread, f, 0, priority...);
+  if(queue < _num_threads)
+  {
+    _instrumentation.on_push(_num_threads, queue, 1);
+    return;
+  }
+  push_counted(_num_threads, _workers[(thread % _num_threads)].queue, f, priority...);
+  _instrumentation.on_push(_num_threads, thread % _num_threads, 1);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Alloc, class F, class Q>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::try_schedule(const Alloc& alloc, F&& f) const
+-> std::enable_if_t<detail::has_push_unless_full<Q>::value, bool>
+{
+  auto work = make_work(alloc, _instrumentation.wrap(forward<F>(f)));
+  const auto worker = current_worker();
+  const auto first = worker < _num_threads ? worker : _next_thread++;
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    const auto queue = (first + i) % _num_threads;
+    if(try_push_counted(worker, _workers[queue].queue, work))
+    {
+      _instrumentation.on_push(worker, queue, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::run(int index) const -> void
+{
+  detail::current_worker_slot() = {this, static_cast<unsigned>(index)};
+  // Before the first try_pop_any() so the worker takes from its own queue as its owner right away
+  bind_owner(_workers[index].queue, 0);
+  _instrumentation.on_worker_start(index);
+  if(_hooks.on_start)
+  {
+    _hooks.on_start(index);
+  }
+
+  while(true)
+  {
+    fire_timers();
+    // Declared first so it counts the task as finished after destroying it
+    finish_guard finished{this, static_cast<unsigned>(index), 0};
+    work_t f;
+    auto found = try_pop_any(index, f);
+
+    for(unsigned round = 0; !found && round < _idle.spin_rounds; ++round)
+    {
+      for(unsigned i = 0, n = 1u << std::min(round, 6u); i < n; ++i)
+      {
+        detail::cpu_relax();
+      }
+      found = try_pop_any(index, f);
+    }
+    for(unsigned round = 0; !found && round < _idle.yield_rounds; ++round)
+    {
+      std::this_thread::yield();
+      found = try_pop_any(index, f);
+    }
+
+    if(!found)
+    {
+      const auto result = park(index, f);
+      if(result == park_result::done)
+      {
+        break;
+      }
+      if(result == park_result::timed_out)
+      {
+        continue;
+      }
+      _instrumentation.on_pop(index, index);
+    }
+
+    if(_stopped.load(std::memory_order_relaxed))
+    {
+      break;
+    }
+    finished.n = 1;
+    move(f)();
+  }
+
+  if(_hooks.on_stop)
+  {
+    _hooks.on_stop(index);
+  }
+  detail::current_worker_slot() = {nullptr, 0};
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::park(unsigned index, work_t& f) const -> park_result
+{
+  using clock = std::chrono::steady_clock;
+  using lock_t = std::unique_lock<std::mutex>;
+
+  // Don't keep freed task memory from its owner while we sleep
+  detail::task_allocator_flush();
+  // Finishing tasks doesn't check for waiters, so whoever finished the last one tells them once it runs out of work
+  notify_if_idle();
+  _workers[index].parked.store(true, std::memory_order_relaxed);
+  ++_num_parked;
+  _instrumentation.on_park(index);
+
+  // Locking even without timers orders this against schedule_timed() looking for a parked worker
+  auto deadline = clock::time_point::max();
+  {
+    lock_t lock{_timer_mutex};
+    const auto keeper = _timer_keeper.load(std::memory_order_relaxed);
+    if((keeper == index || keeper == _num_threads) && !_timers.empty())
+    {
+      _timer_keeper.store(index, std::memory_order_relaxed);
+      deadline = _keeper_deadline = _timers.next_deadline();
+    }
+  }
+  const auto ok = deadline == clock::time_point::max() ? _workers[index].queue.pop(f) : pop_until(_workers[index].queue, f, deadline, 0);
+
+  _instrumentation.on_wake(index);
+  --_num_parked;
+  _workers[index].parked.store(false, std::memory_order_relaxed);
+
+  // We may also have been elected while waiting without a deadline
+  if(_timer_keeper.load(std::memory_order_relaxed) == index)
+  {
+    auto next = _num_threads;
+    {
+      lock_t lock{_timer_mutex};
+      // Keep the role if we were only woken up to park again with an earlier deadline
+      if(!ok || (deadline != clock::time_point::max() && _keeper_deadline >= deadline))
+      {
+        _timer_keeper.store(_num_threads, std::memory_order_relaxed);
+        // If we leave to run a task someone else has to wait for the timers
+        if(ok)
+        {
+          next = elect_timer_keeper();
+        }
+      }
+    }
+    wake(next);
+  }
+
+  if(ok)
+  {
+    return park_result::popped;
+  }
+  // Otherwise we timed out or were woken up to look at the timers again
+  return _queues_done.load(std::memory_order_relaxed) ? park_result::done : park_result::timed_out;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::pop_until(const Queue& q, work_t& f, std::chrono::steady_clock::time_point deadline, int)
+-> decltype(q.pop_until(f, deadline))
+{
+  return q.pop_until(f, deadline);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::fire_timers() const -> void
+{
+  using clock = std::chrono::steady_clock;
+
+  const auto next = _next_timer.load(std::memory_order_relaxed);
+  if(next == clock::time_point::max().time_since_epoch().count() || clock::now().time_since_epoch().count() < next)
+  {
+    return;
+  }
+  std::vector<work_t> expired;
+  {
+    // Whoever holds the lock is already taking care of it
+    std::unique_lock<std::mutex> lock{_timer_mutex, std::try_to_lock};
+    if(!lock)
+    {
+      return;
+    }
+    _timers.advance(clock::now(), expired);
+    _next_timer.store(_timers.next_deadline().time_since_epoch().count(), std::memory_order_relaxed);
+  }
+  for(auto& f : expired)
+  {
+    submit(move(f));
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::elect_timer_keeper() const -> unsigned
+{
+  if(_timer_keeper.load(std::memory_order_relaxed) != _num_threads || _timers.empty())
+  {
+    return _num_threads;
+  }
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    if(_workers[i].parked.load(std::memory_order_relaxed))
+    {
+      _timer_keeper.store(i, std::memory_order_relaxed);
+      // The keeper determines the actual deadline once it parks again
+      _keeper_deadline = _timers.next_deadline();
+      return i;
+    }
+  }
+  // Everyone is busy and checks the timers between tasks
+  return _num_threads;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::wake(unsigned index) const -> void
+{
+  if(index < _num_threads)
+  {
+    wake(_workers[index].queue, index, 0);
+  }
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::wake(const Queue& q, unsigned /*index*/, int) -> decltype(q.interrupt())
+{
+  q.interrupt();
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Queue>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::wake(const Queue& /*q*/, unsigned index, long) const -> void
+{
+  // An empty task is enough to return from the queue's pop
+  push_to(index, make_work(default_allocator_type{}, [] { }));
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::try_run_one() const -> bool
+{
+  const auto worker = current_worker();
+  const auto index = worker < _num_threads ? worker : _next_thread.load(std::memory_order_relaxed) % _num_threads;
+  finish_guard finished{this, worker, 0};
+  work_t f;
+  if(!try_pop_any(index, f))
+  {
+    return false;
+  }
+  finished.n = 1;
+  move(f)();
+  return true;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::try_pop_any(unsigned index, work_t& f) const -> bool
+{
+  return try_pop_any(_workers, index, f, 0);
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Slot>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::try_pop_any(const detail::cache_aligned_array<Slot>& workers, unsigned index, work_t& f, int) const
+-> decltype(workers[index].queue.try_pop(f, task_priority::normal))
+{
+  const auto worker = current_worker();
+  for(std::size_t p = 0; p < num_task_priorities; ++p)
+  {
+    const auto last_lane = p + 1 == num_task_priorities;
+    for(unsigned i = 0; i < _num_threads; ++i)
+    {
+      const auto queue = victim(index, i);
+      if(workers[queue].queue.try_pop(f, static_cast<task_priority>(p)))
+      {
+        _instrumentation.on_pop(worker, queue);
+        return true;
+      }
+      // Only count a steal as failed once all lanes came up empty
+      if(last_lane && queue != worker)
+      {
+        _instrumentation.on_failed_steal(worker, queue);
+      }
+    }
+  }
+  return false;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+template<class Slot>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::try_pop_any(const detail::cache_aligned_array<Slot>& workers, unsigned index, work_t& f, long) const -> bool
+{
+  const auto worker = current_worker();
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    const auto queue = victim(index, i);
+    if(workers[queue].queue.try_pop(f))
+    {
+      _instrumentation.on_pop(worker, queue);
+      return true;
+    }
+    if(queue != worker)
+    {
+      _instrumentation.on_failed_steal(worker, queue);
+    }
+  }
+  return false;
+}
+
+template<class WorkQueue, class ThreadHandle, class Instrumentation>
+auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle, Instrumentation>::current_worker() const noexcept -> unsigned
+{
+  const auto& worker = detail::current_worker_slot();
+  return worker.pool == this ? worker.index : _num_threads;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// thread_pool
+//
+
+template<std::size_t InlineBytes>
+class schedulers::basic_thread_pool_task_queue
+{
+public:
+  // The type of function object stored in the queue
+  using work_t = detail::basic_work_item<InlineBytes>;
+
+  /**
+   Notify the queue to exit.
+
+   Any threads waiting on pop() must exit in a timely fashion. Calls to try_pop() must fail even if the queue is not empty.
+   */
+  auto done() const -> void;
+  /**
+   Wait for a work item to appear in the queue and pop it.
+   */
+  auto pop(work_t& f) const -> bool;
+  /**
+   Like pop() but give up once `deadline` is reached.
+
+   This is optional for user-defined queues. basic_thread_pool only supports timers if it exists. It must only return `false` before the deadline if the queue is done or interrupted.
+   */
+  auto pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool;
+  /**
+   Make the thread waiting in pop() or pop_until(), or the next one to wait if there is none, return `false` although the queue isn't done.
+
+   This is optional for user-defined queues. basic_thread_pool uses it to make the worker waiting for its timers look at them again and otherwise pushes an empty task to that worker.
+   */
+  auto interrupt() const -> void;
+  /**
+   Push a new work item to the queue, blocking if necessary.
+   */
+  auto push(work_t&& f) const -> void;
+  /**
+   Try to pop a work item from the queue without blocking.
+
+   If a work item is available and it can be popped without blocking then return `true` and extract the work item into `f`.
+   */
+  auto try_pop(work_t& f) const -> bool;
+  /**
+   Try to push a work item into the queue without blocking.
+
+   If the work item can be pushed into the queue without blocking then copy it into `f` and return `true`. Otherwise return `false`.
+   */
+  auto try_push(work_t& f)  const -> bool;
+  /**
+   Push all work items in `[first, last)` to the queue with only one lock and one notification.
+
+   This is optional for user-defined queues. If it is missing basic_thread_pool pushes the items one by one.
+   */
+  auto push_bulk(work_t* first, work_t* last) const -> void;
+  /**
+   Destroy all queued work items without running them.
+
+   This is optional for user-defined queues. If it is missing basic_thread_pool::shutdown() pops the items one by one with try_pop().
+   */
+  auto clear() const -> void;
+
+private:
+  using lock_t = std::unique_lock<std::mutex>;
+
+  mutable std::mutex _mutex;
+  mutable std::deque<work_t> _queue;
+  mutable std::condition_variable _ready;
+  mutable unsigned _sleeping{0}; // Only notify when someone is actually waiting
+  mutable bool _interrupted{false};
+  mutable bool _done{false};
+};
+
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::done() const -> void
+{
+  {
+    lock_t lock{_mutex};
+    _done = true;
+  }
+  _ready.notify_all();
+}
+
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::interrupt() const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    _interrupted = true;
+    wake = _sleeping > 0;
+  }
+  if(wake)
+  {
+    _ready.notify_one();
+  }
+}
+
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::try_pop(work_t& f) const -> bool
+{
+  lock_t lock{_mutex, std::try_to_lock};
+  if(!lock || _queue.empty())
+  {
+    return false;
+  }
+  f = move(_queue.front());
+  _queue.pop_front();
+  return true;
+}
 
-  template<class... Args>
-  shared_scheduler_base(Args&&... args)
-  : _ptr(std::make_shared<const Scheduler>(forward<Args>(args)...))
-  { }
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::try_push(work_t& f)  const -> bool
+{
+  bool wake;
+  {
+    lock_t lock{_mutex, std::try_to_lock};
+    if(!lock)
+    {
+      return false;
+    }
+    _queue.emplace_back(move(f));
+    wake = _sleeping > 0;
+  }
+  if(wake)
+  {
+    _ready.notify_one();
+  }
+  return true;
+}
 
-  template<class Alloc, class... Args>
-  shared_scheduler_base(std::allocator_arg_t, const Alloc& alloc, Args&&... args)
-  : _ptr(std::allocate_shared<const Scheduler>(alloc, forward<Args>(args)...))
-  { }
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::push_bulk(work_t* first, work_t* last) const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    _queue.insert(_queue.end(), std::make_move_iterator(first), std::make_move_iterator(last));
+    wake = _sleeping > 0;
+  }
+  if(wake)
+  {
+    _ready.notify_one();
+  }
+}
 
-private:
-  friend available_scheduler<shared_scheduler<Scheduler>>;
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::clear() const -> void
+{
+  // Destroy the tasks outside the lock in case their destructors schedule more work
+  std::deque<work_t> queue;
+  {
+    lock_t lock{_mutex};
+    queue.swap(_queue);
+  }
+}
 
-  template<class Alloc, class F>
-  void schedule(const Alloc& alloc, F&& f) const
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::pop(work_t& f) const -> bool
+{
+  lock_t lock{_mutex};
+  while(_queue.empty() && !_done && !_interrupted)
   {
-    (*_ptr)(alloc, forward<F>(f));
+    ++_sleeping;
+    _ready.wait(lock);
+    --_sleeping;
+  }
+  if(_queue.empty())
+  {
+    _interrupted = false;
+    return false;
   }
+  f = move(_queue.front());
+  _queue.pop_front();
+  return true;
+}
 
-  std::shared_ptr<const Scheduler> _ptr;
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool
+{
+  lock_t lock{_mutex};
+  auto status = std::cv_status::no_timeout;
+  while(_queue.empty() && !_done && !_interrupted && status == std::cv_status::no_timeout)
+  {
+    ++_sleeping;
+    status = _ready.wait_until(lock, deadline);
+    --_sleeping;
+  }
+  if(_queue.empty())
+  {
+    _interrupted = false;
+    return false;
+  }
+  f = move(_queue.front());
+  _queue.pop_front();
+  return true;
+}
+
+template<std::size_t InlineBytes>
+auto schedulers::basic_thread_pool_task_queue<InlineBytes>::push(work_t&& f) const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    _queue.emplace_back(move(f));
+    wake = _sleeping > 0;
+  }
+  if(wake)
+  {
+    _ready.notify_one();
+  }
+}
+
+// The default queue is instantiated once in the library
+extern template class schedulers::basic_thread_pool_task_queue<schedulers::detail::default_work_item_size>;
+
+class schedulers::thread_pool
+: public basic_thread_pool<thread_pool_task_queue, std::thread>
+{
+public:
+  /**
+   Create a thread pool using the given number of standard C++ threads.
+
+   \see thread_pool_idle_policy, thread_pool_hooks
+   */
+  explicit thread_pool(int num_threads = std::thread::hardware_concurrency(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {});
 };
 
-template<class Scheduler>
-class schedulers::detail::shared_scheduler_base<Scheduler, false>
-: public unavailable_scheduler
-{ };
+template<std::size_t InlineBytes>
+class schedulers::sized_thread_pool
+: public basic_thread_pool<basic_thread_pool_task_queue<InlineBytes>, std::thread>
+{
+public:
+  /**
+   Create a thread pool using the given number of standard C++ threads.
 
-template<class Scheduler>
-class schedulers::shared_scheduler
-: public detail::shared_scheduler_base<Scheduler>
+   \see thread_pool_idle_policy, thread_pool_hooks
+   */
+  explicit sized_thread_pool(int num_threads = std::thread::hardware_concurrency(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {})
+  : basic_thread_pool<basic_thread_pool_task_queue<InlineBytes>, std::thread>([] (unsigned, const auto&, auto&& f)
+                                                                           {
+                                                                             return std::thread(forward<decltype(f)>(f));
+                                                                           },
+                                                                           num_threads, idle, move(hooks))
+  { }
+};
+
+template<class Instrumentation>
+class schedulers::instrumented_thread_pool
+: public basic_thread_pool<basic_thread_pool_task_queue<detail::default_work_item_size + Instrumentation::wrap_overhead>, std::thread, Instrumentation>
 {
 public:
-  using detail::shared_scheduler_base<Scheduler>::shared_scheduler_base;
+  /**
+   Create a thread pool using the given number of standard C++ threads.
+
+   \see thread_pool_idle_policy, thread_pool_hooks
+   */
+  explicit instrumented_thread_pool(int num_threads = std::thread::hardware_concurrency(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {})
+  : instrumented_thread_pool::basic_thread_pool([] (unsigned, const auto&, auto&& f) { return std::thread(forward<decltype(f)>(f)); },
+                                                num_threads, idle, move(hooks))
+  { }
 };
 
-template<class Scheduler, class... Args>
-auto schedulers::make_shared_scheduler(Args&&... args)
+////////////////////////////////////////////////////////////////////////////////
+// pinned_thread_pool
+//
+
+class schedulers::pinned_thread_pool
+: public basic_thread_pool<thread_pool_task_queue, std::thread>
 {
-  return shared_scheduler<std::decay_t<Scheduler>>{forward<Args>(args)...};
-}
+public:
+  /**
+   Create a thread pool with one thread for every CPU in `topology`.
+
+   \see thread_pool_idle_policy, thread_pool_hooks
+   */
+  explicit pinned_thread_pool(const cpu_topology& topology = cpu_topology::detect(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {});
+};
 
 ////////////////////////////////////////////////////////////////////////////////
-// custom_thread_pool
+// priority_thread_pool
 //
 
-template<class WorkQueue, class ThreadHandle>
-class schedulers::basic_thread_pool
-: public available_scheduler<basic_thread_pool<WorkQueue, ThreadHandle>>
+class schedulers::priority_task_queue
 {
 public:
-  using work_t = typename WorkQueue::work_t;
-  static_assert(std::is_default_constructible<work_t>(), "Work item of work queue must be default constructible");
-  static_assert(std::is_convertible<decltype(!std::declval<work_t>()), bool>(), "Work item of work queue must be contextually convertible to bool");
+  using work_t = detail::work_item;
 
+  auto done() const -> void;
   /**
-   Create a thread pool with the given thread factory and number of threads.
-   
-   \param f A factory for threads. It is called with the zero-based thread index, a reference to the thread's own work queue, and a `Callable<void()>`. The thread owned by the returned handle must call a copy of the provided function in the context of the new thread and exit in a timely fashion once it returns.
-   \param num_threads Determines how many threads are created for the pool.
+   Wait for a work item to appear in any lane and pop it from the highest one.
    */
-  template<class ThreadFactory>
-  basic_thread_pool(ThreadFactory f, unsigned num_threads = std::thread::hardware_concurrency());
+  auto pop(work_t& f) const -> bool;
+  auto pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool;
+  auto interrupt() const -> void;
+  auto push(work_t&& f, task_priority priority = task_priority::normal) const -> void;
   /**
-   The destructor blocks until all threads in the pool exit.
-
-   What happens to any scheduled but not yet executed tasks is the responsibility of `WorkQueue`.
+   Try to pop a work item from the highest non-empty lane without blocking.
+   */
+  auto try_pop(work_t& f) const -> bool;
+  /**
+   Try to pop a work item from the lane of `priority` without blocking.
 
-   \warning The destructor must not run on a thread belonging to the thread pool otherwise it will deadlock.
+   Fails without touching the mutex if the lane is known to be empty.
    */
-  ~basic_thread_pool();
+  auto try_pop(work_t& f, task_priority priority) const -> bool;
+  auto try_push(work_t& f, task_priority priority = task_priority::normal) const -> bool;
+  /**
+   Push all work items in `[first, last)` to the lane of normal priority.
+   */
+  auto push_bulk(work_t* first, work_t* last) const -> void;
+  /**
+   Destroy the work items of all lanes without running them.
+   */
+  auto clear() const -> void;
 
 private:
-  friend available_scheduler<basic_thread_pool<WorkQueue, ThreadHandle>>;
+  using lock_t = std::unique_lock<std::mutex>;
 
-  using f_is_ok = std::true_type;
-  using f_is_not_ok = std::false_type;
-  using work_t_ctor_has_allocator_arg = std::true_type;
-  using work_t_ctor_has_no_allocator_arg = std::false_type;
-  using work_t_uses_allocator = std::true_type;
-  using work_t_uses_no_allocator = std::false_type;
-  using work_t_uses_allocator_dont_care = dont_care_t;
+  auto push_locked(work_t& f, task_priority priority) const -> void;
+  auto pop_locked(std::size_t lane, work_t& f) const -> void;
+  auto notify(bool wake) const -> void;
 
-  template<class ThreadFactory>
-  auto start(ThreadFactory& f, f_is_ok) -> void;
+  mutable std::mutex _mutex;
+  mutable std::deque<work_t> _lanes[num_task_priorities];
+  // Bit i is set while lane i is not empty. Only written with the mutex locked.
+  mutable std::atomic<unsigned> _non_empty{0};
+  mutable std::condition_variable _ready;
+  mutable unsigned _sleeping{0}; // Only notify when someone is actually waiting
+  mutable bool _interrupted{false};
+  mutable bool _done{false};
+};
 
-  template<class ThreadFactory>
-  auto start(ThreadFactory& f, f_is_not_ok) -> void;
+class schedulers::priority_thread_pool
+: public basic_thread_pool<priority_task_queue, std::thread>
+{
+public:
+  /**
+   Create a thread pool using the given number of standard C++ threads.
 
-  // A little dance to figure out how to construct work_t
-  template<class Alloc, class F>
-  auto schedule(const Alloc& alloc, F&& f) const -> void;
-  // Supports (allocator_arg, alloc, f)
-  template<class Alloc, class F>
-  auto schedule(const Alloc& alloc,
-                F&& f,
-                work_t_ctor_has_allocator_arg,
-                work_t_uses_allocator_dont_care) const -> void;
-  // Supports (f, alloc)
-  template<class Alloc, class F>
-  auto schedule(const Alloc& alloc,
-                F&& f,
-                work_t_ctor_has_no_allocator_arg,
-                work_t_uses_allocator) const -> void;
-  template<class Alloc, class F>
-  // No allocator support
-  auto schedule(const Alloc& alloc,
-                F&& f,
-                work_t_ctor_has_no_allocator_arg,
-                work_t_uses_no_allocator) const -> void;
-  auto schedule(work_t&& work) const -> void;
+   \see thread_pool_idle_policy, thread_pool_hooks
+   */
+  explicit priority_thread_pool(int num_threads = std::thread::hardware_concurrency(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {});
+};
 
-  auto run(int index) const -> void;
+////////////////////////////////////////////////////////////////////////////////
+// bounded_thread_pool
+//
 
-  const unsigned _num_threads;
-  std::vector<WorkQueue> _queues{_num_threads};
-  std::vector<ThreadHandle> _threads;
-  mutable std::atomic<unsigned> _next_thread{0}; // Must be unsigned because it can overflow
+class schedulers::queue_full_error : public std::runtime_error
+{
+public:
+  queue_full_error() : std::runtime_error("bounded_task_queue is full") { }
 };
 
-template<class WorkQueue, class ThreadHandle>
-template<class ThreadFactory>
-schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::basic_thread_pool(ThreadFactory f,
-                                                                          unsigned num_threads)
-: _num_threads(std::max(1u, num_threads))
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+class schedulers::bounded_task_queue
 {
-  auto thread_proc = [this, i = 0] {};
-  constexpr auto thread_factory_ok = std::is_constructible<ThreadHandle, std::result_of_t<ThreadFactory&(unsigned, WorkQueue&, decltype(thread_proc))>>();
+  static_assert(Capacity > 0, "Capacity must not be zero");
 
-  static_assert(thread_factory_ok, "ThreadFactory must be Callable<R(unsigned, WorkQueue&, F)> with F a Callable<void()> and R convertible to ThreadHandle");
+public:
+  // The type of function object stored in the queue
+  using work_t = detail::basic_work_item<InlineBytes>;
+
+  auto done() const -> void;
+  /**
+   Wait for a work item to appear in the queue and pop it.
+   */
+  auto pop(work_t& f) const -> bool;
+  auto pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool;
+  auto interrupt() const -> void;
+  /**
+   Push a new work item to the queue. If the queue is full act according to `Policy`.
+   */
+  auto push(work_t&& f) const -> void;
+  auto try_pop(work_t& f) const -> bool;
+  /**
+   Push a work item into the queue unless it is full or another thread holds its lock. Never blocks.
+   */
+  auto try_push(work_t& f) const -> bool;
+  /**
+   Push a work item into the queue unless it is full, waiting for the lock if another thread holds it.
+
+   basic_thread_pool uses this to find a queue with space left before it applies `Policy`, and only offers basic_thread_pool::try_schedule() for queues which have it.
+   */
+  auto push_unless_full(work_t& f) const -> bool;
+  /**
+   Declare the calling thread as the one consuming this queue. Otherwise this is determined by the last call to pop().
+   */
+  auto set_consumer() const -> void;
+  /**
+   Destroy all queued work items without running them.
+   */
+  auto clear() const -> void;
+
+private:
+  using lock_t = std::unique_lock<std::mutex>;
+
+  auto push_locked(lock_t& lock, work_t& f) const -> void;
+  auto pop_locked(lock_t& lock, work_t& f) const -> void;
+
+  mutable std::mutex _mutex;
+  mutable work_t _slots[Capacity];
+  mutable std::size_t _head{0}; // Index of the oldest item
+  mutable std::size_t _size{0};
+  mutable std::condition_variable _not_empty;
+  mutable std::condition_variable _not_full;
+  mutable unsigned _sleeping{0}; // Consumers waiting in pop()
+  mutable unsigned _blocked{0}; // Producers waiting in push()
+  mutable std::thread::id _consumer; // See set_consumer()
+  mutable bool _interrupted{false};
+  mutable bool _done{false};
+};
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+class schedulers::bounded_thread_pool
+: public basic_thread_pool<bounded_task_queue<Capacity, Policy, InlineBytes>, std::thread>
+{
+public:
+  /**
+   Create a thread pool using the given number of standard C++ threads.
+
+   \see thread_pool_idle_policy, thread_pool_hooks
+   */
+  explicit bounded_thread_pool(int num_threads = std::thread::hardware_concurrency(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {})
+  : basic_thread_pool<bounded_task_queue<Capacity, Policy, InlineBytes>, std::thread>([] (unsigned, const auto& queue, auto&& f)
+                                                                                     {
+                                                                                       return std::thread([&queue, f = forward<decltype(f)>(f)]
+                                                                                       {
+                                                                                         queue.set_consumer();
+                                                                                         f();
+                                                                                       });
+                                                                                     },
+                                                                                     num_threads, idle, move(hooks))
+  { }
+};
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::done() const -> void
+{
+  {
+    lock_t lock{_mutex};
+    _done = true;
+  }
+  _not_empty.notify_all();
+  _not_full.notify_all();
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::pop(work_t& f) const -> bool
+{
+  lock_t lock{_mutex};
+  _consumer = std::this_thread::get_id();
+  while(_size == 0 && !_done && !_interrupted)
+  {
+    ++_sleeping;
+    _not_empty.wait(lock);
+    --_sleeping;
+  }
+  if(_size == 0)
+  {
+    _interrupted = false;
+    return false;
+  }
+  pop_locked(lock, f);
+  return true;
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool
+{
+  lock_t lock{_mutex};
+  _consumer = std::this_thread::get_id();
+  auto status = std::cv_status::no_timeout;
+  while(_size == 0 && !_done && !_interrupted && status == std::cv_status::no_timeout)
+  {
+    ++_sleeping;
+    status = _not_empty.wait_until(lock, deadline);
+    --_sleeping;
+  }
+  if(_size == 0)
+  {
+    _interrupted = false;
+    return false;
+  }
+  pop_locked(lock, f);
+  return true;
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::interrupt() const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    _interrupted = true;
+    wake = _sleeping > 0;
+  }
+  if(wake)
+  {
+    _not_empty.notify_one();
+  }
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::try_pop(work_t& f) const -> bool
+{
+  lock_t lock{_mutex, std::try_to_lock};
+  if(!lock || _size == 0 || _done)
+  {
+    return false;
+  }
+  pop_locked(lock, f);
+  return true;
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::push(work_t&& f) const -> void
+{
+  lock_t lock{_mutex};
+  if(_size == Capacity)
+  {
+    if(Policy == queue_full_policy::reject)
+    {
+      throw queue_full_error{};
+    }
+    if(Policy == queue_full_policy::run_on_caller || _consumer == std::this_thread::get_id())
+    {
+      lock.unlock();
+      move(f)();
+      return;
+    }
+    ++_blocked;
+    _not_full.wait(lock, [this] { return _size < Capacity || _done; });
+    --_blocked;
+    if(_size == Capacity)
+    {
+      // Shutting down, the task would never run anyway
+      return;
+    }
+  }
+  push_locked(lock, f);
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::try_push(work_t& f) const -> bool
+{
+  lock_t lock{_mutex, std::try_to_lock};
+  if(!lock || _size == Capacity)
+  {
+    return false;
+  }
+  push_locked(lock, f);
+  return true;
+}
+
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::push_unless_full(work_t& f) const -> bool
+{
+  lock_t lock{_mutex};
+  if(_size == Capacity)
+  {
+    return false;
+  }
+  push_locked(lock, f);
+  return true;
+}
 
-  start(f, thread_factory_ok);
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::set_consumer() const -> void
+{
+  lock_t lock{_mutex};
+  _consumer = std::this_thread::get_id();
 }
 
-template<class WorkQueue, class ThreadHandle>
-schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::~basic_thread_pool()
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::clear() const -> void
 {
-  for(auto&& q : _queues)
+  std::vector<work_t> items;
+  bool wake;
   {
-    q.done();
+    lock_t lock{_mutex};
+    items.reserve(_size);
+    for(; _size > 0; --_size)
+    {
+      items.push_back(move(_slots[_head]));
+      _head = (_head + 1) % Capacity;
+    }
+    wake = _blocked > 0;
   }
-  for(auto&& t : _threads)
+  if(wake)
   {
-    t.join();
+    _not_full.notify_all();
   }
 }
 
-template<class WorkQueue, class ThreadHandle>
-template<class ThreadFactory>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::start(ThreadFactory& f, f_is_ok)
--> void
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::push_locked(lock_t& lock, work_t& f) const -> void
 {
-  assert(_num_threads > 0 && "invalid number of threads");
+  _slots[(_head + _size) % Capacity] = move(f);
+  ++_size;
+  const auto wake = _sleeping > 0;
+  lock.unlock();
+  if(wake)
+  {
+    _not_empty.notify_one();
+  }
+}
 
-  _threads.reserve(_num_threads);
-  for(int i = 0; i < _num_threads; ++i)
+template<std::size_t Capacity, schedulers::queue_full_policy Policy, std::size_t InlineBytes>
+auto schedulers::bounded_task_queue<Capacity, Policy, InlineBytes>::pop_locked(lock_t& lock, work_t& f) const -> void
+{
+  f = move(_slots[_head]);
+  _head = (_head + 1) % Capacity;
+  --_size;
+  const auto wake = _blocked > 0;
+  lock.unlock();
+  if(wake)
   {
-    _threads.emplace_back(f(i, _queues[i], [this, i] { run(i); }));
+    _not_full.notify_one();
   }
 }
 
-template<class WorkQueue, class ThreadHandle>
-template<class Alloc, class F>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::schedule(const Alloc& alloc, F&& f) const
--> void
+////////////////////////////////////////////////////////////////////////////////
+// detail::work_stealing_deque
+//
+
+template<class T>
+class schedulers::detail::work_stealing_deque
 {
-  constexpr auto has_allocator_arg = std::is_constructible<work_t, std::allocator_arg_t, Alloc, F&&>::value;
-  constexpr auto uses_alloc = std::uses_allocator<work_t, Alloc>::value;
+public:
+  static_assert(std::is_pointer<T>(), "work_stealing_deque can only store pointers");
 
-  schedule(alloc, forward<F>(f), bool_constant<has_allocator_arg>(), bool_constant<uses_alloc>());
-}
+  /**
+   Create the deque with an initial capacity, which must be a power of two. The deque grows as necessary.
+   */
+  explicit work_stealing_deque(std::int64_t capacity = 256);
+  work_stealing_deque(const work_stealing_deque&) = delete;
+  work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+  ~work_stealing_deque();
 
-template<class WorkQueue, class ThreadHandle>
-template<class Alloc, class F>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::schedule(const Alloc& alloc,
-                                                                      F&& f,
-                                                                      work_t_ctor_has_allocator_arg,
-                                                                      work_t_uses_allocator_dont_care) const
--> void
+  /// Push a value to the bottom. Must only be called by the owning thread.
+  auto push(T x) -> void;
+  /// Pop a value from the bottom or return `nullptr` if empty. Must only be called by the owning thread.
+  auto take() -> T;
+  /// Pop a value from the top or return `nullptr` if empty or if another thread got there first. Can be called by any thread.
+  auto steal() -> T;
+  /// This is only a snapshot and can be outdated by the time it returns.
+  auto empty() const noexcept -> bool;
+
+private:
+  struct array
+  {
+    explicit array(std::int64_t capacity)
+    : capacity(capacity)
+    , slots(new std::atomic<T>[capacity])
+    {
+      assert((capacity & (capacity - 1)) == 0 && "deque capacity must be a power of two");
+    }
+
+    auto get(std::int64_t i) const noexcept { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+    auto put(std::int64_t i, T x) noexcept { slots[i & (capacity - 1)].store(x, std::memory_order_relaxed); }
+
+    const std::int64_t capacity;
+    const std::unique_ptr<std::atomic<T>[]> slots;
+    // Thieves may still be reading from a retired array so it is kept alive until the deque is destroyed.
+    std::unique_ptr<array> previous;
+  };
+
+  auto grow(array* a, std::int64_t bottom, std::int64_t top) -> array*;
+
+  // Thieves compete for _top while the owner keeps writing _bottom
+  std::atomic<std::int64_t> _top{0};
+  cache_line_padding _padding;
+  std::atomic<std::int64_t> _bottom{0};
+  std::atomic<array*> _array;
+};
+
+template<class T>
+schedulers::detail::work_stealing_deque<T>::work_stealing_deque(std::int64_t capacity)
+: _array(new array{capacity})
+{ }
+
+template<class T>
+schedulers::detail::work_stealing_deque<T>::~work_stealing_deque()
 {
-  schedule(work_t{std::allocator_arg, alloc, forward<F>(f)});
+  delete _array.load(std::memory_order_relaxed);
 }
 
-template<class WorkQueue, class ThreadHandle>
-template<class Alloc, class F>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::schedule(const Alloc& alloc,
-                                                                      F&& f,
-                                                                      work_t_ctor_has_no_allocator_arg,
-                                                                      work_t_uses_allocator) const
--> void
+template<class T>
+auto schedulers::detail::work_stealing_deque<T>::grow(array* a, std::int64_t bottom, std::int64_t top) -> array*
 {
-  schedule(work_t{forward<F>(f), alloc});
+  auto bigger = std::make_unique<array>(2 * a->capacity);
+  for(auto i = top; i < bottom; ++i)
+  {
+    bigger->put(i, a->get(i));
+  }
+  bigger->previous.reset(a);
+  _array.store(bigger.get(), std::memory_order_release);
+  return bigger.release();
 }
 
-template<class WorkQueue, class ThreadHandle>
-template<class Alloc, class F>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::schedule(const Alloc& /*alloc*/,
-                                                                      F&& f,
-                                                                      work_t_ctor_has_no_allocator_arg,
-                                                                      work_t_uses_no_allocator) const
--> void
+template<class T>
+auto schedulers::detail::work_stealing_deque<T>::push(T x) -> void
 {
-  schedule(work_t{forward<F>(f)});
+  auto b = _bottom.load(std::memory_order_relaxed);
+  auto t = _top.load(std::memory_order_acquire);
+  auto a = _array.load(std::memory_order_relaxed);
+  if(b - t > a->capacity - 1)
+  {
+    a = grow(a, b, t);
+  }
+  a->put(b, x);
+  // A release store instead of the paper's release fence and relaxed store, which is equivalent here but understood by ThreadSanitizer
+  _bottom.store(b + 1, std::memory_order_release);
 }
 
-template<class WorkQueue, class ThreadHandle>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::schedule(work_t&& f) const -> void
+template<class T>
+auto schedulers::detail::work_stealing_deque<T>::take() -> T
 {
-  auto thread = _next_thread++;
+  auto b = _bottom.load(std::memory_order_relaxed) - 1;
+  auto a = _array.load(std::memory_order_relaxed);
+  _bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto t = _top.load(std::memory_order_relaxed);
 
-  for(unsigned i = 0; i < _num_threads; ++i)
+  if(t > b)
+  {
+    // Empty
+    _bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  auto x = a->get(b);
+  if(t == b)
   {
-    if(_queues[(thread + i) % _num_threads].try_push(f))
+    // Last element, we have to race the thieves for it
+    if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
     {
-      return;
+      x = nullptr;
     }
+    _bottom.store(b + 1, std::memory_order_relaxed);
   }
-  _queues[(thread % _num_threads)].push(move(f));
+  return x;
 }
 
-template<class WorkQueue, class ThreadHandle>
-auto schedulers::basic_thread_pool<WorkQueue, ThreadHandle>::run(int index) const -> void
+template<class T>
+auto schedulers::detail::work_stealing_deque<T>::steal() -> T
 {
-  while(true)
-  {
-    work_t f;
-    constexpr unsigned rounds = 8; // How many times we try to steal before sticking to our own queue
-
-    for(int i = 0; i < _num_threads * rounds; ++i)
-    {
-      if(_queues[(index + i) % _num_threads].try_pop(f))
-      {
-        break;
-      }
-    }
-
-    if(!f && !_queues[index].pop(f))
-    {
-      break;
-    }
+  auto t = _top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto b = _bottom.load(std::memory_order_acquire);
 
-    move(f)();
+  if(t >= b)
+  {
+    return nullptr;
   }
+  auto x = _array.load(std::memory_order_acquire)->get(t);
+  if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+  {
+    return nullptr;
+  }
+  return x;
+}
+
+template<class T>
+auto schedulers::detail::work_stealing_deque<T>::empty() const noexcept -> bool
+{
+  return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// thread_pool
+// work_stealing_thread_pool
 //
 
-class schedulers::thread_pool_task_queue
+class schedulers::work_stealing_task_queue
 {
 public:
   // The type of function object stored in the queue
   using work_t = detail::work_item;
 
+  work_stealing_task_queue() = default;
+  work_stealing_task_queue(const work_stealing_task_queue&) = delete;
+  work_stealing_task_queue& operator=(const work_stealing_task_queue&) = delete;
+  ~work_stealing_task_queue();
+
   /**
    Notify the queue to exit.
 
-   Any threads waiting on pop() must exit in a timely fashion. Calls to try_pop() must fail even if the queue is not empty.
+   The owning thread waiting on pop() wakes up and drains any remaining work before pop() returns `false`.
    */
   auto done() const -> void;
+  /**
+   Declare the calling thread as the one owning this queue.
+
+   Only the owner pushes to and takes from the bottom of the deque, all other threads inject and steal. basic_thread_pool calls this when a worker starts, before it looks for its first task.
+   */
+  auto bind_owner() const -> void;
   /**
    Wait for a work item to appear in the queue and pop it.
+
+   Must only be called by the thread owning the queue, see bind_owner().
    */
   auto pop(work_t& f) const -> bool;
   /**
-   Push a new work item to the queue, blocking if necessary.
+   Like pop() but give up once `deadline` is reached.
+   */
+  auto pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool;
+  /**
+   Make the owning thread return `false` from pop() or pop_until() now or the next time it waits, although the queue isn't done.
+   */
+  auto interrupt() const -> void;
+  /**
+   Push a new work item to the queue. Never blocks.
    */
   auto push(work_t&& f) const -> void;
   /**
    Try to pop a work item from the queue without blocking.
 
-   If a work item is available and it can be popped without blocking then return `true` and extract the work item into `f`.
+   The owning thread pops the most recently pushed item, all other threads steal the oldest one. This can fail spuriously if another thread steals the item first.
    */
   auto try_pop(work_t& f) const -> bool;
   /**
-   Try to push a work item into the queue without blocking.
-
-   If the work item can be pushed into the queue without blocking then copy it into `f` and return `true`. Otherwise return `false`.
+   Push a work item into the queue. This always succeeds as pushing never blocks.
    */
-  auto try_push(work_t& f)  const -> bool;
+  auto try_push(work_t& f) const -> bool;
+  /**
+   Push all work items in `[first, last)` to the queue with at most one notification.
+   */
+  auto push_bulk(work_t* first, work_t* last) const -> void;
 
 private:
+  struct node
+  {
+    // Nodes come from the recycled blocks of task_allocator so pushing rarely touches the heap
+    static auto operator new(std::size_t size) -> void* { return detail::task_allocator_allocate(size); }
+    static auto operator delete(void* p) noexcept -> void { detail::task_allocator_deallocate(p); }
+
+    std::atomic<node*> next{nullptr};
+    work_t work;
+  };
+  static_assert(sizeof(node) <= task_allocator_max_block_size, "work_stealing_task_queue nodes must fit into the task_allocator caches");
+
+  auto is_owner() const noexcept -> bool;
+  auto pop_local() const -> node*;
+  auto steal() const -> node*;
+  auto inject(node* first, node* last) const -> void;
+  auto try_pop_injected() const -> node*;
+  auto has_injected() const noexcept -> bool;
+  auto notify() const -> void;
+
   using lock_t = std::unique_lock<std::mutex>;
 
+  mutable detail::work_stealing_deque<node*> _deque;
+  detail::cache_line_padding _deque_padding;
+  // Work pushed from threads other than the owner goes into an intrusive MPSC queue. The single consumer role is acquired with _consuming so both the owner and thieves can pop from it.
+  mutable node _stub;
+  mutable std::atomic<node*> _injected_head{&_stub};
+  // Producers only touch _injected_head, the consumer everything below
+  detail::cache_line_padding _injected_padding;
+  mutable node* _injected_tail{&_stub};
+  mutable std::atomic<bool> _consuming{false};
+  mutable std::atomic<bool> _sleeping{false};
+  mutable std::atomic<bool> _done{false};
   mutable std::mutex _mutex;
-  mutable std::deque<work_t> _queue;
   mutable std::condition_variable _ready;
-  mutable bool _done{false};
+  mutable bool _interrupted{false}; // Protected by _mutex
 };
 
-class schedulers::thread_pool
-: public basic_thread_pool<thread_pool_task_queue, std::thread>
+class schedulers::work_stealing_thread_pool
+: public basic_thread_pool<work_stealing_task_queue, std::thread>
 {
 public:
   /**
-   Create a thread pool using the given number of standard C++ threads.
+   Create a work stealing thread pool using the given number of standard C++ threads.
+
+   \see thread_pool_idle_policy, thread_pool_hooks
    */
-  explicit thread_pool(int num_threads = std::thread::hardware_concurrency());
+  explicit work_stealing_thread_pool(int num_threads = std::thread::hardware_concurrency(), thread_pool_idle_policy idle = {}, thread_pool_hooks hooks = {});
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -692,6 +3765,24 @@ private:
     (*_pool)(alloc, forward<F>(f));
   }
 
+  template<class Alloc, class F>
+  void schedule_bulk(const Alloc& alloc, std::size_t n, F&& f) const
+  {
+    _pool->bulk(alloc, n, forward<F>(f));
+  }
+
+  template<class Alloc, class InputIt>
+  void schedule_bulk(const Alloc& alloc, InputIt first, InputIt last) const
+  {
+    _pool->bulk(alloc, first, last);
+  }
+
+  template<class Alloc, class F>
+  void schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const
+  {
+    _pool->schedule_at(alloc, deadline, forward<F>(f));
+  }
+
   using pool_t = basic_thread_pool<thread_pool_task_queue, std::thread>;
 
   // Use shared_ptr so it can be passed to Java via Djinni without forcing java_shared_native_pool into a shared_ptr
@@ -701,6 +3792,145 @@ private:
 class schedulers::java_shared_native_pool : public unavailable_scheduler { };
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// detail::timerfd_timers
+//
+
+#if defined(__linux__)
+namespace schedulers
+{
+  namespace detail
+  {
+    /**
+     The delayed tasks of an event loop built on file descriptors, kept in a timer_wheel with a `timerfd` armed for its next deadline.
+
+     Due tasks are pushed to a main_thread_task_queue, so they run in its bounded batches and a task which throws doesn't take the others with it. Used by linux_event_loop and android_main_looper.
+     */
+    class timerfd_timers;
+  }
+}
+
+class schedulers::detail::timerfd_timers
+{
+public:
+  timerfd_timers();
+  timerfd_timers(const timerfd_timers&) = delete;
+  timerfd_timers& operator=(const timerfd_timers&) = delete;
+  ~timerfd_timers();
+
+  /// Becomes readable once the next deadline has passed, then call fire().
+  auto fd() const noexcept -> int { return _fd; }
+  /// Push `f` to `queue` once `deadline` has passed. Returns `true` if the caller has to signal the event loop.
+  auto add(const main_thread_task_queue& queue, std::chrono::steady_clock::time_point deadline, work_item&& f) -> bool;
+  /// Push the tasks which are due to `queue`. Returns `true` if the caller has to signal the event loop.
+  auto fire(const main_thread_task_queue& queue) -> bool;
+
+private:
+  auto arm() -> void;
+
+  std::mutex _mutex;
+  timer_wheel<work_item> _wheel;
+  int _fd;
+};
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// linux_event_loop
+//
+
+#if defined(__linux__)
+class schedulers::linux_event_loop : public available_scheduler<linux_event_loop>
+{
+public:
+  /// Called with the `EPOLL*` flags a file descriptor is ready for.
+  using io_handler = std::function<void(std::uint32_t events)>;
+
+  /**
+   Construct, run and destroy on the thread running the loop.
+
+   \param budget How long one iteration of the loop may spend running tasks before it looks at I/O again.
+   */
+  explicit linux_event_loop(std::chrono::nanoseconds budget = main_thread_task_queue::default_batch_budget);
+  linux_event_loop(const linux_event_loop&) = delete;
+  linux_event_loop(linux_event_loop&&) = delete;
+  ~linux_event_loop();
+
+  /**
+   Call `handler` on the loop's thread whenever `fd` is ready for any of the `EPOLL*` flags in `events`.
+
+   The loop doesn't take ownership of `fd`, remove() it before closing it. Adding, modifying and removing file descriptors must happen on the loop's thread, which includes the handlers themselves.
+   */
+  auto add(int fd, std::uint32_t events, io_handler handler) -> void;
+  auto modify(int fd, std::uint32_t events) -> void;
+  auto remove(int fd) -> void;
+
+  /// Handle I/O and tasks until stop() is called.
+  auto run() -> void;
+  /**
+   Wait at most `timeout` for ready file descriptors or pending tasks and handle them.
+
+   I/O handlers run first, followed by at most one batch of the pending tasks, which includes the delayed tasks which became due. A negative timeout waits indefinitely. If a handler or task throws the exception propagates to the caller and the tasks left over run in later iterations.
+   */
+  auto run_once(std::chrono::milliseconds timeout) -> void;
+  /// Make run() return once the tasks scheduled before have run. Can be called from any thread.
+  auto stop() const -> void;
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    if(_queue.push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority))
+    {
+      post();
+    }
+  }
+
+  /// Whether the calling thread is the one which created the loop.
+  auto running_in_this_thread() const noexcept -> bool { return std::this_thread::get_id() == _thread; }
+
+private:
+  friend available_scheduler<linux_event_loop>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc, class F>
+  auto schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const -> void
+  {
+    add_timer(deadline, {std::allocator_arg, alloc, forward<F>(f)});
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    if(_queue.push(move(task)))
+    {
+      post();
+    }
+  }
+
+  auto post() const -> void;
+  auto add_timer(std::chrono::steady_clock::time_point deadline, detail::work_item&& f) const -> void;
+
+  // The I/O handlers by file descriptor and the delayed tasks
+  struct state;
+
+  const std::thread::id _thread;
+  const std::chrono::nanoseconds _budget;
+  main_thread_task_queue _queue;
+  // Readable whenever _queue has to be drained
+  int _event_fd;
+  int _epoll;
+  std::unique_ptr<state> _state;
+  // Only touched on the loop's thread by run() and the task scheduled by stop()
+  mutable bool _stopped = false;
+};
+#else
+class schedulers::linux_event_loop : public unavailable_scheduler { };
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // android_main_looper
 //
@@ -716,26 +3946,152 @@ public:
   android_main_looper(android_main_looper&&) = delete;
   ~android_main_looper();
 
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    if(main_thread_task_queue::get().push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority))
+    {
+      post();
+    }
+  }
+
+  /// Whether the calling thread is the one whose looper this was created on.
+  auto running_in_this_thread() const noexcept -> bool;
+
 private:
   friend available_scheduler<android_main_looper>;
 
   template<class Alloc, class F>
   auto schedule(const Alloc& alloc, F&& f) const -> void
   {
-    main_thread_task_queue::get().push({std::allocator_arg, alloc, forward<F>(f)});
-    post();
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc, class F>
+  auto schedule_timed(const Alloc& alloc, std::chrono::steady_clock::time_point deadline, F&& f) const -> void
+  {
+    add_timer(deadline, {std::allocator_arg, alloc, forward<F>(f)});
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    if(main_thread_task_queue::get().push(move(task)))
+    {
+      post();
+    }
   }
 
   auto post() const -> void;
+  auto add_timer(std::chrono::steady_clock::time_point deadline, detail::work_item&& f) const -> void;
 
-  int _write_fd;
-  int _read_fd;
+  // Called by the looper when the timerfd of _timers is readable
+  static auto timer_callback(int fd, int events, void* data) -> int;
+
+  // An eventfd registered with the looper, main_thread_task_queue is drained whenever it is readable
+  int _event_fd;
   ALooper* _looper;
+  std::unique_ptr<detail::timerfd_timers> _timers;
 };
 #else
 class schedulers::android_main_looper : public unavailable_scheduler { };
 #endif
 
+////////////////////////////////////////////////////////////////////////////////
+// android_choreographer
+//
+
+#if defined(SCHEDULERS_FOR_ANDROID) && __ANDROID_API__ >= 24
+class schedulers::android_choreographer : public available_scheduler<android_choreographer>
+{
+public:
+  /// Construct on the main thread.
+  explicit android_choreographer(std::chrono::nanoseconds budget = main_thread_task_queue::default_batch_budget);
+  android_choreographer(const android_choreographer&) = delete;
+  android_choreographer(android_choreographer&&) = delete;
+  ~android_choreographer();
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority);
+  }
+
+private:
+  friend available_scheduler<android_choreographer>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    push(move(task));
+  }
+
+  auto push(detail::work_item&& f, task_priority priority) const -> void;
+  auto push(detail::cancellable_task&& task) const -> void;
+
+  // Posted frame callbacks cannot be removed so each of them keeps the state alive
+  struct state;
+  static auto post(std::shared_ptr<state> s) -> void;
+  static auto frame_callback(std::int64_t frame_time_nanos, void* data) -> void;
+
+  std::shared_ptr<state> _state;
+};
+#else
+class schedulers::android_choreographer : public unavailable_scheduler { };
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// frame_scheduler
+//
+
+class schedulers::frame_scheduler : public available_scheduler<frame_scheduler>
+{
+public:
+  frame_scheduler() = default;
+  frame_scheduler(const frame_scheduler&) = delete;
+  frame_scheduler(frame_scheduler&&) = delete;
+
+  template<class Alloc, class F>
+  auto schedule_with_priority(const Alloc& alloc, task_priority priority, F&& f) const -> void
+  {
+    _queue.push({std::allocator_arg, alloc, detail::trace(forward<F>(f))}, priority);
+  }
+
+  /// Run queued tasks for at most `budget`. Returns `true` if tasks are left for the next frame. \see main_thread_task_queue::drain_until()
+  auto drain_for(std::chrono::nanoseconds budget) const -> bool
+  {
+    return _queue.drain_for(budget);
+  }
+  /// Run queued tasks until `deadline`, e.g. the next vsync minus the time needed to render. Returns `true` if tasks are left for the next frame.
+  auto drain_until(std::chrono::steady_clock::time_point deadline) const -> bool
+  {
+    return _queue.drain_until(deadline);
+  }
+
+private:
+  friend available_scheduler<frame_scheduler>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    schedule_with_priority(alloc, task_priority::normal, forward<F>(f));
+  }
+
+  template<class Alloc>
+  auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+  {
+    _queue.push(move(task));
+  }
+
+  main_thread_task_queue _queue;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // default_scheduler
 //
@@ -0,0 +1,245 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/schedulers.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace schedulers
+{
+  /**
+   Runs the tasks scheduled through it one at a time and in order on top of another scheduler without a dedicated thread, also known as a strand.
+
+   Tasks are collected in a lock-free queue. Whenever it becomes non-empty a single drain task is scheduled to the underlying scheduler which runs up to `batch_size` of them and then reschedules itself if there are more, so a busy serial_scheduler neither monopolizes a thread nor pays one hop per task. Each task happens-before the next one starts, so state only touched by the tasks of one serial_scheduler needs no further synchronization.
+
+   The underlying scheduler is held by reference and must outlive all tasks scheduled through this one, even those still pending when the serial_scheduler is destroyed, as they are run nonetheless.
+
+   A serial_scheduler costs one small allocation and no threads so there can be one per connection or object. If `Scheduler` is (or derives from, like default_scheduler on Apple platforms) libdispatch_global_default a serial `libdispatch` queue is used instead.
+
+   If a task throws the drain still accounts for it and reschedules itself for the remaining tasks before the exception is propagated to the underlying scheduler.
+   */
+  template<class Scheduler>
+  class serial_scheduler;
+
+  namespace detail
+  {
+    /**
+     A lock-free multi-producer single-consumer queue counting its pending tasks.
+
+     Only the one drain task running at a time calls pop() and finish(), and it must only pop tasks which are known to be pending.
+     */
+    class serial_queue;
+
+    template<class Scheduler, bool = std::is_base_of<libdispatch_global_default, Scheduler>::value>
+    class serial_scheduler_base;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::serial_queue
+//
+
+class schedulers::detail::serial_queue
+{
+public:
+  serial_queue() = default;
+  serial_queue(const serial_queue&) = delete;
+  serial_queue& operator=(const serial_queue&) = delete;
+  ~serial_queue();
+
+  /// Add a task. Returns `true` if the queue was idle and a drain must be scheduled.
+  auto push(work_item&& f) -> bool;
+  /// Remove the oldest task.
+  auto pop() -> work_item;
+  /// Number of tasks pushed but not yet finished.
+  auto pending() const noexcept -> std::size_t
+  {
+    return _pending.load(std::memory_order_acquire);
+  }
+  /// Mark `n` popped tasks as done. Returns `true` if more are pending and the drain must be rescheduled.
+  auto finish(std::size_t n) noexcept -> bool
+  {
+    return _pending.fetch_sub(n, std::memory_order_acq_rel) != n;
+  }
+
+private:
+  struct node
+  {
+    std::atomic<node*> next{nullptr};
+    work_item work;
+  };
+
+  auto link(node* n) noexcept -> void;
+  auto try_pop() noexcept -> node*;
+
+  node _stub;
+  std::atomic<node*> _head{&_stub}; // Where producers append
+  node* _tail{&_stub}; // Where the consumer takes from
+  std::atomic<std::size_t> _pending{0};
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// serial_scheduler
+//
+
+template<class Scheduler>
+class schedulers::detail::serial_scheduler_base<Scheduler, false>
+: public available_scheduler<serial_scheduler_base<Scheduler, false>>
+{
+public:
+  explicit serial_scheduler_base(const Scheduler& s, std::size_t batch_size = 16)
+  : _state(new state{s, std::max<std::size_t>(batch_size, 1)})
+  { }
+  serial_scheduler_base(serial_scheduler_base&& other) noexcept
+  : _state(std::exchange(other._state, nullptr))
+  { }
+  serial_scheduler_base& operator=(serial_scheduler_base&&) = delete;
+  ~serial_scheduler_base()
+  {
+    if(_state)
+    {
+      release(_state);
+    }
+  }
+
+private:
+  friend available_scheduler<serial_scheduler_base<Scheduler, false>>;
+
+  // Owned by the serial_scheduler and the drain task, if one is scheduled
+  struct state
+  {
+    state(const Scheduler& s, std::size_t batch) : scheduler(&s), batch_size(batch) { }
+
+    serial_queue queue;
+    const Scheduler* scheduler;
+    const std::size_t batch_size;
+    std::atomic<unsigned> refs{1};
+  };
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    if(_state->queue.push({std::allocator_arg, alloc, forward<F>(f)}))
+    {
+      _state->refs.fetch_add(1, std::memory_order_relaxed);
+      schedule_drain(_state);
+    }
+  }
+
+  static auto schedule_drain(state* s) -> void
+  {
+    (*s->scheduler)([s] { drain(s); });
+  }
+
+  static auto drain(state* s) -> void
+  {
+    // Only look at the tasks known to be there when we started, there may be more coming in all the time
+    const auto n = std::min(s->queue.pending(), s->batch_size);
+    std::size_t i = 0;
+    try
+    {
+      for(; i < n; ++i)
+      {
+        s->queue.pop()();
+      }
+    }
+    catch(...)
+    {
+      finish(s, i + 1);
+      throw;
+    }
+    finish(s, n);
+  }
+
+  static auto finish(state* s, std::size_t n) -> void
+  {
+    if(s->queue.finish(n))
+    {
+      schedule_drain(s);
+    }
+    else
+    {
+      release(s);
+    }
+  }
+
+  static auto release(state* s) noexcept -> void
+  {
+    if(s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      delete s;
+    }
+  }
+
+  state* _state;
+};
+
+#if defined(__APPLE__)
+template<class Scheduler>
+class schedulers::detail::serial_scheduler_base<Scheduler, true>
+: public available_scheduler<serial_scheduler_base<Scheduler, true>>
+{
+public:
+  using default_allocator_type = task_allocator<char>;
+
+  // libdispatch decides on its own how many tasks to run per hop
+  explicit serial_scheduler_base(const Scheduler& /*s*/, std::size_t /*batch_size*/ = 16)
+  : _queue(dispatch_queue_create(nullptr, DISPATCH_QUEUE_SERIAL))
+  { }
+  serial_scheduler_base(serial_scheduler_base&& other) noexcept
+  : _queue(std::exchange(other._queue, nullptr))
+  { }
+  serial_scheduler_base& operator=(serial_scheduler_base&&) = delete;
+  ~serial_scheduler_base()
+  {
+    // Pending tasks keep the queue alive
+    if(_queue)
+    {
+      dispatch_release(_queue);
+    }
+  }
+
+private:
+  friend available_scheduler<serial_scheduler_base<Scheduler, true>>;
+
+  template<class Alloc, class F>
+  auto schedule(const Alloc& alloc, F&& f) const -> void
+  {
+    auto callback = package_task_as_c_callback<dispatch_function_t>(alloc, detail::trace(forward<F>(f)));
+    dispatch_async_f(_queue, callback.get().data, callback.get().callback);
+    callback.release();
+  }
+
+  dispatch_queue_t _queue;
+};
+#endif
+
+template<class Scheduler>
+class schedulers::serial_scheduler
+: public detail::serial_scheduler_base<Scheduler>
+{
+public:
+  /**
+   Create a serial scheduler running its tasks on `s`.
+
+   \param batch_size The maximum number of tasks run per drain task before it reschedules itself to give other work on `s` a chance.
+   */
+  explicit serial_scheduler(const Scheduler& s, std::size_t batch_size = 16)
+  : detail::serial_scheduler_base<Scheduler>(s, batch_size)
+  { }
+};
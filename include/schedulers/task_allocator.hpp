@@ -0,0 +1,96 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <cstddef>
+#include <memory>
+
+namespace schedulers
+{
+  /**
+   A stateless allocator for task storage with per-thread caches of fixed size blocks.
+
+   Every thread allocates from its own free lists, one per size class, without any synchronization. Tasks are usually allocated on one thread and destroyed on another, so blocks freed on a thread other than the one that allocated them are collected in batches and handed back to the allocating thread with a single atomic operation per batch. The allocating thread picks them up once its own free list runs dry.
+
+   Requests larger than task_allocator_max_block_size or with extended alignment are forwarded to `std::allocator`.
+
+   The caches of exited threads are kept alive and adopted by new threads, so a block may safely outlive the thread that allocated it.
+
+   This is the default allocator of basic_thread_pool if none is given explicitly.
+   */
+  template<class T = char>
+  class task_allocator;
+
+  /// Largest request in bytes served from the per-thread caches.
+  constexpr std::size_t task_allocator_max_block_size = 512;
+
+  namespace detail
+  {
+    // Implemented in the library. `bytes` must be in the range [1, task_allocator_max_block_size].
+    auto task_allocator_allocate(std::size_t bytes) -> void*;
+    auto task_allocator_deallocate(void* p) noexcept -> void;
+    // Hand the current thread's batch of remotely freed blocks back to its owner now. Call this before a thread goes idle.
+    auto task_allocator_flush() noexcept -> void;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// task_allocator
+//
+
+template<class T>
+class schedulers::task_allocator
+{
+public:
+  using value_type = T;
+
+  template<class U>
+  struct rebind { using other = task_allocator<U>; };
+
+  task_allocator() = default;
+  template<class U>
+  task_allocator(const task_allocator<U>&) noexcept { }
+
+  auto allocate(std::size_t n) -> T*
+  {
+    if(is_cached(n))
+    {
+      return static_cast<T*>(detail::task_allocator_allocate(n * sizeof(T)));
+    }
+    return std::allocator<T>{}.allocate(n);
+  }
+
+  auto deallocate(T* p, std::size_t n) noexcept -> void
+  {
+    if(is_cached(n))
+    {
+      detail::task_allocator_deallocate(p);
+    }
+    else
+    {
+      std::allocator<T>{}.deallocate(p, n);
+    }
+  }
+
+  template<class U>
+  friend bool operator==(const task_allocator&, const task_allocator<U>&) noexcept { return true; }
+  template<class U>
+  friend bool operator!=(const task_allocator&, const task_allocator<U>&) noexcept { return false; }
+
+private:
+  static constexpr auto is_cached(std::size_t n) noexcept
+  {
+    return alignof(T) <= alignof(std::max_align_t) && n > 0 && n <= task_allocator_max_block_size / sizeof(T);
+  }
+};
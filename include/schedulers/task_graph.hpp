@@ -0,0 +1,287 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/parallel.hpp"
+#include "schedulers/utils.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace schedulers
+{
+  /**
+   A graph of tasks with dependencies which can be run over and over again.
+
+   Build it once with emplace() and precede() and then call run() every frame. Callables are stored in an arena owned by the graph and edges in one contiguous array, so neither adding an edge nor running the graph allocates per node or edge. Every run resets one atomic predecessor counter per node and a finished task releases its successors by decrementing theirs.
+
+   Nodes are not removed individually, the graph is only destroyed as a whole. A graph must not be run concurrently with itself or modified while it runs, and it must not contain cycles.
+   */
+  class task_graph;
+
+  /**
+   Run all tasks of `g` on `s` in dependency order and block until they are done.
+
+   Tasks which become ready are scheduled from the thread which completed their last predecessor, except for one of them which that thread runs next by itself. On basic_thread_pool the scheduled ones therefore go straight to the completing worker's own queue unless other workers are idle.
+
+   If `s` has a `try_run_one()` member (as basic_thread_pool does) the calling thread helps running pending tasks while it waits. If any task throws, the tasks which haven't started yet are skipped and one of the exceptions is rethrown once all running tasks are done.
+   */
+  template<class Scheduler>
+  auto run(task_graph& g, const Scheduler& s) -> void;
+
+  namespace detail
+  {
+    template<class Scheduler>
+    class task_graph_run;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// task_graph
+//
+
+class schedulers::task_graph
+{
+public:
+  class node
+  {
+  public:
+    friend task_graph;
+
+  private:
+    explicit node(std::uint32_t index) noexcept : _index(index) { }
+    std::uint32_t _index;
+  };
+
+  task_graph() = default;
+  task_graph(const task_graph&) = delete;
+  task_graph& operator=(const task_graph&) = delete;
+  task_graph(task_graph&& other) noexcept;
+  task_graph& operator=(task_graph&&) = delete;
+  ~task_graph();
+
+  /// Add a task which runs `f()` once per run().
+  template<class F>
+  auto emplace(F&& f) -> node;
+  /// Make `after` wait for `before` to finish in every run.
+  auto precede(node before, node after) -> void;
+
+  auto reserve(std::size_t nodes, std::size_t edges) -> void;
+  auto size() const noexcept -> std::size_t { return _nodes.size(); }
+
+private:
+  template<class Scheduler>
+  friend class detail::task_graph_run;
+
+  static constexpr std::uint32_t no_edge = ~std::uint32_t(0);
+  static constexpr std::size_t arena_block_size = 4096;
+
+  struct node_data
+  {
+    void* callable;
+    void (*invoke)(void*);
+    void (*destroy)(void*) noexcept;
+    std::uint32_t first_successor;
+    std::uint32_t num_predecessors;
+  };
+  struct edge
+  {
+    std::uint32_t to;
+    std::uint32_t next;
+  };
+
+  auto allocate(std::size_t size, std::size_t alignment) -> void*;
+  auto add_node(void* callable, void (*invoke)(void*), void (*destroy)(void*) noexcept) -> node;
+  // Reset the predecessor counters for the next run, only allocates if the graph grew
+  auto prepare_run() -> void;
+
+  std::vector<node_data> _nodes;
+  std::vector<edge> _edges;
+  std::vector<std::unique_ptr<unsigned char[]>> _arena;
+  std::size_t _arena_used = arena_block_size;
+  std::unique_ptr<std::atomic<std::uint32_t>[]> _pending;
+  std::size_t _pending_size = 0;
+};
+
+template<class F>
+auto schedulers::task_graph::emplace(F&& f) -> node
+{
+  using callable_t = std::decay_t<F>;
+  auto memory = allocate(sizeof(callable_t), alignof(callable_t));
+  auto callable = ::new(memory) callable_t(forward<F>(f));
+  try
+  {
+    return add_node(callable,
+                    [] (void* p) { (*static_cast<callable_t*>(p))(); },
+                    [] (void* p) noexcept { static_cast<callable_t*>(p)->~callable_t(); });
+  }
+  catch(...)
+  {
+    callable->~callable_t();
+    throw;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// run
+//
+
+template<class Scheduler>
+class schedulers::detail::task_graph_run
+{
+public:
+  task_graph_run(task_graph& g, const Scheduler& s) noexcept
+  : _graph(g)
+  , _scheduler(s)
+  { }
+
+  auto run() -> void
+  {
+    _graph.prepare_run();
+    const auto size = static_cast<std::uint32_t>(_graph._nodes.size());
+    auto is_root = [this] (std::uint32_t i) { return _graph._nodes[i].num_predecessors == 0; };
+    auto first = std::uint32_t(0);
+    while(first < size && !is_root(first))
+    {
+      ++first;
+    }
+    if(first == size)
+    {
+      throw std::logic_error("task_graph has no task without predecessors");
+    }
+    _remaining.store(size, std::memory_order_relaxed);
+    // The calling thread runs the first root itself
+    for(auto i = first + 1; i < size; ++i)
+    {
+      if(is_root(i))
+      {
+        spawn(i);
+      }
+    }
+    execute(first);
+    wait_helping(_scheduler, _mutex, _done, [this] { return _finished; });
+    if(_exception)
+    {
+      std::rethrow_exception(_exception);
+    }
+  }
+
+private:
+  using lock_t = std::unique_lock<std::mutex>;
+
+  struct node_task
+  {
+    auto operator()() const -> void { run->execute(index); }
+    task_graph_run* run;
+    std::uint32_t index;
+  };
+
+  auto execute(std::uint32_t index) -> void
+  {
+    while(true)
+    {
+      const auto& n = _graph._nodes[index];
+      if(!_failed.load(std::memory_order_relaxed))
+      {
+        try
+        {
+          n.invoke(n.callable);
+        }
+        catch(...)
+        {
+          lock_t lock{_mutex};
+          if(!_exception)
+          {
+            _exception = std::current_exception();
+          }
+          _failed = true;
+        }
+      }
+      // Keep one ready successor for ourselves, it is likely to use what this task just produced
+      auto next = task_graph::no_edge;
+      for(auto e = n.first_successor; e != task_graph::no_edge; e = _graph._edges[e].next)
+      {
+        const auto successor = _graph._edges[e].to;
+        if(_graph._pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+          if(next == task_graph::no_edge)
+          {
+            next = successor;
+          }
+          else
+          {
+            spawn(successor);
+          }
+        }
+      }
+      // Once the last task completes the waiting thread may destroy us, but that cannot happen while next is outstanding
+      complete();
+      if(next == task_graph::no_edge)
+      {
+        return;
+      }
+      index = next;
+    }
+  }
+
+  auto spawn(std::uint32_t index) -> void
+  {
+    try
+    {
+      _scheduler(node_task{this, index});
+    }
+    catch(...)
+    {
+      // Couldn't schedule, so just do it ourselves
+      execute(index);
+    }
+  }
+
+  auto complete() -> void
+  {
+    if(_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+      // This must happen under the lock, otherwise the waiting thread might destroy us before notify_all() returns
+      lock_t lock{_mutex};
+      _finished = true;
+      _done.notify_all();
+    }
+  }
+
+  task_graph& _graph;
+  const Scheduler& _scheduler;
+  std::atomic<std::uint32_t> _remaining{0}; // Tasks not yet finished
+  std::atomic<bool> _failed{false};
+  std::mutex _mutex;
+  std::condition_variable _done;
+  std::exception_ptr _exception;
+  bool _finished = false;
+};
+
+template<class Scheduler>
+auto schedulers::run(task_graph& g, const Scheduler& s) -> void
+{
+  if(g.size() > 0)
+  {
+    detail::task_graph_run<Scheduler>{g, s}.run();
+  }
+}
@@ -0,0 +1,294 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/task_allocator.hpp"
+#include "schedulers/utils.hpp"
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace schedulers
+{
+  namespace detail
+  {
+    /**
+     A hierarchical timer wheel as described in "Hashed and Hierarchical Timing Wheels" (Varghese and Lauck 1987).
+
+     Deadlines are rounded up to whole ticks since the wheel's start so nothing ever expires early. Every level has 64 slots and a slot on level `l` spans `64^l` ticks, with enough levels to cover all 64 bit tick counts. Inserting a timer is O(1), and on its way to expiry it is moved down at most once per level. Timers are only moved when advance() reaches the start of their slot, and next_deadline() tells when that is so a waiting thread can sleep until then.
+
+     The wheel is not synchronized. Nodes are allocated with task_allocator.
+     */
+    template<class T>
+    class timer_wheel;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::timer_wheel
+//
+
+template<class T>
+class schedulers::detail::timer_wheel
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit timer_wheel(clock::duration tick = std::chrono::milliseconds(1), clock::time_point start = clock::now())
+  : _start(start)
+  , _tick(tick)
+  { }
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+  ~timer_wheel();
+
+  /// Add `value` to expire at `deadline`. Returns `false` without touching `value` if that tick has already been processed.
+  auto insert(clock::time_point deadline, T& value) -> bool;
+  /// Move the values of all timers expired at `now` to the end of `expired`, earlier deadlines first.
+  auto advance(clock::time_point now, std::vector<T>& expired) -> void;
+  /// The earliest time advance() has something to do, or `clock::time_point::max()` if the wheel is empty.
+  auto next_deadline() const noexcept -> clock::time_point;
+
+  auto size() const noexcept -> std::size_t { return _size; }
+  auto empty() const noexcept -> bool { return _size == 0; }
+
+private:
+  static constexpr unsigned slot_bits = 6;
+  static constexpr unsigned num_slots = 1u << slot_bits;
+  static constexpr unsigned num_levels = (64 + slot_bits - 1) / slot_bits;
+  static constexpr auto no_tick = std::numeric_limits<std::uint64_t>::max();
+
+  struct node
+  {
+    node* next;
+    std::uint64_t deadline;
+    T value;
+  };
+
+  auto ceil_tick(clock::time_point t) const noexcept -> std::uint64_t;
+  auto floor_tick(clock::time_point t) const noexcept -> std::uint64_t;
+  // The first tick after _now at which a slot must be processed
+  auto next_tick() const noexcept -> std::uint64_t;
+  // Link n into the slot matching its deadline, or expire it if it is due
+  auto place(node* n, std::vector<T>& expired) -> void;
+  auto link(node* n) noexcept -> void;
+  auto take(unsigned level, unsigned slot) noexcept -> node*;
+  auto expire(node* n, std::vector<T>& expired) -> void;
+  static auto destroy(node* n) noexcept -> void;
+
+  const clock::time_point _start;
+  const clock::duration _tick;
+  std::uint64_t _now = 0; // The last processed tick
+  std::size_t _size = 0;
+  // Bit i of entry l is set if slot i of level l is not empty
+  std::uint64_t _occupied[num_levels] = {};
+  node* _slots[num_levels][num_slots] = {};
+};
+
+template<class T>
+schedulers::detail::timer_wheel<T>::~timer_wheel()
+{
+  for(auto& level : _slots)
+  {
+    for(auto n : level)
+    {
+      while(n)
+      {
+        destroy(std::exchange(n, n->next));
+      }
+    }
+  }
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::insert(clock::time_point deadline, T& value) -> bool
+{
+  const auto tick = ceil_tick(deadline);
+  if(tick <= _now)
+  {
+    return false;
+  }
+  task_allocator<node> alloc;
+  auto n = alloc.allocate(1);
+  try
+  {
+    ::new(static_cast<void*>(n)) node{nullptr, tick, move(value)};
+  }
+  catch(...)
+  {
+    alloc.deallocate(n, 1);
+    throw;
+  }
+  link(n);
+  ++_size;
+  return true;
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::advance(clock::time_point now, std::vector<T>& expired) -> void
+{
+  const auto target = floor_tick(now);
+  while(_size > 0)
+  {
+    const auto tick = next_tick();
+    if(tick > target)
+    {
+      break;
+    }
+    _now = tick;
+    // The slots of all levels starting at this tick, from the top down so timers moved from one level are moved on by the next
+    for(auto level = num_levels - 1; level > 0; --level)
+    {
+      const auto shift = level * slot_bits;
+      if((_now & ((std::uint64_t(1) << shift) - 1)) == 0)
+      {
+        for(auto n = take(level, (_now >> shift) & (num_slots - 1)); n;)
+        {
+          place(std::exchange(n, n->next), expired);
+        }
+      }
+    }
+    for(auto n = take(0, _now & (num_slots - 1)); n;)
+    {
+      expire(std::exchange(n, n->next), expired);
+    }
+  }
+  if(target > _now)
+  {
+    _now = target;
+  }
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::next_deadline() const noexcept -> clock::time_point
+{
+  const auto tick = next_tick();
+  if(tick == no_tick || tick >= static_cast<std::uint64_t>((clock::time_point::max() - _start) / _tick))
+  {
+    return clock::time_point::max();
+  }
+  return _start + _tick * static_cast<clock::rep>(tick);
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::ceil_tick(clock::time_point t) const noexcept -> std::uint64_t
+{
+  if(t <= _start)
+  {
+    return 0;
+  }
+  if(t == clock::time_point::max())
+  {
+    return no_tick - 1;
+  }
+  return static_cast<std::uint64_t>((t - _start + _tick - clock::duration(1)) / _tick);
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::floor_tick(clock::time_point t) const noexcept -> std::uint64_t
+{
+  return t <= _start ? 0 : static_cast<std::uint64_t>((t - _start) / _tick);
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::next_tick() const noexcept -> std::uint64_t
+{
+  // Every timer on level l shares all digits above l with _now and has a larger digit l, so the lowest occupied slot of the lowest occupied level comes first
+  for(unsigned level = 0; level < num_levels; ++level)
+  {
+    if(const auto occupied = _occupied[level])
+    {
+      std::uint64_t slot = 0;
+      while((occupied & (std::uint64_t(1) << slot)) == 0)
+      {
+        ++slot;
+      }
+      const auto shift = level * slot_bits;
+      const auto above = level + 1 < num_levels ? (_now >> (shift + slot_bits)) << (shift + slot_bits) : 0;
+      return above | (slot << shift);
+    }
+  }
+  return no_tick;
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::place(node* n, std::vector<T>& expired) -> void
+{
+  if(n->deadline <= _now)
+  {
+    expire(n, expired);
+  }
+  else
+  {
+    link(n);
+  }
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::link(node* n) noexcept -> void
+{
+  // The level is determined by the highest digit in which the deadline differs from _now
+  const auto diff = n->deadline ^ _now;
+  unsigned level = 0;
+  while(level + 1 < num_levels && (diff >> ((level + 1) * slot_bits)) != 0)
+  {
+    ++level;
+  }
+  const auto slot = (n->deadline >> (level * slot_bits)) & (num_slots - 1);
+  n->next = _slots[level][slot];
+  _slots[level][slot] = n;
+  _occupied[level] |= std::uint64_t(1) << slot;
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::take(unsigned level, unsigned slot) noexcept -> node*
+{
+  _occupied[level] &= ~(std::uint64_t(1) << slot);
+  // The slot is a stack, reverse it so timers of the same tick expire in insertion order
+  node* reversed = nullptr;
+  for(auto n = std::exchange(_slots[level][slot], nullptr); n;)
+  {
+    auto next = n->next;
+    n->next = reversed;
+    reversed = n;
+    n = next;
+  }
+  return reversed;
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::expire(node* n, std::vector<T>& expired) -> void
+{
+  --_size;
+  try
+  {
+    expired.push_back(move(n->value));
+  }
+  catch(...)
+  {
+    destroy(n);
+    throw;
+  }
+  destroy(n);
+}
+
+template<class T>
+auto schedulers::detail::timer_wheel<T>::destroy(node* n) noexcept -> void
+{
+  n->~node();
+  task_allocator<node>{}.deallocate(n, 1);
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/utils.hpp"
+#include <cstddef>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace schedulers
+{
+  /**
+   The logical CPUs the process may run on and the NUMA nodes they belong to.
+
+   CPUs are sorted by node so consecutive CPUs share a node whenever possible. Node numbers are renumbered to be contiguous starting at zero. If the system doesn't provide the information all CPUs belong to node 0.
+   */
+  struct cpu_topology
+  {
+    struct cpu
+    {
+      unsigned id; ///< The operating system's CPU number, within its group on Win32
+      unsigned group; ///< The Win32 processor group, 0 elsewhere
+      unsigned node; ///< The NUMA node
+    };
+
+    std::vector<cpu> cpus;
+    unsigned num_nodes = 1;
+
+    /// Query the topology of the CPUs available to the current process.
+    static auto detect() -> cpu_topology;
+  };
+
+  /**
+   Pin the calling thread to the given CPU.
+
+   \return `false` if the platform doesn't support pinning or the call failed, in which case the thread keeps running unpinned.
+   */
+  auto pin_current_thread(const cpu_topology::cpu& cpu) noexcept -> bool;
+
+  /**
+   A thread factory for basic_thread_pool starting worker `i` pinned to CPU `i % cpus.size()` of the given topology.
+
+   As the CPUs are sorted by node the workers are grouped by node too. The factory also provides `node_of()` which basic_thread_pool uses to try stealing from workers on the same node before crossing to other nodes.
+   */
+  class pinned_thread_factory;
+
+  namespace detail
+  {
+    /**
+     Determine for every worker the order in which basic_thread_pool looks for work in the queues of all workers, given the node of every worker.
+
+     Returns `nodes.size()` rows of `nodes.size()` queue indices. Each row starts with the worker itself, then the other workers on the same node, then the workers on the nodes following it, wrapping around. Within each node the workers are rotated so the victims of workers on the same node are spread out.
+     */
+    auto steal_order_by_node(const std::vector<unsigned>& nodes) -> std::vector<unsigned>;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// pinned_thread_factory
+//
+
+class schedulers::pinned_thread_factory
+{
+public:
+  explicit pinned_thread_factory(cpu_topology topology = cpu_topology::detect())
+  : _topology(move(topology))
+  { }
+
+  template<class Queue, class F>
+  auto operator()(unsigned index, const Queue& /*queue*/, F&& f) const -> std::thread
+  {
+    return std::thread([cpu = cpu_of(index), f = std::decay_t<F>(forward<F>(f))] () mutable
+    {
+      pin_current_thread(cpu);
+      f();
+    });
+  }
+
+  auto cpu_of(unsigned index) const noexcept -> cpu_topology::cpu
+  {
+    return _topology.cpus.empty() ? cpu_topology::cpu{0, 0, 0} : _topology.cpus[index % _topology.cpus.size()];
+  }
+  auto node_of(unsigned index) const noexcept -> unsigned
+  {
+    return cpu_of(index).node;
+  }
+  auto topology() const noexcept -> const cpu_topology& { return _topology; }
+
+private:
+  cpu_topology _topology;
+};
@@ -0,0 +1,341 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include "schedulers/instrumentation.hpp"
+#include "schedulers/utils.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace schedulers
+{
+  /**
+   Records a timeline of task executions and writes it in the Chrome trace event format.
+
+   Traced tasks are recorded into the recorder which was installed when they were scheduled. Tasks are traced by pools using tracing_instrumentation and, if the library is built with `SCHEDULERS_TRACING`, by the main thread schedulers and the schedulers which hand tasks to C callback APIs.
+
+   Every thread writes into its own ring buffer without locks or contention and only keeps the most recent events once it is full. The buffers live as long as the recorder so the trace includes threads which already exited. The recorder must outlive all tasks traced into it.
+   */
+  class trace_recorder;
+
+  /**
+   An instrumentation policy for basic_thread_pool recording every task into the installed trace_recorder.
+
+   The trace shows on which worker every task ran, when it was scheduled, how long it waited in the queue and ran, and whether it was stolen from another worker's queue. Tasks are wrapped at a cost of a pointer, a label and a time stamp even if no recorder is installed.
+
+   \tparam Base Another instrumentation policy whose hooks are called as well, for example counting_instrumentation.
+   */
+  template<class Base = no_instrumentation>
+  class tracing_instrumentation;
+
+  /**
+   Attach a label to a task which becomes the name of its slice in the trace.
+
+   Only the pointer is stored so `label` must have static storage duration, usually it is a string literal. Invoking the returned callable invokes `f`.
+   */
+  template<class F>
+  auto labeled(const char* label, F&& f);
+
+  namespace detail
+  {
+    class trace_buffer;
+    template<class F>
+    class labeled_task;
+    template<class F>
+    class traced_task;
+
+    struct trace_event
+    {
+      std::atomic<const char*> label;
+      std::atomic<std::uint32_t> submitter;
+      std::atomic<bool> stolen;
+      std::atomic<std::int64_t> enqueued;
+      std::atomic<std::int64_t> started;
+      std::atomic<std::int64_t> finished;
+    };
+
+    // What tracing knows about the current thread
+    struct trace_thread_state
+    {
+      // Identifies the thread to every recorder, unlike std::thread::id never reused, zero until it first registers
+      std::uint64_t token;
+      // The recorder id `buffer` belongs to, zero is never used
+      std::uint64_t recorder;
+      trace_buffer* buffer;
+      unsigned worker;
+      bool is_worker;
+      // Set by the pool for the task it is about to run
+      bool stolen;
+    };
+
+    inline auto trace_thread() noexcept -> trace_thread_state&
+    {
+      static thread_local trace_thread_state state{0, 0, nullptr, 0, false, false};
+      return state;
+    }
+
+    template<class F>
+    auto task_label(const F&) noexcept -> const char* { return nullptr; }
+    template<class F>
+    auto task_label(const labeled_task<F>& f) noexcept -> const char* { return f.label(); }
+
+    /**
+     The tracing hook of the schedulers which don't have an instrumentation policy.
+
+     Wraps `f` into a traced_task if the library is built with `SCHEDULERS_TRACING` and returns it unchanged otherwise.
+     */
+#if defined(SCHEDULERS_TRACING)
+    template<class F>
+    auto trace(F&& f);
+#else
+    template<class F>
+    auto trace(F&& f) -> F&&;
+#endif
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::trace_buffer
+//
+
+// A single-producer ring buffer which can be read while it is written
+class schedulers::detail::trace_buffer
+{
+public:
+  trace_buffer(std::size_t capacity, std::uint32_t tid, std::uint64_t owner, std::string name)
+  : _events(new trace_event[capacity]()), _mask(capacity - 1), _tid(tid), _owner(owner), _name(move(name))
+  { }
+
+  auto push(const char* label, std::uint32_t submitter, bool stolen, std::int64_t enqueued, std::int64_t started, std::int64_t finished) noexcept -> void
+  {
+    const auto n = _written.load(std::memory_order_relaxed);
+    auto& e = _events[n & _mask];
+    e.label.store(label, std::memory_order_relaxed);
+    e.submitter.store(submitter, std::memory_order_relaxed);
+    e.stolen.store(stolen, std::memory_order_relaxed);
+    e.enqueued.store(enqueued, std::memory_order_relaxed);
+    e.started.store(started, std::memory_order_relaxed);
+    e.finished.store(finished, std::memory_order_relaxed);
+    _written.store(n + 1, std::memory_order_release);
+  }
+
+  auto tid() const noexcept -> std::uint32_t { return _tid; }
+
+private:
+  friend trace_recorder;
+
+  std::unique_ptr<trace_event[]> _events;
+  std::uint64_t _mask;
+  std::atomic<std::uint64_t> _written{0};
+  std::uint32_t _tid;
+  // The trace_thread_state::token of the thread writing it
+  std::uint64_t _owner;
+  // Protected by the recorder's mutex
+  std::string _name;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// trace_recorder
+//
+
+class schedulers::trace_recorder
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  /// Every thread keeps at least the last `events_per_thread` tasks it ran.
+  explicit trace_recorder(std::size_t events_per_thread = 2048);
+  trace_recorder(const trace_recorder&) = delete;
+  trace_recorder& operator=(const trace_recorder&) = delete;
+  /// Uninstalls the recorder if it is still installed.
+  ~trace_recorder();
+
+  /// Record all tasks traced from now on, replacing the previously installed recorder.
+  auto install() noexcept -> void;
+  /// Stop tracing tasks scheduled from now on. Already traced tasks are still recorded when they run.
+  static auto uninstall() noexcept -> void;
+  static auto installed() noexcept -> trace_recorder*;
+
+  /// Name the calling thread's track in the trace. Workers of traced pools are named "worker <index>" and all other threads "thread <n>" unless named otherwise.
+  auto set_thread_name(std::string name) -> void;
+
+  /**
+   Write everything recorded so far as Chrome trace JSON, which can be opened in `chrome://tracing` or the Perfetto UI.
+
+   Every task is a slice on the track of the thread which ran it. A flow arrow connects it with the thread which scheduled it at the time it was scheduled. The slice's arguments show how long the task was queued and whether it was stolen. Can be called while tasks are still running, in which case events overwritten during the call are left out.
+   */
+  auto write_chrome_trace(std::ostream& out) const -> void;
+
+  /// The calling thread's track, or `no_thread` if its buffer couldn't be allocated.
+  auto current_thread() noexcept -> std::uint32_t
+  {
+    const auto buffer = this_thread_buffer();
+    return buffer ? buffer->tid() : no_thread;
+  }
+  auto record(const char* label, std::uint32_t submitter, clock::time_point enqueued, clock::time_point started, clock::time_point finished, bool stolen) noexcept -> void
+  {
+    if(const auto buffer = this_thread_buffer())
+    {
+      buffer->push(label, submitter, stolen, since_epoch(enqueued), since_epoch(started), since_epoch(finished));
+    }
+  }
+
+  static constexpr std::uint32_t no_thread = ~std::uint32_t(0);
+
+private:
+  auto this_thread_buffer() noexcept -> detail::trace_buffer*
+  {
+    const auto& thread = detail::trace_thread();
+    return thread.recorder == _id ? thread.buffer : register_thread();
+  }
+  auto register_thread() noexcept -> detail::trace_buffer*;
+  auto since_epoch(clock::time_point t) const noexcept -> std::int64_t
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - _epoch).count();
+  }
+
+  const std::uint64_t _id;
+  const clock::time_point _epoch = clock::now();
+  std::size_t _capacity;
+  mutable std::mutex _mutex;
+  std::vector<std::unique_ptr<detail::trace_buffer>> _buffers;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::labeled_task
+//
+
+template<class F>
+class schedulers::detail::labeled_task
+{
+public:
+  template<class G>
+  labeled_task(const char* label, G&& f) : _label(label), _f(forward<G>(f)) { }
+
+  auto label() const noexcept -> const char* { return _label; }
+
+  template<class... Args>
+  auto operator()(Args&&... args) -> decltype(auto)
+  {
+    return _f(forward<Args>(args)...);
+  }
+
+private:
+  const char* _label;
+  F _f;
+};
+
+template<class F>
+auto schedulers::labeled(const char* label, F&& f)
+{
+  return detail::labeled_task<std::decay_t<F>>(label, forward<F>(f));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::traced_task
+//
+
+template<class F>
+class schedulers::detail::traced_task
+{
+public:
+  using clock = trace_recorder::clock;
+
+  // Takes the label separately as f may already be wrapped by another instrumentation
+  template<class G>
+  traced_task(trace_recorder* recorder, const char* label, G&& f)
+  : _recorder(recorder), _label(label), _f(forward<G>(f))
+  {
+    if(_recorder)
+    {
+      _submitter = _recorder->current_thread();
+      _enqueued = clock::now();
+    }
+  }
+
+  auto operator()() -> void
+  {
+    if(!_recorder)
+    {
+      move(_f)();
+      return;
+    }
+    const auto stolen = std::exchange(trace_thread().stolen, false);
+    const auto started = clock::now();
+    move(_f)();
+    _recorder->record(_label, _submitter, _enqueued, started, clock::now(), stolen);
+  }
+
+private:
+  trace_recorder* _recorder;
+  const char* _label;
+  std::uint32_t _submitter = trace_recorder::no_thread;
+  clock::time_point _enqueued;
+  F _f;
+};
+
+#if defined(SCHEDULERS_TRACING)
+template<class F>
+auto schedulers::detail::trace(F&& f)
+{
+  const auto label = task_label(f);
+  return traced_task<std::decay_t<F>>(trace_recorder::installed(), label, forward<F>(f));
+}
+#else
+template<class F>
+auto schedulers::detail::trace(F&& f) -> F&&
+{
+  return forward<F>(f);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// tracing_instrumentation
+//
+
+template<class Base>
+class schedulers::tracing_instrumentation : public Base
+{
+public:
+  auto on_worker_start(unsigned worker) const noexcept -> void
+  {
+    Base::on_worker_start(worker);
+    auto& thread = detail::trace_thread();
+    thread.worker = worker;
+    thread.is_worker = true;
+  }
+  auto on_pop(unsigned worker, unsigned queue) const noexcept -> void
+  {
+    Base::on_pop(worker, queue);
+    detail::trace_thread().stolen = worker != queue;
+  }
+  template<class F>
+  auto wrap(F&& f) const
+  {
+    const auto label = detail::task_label(f);
+    using wrapped_t = std::decay_t<decltype(Base::wrap(forward<F>(f)))>;
+    return detail::traced_task<wrapped_t>(trace_recorder::installed(), label, Base::wrap(forward<F>(f)));
+  }
+  static constexpr std::size_t wrap_overhead = Base::wrap_overhead + sizeof(detail::traced_task<void*>) - sizeof(void*);
+};
+
+template<class Base>
+constexpr std::size_t schedulers::tracing_instrumentation<Base>::wrap_overhead;
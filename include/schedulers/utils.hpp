@@ -14,10 +14,17 @@
 
 #pragma once
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <new>
 #include <type_traits>
 
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
 namespace schedulers
 {
   template<class...>
@@ -64,6 +71,38 @@ namespace schedulers
 
   namespace detail
   {
+    /// Hint to the CPU that we are in a spin-wait loop
+    inline auto cpu_relax() noexcept -> void;
+
+    /**
+     The distance objects written by different threads are kept apart to avoid false sharing.
+
+     This is what `std::hardware_destructive_interference_size` would be, but it is available in C++14 and doesn't change with compiler flags. Apple's ARM cores and POWER have 128 byte cache lines.
+     */
+#if (defined(__APPLE__) && defined(__aarch64__)) || defined(__powerpc64__)
+    constexpr std::size_t cache_line_size = 128;
+#else
+    constexpr std::size_t cache_line_size = 64;
+#endif
+
+    /**
+     Put between two members written by different threads so they never share a cache line.
+
+     Unlike `alignas` this works no matter how the enclosing object is aligned, which C++14's `operator new` doesn't guarantee for over-aligned types.
+     */
+    struct cache_line_padding
+    {
+      char bytes[cache_line_size];
+    };
+
+    /**
+     A fixed size array in which every element starts on a cache line of its own, so elements used by different threads don't interfere.
+
+     The elements are value-initialized in place and never move, so `T` doesn't have to be movable.
+     */
+    template<class T>
+    class cache_aligned_array;
+
     /**
      A stripped-down specialized version of std::function used for holding move-only callables in a task queue
     
@@ -74,13 +113,100 @@ namespace schedulers
      4. destroy it
      
      Doing anything else is undefined.
+
+     \tparam InlineBytes The size of the internal buffer. Callables which are nothrow-move-constructible and fit into it together with a vtbl pointer are stored inline without allocating. Must be at least `2 * sizeof(void*)`.
      */
-    class work_item;
+    template<std::size_t InlineBytes>
+    class basic_work_item;
+
+    /// Buffer size follows standard recommendation: vtbl pointer + two-pointer-sized callable
+    constexpr std::size_t default_work_item_size = 3 * sizeof(void*);
+
+    using work_item = basic_work_item<default_work_item_size>;
+  }
+}
+
+template<std::size_t InlineBytes, class Alloc>
+struct std::uses_allocator<schedulers::detail::basic_work_item<InlineBytes>, Alloc> : std::true_type { };
+
+////////////////////////////////////////////////////////////////////////////////
+// cpu_relax
+//
+
+inline auto schedulers::detail::cpu_relax() noexcept -> void
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+  asm volatile("yield");
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// cache_aligned_array
+//
+
+template<class T>
+class schedulers::detail::cache_aligned_array
+{
+public:
+  explicit cache_aligned_array(std::size_t size);
+  cache_aligned_array(const cache_aligned_array&) = delete;
+  cache_aligned_array& operator=(const cache_aligned_array&) = delete;
+  ~cache_aligned_array();
+
+  auto size() const noexcept -> std::size_t { return _size; }
+  auto operator[](std::size_t i) noexcept -> T& { return *reinterpret_cast<T*>(_first + i * stride); }
+  auto operator[](std::size_t i) const noexcept -> const T& { return *reinterpret_cast<const T*>(_first + i * stride); }
+
+private:
+  static constexpr std::size_t alignment = alignof(T) > cache_line_size ? alignof(T) : cache_line_size;
+  static constexpr std::size_t stride = (sizeof(T) + alignment - 1) / alignment * alignment;
+
+  auto destroy_elements() noexcept -> void;
+
+  std::unique_ptr<unsigned char[]> _storage;
+  unsigned char* _first;
+  std::size_t _size = 0;
+};
+
+template<class T>
+schedulers::detail::cache_aligned_array<T>::cache_aligned_array(std::size_t size)
+: _storage(new unsigned char[size * stride + alignment])
+{
+  // operator new[] only guarantees fundamental alignment so we align the first element ourselves
+  const auto address = reinterpret_cast<std::uintptr_t>(_storage.get());
+  _first = _storage.get() + (alignment - address % alignment) % alignment;
+  try
+  {
+    for(; _size < size; ++_size)
+    {
+      ::new(_first + _size * stride) T();
+    }
+  }
+  catch(...)
+  {
+    destroy_elements();
+    throw;
   }
 }
 
-template<class Alloc>
-struct std::uses_allocator<schedulers::detail::work_item, Alloc> : std::true_type { };
+template<class T>
+schedulers::detail::cache_aligned_array<T>::~cache_aligned_array()
+{
+  destroy_elements();
+}
+
+template<class T>
+auto schedulers::detail::cache_aligned_array<T>::destroy_elements() noexcept -> void
+{
+  while(_size > 0)
+  {
+    (*this)[--_size].~T();
+  }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // allocator nonsense that should be in std
@@ -132,27 +258,37 @@ auto schedulers::allocate_unique(const std::allocator<X>& alloc, Args&&... args)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// work_item
+// basic_work_item
 //
 
-class schedulers::detail::work_item
+template<std::size_t InlineBytes>
+class schedulers::detail::basic_work_item
 {
+  static_assert(InlineBytes >= 2 * sizeof(void*), "InlineBytes must fit at least a vtbl pointer and one pointer-sized callable");
+
 public:
-  work_item();
-  work_item(const work_item&) = delete;
-  work_item(work_item&& other) noexcept;
-  work_item& operator=(work_item&& other) noexcept;
-  ~work_item();
+  basic_work_item();
+  basic_work_item(const basic_work_item&) = delete;
+  basic_work_item(basic_work_item&& other) noexcept;
+  basic_work_item& operator=(basic_work_item&& other) noexcept;
+  ~basic_work_item();
 
   template<class Alloc, class F>
-  work_item(std::allocator_arg_t, const Alloc& alloc, F&& f);
+  basic_work_item(std::allocator_arg_t, const Alloc& alloc, F&& f);
 
   template<class Alloc>
-  work_item(std::allocator_arg_t, const Alloc& alloc, std::nullptr_t) = delete;
+  basic_work_item(std::allocator_arg_t, const Alloc& alloc, std::nullptr_t) = delete;
 
   explicit operator bool() const noexcept { return _target != nullptr; }
   auto operator()() && -> void { move(*_target)(); }
 
+  /// Whether a callable of type `F` is stored in the inline buffer instead of being allocated.
+  template<class F>
+  static constexpr auto stores_inline() noexcept -> bool
+  {
+    return sizeof(fun_without_alloc<std::decay_t<F>>) <= sizeof(buffer_t) && std::is_nothrow_move_constructible<std::decay_t<F>>::value;
+  }
+
 private:
   struct base
   {
@@ -173,7 +309,8 @@ private:
     { }
     auto destroy() noexcept -> void override
     {
-      data.~decltype(data)();
+      using data_t = decltype(data);
+      data.~data_t();
     }
     auto destroy_dealloc() noexcept -> void override
     {
@@ -214,8 +351,7 @@ private:
     F f;
   };
 
-  // Buffer size follows standard recommendation: vtbl pointer + two-pointer-sized callable
-  using buffer_t = std::aligned_storage_t<3 * sizeof(void*)>;
+  using buffer_t = std::aligned_storage_t<InlineBytes>;
 
   static auto as_base(buffer_t* buf) noexcept
   {
@@ -247,18 +383,21 @@ private:
   base* _target;
 };
 
-inline schedulers::detail::work_item::work_item()
+template<std::size_t InlineBytes>
+schedulers::detail::basic_work_item<InlineBytes>::basic_work_item()
 : _target(nullptr)
 { }
 
-inline schedulers::detail::work_item::work_item(work_item&& other) noexcept
+template<std::size_t InlineBytes>
+schedulers::detail::basic_work_item<InlineBytes>::basic_work_item(basic_work_item&& other) noexcept
 {
   _target = nullptr;
   *this = move(other);
 }
 
-inline auto schedulers::detail::work_item::operator=(work_item&& other) noexcept
--> schedulers::detail::work_item&
+template<std::size_t InlineBytes>
+auto schedulers::detail::basic_work_item<InlineBytes>::operator=(basic_work_item&& other) noexcept
+-> basic_work_item&
 {
   assert(!_target && "must move to empty work_item");
   assert(other._target && "moved from work_item twice");
@@ -275,7 +414,8 @@ inline auto schedulers::detail::work_item::operator=(work_item&& other) noexcept
   return *this;
 }
 
-inline schedulers::detail::work_item::~work_item()
+template<std::size_t InlineBytes>
+schedulers::detail::basic_work_item<InlineBytes>::~basic_work_item()
 {
   if(_target)
   {
@@ -290,8 +430,9 @@ inline schedulers::detail::work_item::~work_item()
   }
 }
 
+template<std::size_t InlineBytes>
 template<class Alloc, class F>
-schedulers::detail::work_item::work_item(std::allocator_arg_t, const Alloc& alloc, F&& f)
+schedulers::detail::basic_work_item<InlineBytes>::basic_work_item(std::allocator_arg_t, const Alloc& alloc, F&& f)
 {
   assert(not_null(f) && "function is NULL");
 
@@ -309,25 +450,25 @@ schedulers::detail::work_item::work_item(std::allocator_arg_t, const Alloc& allo
           bool_constant<ok>());
 }
 
+template<std::size_t InlineBytes>
 template<class Alloc, class F>
-auto schedulers::detail::work_item::emplace(const Alloc& alloc, F&& f, f_is_ok) -> void
+auto schedulers::detail::basic_work_item<InlineBytes>::emplace(const Alloc& alloc, F&& f, f_is_ok) -> void
 {
-  using decayed = std::decay_t<F>;
-  using embedded = fun_without_alloc<decayed>;
-  constexpr auto can_embed = sizeof(embedded) <= sizeof(_buffer) && std::is_nothrow_move_constructible<decayed>();
-  emplace_impl(alloc, forward<F>(f), bool_constant<can_embed>());
+  emplace_impl(alloc, forward<F>(f), bool_constant<stores_inline<F>()>());
 }
 
+template<std::size_t InlineBytes>
 template<class Alloc, class F>
-auto schedulers::detail::work_item::emplace_impl(const Alloc& alloc, F&& f, can_embed_in_void_ptr) -> void
+auto schedulers::detail::basic_work_item<InlineBytes>::emplace_impl(const Alloc& alloc, F&& f, can_embed_in_void_ptr) -> void
 {
   using decayed = std::decay_t<F>;
   new (static_cast<void*>(&_buffer)) fun_without_alloc<decayed>(forward<F>(f));
   _target = as_base(&_buffer);
 }
 
+template<std::size_t InlineBytes>
 template<class Alloc, class F>
-auto schedulers::detail::work_item::emplace_impl(const Alloc& alloc, F&& f, cannot_embed_in_void_ptr) -> void
+auto schedulers::detail::basic_work_item<InlineBytes>::emplace_impl(const Alloc& alloc, F&& f, cannot_embed_in_void_ptr) -> void
 {
   using decayed = std::decay_t<F>;
   auto p = allocate_unique<fun_with_alloc<Alloc, decayed>>(alloc, alloc, forward<F>(f));
@@ -0,0 +1,52 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/cancellation.hpp"
+
+using schedulers::detail::cancellable_state;
+
+////////////////////////////////////////////////////////////////////////////////
+// cancellable_state
+//
+
+auto cancellable_state::run() -> void
+{
+  auto expected = static_cast<int>(pending_status);
+  if(_status.compare_exchange_strong(expected, started_status, std::memory_order_acquire, std::memory_order_relaxed))
+  {
+    auto f = move(_work);
+    move(f)();
+  }
+}
+
+auto cancellable_state::cancel() noexcept -> bool
+{
+  auto expected = static_cast<int>(pending_status);
+  if(_status.compare_exchange_strong(expected, cancelled_status, std::memory_order_acq_rel, std::memory_order_relaxed))
+  {
+    // Whoever holds the placeholder must not keep the captured state alive
+    auto discarded = move(_work);
+    return true;
+  }
+  return false;
+}
+
+auto cancellable_state::release() noexcept -> void
+{
+  if(_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+  {
+    this->~cancellable_state();
+    task_allocator_deallocate(this);
+  }
+}
@@ -0,0 +1,298 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/elastic_thread_pool.hpp"
+
+using schedulers::blocking_region;
+using schedulers::elastic_pool_options;
+using schedulers::elastic_thread_pool;
+
+namespace
+{
+  // The pool the current thread is a worker of, if any
+  thread_local const elastic_thread_pool* current_pool = nullptr;
+
+  auto make_thread = [] (unsigned /*index*/, std::function<void()> f)
+  {
+    return std::thread(std::move(f));
+  };
+
+  auto sanitize(elastic_pool_options options)
+  {
+    options.max_threads = std::max(1u, options.max_threads);
+    options.min_threads = std::min(options.min_threads, options.max_threads);
+    options.concurrency = std::max(1u, std::min(options.concurrency, options.max_threads));
+    return options;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// elastic_thread_pool
+//
+
+elastic_thread_pool::elastic_thread_pool(elastic_pool_options options)
+: elastic_thread_pool(make_thread, options)
+{ }
+
+elastic_thread_pool::elastic_thread_pool(thread_factory factory, elastic_pool_options options)
+: _options(sanitize(options))
+, _factory(std::move(factory))
+, _threads(_options.max_threads)
+{
+  _free_slots.reserve(_options.max_threads);
+  for(auto i = _options.max_threads; i > 0; --i)
+  {
+    _free_slots.push_back(i - 1);
+  }
+
+  lock_t lock{_mutex};
+  while(_num_threads < _options.min_threads)
+  {
+    spawn(lock);
+  }
+  lock.unlock();
+  _monitor = std::thread([this] { monitor(); });
+}
+
+elastic_thread_pool::~elastic_thread_pool()
+{
+  {
+    lock_t lock{_mutex};
+    _done = true;
+  }
+  _work_ready.notify_all();
+  _monitor_ready.notify_all();
+  _monitor.join();
+  // Threads can only be started with the mutex held and _done prevents that now
+  for(auto&& t : _threads)
+  {
+    if(t.joinable())
+    {
+      t.join();
+    }
+  }
+}
+
+auto elastic_thread_pool::num_threads() const -> unsigned
+{
+  lock_t lock{_mutex};
+  return _num_threads;
+}
+
+auto elastic_thread_pool::spawn(lock_t& lock) const -> bool
+{
+  if(_free_slots.empty() || _done)
+  {
+    return false;
+  }
+  const auto index = _free_slots.back();
+  auto& slot = _threads[index];
+  // The previous thread of this slot retired and is about to exit, if it hasn't already
+  auto retired = move(slot);
+  try
+  {
+    slot = _factory(index, [this, index] { run(index); });
+  }
+  catch(...)
+  {
+    slot = move(retired);
+    throw;
+  }
+  _free_slots.pop_back();
+  ++_num_threads;
+  if(retired.joinable())
+  {
+    // Nobody else has to wait for the retired thread to finish exiting
+    lock.unlock();
+    retired.join();
+    lock.lock();
+  }
+  return true;
+}
+
+auto elastic_thread_pool::push(detail::work_item&& f) const -> void
+{
+  lock_t lock{_mutex};
+  _queue.push_back({move(f), clock::now()});
+  const auto wake_worker = _num_idle > 0;
+  if(!wake_worker && _num_threads - _num_blocked < _options.concurrency)
+  {
+    try
+    {
+      spawn(lock);
+    }
+    catch(...)
+    {
+      // Nobody would ever run the task
+      if(_num_threads == 0)
+      {
+        _queue.pop_back();
+        throw;
+      }
+    }
+  }
+  // Even if an idle thread takes the task it may block, leaving tasks queued behind it to the monitor
+  const auto wake_monitor = _monitor_sleeping;
+  lock.unlock();
+  if(wake_worker)
+  {
+    _work_ready.notify_one();
+  }
+  if(wake_monitor)
+  {
+    _monitor_ready.notify_one();
+  }
+}
+
+auto elastic_thread_pool::run(unsigned index) const -> void
+{
+  current_pool = this;
+  lock_t lock{_mutex};
+  while(true)
+  {
+    if(!_queue.empty())
+    {
+      auto f = move(_queue.front().work);
+      _queue.pop_front();
+      lock.unlock();
+      move(f)();
+      lock.lock();
+      continue;
+    }
+    if(_done)
+    {
+      break;
+    }
+
+    // Don't keep freed task memory from its owner while we sleep
+    lock.unlock();
+    detail::task_allocator_flush();
+    lock.lock();
+    if(!_queue.empty() || _done)
+    {
+      continue;
+    }
+
+    ++_num_idle;
+    const auto status = _work_ready.wait_for(lock, _options.idle_timeout);
+    --_num_idle;
+    if(status == std::cv_status::timeout && _queue.empty() && !_done && _num_threads > _options.min_threads)
+    {
+      break;
+    }
+  }
+  --_num_threads;
+  _free_slots.push_back(index);
+  current_pool = nullptr;
+}
+
+auto elastic_thread_pool::monitor() const -> void
+{
+  lock_t lock{_mutex};
+  while(!_done)
+  {
+    if(_queue.empty())
+    {
+      _monitor_sleeping = true;
+      _monitor_ready.wait(lock);
+      _monitor_sleeping = false;
+      continue;
+    }
+    const auto waited = clock::now() - _queue.front().enqueued;
+    if(waited < _options.spawn_delay)
+    {
+      _monitor_ready.wait_for(lock, _options.spawn_delay - waited);
+      continue;
+    }
+    if(_num_idle == 0)
+    {
+      try
+      {
+        spawn(lock);
+      }
+      catch(...)
+      {
+        // Try again later
+      }
+    }
+    // Give the new or idle thread time to pick up the task before looking again. spawn() may have unlocked the mutex so _done needs checking.
+    if(!_done)
+    {
+      _monitor_ready.wait_for(lock, _options.spawn_delay);
+    }
+  }
+}
+
+auto elastic_thread_pool::running_in_this_thread() const noexcept -> bool
+{
+  return current_pool == this;
+}
+
+auto elastic_thread_pool::try_run_one() const -> bool
+{
+  lock_t lock{_mutex};
+  if(_queue.empty())
+  {
+    return false;
+  }
+  auto f = move(_queue.front().work);
+  _queue.pop_front();
+  lock.unlock();
+  move(f)();
+  return true;
+}
+
+auto elastic_thread_pool::enter_blocking() const -> void
+{
+  lock_t lock{_mutex};
+  ++_num_blocked;
+  if(!_queue.empty() && _num_idle == 0 && _num_threads - _num_blocked < _options.concurrency)
+  {
+    try
+    {
+      spawn(lock);
+    }
+    catch(...)
+    {
+      // The monitor will try again
+    }
+  }
+}
+
+auto elastic_thread_pool::leave_blocking() const -> void
+{
+  lock_t lock{_mutex};
+  --_num_blocked;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// blocking_region
+//
+
+blocking_region::blocking_region()
+: _pool(current_pool)
+{
+  if(_pool)
+  {
+    _pool->enter_blocking();
+  }
+}
+
+blocking_region::~blocking_region()
+{
+  if(_pool)
+  {
+    _pool->leave_blocking();
+  }
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/instrumentation.hpp"
+#include <algorithm>
+
+using schedulers::counting_instrumentation;
+using schedulers::no_instrumentation;
+using schedulers::thread_pool_stats;
+
+constexpr std::size_t no_instrumentation::wrap_overhead;
+constexpr std::size_t counting_instrumentation::wrap_overhead;
+
+namespace
+{
+  // Which instrumentation and worker the current thread belongs to, if any
+  struct current_worker_t
+  {
+    const counting_instrumentation* owner;
+    unsigned index;
+  };
+  thread_local current_worker_t current{nullptr, 0};
+
+  auto bucket_of(std::uint64_t nanoseconds) noexcept -> std::size_t
+  {
+    std::size_t bucket = 0;
+    while(nanoseconds > 1 && bucket < thread_pool_stats::histogram::num_buckets - 1)
+    {
+      nanoseconds >>= 1;
+      ++bucket;
+    }
+    return bucket;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// thread_pool_stats
+//
+
+constexpr std::size_t thread_pool_stats::histogram::num_buckets;
+
+auto thread_pool_stats::histogram::count() const noexcept -> std::uint64_t
+{
+  std::uint64_t n = 0;
+  for(auto b : buckets)
+  {
+    n += b;
+  }
+  return n;
+}
+
+auto thread_pool_stats::histogram::quantile(double q) const noexcept -> std::chrono::nanoseconds
+{
+  const auto n = count();
+  if(n == 0)
+  {
+    return std::chrono::nanoseconds::zero();
+  }
+  const auto target = static_cast<std::uint64_t>(std::min(std::max(q, 0.), 1.) * (n - 1)) + 1;
+  std::uint64_t seen = 0;
+  for(std::size_t i = 0; i < num_buckets; ++i)
+  {
+    seen += buckets[i];
+    if(seen >= target)
+    {
+      return std::chrono::nanoseconds(std::int64_t(2) << i);
+    }
+  }
+  return std::chrono::nanoseconds(std::int64_t(2) << (num_buckets - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// counting_instrumentation
+//
+
+auto counting_instrumentation::init(unsigned num_threads) -> void
+{
+  _num_threads = num_threads;
+  _workers = std::make_unique<detail::cache_aligned_array<worker_counters>>(num_threads + 1);
+  _queues = std::make_unique<detail::cache_aligned_array<queue_counters>>(num_threads);
+}
+
+auto counting_instrumentation::on_worker_start(unsigned worker) const noexcept -> void
+{
+  current = {this, worker};
+}
+
+auto counting_instrumentation::current_worker() const noexcept -> worker_counters&
+{
+  return (*_workers)[current.owner == this ? current.index : _num_threads];
+}
+
+auto counting_instrumentation::record(histogram& h, clock::duration d) noexcept -> void
+{
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  add(h.buckets[bucket_of(ns > 0 ? static_cast<std::uint64_t>(ns) : 0)]);
+}
+
+auto counting_instrumentation::snapshot() const -> thread_pool_stats
+{
+  auto load = [] (const counter& c) { return c.load(std::memory_order_relaxed); };
+
+  thread_pool_stats stats{};
+  stats.workers.reserve(_num_threads + 1);
+  for(unsigned i = 0; i <= _num_threads; ++i)
+  {
+    const auto& w = (*_workers)[i];
+    stats.workers.push_back({load(w.pushes), load(w.local_pops), load(w.steals), load(w.failed_steals), load(w.parks), load(w.wakeups)});
+    for(std::size_t b = 0; b < thread_pool_stats::histogram::num_buckets; ++b)
+    {
+      stats.queue_latency.buckets[b] += load(w.queue_latency.buckets[b]);
+      stats.run_time.buckets[b] += load(w.run_time.buckets[b]);
+    }
+  }
+  stats.queues.reserve(_num_threads);
+  for(unsigned i = 0; i < _num_threads; ++i)
+  {
+    const auto& q = (*_queues)[i];
+    // Pops are read first so the difference cannot underflow due to concurrent pushes
+    const auto pops = load(q.pops);
+    const auto pushes = load(q.pushes);
+    stats.queues.push_back({pushes > pops ? pushes - pops : 0, load(q.max_depth)});
+  }
+  return stats;
+}
@@ -15,11 +15,42 @@
 package de.knejp.schedulers;
 
 import java.lang.Runnable;
+import java.util.ArrayList;
+import java.util.Collection;
+import java.util.Collections;
+import java.util.List;
+import java.util.concurrent.AbstractExecutorService;
+import java.util.concurrent.Callable;
+import java.util.concurrent.CancellationException;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.Future;
+import java.util.concurrent.RejectedExecutionException;
+import java.util.concurrent.RunnableFuture;
+import java.util.concurrent.TimeUnit;
 import java.util.concurrent.atomic.AtomicBoolean;
-import java.util.concurrent.Executor;
 
-public class SharedNativeThreadPoolExecutor implements Executor
+/**
+ * An ExecutorService running on the threads of a native thread pool shared with C++.
+ *
+ * shutdown() stops accepting new tasks and lets the submitted ones finish, the pool itself keeps running as long as
+ * C++ still uses it. The Java side gives up its ownership of the pool once it is terminated and awaitTermination()
+ * returned true, or when it is finalized. Calls on one of the pool's own workers leave that to a later caller or
+ * finalize(), as dropping the last reference there would make the pool join itself.
+ */
+public class SharedNativeThreadPoolExecutor extends AbstractExecutorService
 {
+    // Runnables waiting for a native worker to drain them, everything below is guarded by synchronizing on the array
+    private static final int RING_CAPACITY = 1024; // Must be a power of two
+    private static final int BATCH_SIZE = 64; // Runnables per drain() before the worker returns to native tasks
+    private final Runnable[] ring = new Runnable[RING_CAPACITY];
+    private int head = 0;
+    private int size = 0;
+    // Drain tasks scheduled in the native pool which haven't started taking Runnables yet
+    private int pendingDrains = 0;
+    // Accepted Runnables which haven't finished yet
+    private int outstanding = 0;
+    private boolean isShutdown = false;
+
     private final long nativeRef;
     private final AtomicBoolean destroyed = new AtomicBoolean(false);
 
@@ -30,24 +61,271 @@ public class SharedNativeThreadPoolExecutor implements Executor
     }
 
     private native void nativeShutdown(long nativeRef);
-    public void shutdown()
+    // Whether the calling thread is a worker of a shared native pool
+    private static native boolean nativeOnWorkerThread();
+    // Gives up the Java side's ownership of the native pool unless called from a pool thread, as it might destroy the pool
+    private void release()
     {
+        if (nativeOnWorkerThread()) return;
         boolean destroyed = this.destroyed.getAndSet(true);
         if (!destroyed) nativeShutdown(this.nativeRef);
     }
 
+    @Override
+    public void shutdown()
+    {
+        boolean terminated;
+        synchronized (this.ring)
+        {
+            this.isShutdown = true;
+            terminated = this.outstanding == 0;
+            this.ring.notifyAll();
+        }
+        if (terminated) release();
+    }
+
+    /**
+     * Shut down and return the Runnables which haven't been taken by a native worker yet.
+     *
+     * Runnables already handed to the native pool individually because the queue was full still run.
+     */
+    @Override
+    public List<Runnable> shutdownNow()
+    {
+        final ArrayList<Runnable> pending = new ArrayList<Runnable>();
+        boolean terminated;
+        synchronized (this.ring)
+        {
+            this.isShutdown = true;
+            while (this.size > 0)
+            {
+                pending.add(take());
+            }
+            this.outstanding -= pending.size();
+            terminated = this.outstanding == 0;
+            this.ring.notifyAll();
+        }
+        if (terminated) release();
+        return pending;
+    }
+
+    @Override
+    public boolean isShutdown()
+    {
+        synchronized (this.ring)
+        {
+            return this.isShutdown;
+        }
+    }
+
+    @Override
+    public boolean isTerminated()
+    {
+        synchronized (this.ring)
+        {
+            return this.isShutdown && this.outstanding == 0;
+        }
+    }
+
+    @Override
+    public boolean awaitTermination(long timeout, TimeUnit unit) throws InterruptedException
+    {
+        long nanos = unit.toNanos(timeout);
+        synchronized (this.ring)
+        {
+            final long deadline = System.nanoTime() + nanos;
+            while (!(this.isShutdown && this.outstanding == 0))
+            {
+                if (nanos <= 0) return false;
+                TimeUnit.NANOSECONDS.timedWait(this.ring, nanos);
+                nanos = deadline - System.nanoTime();
+            }
+        }
+        release();
+        return true;
+    }
+
     @Override
     protected void finalize() throws Throwable
     {
-        shutdown();
+        release();
         super.finalize();
     }
 
     @Override
     public void execute(Runnable r)
+    {
+        if (r == null) throw new NullPointerException();
+        executeAll(Collections.singletonList(r));
+    }
+
+    /**
+     * Submit all tasks with one lock acquisition and start native workers for them in one native bulk submission,
+     * then wait for all of them like AbstractExecutorService.invokeAll().
+     */
+    @Override
+    public <T> List<Future<T>> invokeAll(Collection<? extends Callable<T>> tasks) throws InterruptedException
+    {
+        if (tasks == null) throw new NullPointerException();
+        final ArrayList<Future<T>> futures = new ArrayList<Future<T>>(tasks.size());
+        final ArrayList<Runnable> runnables = new ArrayList<Runnable>(tasks.size());
+        for (Callable<T> task : tasks)
+        {
+            RunnableFuture<T> f = newTaskFor(task);
+            futures.add(f);
+            runnables.add(f);
+        }
+        boolean done = false;
+        try
+        {
+            executeAll(runnables);
+            for (Future<T> f : futures)
+            {
+                if (!f.isDone())
+                {
+                    try
+                    {
+                        f.get();
+                    }
+                    catch (CancellationException ignore)
+                    {
+                    }
+                    catch (ExecutionException ignore)
+                    {
+                    }
+                }
+            }
+            done = true;
+            return futures;
+        }
+        finally
+        {
+            if (!done)
+            {
+                for (Future<T> f : futures)
+                {
+                    f.cancel(true);
+                }
+            }
+        }
+    }
+
+    private void executeAll(List<? extends Runnable> runnables)
     {
         assert !this.destroyed.get() : "trying to use a destroyed object";
-        native_execute(this.nativeRef, r);
+        int queued = 0;
+        int drainers = 0;
+        synchronized (this.ring)
+        {
+            if (this.isShutdown) throw new RejectedExecutionException("executor has been shut down");
+            this.outstanding += runnables.size();
+            for (; queued < runnables.size() && this.size < RING_CAPACITY; ++queued)
+            {
+                this.ring[(this.head + this.size) & (RING_CAPACITY - 1)] = runnables.get(queued);
+                ++this.size;
+            }
+            // A single Runnable only needs a drain if none is pending, a burst one per processor
+            final int wanted = Math.min(queued, Runtime.getRuntime().availableProcessors());
+            if (this.pendingDrains < wanted)
+            {
+                drainers = wanted - this.pendingDrains;
+                this.pendingDrains = wanted;
+            }
+        }
+        if (drainers > 0)
+        {
+            nativeSignal(this.nativeRef, drainers);
+        }
+        // The ring is full, fall back to one native task per Runnable
+        for (int i = queued; i < runnables.size(); ++i)
+        {
+            final Runnable r = runnables.get(i);
+            native_execute(this.nativeRef, new Runnable()
+            {
+                @Override
+                public void run()
+                {
+                    runSafely(r);
+                    taskDone(1);
+                }
+            });
+        }
     }
     private native void native_execute(long _nativeRef, Runnable r);
+    // Schedule `count` native tasks calling drain()
+    private native void nativeSignal(long _nativeRef, int count);
+
+    // Called from native workers in a single JNI transition per batch
+    private void drain()
+    {
+        boolean first = true;
+        int finished = 0;
+        for (int i = 0; ; ++i)
+        {
+            Runnable r;
+            boolean signal = false;
+            synchronized (this.ring)
+            {
+                if (first)
+                {
+                    // From now on new Runnables need another drain task
+                    --this.pendingDrains;
+                    first = false;
+                }
+                taskDoneLocked(finished);
+                finished = 0;
+                if (i == BATCH_SIZE || this.size == 0) return;
+                r = take();
+                // Get another worker to help while we run this one
+                if (this.size > 0 && this.pendingDrains == 0)
+                {
+                    this.pendingDrains = 1;
+                    signal = true;
+                }
+            }
+            if (signal)
+            {
+                nativeSignal(this.nativeRef, 1);
+            }
+            runSafely(r);
+            finished = 1;
+        }
+    }
+
+    private Runnable take()
+    {
+        final Runnable r = this.ring[this.head];
+        this.ring[this.head] = null;
+        this.head = (this.head + 1) & (RING_CAPACITY - 1);
+        --this.size;
+        return r;
+    }
+
+    private void taskDone(int n)
+    {
+        synchronized (this.ring)
+        {
+            taskDoneLocked(n);
+        }
+    }
+
+    private void taskDoneLocked(int n)
+    {
+        this.outstanding -= n;
+        if (n > 0 && this.outstanding == 0 && this.isShutdown) this.ring.notifyAll();
+    }
+
+    private static void runSafely(Runnable r)
+    {
+        try
+        {
+            r.run();
+        }
+        catch (Throwable e)
+        {
+            // Don't lose the rest of the batch
+            Thread t = Thread.currentThread();
+            t.getUncaughtExceptionHandler().uncaughtException(t, e);
+        }
+    }
 }
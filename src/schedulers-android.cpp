@@ -13,9 +13,11 @@
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 #include "schedulers/schedulers.hpp"
+#include <android/choreographer.h>
 #include <android/looper.h>
-#include <fcntl.h>
+#include <sys/eventfd.h>
 #include <cerrno>
+#include <memory>
 #include <unistd.h>
 
 using namespace schedulers;
@@ -24,57 +26,160 @@ namespace
 {
   auto looper_callback(int fd, int events, void* data) -> int
   {
-    std::int8_t byte;
-		// We cannot loop here otherwise we could get into infinite loops if the callback enqueues a new callback on the main thread. However we know there are as many bytes waiting in the pipe as there are scheduled callbacks so this callback will be called again for each.
-		if(read(fd, &byte, sizeof(byte)) > 0)
+    eventfd_t count;
+    // Reading resets the counter. drain() is bounded so tasks scheduling more main thread work cannot keep us from returning to the looper, instead we signal ourselves again if anything is left.
+    if(eventfd_read(fd, &count) == 0 && main_thread_task_queue::get().drain())
     {
-      detail::work_item f;
-      if(main_thread_task_queue::get().try_pop(f))
-      {
-        move(f)();
-      }
+      eventfd_write(fd, 1);
     }
     return 1; // Continue receiving events
   }
 }
 
+auto android_main_looper::timer_callback(int fd, int events, void* data) -> int
+{
+  auto& looper = *static_cast<const android_main_looper*>(data);
+  // Due tasks run from looper_callback() so they are bounded like all others
+  if(looper._timers->fire(main_thread_task_queue::get()))
+  {
+    eventfd_write(looper._event_fd, 1);
+  }
+  return 1;
+}
+
 android_main_looper::android_main_looper()
 : _looper(ALooper_forThread())
 {
   assert(_looper && "no android looper in current thread?");
 
-  int fd[2];
-  if(pipe2(fd, O_NONBLOCK | O_CLOEXEC) == 0)
+  _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(_event_fd < 0)
   {
-    _read_fd = fd[0];
-    _write_fd = fd[1];
+    throw std::system_error{errno, std::system_category(), "Unable to create eventfd for ALooper."};
   }
-  else
+
+  if(ALooper_addFd(_looper, _event_fd, ALOOPER_POLL_CALLBACK, ALOOPER_EVENT_INPUT, looper_callback, nullptr) != 1)
   {
-    throw std::system_error{errno, std::system_category(), "Unable to create pipe for ALooper."};
+    const auto error = errno;
+    close(_event_fd);
+    throw std::system_error{error, std::system_category(), "Unable to add eventfd to ALooper."};
   }
 
-  if(ALooper_addFd(_looper, _read_fd, ALOOPER_POLL_CALLBACK, ALOOPER_EVENT_INPUT, looper_callback, nullptr) != 1)
+  try
   {
-    close(_read_fd);
-    close(_write_fd);
-    throw std::system_error{errno, std::system_category(), "Unable to add pipe to ALooper."};
+    _timers.reset(new detail::timerfd_timers);
+    if(ALooper_addFd(_looper, _timers->fd(), ALOOPER_POLL_CALLBACK, ALOOPER_EVENT_INPUT, timer_callback, this) != 1)
+    {
+      throw std::system_error{errno, std::system_category(), "Unable to add timerfd to ALooper."};
+    }
+  }
+  catch(...)
+  {
+    ALooper_removeFd(_looper, _event_fd);
+    close(_event_fd);
+    throw;
   }
 }
 
 android_main_looper::~android_main_looper()
 {
-  ALooper_removeFd(_looper, _read_fd);
-  close(_read_fd);
-  close(_write_fd);
+  ALooper_removeFd(_looper, _timers->fd());
+  ALooper_removeFd(_looper, _event_fd);
+  close(_event_fd);
   main_thread_task_queue::get().clear();
 }
 
+auto android_main_looper::running_in_this_thread() const noexcept -> bool
+{
+  return ALooper_forThread() == _looper;
+}
+
 auto android_main_looper::post() const -> void
 {
-  std::int8_t byte = 0;
-  if(write(_write_fd, &byte, sizeof(byte)) < sizeof(byte))
+  // Only called when main_thread_task_queue asks for a signal, so the counter stays tiny
+  if(eventfd_write(_event_fd, 1) != 0)
+  {
+    throw std::system_error{errno, std::system_category(), "Unable to signal ALooper."};
+  }
+}
+
+auto android_main_looper::add_timer(std::chrono::steady_clock::time_point deadline, detail::work_item&& f) const -> void
+{
+  if(_timers->add(main_thread_task_queue::get(), deadline, move(f)))
+  {
+    post();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// android_choreographer
+//
+
+#if __ANDROID_API__ >= 24
+struct android_choreographer::state
+{
+  AChoreographer* choreographer;
+  std::chrono::nanoseconds budget;
+  main_thread_task_queue queue;
+};
+
+android_choreographer::android_choreographer(std::chrono::nanoseconds budget)
+: _state(std::make_shared<state>())
+{
+  _state->choreographer = AChoreographer_getInstance();
+  assert(_state->choreographer && "no android looper in current thread?");
+  _state->budget = budget;
+}
+
+android_choreographer::~android_choreographer()
+{
+  // A callback still posted finds the queue empty
+  _state->queue.clear();
+}
+
+auto android_choreographer::push(detail::work_item&& f, task_priority priority) const -> void
+{
+  if(_state->queue.push(move(f), priority))
+  {
+    post(_state);
+  }
+}
+
+auto android_choreographer::push(detail::cancellable_task&& task) const -> void
+{
+  if(_state->queue.push(move(task)))
+  {
+    post(_state);
+  }
+}
+
+auto android_choreographer::post(std::shared_ptr<state> s) -> void
+{
+  const auto choreographer = s->choreographer;
+  auto data = std::make_unique<std::shared_ptr<state>>(move(s));
+  // The choreographer handles callbacks posted from other threads by messaging its looper
+#if __ANDROID_API__ >= 29
+  AChoreographer_postFrameCallback64(choreographer, frame_callback, data.get());
+#else
+  // The frame time is truncated on 32 bit platforms
+  AChoreographer_postFrameCallback(choreographer, [] (long frame_time_nanos, void* data)
+  {
+    frame_callback(sizeof(long) >= sizeof(std::int64_t) ? frame_time_nanos : 0, data);
+  }, data.get());
+#endif
+  data.release();
+}
+
+auto android_choreographer::frame_callback(std::int64_t frame_time_nanos, void* data) -> void
+{
+  auto s = std::unique_ptr<std::shared_ptr<state>>{static_cast<std::shared_ptr<state>*>(data)};
+  // The frame time is the vsync on CLOCK_MONOTONIC like steady_clock, so a late callback doesn't get the whole budget
+  const auto frame_start = frame_time_nanos > 0
+                         ? std::chrono::steady_clock::time_point{std::chrono::nanoseconds(frame_time_nanos)}
+                         : std::chrono::steady_clock::now();
+  if((*s)->queue.drain_until(frame_start + (*s)->budget))
   {
-    throw std::system_error{errno, std::system_category(), "ALooper buffer overflow."};
+    post(move(*s));
   }
 }
+#endif
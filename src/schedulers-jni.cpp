@@ -15,6 +15,7 @@
 #include "schedulers/djinni/schedulers-jni.hpp"
 #include <jni.h>
 #include <cstdlib>
+#include <utility>
 
 using namespace schedulers;
 
@@ -30,6 +31,7 @@ namespace
   struct de_knejp_schedulers_SharedNativeThreadPoolExecutor
   {
     const djinni::GlobalRef<jclass> clazz{djinni::jniFindClass("de/knejp/schedulers/SharedNativeThreadPoolExecutor")};
+    const jmethodID method_drain{djinni::jniGetMethodID(clazz.get(), "drain", "()V")};
   };
   struct de_knejp_schedulers_NativeWorkerCallstack
   {
@@ -52,6 +54,14 @@ jni::default_scheduler::~default_scheduler() = default;
 
 namespace
 {
+  // Set for the whole lifetime of the pool's workers so they don't have to ask the JVM for every task
+  thread_local JNIEnv* worker_env = nullptr;
+
+  auto thread_env() -> JNIEnv*
+  {
+    return worker_env ? worker_env : djinni::jniGetThreadEnv();
+  }
+
   // Sometimes in jni.h the signature is
   // AttachCurrentThread(void**, void*) and sometimes it's
   // AttachCurrentThread(JNIEnv**, void*).
@@ -115,6 +125,15 @@ namespace
                                   reinterpret_cast<jlong>(&f));
       }};
   };
+
+  // The workers are attached to the JVM by make_java_attached_thread before the pool starts them, so the hooks only cache their JNIEnv
+  auto java_worker_hooks() -> thread_pool_hooks
+  {
+    thread_pool_hooks hooks;
+    hooks.on_start = [] (unsigned) { worker_env = djinni::jniGetThreadEnv(); };
+    hooks.on_stop = [] (unsigned) { worker_env = nullptr; };
+    return hooks;
+  }
 }
 
 CJNIEXPORT void JNICALL Java_de_knejp_schedulers_NativeWorkerCallstack_run(JNIEnv* jniEnv,
@@ -134,7 +153,7 @@ CJNIEXPORT void JNICALL Java_de_knejp_schedulers_NativeWorkerCallstack_run(JNIEn
 }
 
 java_shared_native_pool::java_shared_native_pool(int num_threads)
-: _pool(std::make_shared<pool_t>(make_java_attached_thread, num_threads))
+: _pool(std::make_shared<pool_t>(make_java_attached_thread, num_threads, thread_pool_idle_policy{}, java_worker_hooks()))
 {
 }
 
@@ -157,6 +176,12 @@ CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_
   JNI_TRANSLATE_EXCEPTIONS_RETURN(jniEnv, )
 }
 
+CJNIEXPORT jboolean JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_nativeOnWorkerThread(JNIEnv* /*jniEnv*/,
+                                                                                                        jclass /*clazz*/)
+{
+  return worker_env ? JNI_TRUE : JNI_FALSE;
+}
+
 CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_native_1execute(JNIEnv* jniEnv,
                                                                                                 jobject /*this*/,
                                                                                                 jlong nativeRef,
@@ -176,7 +201,7 @@ CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_
       { }
       F(const F& other) noexcept
       {
-        auto jniEnv = djinni::jniGetThreadEnv();
+        auto jniEnv = thread_env();
         _runnable = other._runnable ? jniEnv->NewGlobalRef(other._runnable) : nullptr;
       }
       F(F&& other) noexcept
@@ -188,7 +213,7 @@ CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_
       {
         if(_runnable)
         {
-          djinni::jniGetThreadEnv()->DeleteGlobalRef(_runnable);
+          thread_env()->DeleteGlobalRef(_runnable);
         }
       }
 
@@ -196,7 +221,7 @@ CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_
       {
         assert(_runnable && "lost runnable reference");
         auto& data = djinni::JniClass<java_lang_Runnable>::get();
-        auto* env = djinni::jniGetThreadEnv();
+        auto* env = thread_env();
         env->CallVoidMethod(_runnable, data.method_run);
         djinni::jniExceptionCheck(env);
       }
@@ -211,3 +236,59 @@ CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_
   }
   JNI_TRANSLATE_EXCEPTIONS_RETURN(jniEnv, )
 }
+
+CJNIEXPORT void JNICALL Java_de_knejp_schedulers_SharedNativeThreadPoolExecutor_nativeSignal(JNIEnv* jniEnv,
+                                                                                              jobject j_this,
+                                                                                              jlong nativeRef,
+                                                                                              jint count)
+{
+  try
+  {
+    DJINNI_FUNCTION_PROLOGUE1(jniEnv, nativeRef);
+    const auto& ref = djinni::objectFromHandleAddress<thread_pool>(nativeRef);
+
+    // Runs SharedNativeThreadPoolExecutor.drain(), which takes a batch of Runnables from the Java side ring in a single JNI transition. The only global reference is the one for the executor, once per batch.
+    class drain_task
+    {
+    public:
+      drain_task(JNIEnv* jniEnv, jobject executor)
+      : _executor(jniEnv->NewGlobalRef(executor))
+      {
+        djinni::jniExceptionCheck(jniEnv);
+      }
+      drain_task(drain_task&& other) noexcept
+      : _executor(std::exchange(other._executor, nullptr))
+      { }
+      ~drain_task()
+      {
+        if(_executor)
+        {
+          thread_env()->DeleteGlobalRef(_executor);
+        }
+      }
+
+      void operator()() const
+      {
+        const auto& data = djinni::JniClass<de_knejp_schedulers_SharedNativeThreadPoolExecutor>::get();
+        auto* env = thread_env();
+        env->CallVoidMethod(_executor, data.method_drain);
+        djinni::jniExceptionCheck(env);
+      }
+
+    private:
+      jobject _executor;
+    };
+
+    if(count == 1)
+    {
+      (*ref)(drain_task{jniEnv, j_this});
+    }
+    else if(count > 1)
+    {
+      // One bulk submission shares the executor reference between all drain tasks
+      ref->bulk(static_cast<std::size_t>(count), [task = drain_task{jniEnv, j_this}] (std::size_t) { task(); });
+    }
+
+  }
+  JNI_TRANSLATE_EXCEPTIONS_RETURN(jniEnv, )
+}
@@ -0,0 +1,283 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/schedulers.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace schedulers;
+
+////////////////////////////////////////////////////////////////////////////////
+// detail::timerfd_timers
+//
+
+schedulers::detail::timerfd_timers::timerfd_timers()
+: _fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+{
+  if(_fd < 0)
+  {
+    throw std::system_error{errno, std::system_category(), "Unable to create timerfd."};
+  }
+}
+
+schedulers::detail::timerfd_timers::~timerfd_timers()
+{
+  close(_fd);
+}
+
+auto schedulers::detail::timerfd_timers::add(const main_thread_task_queue& queue, std::chrono::steady_clock::time_point deadline, work_item&& f) -> bool
+{
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    const auto previous = _wheel.next_deadline();
+    if(_wheel.insert(deadline, f))
+    {
+      if(_wheel.next_deadline() < previous)
+      {
+        arm();
+      }
+      return false;
+    }
+  }
+  // Already due
+  return queue.push(move(f));
+}
+
+auto schedulers::detail::timerfd_timers::fire(const main_thread_task_queue& queue) -> bool
+{
+  std::uint64_t expirations;
+  if(read(_fd, &expirations, sizeof(expirations)) <= 0)
+  {
+    return false;
+  }
+  std::vector<work_item> expired;
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _wheel.advance(std::chrono::steady_clock::now(), expired);
+    arm();
+  }
+  auto signal = false;
+  for(auto& f : expired)
+  {
+    signal = queue.push(move(f)) || signal;
+  }
+  return signal;
+}
+
+auto schedulers::detail::timerfd_timers::arm() -> void
+{
+  // steady_clock is CLOCK_MONOTONIC on Linux and Android
+  itimerspec spec{};
+  const auto deadline = _wheel.next_deadline();
+  if(deadline != std::chrono::steady_clock::time_point::max())
+  {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    // A zero value disarms the timer
+    if(spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+    {
+      spec.it_value.tv_nsec = 1;
+    }
+  }
+  timerfd_settime(_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// linux_event_loop
+//
+
+struct linux_event_loop::state
+{
+  // Held by shared_ptr so a handler can remove itself or others while the loop goes through the ready file descriptors
+  std::unordered_map<int, std::shared_ptr<const io_handler>> handlers;
+  detail::timerfd_timers timers;
+};
+
+namespace
+{
+  auto watch(int epoll, int op, int fd, std::uint32_t events) -> void
+  {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = fd;
+    if(epoll_ctl(epoll, op, fd, &event) != 0)
+    {
+      throw std::system_error{errno, std::system_category(), "Unable to change the file descriptors of linux_event_loop."};
+    }
+  }
+}
+
+linux_event_loop::linux_event_loop(std::chrono::nanoseconds budget)
+: _thread(std::this_thread::get_id())
+, _budget(budget)
+, _state(new state)
+{
+  _epoll = epoll_create1(EPOLL_CLOEXEC);
+  if(_epoll < 0)
+  {
+    throw std::system_error{errno, std::system_category(), "Unable to create epoll instance for linux_event_loop."};
+  }
+  _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  try
+  {
+    if(_event_fd < 0)
+    {
+      throw std::system_error{errno, std::system_category(), "Unable to create eventfd for linux_event_loop."};
+    }
+    watch(_epoll, EPOLL_CTL_ADD, _event_fd, EPOLLIN);
+    watch(_epoll, EPOLL_CTL_ADD, _state->timers.fd(), EPOLLIN);
+  }
+  catch(...)
+  {
+    if(_event_fd >= 0)
+    {
+      close(_event_fd);
+    }
+    close(_epoll);
+    throw;
+  }
+}
+
+linux_event_loop::~linux_event_loop()
+{
+  close(_event_fd);
+  close(_epoll);
+  _queue.clear();
+}
+
+auto linux_event_loop::add(int fd, std::uint32_t events, io_handler handler) -> void
+{
+  assert(running_in_this_thread() && "file descriptors must be added on the thread of the linux_event_loop");
+  auto h = std::make_shared<const io_handler>(move(handler));
+  watch(_epoll, EPOLL_CTL_ADD, fd, events);
+  _state->handlers[fd] = move(h);
+}
+
+auto linux_event_loop::modify(int fd, std::uint32_t events) -> void
+{
+  assert(running_in_this_thread() && "file descriptors must be modified on the thread of the linux_event_loop");
+  watch(_epoll, EPOLL_CTL_MOD, fd, events);
+}
+
+auto linux_event_loop::remove(int fd) -> void
+{
+  assert(running_in_this_thread() && "file descriptors must be removed on the thread of the linux_event_loop");
+  if(_state->handlers.erase(fd) > 0)
+  {
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+auto linux_event_loop::run() -> void
+{
+  while(!_stopped)
+  {
+    run_once(std::chrono::milliseconds{-1});
+  }
+  _stopped = false;
+}
+
+auto linux_event_loop::run_once(std::chrono::milliseconds timeout) -> void
+{
+  assert(running_in_this_thread() && "linux_event_loop must run on the thread which created it");
+
+  constexpr int max_events = 64;
+  epoll_event events[max_events];
+  const auto n = epoll_wait(_epoll, events, max_events, timeout.count() < 0 ? -1 : static_cast<int>(std::min<std::chrono::milliseconds::rep>(timeout.count(), INT_MAX)));
+  if(n < 0)
+  {
+    if(errno == EINTR)
+    {
+      return;
+    }
+    throw std::system_error{errno, std::system_category(), "Unable to wait for linux_event_loop events."};
+  }
+
+  auto signaled = false;
+  try
+  {
+    for(int i = 0; i < n; ++i)
+    {
+      const auto fd = events[i].data.fd;
+      if(fd == _event_fd)
+      {
+        // Reading resets the counter
+        eventfd_t count;
+        signaled = eventfd_read(_event_fd, &count) == 0 || signaled;
+      }
+      else if(fd == _state->timers.fd())
+      {
+        // Due tasks go to the queue, if they ask for a signal we drain below anyway
+        signaled = _state->timers.fire(_queue) || signaled;
+      }
+      else
+      {
+        const auto it = _state->handlers.find(fd);
+        // A previous handler may have removed it
+        if(it != _state->handlers.end())
+        {
+          const auto handler = it->second;
+          (*handler)(events[i].events);
+        }
+      }
+    }
+  }
+  catch(...)
+  {
+    // The queue still waits for the signal we consumed, so give it back or it never asks for another one
+    if(signaled)
+    {
+      post();
+    }
+    throw;
+  }
+
+  // drain() is bounded so tasks scheduling more tasks cannot starve I/O, instead we signal ourselves again if anything is left
+  if(signaled && _queue.drain(main_thread_task_queue::default_batch_size, _budget))
+  {
+    post();
+  }
+}
+
+auto linux_event_loop::stop() const -> void
+{
+  (*this)([this] { _stopped = true; });
+}
+
+auto linux_event_loop::post() const -> void
+{
+  // Only called when the queue asks for a signal, so the counter stays tiny
+  if(eventfd_write(_event_fd, 1) != 0)
+  {
+    throw std::system_error{errno, std::system_category(), "Unable to signal linux_event_loop."};
+  }
+}
+
+auto linux_event_loop::add_timer(std::chrono::steady_clock::time_point deadline, detail::work_item&& f) const -> void
+{
+  if(_state->timers.add(_queue, deadline, move(f)))
+  {
+    post();
+  }
+}
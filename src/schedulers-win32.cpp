@@ -0,0 +1,260 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/schedulers.hpp"
+#include <algorithm>
+#include <system_error>
+
+using namespace schedulers;
+
+namespace
+{
+  [[noreturn]] auto throw_last_error(const char* what) -> void
+  {
+    throw std::system_error{static_cast<int>(::GetLastError()), std::system_category(), what};
+  }
+
+  // Posted whenever the main_thread_task_queue requests a signal
+  constexpr UINT drain_message = WM_USER;
+  // Continues a batch which ran out of budget once more urgent messages had their turn
+  constexpr UINT_PTR drain_timer = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// win32_thread_pool
+//
+
+win32_thread_pool::win32_thread_pool(unsigned max_threads, unsigned min_threads)
+: _max_threads(std::max(1u, max_threads))
+{
+  for(auto& lane : _lanes)
+  {
+    lane.pool = this;
+    ::InitializeThreadpoolEnvironment(&lane.environment);
+  }
+  _pool = ::CreateThreadpool(nullptr);
+  _cleanup = _pool ? ::CreateThreadpoolCleanupGroup() : nullptr;
+  if(!_cleanup)
+  {
+    const auto error = ::GetLastError();
+    close(TRUE);
+    throw std::system_error{static_cast<int>(error), std::system_category(), "Unable to create Win32 thread pool."};
+  }
+  ::SetThreadpoolThreadMaximum(_pool, _max_threads);
+  if(!::SetThreadpoolThreadMinimum(_pool, std::min(min_threads, _max_threads)))
+  {
+    const auto error = ::GetLastError();
+    close(TRUE);
+    throw std::system_error{static_cast<int>(error), std::system_category(), "Unable to start the threads of Win32 thread pool."};
+  }
+  for(std::size_t i = 0; i < num_task_priorities; ++i)
+  {
+    auto& lane = _lanes[i];
+    ::SetThreadpoolCallbackPool(&lane.environment, _pool);
+    ::SetThreadpoolCallbackCleanupGroup(&lane.environment, _cleanup, nullptr);
+    ::SetThreadpoolCallbackPriority(&lane.environment, detail::win32_callback_priority(static_cast<task_priority>(i)));
+    lane.work = ::CreateThreadpoolWork(&run_lane, &lane, &lane.environment);
+    if(!lane.work)
+    {
+      const auto error = ::GetLastError();
+      close(TRUE);
+      throw std::system_error{static_cast<int>(error), std::system_category(), "Unable to create Win32 thread pool work."};
+    }
+  }
+}
+
+win32_thread_pool::~win32_thread_pool()
+{
+  shutdown(shutdown_mode::drain);
+}
+
+auto win32_thread_pool::close(BOOL cancel_pending) noexcept -> void
+{
+  if(_cleanup)
+  {
+    // Closes the work objects of all lanes after waiting for the running callbacks
+    ::CloseThreadpoolCleanupGroupMembers(_cleanup, cancel_pending, nullptr);
+    ::CloseThreadpoolCleanupGroup(_cleanup);
+    _cleanup = nullptr;
+  }
+  for(auto& lane : _lanes)
+  {
+    lane.work = nullptr;
+    ::DestroyThreadpoolEnvironment(&lane.environment);
+  }
+  if(_pool)
+  {
+    ::CloseThreadpool(_pool);
+    _pool = nullptr;
+  }
+}
+
+auto win32_thread_pool::push(task_priority priority, detail::work_item&& f) const -> void
+{
+  auto& lane = _lanes[static_cast<std::size_t>(priority)];
+  std::lock_guard<std::mutex> lock{lane.mutex};
+  if(lane.closed)
+  {
+    return;
+  }
+  lane.queue.push_back(move(f));
+  _outstanding.fetch_add(1, std::memory_order_relaxed);
+  ::SubmitThreadpoolWork(lane.work);
+}
+
+auto win32_thread_pool::push_bulk(detail::work_item* first, detail::work_item* last) const -> void
+{
+  auto& lane = _lanes[static_cast<std::size_t>(task_priority::normal)];
+  std::lock_guard<std::mutex> lock{lane.mutex};
+  if(lane.closed)
+  {
+    return;
+  }
+  lane.queue.insert(lane.queue.end(), std::make_move_iterator(first), std::make_move_iterator(last));
+  _outstanding.fetch_add(last - first, std::memory_order_relaxed);
+  for(; first != last; ++first)
+  {
+    ::SubmitThreadpoolWork(lane.work);
+  }
+}
+
+auto CALLBACK win32_thread_pool::run_lane(PTP_CALLBACK_INSTANCE, PVOID context, PTP_WORK) -> void
+{
+  auto& self = *static_cast<lane*>(context);
+  detail::work_item f;
+  {
+    std::lock_guard<std::mutex> lock{self.mutex};
+    // Every submission belongs to one task, unless shutdown() discarded it
+    if(self.queue.empty())
+    {
+      return;
+    }
+    f = move(self.queue.front());
+    self.queue.pop_front();
+  }
+  struct finish_guard
+  {
+    const win32_thread_pool* pool;
+    ~finish_guard()
+    {
+      pool->_outstanding.fetch_sub(1, std::memory_order_release);
+    }
+  };
+  finish_guard finished{self.pool};
+  move(f)();
+}
+
+auto win32_thread_pool::wait_idle() const -> void
+{
+  // Tasks may schedule to lanes we already waited for, so keep going until nothing is left anywhere
+  while(_outstanding.load(std::memory_order_acquire) != 0)
+  {
+    for(auto& lane : _lanes)
+    {
+      if(lane.work)
+      {
+        ::WaitForThreadpoolWorkCallbacks(lane.work, FALSE);
+      }
+    }
+  }
+}
+
+auto win32_thread_pool::shutdown(shutdown_mode mode) -> void
+{
+  if(!_pool)
+  {
+    return;
+  }
+  if(mode == shutdown_mode::drain)
+  {
+    wait_idle();
+  }
+  // Destroyed after the callbacks are gone in case their destructors schedule more work
+  std::deque<detail::work_item> discarded[num_task_priorities];
+  for(std::size_t i = 0; i < num_task_priorities; ++i)
+  {
+    std::lock_guard<std::mutex> lock{_lanes[i].mutex};
+    _lanes[i].closed = true;
+    discarded[i].swap(_lanes[i].queue);
+  }
+  // Cancelled callbacks would only find empty lanes
+  close(mode == shutdown_mode::discard);
+  _outstanding.store(0, std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// win32_message_queue
+//
+
+win32_message_queue::win32_message_queue(std::chrono::nanoseconds budget)
+: _budget(budget)
+, _thread(::GetCurrentThreadId())
+{
+  // Registered once and never unregistered, the class is released with the process
+  static const auto window_class = []
+  {
+    WNDCLASSEXW wc{};
+    wc.cbSize = sizeof(wc);
+    wc.lpfnWndProc = &window_proc;
+    wc.hInstance = ::GetModuleHandleW(nullptr);
+    wc.lpszClassName = L"schedulers::win32_message_queue";
+    const auto atom = ::RegisterClassExW(&wc);
+    if(!atom)
+    {
+      throw_last_error("Unable to register the window class of win32_message_queue.");
+    }
+    return atom;
+  }();
+  _window = ::CreateWindowExW(0, MAKEINTATOM(window_class), L"", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, ::GetModuleHandleW(nullptr), nullptr);
+  if(!_window)
+  {
+    throw_last_error("Unable to create the window of win32_message_queue.");
+  }
+  // Messages sent while creating the window only reach DefWindowProcW()
+  ::SetWindowLongPtrW(_window, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(this));
+}
+
+win32_message_queue::~win32_message_queue()
+{
+  // Messages still posted to the window are discarded with it
+  ::DestroyWindow(_window);
+  _queue.clear();
+}
+
+auto win32_message_queue::post() const -> void
+{
+  if(!::PostMessageW(_window, drain_message, 0, 0))
+  {
+    throw_last_error("Unable to post to the window of win32_message_queue.");
+  }
+}
+
+auto CALLBACK win32_message_queue::window_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam) -> LRESULT
+{
+  if(message != drain_message && !(message == WM_TIMER && wparam == drain_timer))
+  {
+    return ::DefWindowProcW(window, message, wparam, lparam);
+  }
+  auto self = reinterpret_cast<const win32_message_queue*>(::GetWindowLongPtrW(window, GWLP_USERDATA));
+  if(message == WM_TIMER)
+  {
+    ::KillTimer(window, drain_timer);
+  }
+  // Posted messages come before input, timers come after it
+  if(self->_queue.drain_for(self->_budget) && !::SetTimer(window, drain_timer, USER_TIMER_MINIMUM, nullptr))
+  {
+    self->post();
+  }
+  return 0;
+}
@@ -13,12 +13,45 @@
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
 #include "schedulers/schedulers.hpp"
+#include <algorithm>
+#include <limits>
+#include <utility>
 
 using schedulers::thread_pool;
 using schedulers::main_thread_task_queue;
-using schedulers::thread_pool_task_queue;
+using schedulers::priority_task_queue;
+using schedulers::task_priority;
+using schedulers::work_stealing_task_queue;
+using schedulers::work_stealing_thread_pool;
 
 const main_thread_task_queue main_thread_task_queue::_instance{};
+constexpr std::size_t main_thread_task_queue::default_batch_size;
+constexpr std::chrono::milliseconds main_thread_task_queue::default_batch_budget;
+
+////////////////////////////////////////////////////////////////////////////////
+// inlining_scheduler
+//
+
+auto schedulers::detail::inline_depth() noexcept -> unsigned&
+{
+  thread_local unsigned depth = 0;
+  return depth;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// current_worker
+//
+
+auto schedulers::detail::current_worker_slot() noexcept -> thread_pool_worker&
+{
+  thread_local thread_pool_worker worker{nullptr, 0};
+  return worker;
+}
+
+auto schedulers::current_worker() noexcept -> thread_pool_worker
+{
+  return detail::current_worker_slot();
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 // main_thread_task_queue
@@ -26,34 +59,107 @@ const main_thread_task_queue main_thread_task_queue::_instance{};
 
 auto main_thread_task_queue::clear() const noexcept -> void
 {
-  std::deque<detail::work_item> temp;
+  std::deque<entry> temp[num_task_priorities];
   lock_t lock{_mutex};
-  swap(_queue, temp);
+  for(std::size_t i = 0; i < num_task_priorities; ++i)
+  {
+    swap(_queues[i], temp[i]);
+  }
+  // The signal may have gone with the scheduler's event source
+  _signaled = false;
 }
 
-auto main_thread_task_queue::push(detail::work_item&& f) const -> void
+auto main_thread_task_queue::push(detail::work_item&& f, task_priority priority) const -> bool
+{
+  return push_entry({move(f), nullptr}, priority);
+}
+
+auto main_thread_task_queue::push(detail::cancellable_task&& task, task_priority priority) const -> bool
+{
+  const auto cancel = &task.state();
+  return push_entry({{std::allocator_arg, std::allocator<char>(), move(task)}, cancel}, priority);
+}
+
+auto main_thread_task_queue::push_entry(entry&& e, task_priority priority) const -> bool
 {
   lock_t lock{_mutex};
-  _queue.emplace_back(move(f));
+  _queues[static_cast<std::size_t>(priority)].push_back(move(e));
+  return !std::exchange(_signaled, true);
 }
 
 auto main_thread_task_queue::try_pop(detail::work_item& f) const -> bool
 {
   lock_t lock{_mutex};
-  if(_queue.empty())
+  for(auto&& queue : _queues)
   {
-    return false;
+    while(!queue.empty())
+    {
+      // The callable of a cancelled task is already gone, dropping the placeholder only releases its state
+      auto& front = queue.front();
+      if(front.cancel && front.cancel->cancelled())
+      {
+        queue.pop_front();
+        continue;
+      }
+      f = move(front.work);
+      queue.pop_front();
+      return true;
+    }
   }
-  f = move(_queue.front());
-  _queue.pop_front();
-  return true;
+  return false;
+}
+
+auto main_thread_task_queue::drain(std::size_t max_tasks, std::chrono::nanoseconds budget) const -> bool
+{
+  return drain(max_tasks, std::chrono::steady_clock::now() + budget);
+}
+
+auto main_thread_task_queue::drain_until(std::chrono::steady_clock::time_point deadline) const -> bool
+{
+  return drain(std::numeric_limits<std::size_t>::max(), deadline);
+}
+
+auto main_thread_task_queue::drain(std::size_t max_tasks, std::chrono::steady_clock::time_point deadline) const -> bool
+{
+  try
+  {
+    for(std::size_t i = 0; i < max_tasks; ++i)
+    {
+      detail::work_item f;
+      if(!try_pop(f))
+      {
+        break;
+      }
+      move(f)();
+      if(std::chrono::steady_clock::now() >= deadline)
+      {
+        break;
+      }
+    }
+  }
+  catch(...)
+  {
+    lock_t lock{_mutex};
+    _signaled = false;
+    throw;
+  }
+  // Tasks pushed since the last try_pop() didn't signal, so check again under the lock
+  lock_t lock{_mutex};
+  _signaled = std::any_of(std::begin(_queues), std::end(_queues), [] (const auto& queue) { return !queue.empty(); });
+  return _signaled;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // thread_pool_task_queue
 //
 
-auto thread_pool_task_queue::done() const -> void
+template class schedulers::basic_thread_pool_task_queue<schedulers::detail::default_work_item_size>;
+
+////////////////////////////////////////////////////////////////////////////////
+// priority_task_queue
+//
+
+auto priority_task_queue::done() const -> void
 {
   {
     lock_t lock{_mutex};
@@ -62,57 +168,472 @@ auto thread_pool_task_queue::done() const -> void
   _ready.notify_all();
 }
 
-auto thread_pool_task_queue::try_pop(detail::work_item& f) const -> bool
+auto priority_task_queue::notify(bool wake) const -> void
 {
-  lock_t lock{_mutex, std::try_to_lock};
-  if(!lock || _queue.empty())
+  if(wake)
   {
-    return false;
+    _ready.notify_one();
   }
-  f = move(_queue.front());
-  _queue.pop_front();
-  return true;
 }
 
-auto thread_pool_task_queue::try_push(detail::work_item& f)  const -> bool
+auto priority_task_queue::push_locked(work_t& f, task_priority priority) const -> void
+{
+  const auto lane = static_cast<std::size_t>(priority);
+  _lanes[lane].emplace_back(move(f));
+  _non_empty.store(_non_empty.load(std::memory_order_relaxed) | (1u << lane), std::memory_order_relaxed);
+}
+
+auto priority_task_queue::pop_locked(std::size_t lane, work_t& f) const -> void
 {
+  f = move(_lanes[lane].front());
+  _lanes[lane].pop_front();
+  if(_lanes[lane].empty())
+  {
+    _non_empty.store(_non_empty.load(std::memory_order_relaxed) & ~(1u << lane), std::memory_order_relaxed);
+  }
+}
+
+auto priority_task_queue::push(work_t&& f, task_priority priority) const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    push_locked(f, priority);
+    wake = _sleeping > 0;
+  }
+  notify(wake);
+}
+
+auto priority_task_queue::try_push(work_t& f, task_priority priority) const -> bool
+{
+  bool wake;
   {
     lock_t lock{_mutex, std::try_to_lock};
     if(!lock)
     {
       return false;
     }
-    _queue.emplace_back(move(f));
+    push_locked(f, priority);
+    wake = _sleeping > 0;
   }
-  _ready.notify_one();
+  notify(wake);
   return true;
 }
 
-auto thread_pool_task_queue::pop(detail::work_item& f) const -> bool
+auto priority_task_queue::push_bulk(work_t* first, work_t* last) const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    for(; first != last; ++first)
+    {
+      push_locked(*first, task_priority::normal);
+    }
+    wake = _sleeping > 0;
+  }
+  notify(wake);
+}
+
+auto priority_task_queue::clear() const -> void
+{
+  std::deque<work_t> lanes[num_task_priorities];
+  {
+    lock_t lock{_mutex};
+    for(std::size_t lane = 0; lane < num_task_priorities; ++lane)
+    {
+      lanes[lane].swap(_lanes[lane]);
+    }
+    _non_empty.store(0, std::memory_order_relaxed);
+  }
+}
+
+auto priority_task_queue::try_pop(work_t& f) const -> bool
+{
+  if(_non_empty.load(std::memory_order_relaxed) == 0)
+  {
+    return false;
+  }
+  lock_t lock{_mutex, std::try_to_lock};
+  if(!lock)
+  {
+    return false;
+  }
+  for(std::size_t lane = 0; lane < num_task_priorities; ++lane)
+  {
+    if(!_lanes[lane].empty())
+    {
+      pop_locked(lane, f);
+      return true;
+    }
+  }
+  return false;
+}
+
+auto priority_task_queue::try_pop(work_t& f, task_priority priority) const -> bool
+{
+  const auto lane = static_cast<std::size_t>(priority);
+  if((_non_empty.load(std::memory_order_relaxed) & (1u << lane)) == 0)
+  {
+    return false;
+  }
+  lock_t lock{_mutex, std::try_to_lock};
+  if(!lock || _lanes[lane].empty())
+  {
+    return false;
+  }
+  pop_locked(lane, f);
+  return true;
+}
+
+auto priority_task_queue::pop(work_t& f) const -> bool
 {
   lock_t lock{_mutex};
-  while(_queue.empty() && !_done)
+  while(_non_empty.load(std::memory_order_relaxed) == 0 && !_done && !_interrupted)
   {
+    ++_sleeping;
     _ready.wait(lock);
+    --_sleeping;
+  }
+  for(std::size_t lane = 0; lane < num_task_priorities; ++lane)
+  {
+    if(!_lanes[lane].empty())
+    {
+      pop_locked(lane, f);
+      return true;
+    }
+  }
+  _interrupted = false;
+  return false;
+}
+
+auto priority_task_queue::pop_until(work_t& f, std::chrono::steady_clock::time_point deadline) const -> bool
+{
+  lock_t lock{_mutex};
+  auto status = std::cv_status::no_timeout;
+  while(_non_empty.load(std::memory_order_relaxed) == 0 && !_done && !_interrupted && status == std::cv_status::no_timeout)
+  {
+    ++_sleeping;
+    status = _ready.wait_until(lock, deadline);
+    --_sleeping;
+  }
+  for(std::size_t lane = 0; lane < num_task_priorities; ++lane)
+  {
+    if(!_lanes[lane].empty())
+    {
+      pop_locked(lane, f);
+      return true;
+    }
   }
-  if(_queue.empty())
+  _interrupted = false;
+  return false;
+}
+
+auto priority_task_queue::interrupt() const -> void
+{
+  bool wake;
+  {
+    lock_t lock{_mutex};
+    _interrupted = true;
+    wake = _sleeping > 0;
+  }
+  if(wake)
+  {
+    _ready.notify_one();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// work_stealing_task_queue
+//
+
+namespace
+{
+  // The queue bound to the current thread with bind_owner(), if any
+  thread_local const work_stealing_task_queue* owned_queue = nullptr;
+}
+
+work_stealing_task_queue::~work_stealing_task_queue()
+{
+  if(owned_queue == this)
+  {
+    owned_queue = nullptr;
+  }
+  while(auto n = _deque.take())
+  {
+    delete n;
+  }
+  while(auto n = try_pop_injected())
+  {
+    delete n;
+  }
+}
+
+auto work_stealing_task_queue::is_owner() const noexcept -> bool
+{
+  return owned_queue == this;
+}
+
+auto work_stealing_task_queue::bind_owner() const -> void
+{
+  assert((!owned_queue || owned_queue == this) && "a thread can only own one work_stealing_task_queue");
+  owned_queue = this;
+}
+
+auto work_stealing_task_queue::notify() const -> void
+{
+  // Pairs with the store to _sleeping in pop(): either we see the flag or the owner sees our work
+  if(_sleeping.load())
+  {
+    {
+      lock_t lock{_mutex};
+    }
+    _ready.notify_one();
+  }
+}
+
+auto work_stealing_task_queue::inject(node* first, node* last) const -> void
+{
+  // The nodes in [first, last] are already linked
+  last->next.store(nullptr, std::memory_order_relaxed);
+  auto prev = _injected_head.exchange(last);
+  // Between the exchange and this store the queue appears empty to the consumer
+  prev->next.store(first, std::memory_order_release);
+}
+
+auto work_stealing_task_queue::has_injected() const noexcept -> bool
+{
+  return _injected_head.load() != &_stub || _stub.next.load() != nullptr;
+}
+
+auto work_stealing_task_queue::try_pop_injected() const -> node*
+{
+  // This is Dmitry Vyukov's intrusive MPSC queue with the single consumer protected by a try-lock
+  if(_consuming.exchange(true, std::memory_order_acquire))
+  {
+    return nullptr;
+  }
+  auto tail = _injected_tail;
+  auto next = tail->next.load(std::memory_order_acquire);
+  auto result = static_cast<node*>(nullptr);
+  if(tail == &_stub)
+  {
+    if(next)
+    {
+      _injected_tail = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    else
+    {
+      tail = nullptr;
+    }
+  }
+  if(tail)
+  {
+    if(next)
+    {
+      _injected_tail = next;
+      result = tail;
+    }
+    else if(tail == _injected_head.load(std::memory_order_acquire))
+    {
+      // Only one item left, put the stub back behind it so we can take it
+      inject(&_stub, &_stub);
+      next = tail->next.load(std::memory_order_acquire);
+      if(next)
+      {
+        _injected_tail = next;
+        result = tail;
+      }
+    }
+  }
+  _consuming.store(false, std::memory_order_release);
+  return result;
+}
+
+auto work_stealing_task_queue::pop_local() const -> node*
+{
+  if(auto n = _deque.take())
+  {
+    return n;
+  }
+  auto n = try_pop_injected();
+  if(n)
+  {
+    // Move the rest of the injected work into the deque for thieves to take from
+    constexpr int batch = 32;
+    for(int i = 0; i < batch; ++i)
+    {
+      auto m = try_pop_injected();
+      if(!m)
+      {
+        break;
+      }
+      _deque.push(m);
+    }
+  }
+  return n;
+}
+
+auto work_stealing_task_queue::steal() const -> node*
+{
+  if(auto n = _deque.steal())
+  {
+    return n;
+  }
+  return try_pop_injected();
+}
+
+auto work_stealing_task_queue::done() const -> void
+{
+  _done = true;
+  {
+    lock_t lock{_mutex};
+  }
+  _ready.notify_all();
+}
+
+auto work_stealing_task_queue::try_pop(detail::work_item& f) const -> bool
+{
+  auto n = std::unique_ptr<node>{is_owner() ? pop_local() : steal()};
+  if(!n)
   {
     return false;
   }
-  f = move(_queue.front());
-  _queue.pop_front();
+  f = move(n->work);
   return true;
 }
 
-auto thread_pool_task_queue::push(detail::work_item&& f) const -> void
+auto work_stealing_task_queue::try_push(detail::work_item& f) const -> bool
+{
+  push(move(f));
+  return true;
+}
+
+auto work_stealing_task_queue::pop(detail::work_item& f) const -> bool
+{
+  assert(is_owner() && "only the owner of a work_stealing_task_queue can wait on it");
+
+  while(true)
+  {
+    if(auto n = std::unique_ptr<node>{pop_local()})
+    {
+      f = move(n->work);
+      return true;
+    }
+
+    // Only the owner pushes into the deque so we only have to watch for injected work while parked
+    lock_t lock{_mutex};
+    _sleeping = true;
+    while(!has_injected() && !_done && !_interrupted)
+    {
+      _ready.wait(lock);
+    }
+    _sleeping.store(false, std::memory_order_relaxed);
+    if(!has_injected())
+    {
+      _interrupted = false;
+      return false;
+    }
+  }
+}
+
+auto work_stealing_task_queue::pop_until(detail::work_item& f, std::chrono::steady_clock::time_point deadline) const -> bool
+{
+  assert(is_owner() && "only the owner of a work_stealing_task_queue can wait on it");
+
+  while(true)
+  {
+    if(auto n = std::unique_ptr<node>{pop_local()})
+    {
+      f = move(n->work);
+      return true;
+    }
+
+    lock_t lock{_mutex};
+    _sleeping = true;
+    auto status = std::cv_status::no_timeout;
+    while(!has_injected() && !_done && !_interrupted && status == std::cv_status::no_timeout)
+    {
+      status = _ready.wait_until(lock, deadline);
+    }
+    _sleeping.store(false, std::memory_order_relaxed);
+    if(!has_injected())
+    {
+      _interrupted = false;
+      return false;
+    }
+  }
+}
+
+auto work_stealing_task_queue::interrupt() const -> void
 {
   {
     lock_t lock{_mutex};
-    _queue.emplace_back(move(f));
+    _interrupted = true;
   }
   _ready.notify_one();
 }
 
+auto work_stealing_task_queue::push(detail::work_item&& f) const -> void
+{
+  auto n = new node;
+  n->work = move(f);
+  if(is_owner())
+  {
+    _deque.push(n);
+  }
+  else
+  {
+    inject(n, n);
+    notify();
+  }
+}
+
+auto work_stealing_task_queue::push_bulk(detail::work_item* first, detail::work_item* last) const -> void
+{
+  if(first == last)
+  {
+    return;
+  }
+  if(is_owner())
+  {
+    for(; first != last; ++first)
+    {
+      auto n = new node;
+      n->work = move(*first);
+      _deque.push(n);
+    }
+    return;
+  }
+
+  // Link all nodes before we publish them with a single exchange
+  auto head = std::unique_ptr<node>{new node};
+  head->work = move(*first++);
+  auto tail = head.get();
+  try
+  {
+    for(; first != last; ++first)
+    {
+      auto n = new node;
+      n->work = move(*first);
+      tail->next.store(n, std::memory_order_relaxed);
+      tail = n;
+    }
+  }
+  catch(...)
+  {
+    auto n = head->next.load(std::memory_order_relaxed);
+    while(n)
+    {
+      delete std::exchange(n, n->next.load(std::memory_order_relaxed));
+    }
+    throw;
+  }
+  inject(head.release(), tail);
+  notify();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // thread_pool
 //
@@ -125,6 +646,22 @@ namespace
   };
 }
 
-schedulers::thread_pool::thread_pool(int num_threads)
-: basic_thread_pool(make_thread)
+schedulers::thread_pool::thread_pool(int num_threads, thread_pool_idle_policy idle, thread_pool_hooks hooks)
+: basic_thread_pool(make_thread, num_threads, idle, move(hooks))
+{ }
+
+schedulers::pinned_thread_pool::pinned_thread_pool(const cpu_topology& topology, thread_pool_idle_policy idle, thread_pool_hooks hooks)
+: basic_thread_pool(pinned_thread_factory{topology}, static_cast<unsigned>(topology.cpus.size()), idle, move(hooks))
+{ }
+
+schedulers::priority_thread_pool::priority_thread_pool(int num_threads, thread_pool_idle_policy idle, thread_pool_hooks hooks)
+: basic_thread_pool(make_thread, num_threads, idle, move(hooks))
+{ }
+
+////////////////////////////////////////////////////////////////////////////////
+// work_stealing_thread_pool
+//
+
+work_stealing_thread_pool::work_stealing_thread_pool(int num_threads, thread_pool_idle_policy idle, thread_pool_hooks hooks)
+: basic_thread_pool(make_thread, num_threads, idle, move(hooks))
 { }
@@ -0,0 +1,101 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/serial_scheduler.hpp"
+#include "schedulers/task_allocator.hpp"
+#include <new>
+#include <thread>
+
+using schedulers::detail::serial_queue;
+using schedulers::detail::work_item;
+
+////////////////////////////////////////////////////////////////////////////////
+// serial_queue
+//
+
+serial_queue::~serial_queue()
+{
+  while(auto n = try_pop())
+  {
+    n->~node();
+    schedulers::detail::task_allocator_deallocate(n);
+  }
+}
+
+auto serial_queue::link(node* n) noexcept -> void
+{
+  n->next.store(nullptr, std::memory_order_relaxed);
+  auto prev = _head.exchange(n, std::memory_order_acq_rel);
+  // Between the exchange and this store the consumer cannot see n or anything after it yet
+  prev->next.store(n, std::memory_order_release);
+}
+
+auto serial_queue::push(work_item&& f) -> bool
+{
+  static_assert(sizeof(node) <= schedulers::task_allocator_max_block_size, "serial_queue nodes must fit into the task_allocator caches");
+  auto n = new (schedulers::detail::task_allocator_allocate(sizeof(node))) node;
+  n->work = move(f);
+  link(n);
+  return _pending.fetch_add(1, std::memory_order_acq_rel) == 0;
+}
+
+auto serial_queue::try_pop() noexcept -> node*
+{
+  // Dmitry Vyukov's intrusive MPSC queue, the same as the injection queue of work_stealing_task_queue but with only one consumer
+  auto tail = _tail;
+  auto next = tail->next.load(std::memory_order_acquire);
+  if(tail == &_stub)
+  {
+    if(!next)
+    {
+      return nullptr;
+    }
+    _tail = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if(next)
+  {
+    _tail = next;
+    return tail;
+  }
+  if(tail != _head.load(std::memory_order_acquire))
+  {
+    return nullptr;
+  }
+  // Only one item left, put the stub back behind it so we can take it
+  link(&_stub);
+  next = tail->next.load(std::memory_order_acquire);
+  if(next)
+  {
+    _tail = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+auto serial_queue::pop() -> work_item
+{
+  auto n = try_pop();
+  while(!n)
+  {
+    // The task is pending so a producer is only about to link it
+    std::this_thread::yield();
+    n = try_pop();
+  }
+  auto f = move(n->work);
+  n->~node();
+  schedulers::detail::task_allocator_deallocate(n);
+  return f;
+}
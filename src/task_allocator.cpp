@@ -0,0 +1,295 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/task_allocator.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace
+{
+  // Blocks of 32, 64, 128, 256 and 512 bytes payload
+  constexpr std::size_t min_block_shift = 5;
+  constexpr std::size_t num_size_classes = 5;
+  static_assert((std::size_t(1) << (min_block_shift + num_size_classes - 1)) == schedulers::task_allocator_max_block_size, "size classes don't match task_allocator_max_block_size");
+
+  // Number of remotely freed blocks collected before they are handed back to their owner
+  constexpr unsigned remote_batch_size = 32;
+  constexpr std::size_t slab_size = 64 * 1024;
+
+  struct thread_cache;
+
+  // Every block is preceded by a header identifying where it has to go back to. The payload itself is used as the free list link.
+  struct alignas(std::max_align_t) block_header
+  {
+    thread_cache* owner; // nullptr if allocated with plain operator new
+    unsigned size_class;
+  };
+
+  struct free_block
+  {
+    free_block* next;
+  };
+
+  auto header_of(void* p) noexcept
+  {
+    return static_cast<block_header*>(p) - 1;
+  }
+
+  auto payload_of(block_header* h) noexcept -> void*
+  {
+    return h + 1;
+  }
+
+  auto block_of(block_header* h) noexcept
+  {
+    return static_cast<free_block*>(payload_of(h));
+  }
+
+  auto size_class_of(std::size_t bytes) noexcept
+  {
+    auto c = 0u;
+    while((std::size_t(1) << (min_block_shift + c)) < bytes)
+    {
+      ++c;
+    }
+    return c;
+  }
+
+  auto block_size(unsigned size_class) noexcept
+  {
+    return sizeof(block_header) + (std::size_t(1) << (min_block_shift + size_class));
+  }
+
+  struct thread_cache
+  {
+    // Only touched by the thread currently owning the cache
+    free_block* free[num_size_classes] = {};
+    char* slab_pos = nullptr;
+    char* slab_end = nullptr;
+    // Batch of blocks freed on this thread but owned by another cache
+    thread_cache* pending_owner = nullptr;
+    free_block* pending_first = nullptr;
+    free_block* pending_last = nullptr;
+    unsigned pending_count = 0;
+
+    // Blocks handed back to us by other threads
+    std::atomic<free_block*> remote{nullptr};
+
+    thread_cache* next_orphan = nullptr;
+
+    auto allocate(std::size_t bytes) -> void*;
+    auto deallocate(block_header* h) noexcept -> void;
+    auto flush_pending() noexcept -> void;
+    auto reclaim_remote() noexcept -> void;
+    auto carve(unsigned size_class) -> block_header*;
+  };
+
+  auto push_remote(thread_cache* owner, free_block* first, free_block* last) noexcept
+  {
+    auto head = owner->remote.load(std::memory_order_relaxed);
+    do
+    {
+      last->next = head;
+    }
+    while(!owner->remote.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  auto thread_cache::allocate(std::size_t bytes) -> void*
+  {
+    const auto c = size_class_of(bytes);
+    if(!free[c])
+    {
+      reclaim_remote();
+    }
+    if(auto b = free[c])
+    {
+      free[c] = b->next;
+      return b;
+    }
+    return payload_of(carve(c));
+  }
+
+  auto thread_cache::deallocate(block_header* h) noexcept -> void
+  {
+    auto b = block_of(h);
+    if(h->owner == this)
+    {
+      b->next = free[h->size_class];
+      free[h->size_class] = b;
+      return;
+    }
+    if(pending_owner != h->owner)
+    {
+      flush_pending();
+      pending_owner = h->owner;
+    }
+    b->next = pending_first;
+    pending_first = b;
+    if(!pending_last)
+    {
+      pending_last = b;
+    }
+    if(++pending_count == remote_batch_size)
+    {
+      flush_pending();
+    }
+  }
+
+  auto thread_cache::flush_pending() noexcept -> void
+  {
+    if(pending_first)
+    {
+      push_remote(pending_owner, pending_first, pending_last);
+    }
+    pending_owner = nullptr;
+    pending_first = nullptr;
+    pending_last = nullptr;
+    pending_count = 0;
+  }
+
+  auto thread_cache::reclaim_remote() noexcept -> void
+  {
+    auto b = remote.exchange(nullptr, std::memory_order_acquire);
+    while(b)
+    {
+      auto next = b->next;
+      auto h = header_of(b);
+      b->next = free[h->size_class];
+      free[h->size_class] = b;
+      b = next;
+    }
+  }
+
+  auto thread_cache::carve(unsigned size_class) -> block_header*
+  {
+    const auto size = block_size(size_class);
+    if(std::size_t(slab_end - slab_pos) < size)
+    {
+      // The remainder of the old slab is abandoned, slabs are never returned to the system
+      slab_pos = static_cast<char*>(::operator new(slab_size));
+      slab_end = slab_pos + slab_size;
+    }
+    auto h = new (static_cast<void*>(slab_pos)) block_header{this, size_class};
+    slab_pos += size;
+    return h;
+  }
+
+  // Caches of exited threads are recycled as other threads may still hold blocks pointing to them
+  std::mutex orphans_mutex;
+  thread_cache* orphans = nullptr;
+
+  auto adopt_or_create_cache() -> thread_cache*
+  {
+    {
+      std::lock_guard<std::mutex> lock{orphans_mutex};
+      if(auto c = orphans)
+      {
+        orphans = c->next_orphan;
+        c->next_orphan = nullptr;
+        return c;
+      }
+    }
+    return new thread_cache;
+  }
+
+  auto orphan_cache(thread_cache* c) noexcept
+  {
+    c->flush_pending();
+    std::lock_guard<std::mutex> lock{orphans_mutex};
+    c->next_orphan = orphans;
+    orphans = c;
+  }
+
+  // Only trivially destructible thread_locals so they remain accessible during thread exit
+  thread_local thread_cache* current_cache = nullptr;
+  thread_local bool thread_exited = false;
+
+  struct cache_guard
+  {
+    ~cache_guard()
+    {
+      thread_exited = true;
+      if(current_cache)
+      {
+        orphan_cache(current_cache);
+        current_cache = nullptr;
+      }
+    }
+  };
+
+  auto local_cache() -> thread_cache*
+  {
+    if(!current_cache && !thread_exited)
+    {
+      thread_local cache_guard guard;
+      current_cache = adopt_or_create_cache();
+    }
+    return current_cache;
+  }
+}
+
+auto schedulers::detail::task_allocator_allocate(std::size_t bytes) -> void*
+{
+  assert(bytes > 0 && bytes <= task_allocator_max_block_size);
+  if(auto c = local_cache())
+  {
+    return c->allocate(bytes);
+  }
+  // Allocations during thread exit bypass the caches
+  const auto size_class = size_class_of(bytes);
+  auto h = new (::operator new(block_size(size_class))) block_header{nullptr, size_class};
+  return payload_of(h);
+}
+
+auto schedulers::detail::task_allocator_flush() noexcept -> void
+{
+  if(auto c = current_cache)
+  {
+    c->flush_pending();
+  }
+}
+
+auto schedulers::detail::task_allocator_deallocate(void* p) noexcept -> void
+{
+  auto h = header_of(p);
+  if(!h->owner)
+  {
+    ::operator delete(h);
+  }
+  else if(auto c = current_cache)
+  {
+    c->deallocate(h);
+  }
+  else if(thread_exited)
+  {
+    auto b = block_of(h);
+    push_remote(h->owner, b, b);
+  }
+  else
+  {
+    // local_cache() can throw, so only call it if there is no alternative
+    try
+    {
+      local_cache()->deallocate(h);
+    }
+    catch(...)
+    {
+      auto b = block_of(h);
+      push_remote(h->owner, b, b);
+    }
+  }
+}
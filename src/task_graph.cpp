@@ -0,0 +1,110 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/task_graph.hpp"
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+using namespace schedulers;
+
+constexpr std::uint32_t task_graph::no_edge;
+constexpr std::size_t task_graph::arena_block_size;
+
+////////////////////////////////////////////////////////////////////////////////
+// task_graph
+//
+
+schedulers::task_graph::task_graph(task_graph&& other) noexcept
+: _nodes(move(other._nodes))
+, _edges(move(other._edges))
+, _arena(move(other._arena))
+, _arena_used(std::exchange(other._arena_used, arena_block_size))
+, _pending(move(other._pending))
+, _pending_size(std::exchange(other._pending_size, 0))
+{
+  // other must start a new arena block on its next emplace(), its old ones are ours now
+}
+
+schedulers::task_graph::~task_graph()
+{
+  for(auto& n : _nodes)
+  {
+    n.destroy(n.callable);
+  }
+}
+
+auto schedulers::task_graph::precede(node before, node after) -> void
+{
+  if(_edges.size() >= no_edge)
+  {
+    throw std::length_error("too many edges in task_graph");
+  }
+  auto& n = _nodes.at(before._index);
+  _nodes.at(after._index).num_predecessors += 1;
+  _edges.push_back({after._index, n.first_successor});
+  n.first_successor = static_cast<std::uint32_t>(_edges.size() - 1);
+}
+
+auto schedulers::task_graph::reserve(std::size_t nodes, std::size_t edges) -> void
+{
+  _nodes.reserve(nodes);
+  _edges.reserve(edges);
+}
+
+auto schedulers::task_graph::allocate(std::size_t size, std::size_t alignment) -> void*
+{
+  // Callables are never freed individually, so bump allocating from blocks is all we need
+  if(size + alignment > arena_block_size || alignment > alignof(std::max_align_t))
+  {
+    // Oversized or over-aligned callables get a block of their own which goes before the current one
+    auto space = size + alignment;
+    std::unique_ptr<unsigned char[]> block{new unsigned char[space]};
+    void* p = block.get();
+    _arena.insert(_arena.empty() ? _arena.end() : _arena.end() - 1, move(block));
+    return std::align(alignment, size, p, space);
+  }
+  // Blocks come from operator new[] and are therefore aligned for any fundamental type
+  auto offset = (_arena_used + alignment - 1) & ~(alignment - 1);
+  if(offset + size > arena_block_size)
+  {
+    _arena.emplace_back(new unsigned char[arena_block_size]);
+    offset = 0;
+  }
+  _arena_used = offset + size;
+  return _arena.back().get() + offset;
+}
+
+auto schedulers::task_graph::add_node(void* callable, void (*invoke)(void*), void (*destroy)(void*) noexcept) -> node
+{
+  if(_nodes.size() >= std::numeric_limits<std::uint32_t>::max())
+  {
+    throw std::length_error("too many nodes in task_graph");
+  }
+  _nodes.push_back({callable, invoke, destroy, no_edge, 0});
+  return node{static_cast<std::uint32_t>(_nodes.size() - 1)};
+}
+
+auto schedulers::task_graph::prepare_run() -> void
+{
+  if(_pending_size < _nodes.size())
+  {
+    _pending.reset(new std::atomic<std::uint32_t>[_nodes.size()]);
+    _pending_size = _nodes.size();
+  }
+  for(std::size_t i = 0; i < _nodes.size(); ++i)
+  {
+    _pending[i].store(_nodes[i].num_predecessors, std::memory_order_relaxed);
+  }
+}
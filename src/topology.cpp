@@ -0,0 +1,261 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/topology.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <tuple>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#endif
+
+using schedulers::cpu_topology;
+
+namespace
+{
+  // Sort by node and make the node numbers contiguous
+  auto normalize(cpu_topology& topology) -> void
+  {
+    auto& cpus = topology.cpus;
+    std::sort(cpus.begin(), cpus.end(), [] (const auto& a, const auto& b)
+    {
+      return std::tie(a.node, a.group, a.id) < std::tie(b.node, b.group, b.id);
+    });
+    unsigned node = 0;
+    for(std::size_t i = 0; i < cpus.size(); ++i)
+    {
+      if(i > 0 && cpus[i].node != cpus[i - 1].node)
+      {
+        ++node;
+      }
+      cpus[i].node = node;
+    }
+    topology.num_nodes = node + 1;
+  }
+
+#if defined(__linux__)
+  // Parse a sysfs CPU list like "0-3,8-11"
+  auto parse_cpu_list(const std::string& list) -> std::vector<unsigned>
+  {
+    std::vector<unsigned> result;
+    auto p = list.c_str();
+    while(*p)
+    {
+      char* end;
+      const auto first = std::strtoul(p, &end, 10);
+      if(end == p)
+      {
+        break;
+      }
+      auto last = first;
+      p = end;
+      if(*p == '-')
+      {
+        last = std::strtoul(p + 1, &end, 10);
+        p = end;
+      }
+      for(auto cpu = first; cpu <= last; ++cpu)
+      {
+        result.push_back(static_cast<unsigned>(cpu));
+      }
+      if(*p == ',')
+      {
+        ++p;
+      }
+      else
+      {
+        break;
+      }
+    }
+    return result;
+  }
+
+  // Map from CPU number to node for every CPU listed in /sys/devices/system/node
+  auto read_cpu_nodes() -> std::vector<std::pair<unsigned, unsigned>>
+  {
+    std::vector<std::pair<unsigned, unsigned>> result;
+    const auto dir = opendir("/sys/devices/system/node");
+    if(!dir)
+    {
+      return result;
+    }
+    while(const auto entry = readdir(dir))
+    {
+      unsigned node;
+      char rest;
+      if(std::sscanf(entry->d_name, "node%u%c", &node, &rest) != 1)
+      {
+        continue;
+      }
+      std::ifstream file{std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist"};
+      std::string list;
+      if(std::getline(file, list))
+      {
+        for(auto cpu : parse_cpu_list(list))
+        {
+          result.emplace_back(cpu, node);
+        }
+      }
+    }
+    closedir(dir);
+    return result;
+  }
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// cpu_topology
+//
+
+#if defined(_WIN32)
+auto cpu_topology::detect() -> cpu_topology
+{
+  cpu_topology topology;
+  DWORD length = 0;
+  ::GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &length);
+  std::vector<char> buffer(length);
+  auto info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data());
+  if(length > 0 && ::GetLogicalProcessorInformationEx(RelationNumaNode, info, &length))
+  {
+    for(DWORD offset = 0; offset < length; offset += info->Size)
+    {
+      info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data() + offset);
+      const auto& node = info->NumaNode;
+      for(unsigned bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit)
+      {
+        if(node.GroupMask.Mask & (KAFFINITY(1) << bit))
+        {
+          topology.cpus.push_back({bit, node.GroupMask.Group, static_cast<unsigned>(node.NodeNumber)});
+        }
+      }
+    }
+  }
+  if(topology.cpus.empty())
+  {
+    for(unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+    {
+      topology.cpus.push_back({i, 0, 0});
+    }
+  }
+  normalize(topology);
+  return topology;
+}
+
+auto schedulers::pin_current_thread(const cpu_topology::cpu& cpu) noexcept -> bool
+{
+  GROUP_AFFINITY affinity{};
+  affinity.Mask = KAFFINITY(1) << cpu.id;
+  affinity.Group = static_cast<WORD>(cpu.group);
+  return ::SetThreadGroupAffinity(::GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+#elif defined(__linux__)
+auto cpu_topology::detect() -> cpu_topology
+{
+  cpu_topology topology;
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+  {
+    for(unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+    {
+      CPU_SET(i, &allowed);
+    }
+  }
+  const auto nodes = read_cpu_nodes();
+  for(unsigned i = 0; i < CPU_SETSIZE; ++i)
+  {
+    if(CPU_ISSET(i, &allowed))
+    {
+      const auto it = std::find_if(nodes.begin(), nodes.end(), [i] (const auto& x) { return x.first == i; });
+      topology.cpus.push_back({i, 0, it != nodes.end() ? it->second : 0});
+    }
+  }
+  normalize(topology);
+  return topology;
+}
+
+auto schedulers::pin_current_thread(const cpu_topology::cpu& cpu) noexcept -> bool
+{
+  if(cpu.id >= CPU_SETSIZE)
+  {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu.id, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#else
+auto cpu_topology::detect() -> cpu_topology
+{
+  // No portable way to query or pin, e.g. macOS only has affinity hints
+  cpu_topology topology;
+  for(unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+  {
+    topology.cpus.push_back({i, 0, 0});
+  }
+  return topology;
+}
+
+auto schedulers::pin_current_thread(const cpu_topology::cpu& /*cpu*/) noexcept -> bool
+{
+  return false;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// steal_order_by_node
+//
+
+auto schedulers::detail::steal_order_by_node(const std::vector<unsigned>& nodes) -> std::vector<unsigned>
+{
+  const auto n = static_cast<unsigned>(nodes.size());
+  const auto num_nodes = n == 0 ? 0 : *std::max_element(nodes.begin(), nodes.end()) + 1;
+
+  // The workers of every node in index order
+  std::vector<std::vector<unsigned>> members(num_nodes);
+  for(unsigned i = 0; i < n; ++i)
+  {
+    members[nodes[i]].push_back(i);
+  }
+
+  std::vector<unsigned> order;
+  order.reserve(n * n);
+  for(unsigned i = 0; i < n; ++i)
+  {
+    for(unsigned d = 0; d < num_nodes; ++d)
+    {
+      const auto& group = members[(nodes[i] + d) % num_nodes];
+      // Start after ourselves on our own node, and at the same relative position on the others
+      const auto self = std::find(group.begin(), group.end(), i) - group.begin();
+      const auto start = d == 0 ? self : static_cast<std::ptrdiff_t>(i % std::max<std::size_t>(group.size(), 1));
+      for(std::size_t k = 0; k < group.size(); ++k)
+      {
+        order.push_back(group[(start + k) % group.size()]);
+      }
+    }
+  }
+  return order;
+}
@@ -0,0 +1,231 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/tracing.hpp"
+#include <ostream>
+
+using schedulers::trace_recorder;
+using schedulers::detail::trace_buffer;
+
+namespace
+{
+  std::atomic<trace_recorder*> installed_recorder{nullptr};
+  // Every recorder gets a new id so threads never mistake a recorder at a reused address for the one they cached
+  std::atomic<std::uint64_t> next_recorder_id{1};
+  std::atomic<std::uint64_t> next_thread_token{1};
+
+  auto round_up_to_power_of_two(std::size_t n) noexcept -> std::size_t
+  {
+    std::size_t result = 1;
+    while(result < n)
+    {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  auto write_string(std::ostream& out, const char* s) -> void
+  {
+    static const char hex[] = "0123456789abcdef";
+    out << '"';
+    for(; *s; ++s)
+    {
+      const auto c = static_cast<unsigned char>(*s);
+      if(c == '"' || c == '\\')
+      {
+        out << '\\' << *s;
+      }
+      else if(c < 0x20)
+      {
+        out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+      }
+      else
+      {
+        out << *s;
+      }
+    }
+    out << '"';
+  }
+
+  // Chrome trace time stamps are in microseconds
+  auto write_micros(std::ostream& out, std::int64_t nanoseconds) -> void
+  {
+    if(nanoseconds < 0)
+    {
+      out << '-';
+      nanoseconds = -nanoseconds;
+    }
+    const auto fraction = nanoseconds % 1000;
+    out << nanoseconds / 1000 << '.' << fraction / 100 << fraction / 10 % 10 << fraction % 10;
+  }
+
+  struct event
+  {
+    std::uint64_t index;
+    const char* label;
+    std::uint32_t submitter;
+    bool stolen;
+    std::int64_t enqueued;
+    std::int64_t started;
+    std::int64_t finished;
+  };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// trace_recorder
+//
+
+constexpr std::uint32_t trace_recorder::no_thread;
+
+// The slot which is being written can't be read, so there is one more than requested
+trace_recorder::trace_recorder(std::size_t events_per_thread)
+: _id(next_recorder_id.fetch_add(1, std::memory_order_relaxed))
+, _capacity(round_up_to_power_of_two(events_per_thread + 1))
+{
+}
+
+trace_recorder::~trace_recorder()
+{
+  auto self = this;
+  installed_recorder.compare_exchange_strong(self, nullptr, std::memory_order_acq_rel);
+}
+
+auto trace_recorder::install() noexcept -> void
+{
+  installed_recorder.store(this, std::memory_order_release);
+}
+
+auto trace_recorder::uninstall() noexcept -> void
+{
+  installed_recorder.store(nullptr, std::memory_order_release);
+}
+
+auto trace_recorder::installed() noexcept -> trace_recorder*
+{
+  return installed_recorder.load(std::memory_order_acquire);
+}
+
+auto trace_recorder::register_thread() noexcept -> trace_buffer*
+{
+  auto& thread = detail::trace_thread();
+  try
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    trace_buffer* buffer = nullptr;
+    if(thread.token == 0)
+    {
+      thread.token = next_thread_token.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+      // The thread may have switched between recorders
+      for(auto& b : _buffers)
+      {
+        if(b->_owner == thread.token)
+        {
+          buffer = b.get();
+        }
+      }
+    }
+    if(!buffer)
+    {
+      const auto tid = static_cast<std::uint32_t>(_buffers.size());
+      auto name = thread.is_worker ? "worker " + std::to_string(thread.worker) : "thread " + std::to_string(tid);
+      _buffers.push_back(std::make_unique<trace_buffer>(_capacity, tid, thread.token, move(name)));
+      buffer = _buffers.back().get();
+    }
+    thread.recorder = _id;
+    thread.buffer = buffer;
+    return buffer;
+  }
+  catch(...)
+  {
+    // The events of this thread are lost but the tasks still run
+    return nullptr;
+  }
+}
+
+auto trace_recorder::set_thread_name(std::string name) -> void
+{
+  if(const auto buffer = this_thread_buffer())
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    buffer->_name = move(name);
+  }
+}
+
+auto trace_recorder::write_chrome_trace(std::ostream& out) const -> void
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  auto separator = "\n";
+  for(auto& buffer : _buffers)
+  {
+    out << separator << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << buffer->_tid << ",\"args\":{\"name\":";
+    write_string(out, buffer->_name.c_str());
+    out << "}}";
+    separator = ",\n";
+  }
+
+  std::vector<event> events;
+  for(auto& buffer : _buffers)
+  {
+    const auto capacity = buffer->_mask + 1;
+    const auto written = buffer->_written.load(std::memory_order_acquire);
+    events.clear();
+    for(auto i = written > capacity ? written - capacity : 0; i < written; ++i)
+    {
+      const auto& e = buffer->_events[i & buffer->_mask];
+      events.push_back({i,
+                        e.label.load(std::memory_order_relaxed),
+                        e.submitter.load(std::memory_order_relaxed),
+                        e.stolen.load(std::memory_order_relaxed),
+                        e.enqueued.load(std::memory_order_relaxed),
+                        e.started.load(std::memory_order_relaxed),
+                        e.finished.load(std::memory_order_relaxed)});
+    }
+    // Everything the writer may have touched since we started copying is unreliable, including the slot it is writing right now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto now_written = buffer->_written.load(std::memory_order_relaxed);
+    const auto first_valid = now_written + 1 > capacity ? now_written + 1 - capacity : 0;
+
+    for(auto& e : events)
+    {
+      if(e.index < first_valid)
+      {
+        continue;
+      }
+      const auto flow = static_cast<std::uint64_t>(buffer->_tid) << 32 | (e.index & 0xffffffff);
+      out << separator << "{\"ph\":\"X\",\"cat\":\"task\",\"name\":";
+      write_string(out, e.label ? e.label : "task");
+      out << ",\"pid\":1,\"tid\":" << buffer->_tid << ",\"ts\":";
+      write_micros(out, e.started);
+      out << ",\"dur\":";
+      write_micros(out, e.finished - e.started);
+      out << ",\"args\":{\"queued_us\":";
+      write_micros(out, e.started - e.enqueued);
+      out << ",\"stolen\":" << (e.stolen ? "true" : "false") << "}}";
+      if(e.submitter != no_thread)
+      {
+        out << ",\n{\"ph\":\"s\",\"cat\":\"task\",\"name\":\"schedule\",\"id\":" << flow << ",\"pid\":1,\"tid\":" << e.submitter << ",\"ts\":";
+        write_micros(out, e.enqueued);
+        out << "},\n{\"ph\":\"f\",\"bp\":\"e\",\"cat\":\"task\",\"name\":\"schedule\",\"id\":" << flow << ",\"pid\":1,\"tid\":" << buffer->_tid << ",\"ts\":";
+        write_micros(out, e.started);
+        out << "}";
+      }
+    }
+  }
+  out << "\n]}\n";
+}
@@ -0,0 +1,177 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/schedulers.hpp"
+#include "catch.hpp"
+#include "test_tools.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace schedulers;
+
+namespace
+{
+  // Occupies the pool's only thread until released
+  class blocker
+  {
+  public:
+    explicit blocker(const thread_pool& pool)
+    {
+      pool([this]
+      {
+        _blocked = true;
+        while(!_release)
+        {
+          std::this_thread::yield();
+        }
+      });
+      while(!_blocked)
+      {
+        std::this_thread::yield();
+      }
+    }
+    ~blocker() { release(); }
+
+    auto release() -> void { _release = true; }
+
+  private:
+    std::atomic<bool> _blocked{false};
+    std::atomic<bool> _release{false};
+  };
+
+  // Feeds main_thread_task_queue like the "main thread" schedulers, the test plays the event loop
+  struct main_queue_scheduler : available_scheduler<main_queue_scheduler>
+  {
+  private:
+    friend available_scheduler<main_queue_scheduler>;
+
+    template<class Alloc, class F>
+    auto schedule(const Alloc& alloc, F&& f) const -> void
+    {
+      main_thread_task_queue::get().push({std::allocator_arg, alloc, std::forward<F>(f)});
+    }
+
+    template<class Alloc>
+    auto schedule_cancellable_task(const Alloc&, detail::cancellable_task&& task) const -> void
+    {
+      main_thread_task_queue::get().push(std::move(task));
+    }
+  };
+}
+
+SCENARIO("Cancelled tasks never run and release their state immediately.", "[cancellation]")
+{
+  GIVEN("a thread pool whose only thread is busy")
+  {
+    auto pool = std::make_unique<thread_pool>(1);
+    blocker b{*pool};
+
+    WHEN("a pending task is cancelled")
+    {
+      int instances = 0;
+      std::atomic<bool> ran{false};
+      auto token = pool->schedule_cancellable([&ran, t = tracked_callable{&instances}] { ran = true; });
+      REQUIRE(instances == 1);
+      REQUIRE(token.cancel());
+
+      THEN("its callable is destroyed before the pool gets to it")
+      {
+        REQUIRE(instances == 0);
+      }
+      THEN("cancelling again has no effect")
+      {
+        REQUIRE_FALSE(token.cancel());
+      }
+      THEN("it doesn't run once the pool is free")
+      {
+        std::atomic<bool> after{false};
+        (*pool)([&after] { after = true; });
+        b.release();
+        while(!after)
+        {
+          std::this_thread::yield();
+        }
+        REQUIRE_FALSE(ran);
+      }
+    }
+    b.release();
+    pool.reset();
+  }
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{1};
+
+    WHEN("a task already ran")
+    {
+      std::atomic<bool> ran{false};
+      auto token = pool.schedule_cancellable([&ran] { ran = true; });
+      while(!ran)
+      {
+        std::this_thread::yield();
+      }
+
+      THEN("cancelling it fails")
+      {
+        REQUIRE_FALSE(token.cancel());
+      }
+    }
+  }
+  GIVEN("an empty token")
+  {
+    cancellation_token token;
+
+    THEN("it cannot cancel anything")
+    {
+      REQUIRE_FALSE(token);
+      REQUIRE_FALSE(token.cancel());
+    }
+  }
+}
+
+SCENARIO("main_thread_task_queue drops cancelled tasks.", "[cancellation]")
+{
+  GIVEN("cancellable tasks in the main thread queue")
+  {
+    const auto& queue = main_thread_task_queue::get();
+    main_queue_scheduler s;
+    std::vector<int> order;
+    std::vector<cancellation_token> tokens;
+    for(int i = 0; i < 4; ++i)
+    {
+      tokens.push_back(s.schedule_cancellable([&order, i] { order.push_back(i); }));
+    }
+
+    WHEN("some of them are cancelled")
+    {
+      REQUIRE(tokens[0].cancel());
+      REQUIRE(tokens[2].cancel());
+
+      THEN("try_pop skips them and returns the live ones in order")
+      {
+        for(;;)
+        {
+          detail::work_item f;
+          if(!queue.try_pop(f))
+          {
+            break;
+          }
+          move(f)();
+        }
+        REQUIRE(order == (std::vector<int>{1, 3}));
+      }
+    }
+    queue.clear();
+  }
+}
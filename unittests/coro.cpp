@@ -0,0 +1,232 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/coro.hpp"
+#include "schedulers/instrumentation.hpp"
+#include "schedulers/schedulers.hpp"
+#include "catch.hpp"
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace schedulers;
+
+namespace
+{
+  auto hop(const thread_pool& pool, std::thread::id& before, std::thread::id& after) -> task<>
+  {
+    before = std::this_thread::get_id();
+    co_await schedule_on(pool);
+    after = std::this_thread::get_id();
+  }
+
+  auto square_on(const thread_pool& pool, int x) -> task<int>
+  {
+    co_await schedule_on(pool);
+    co_return x * x;
+  }
+
+  auto sum_of_squares(const thread_pool& pool, int n) -> task<int>
+  {
+    int sum = 0;
+    for(int i = 1; i <= n; ++i)
+    {
+      sum += co_await square_on(pool, i);
+    }
+    co_return sum;
+  }
+
+  auto fail_on(const thread_pool& pool) -> task<int>
+  {
+    co_await schedule_on(pool);
+    throw std::runtime_error{"failed"};
+  }
+
+  // The exception of fail_on() passes through two levels of co_await
+  auto fail_nested(const thread_pool& pool, bool& resumed) -> task<int>
+  {
+    const auto x = co_await fail_on(pool);
+    resumed = true;
+    co_return x;
+  }
+
+  auto fail_twice_nested(const thread_pool& pool, bool& resumed) -> task<>
+  {
+    co_await fail_nested(pool, resumed);
+    resumed = true;
+  }
+
+  auto catch_nested(const thread_pool& pool) -> task<int>
+  {
+    bool resumed = false;
+    try
+    {
+      co_await fail_nested(pool, resumed);
+    }
+    catch(const std::runtime_error&)
+    {
+      co_return resumed ? -1 : 1;
+    }
+    co_return 0;
+  }
+
+  template<class Scheduler>
+  auto square_on_any(const Scheduler& s, int x) -> task<int>
+  {
+    co_await schedule_on(s);
+    co_return x * x;
+  }
+
+  auto hop_between(const thread_pool& first, const thread_pool& second, std::vector<std::thread::id>& threads) -> task<>
+  {
+    for(int i = 0; i < 3; ++i)
+    {
+      co_await schedule_on(first);
+      threads.push_back(std::this_thread::get_id());
+      co_await schedule_on(second);
+      threads.push_back(std::this_thread::get_id());
+    }
+  }
+
+  auto hop_instrumented(const instrumented_thread_pool<counting_instrumentation>& pool, std::thread::id& after) -> task<>
+  {
+    co_await schedule_on(pool);
+    after = std::this_thread::get_id();
+  }
+
+  static_assert(detail::stores_continuation_inline<thread_pool>::value, "");
+  static_assert(detail::stores_continuation_inline<instrumented_thread_pool<counting_instrumentation>>::value, "");
+  static_assert(!decltype(detail::can_run_one(std::declval<const prioritized_scheduler<thread_pool>&>(), 0))::value, "");
+
+  // Blocks the pool's only thread in sync_wait() on work which can only run through the waiting thread helping
+  auto nested_wait(const thread_pool& pool) -> task<int>
+  {
+    co_await schedule_on(pool);
+    co_return sync_wait(pool, square_on(pool, 7));
+  }
+}
+
+SCENARIO("Coroutines hop onto schedulers with co_await.", "[coro]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{2};
+
+    WHEN("a coroutine awaits schedule_on(pool)")
+    {
+      std::thread::id before;
+      std::thread::id after;
+      sync_wait(hop(pool, before, after));
+
+      THEN("it continues on a different thread")
+      {
+        REQUIRE(before == std::this_thread::get_id());
+        REQUIRE(after != before);
+      }
+    }
+    WHEN("tasks await other tasks")
+    {
+      const auto sum = sync_wait(pool, sum_of_squares(pool, 10));
+
+      THEN("results are passed back")
+      {
+        REQUIRE(sum == 385);
+      }
+    }
+    WHEN("a task throws")
+    {
+      THEN("sync_wait rethrows the exception")
+      {
+        REQUIRE_THROWS_AS(sync_wait(pool, fail_on(pool)), const std::runtime_error&);
+      }
+    }
+    WHEN("a task throws below nested co_awaits")
+    {
+      bool resumed = false;
+
+      THEN("it propagates through every awaiting task to sync_wait")
+      {
+        REQUIRE_THROWS_AS(sync_wait(pool, fail_twice_nested(pool, resumed)), const std::runtime_error&);
+        REQUIRE_FALSE(resumed);
+      }
+      THEN("an awaiting task can catch it")
+      {
+        REQUIRE(sync_wait(pool, catch_nested(pool)) == 1);
+      }
+    }
+    WHEN("calling sync_wait with a scheduler which can't run tasks on the waiting thread")
+    {
+      const auto low = with_priority(pool, task_priority::low);
+      const auto result = sync_wait(low, square_on_any(low, 6));
+
+      THEN("it blocks until the task is done")
+      {
+        REQUIRE(result == 36);
+      }
+    }
+  }
+  GIVEN("a thread pool with one thread")
+  {
+    thread_pool pool{1};
+
+    WHEN("a task running on the pool calls sync_wait")
+    {
+      const auto result = sync_wait(nested_wait(pool));
+
+      THEN("the waiting thread helps running the pool's work")
+      {
+        REQUIRE(result == 49);
+      }
+    }
+  }
+  GIVEN("two thread pools")
+  {
+    thread_pool first{1};
+    thread_pool second{1};
+
+    WHEN("a coroutine hops back and forth between them")
+    {
+      std::vector<std::thread::id> threads;
+      sync_wait(hop_between(first, second, threads));
+
+      THEN("it continues on the thread of the pool it last scheduled on")
+      {
+        REQUIRE(threads.size() == 6);
+        REQUIRE(threads[0] != threads[1]);
+        for(std::size_t i = 2; i < threads.size(); ++i)
+        {
+          REQUIRE(threads[i] == threads[i % 2]);
+        }
+      }
+    }
+  }
+  GIVEN("an instrumented thread pool")
+  {
+    instrumented_thread_pool<counting_instrumentation> pool{2};
+
+    WHEN("a coroutine awaits schedule_on(pool)")
+    {
+      std::thread::id after;
+      sync_wait(hop_instrumented(pool, after));
+
+      THEN("it continues on the pool and the hop is counted")
+      {
+        REQUIRE(after != std::this_thread::get_id());
+        REQUIRE(pool.stats().workers.back().pushes == 1);
+      }
+    }
+  }
+}
@@ -0,0 +1,177 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/elastic_thread_pool.hpp"
+#include "catch.hpp"
+
+using namespace schedulers;
+
+namespace
+{
+  // Wait until the condition holds or a generous timeout expires
+  template<class F>
+  auto eventually(F&& condition) -> bool
+  {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while(!condition())
+    {
+      if(std::chrono::steady_clock::now() > deadline)
+      {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+}
+
+SCENARIO("elastic_thread_pool runs all tasks.", "[elastic_thread_pool]")
+{
+  GIVEN("an elastic pool")
+  {
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<elastic_thread_pool>();
+
+    THEN("tasks scheduled from outside and inside all run before it is destroyed")
+    {
+      for(int i = 0; i < 1000; ++i)
+      {
+        (*pool)([&counter, &pool]
+        {
+          ++counter;
+          (*pool)([&counter] { ++counter; });
+        });
+      }
+      while(counter < 2000)
+      {
+        std::this_thread::yield();
+      }
+      pool.reset();
+      REQUIRE(counter == 2000);
+    }
+  }
+}
+
+SCENARIO("elastic_thread_pool grows and shrinks with load.", "[elastic_thread_pool]")
+{
+  elastic_pool_options options;
+  options.min_threads = 1;
+  options.max_threads = 4;
+  options.concurrency = 1;
+  options.spawn_delay = std::chrono::milliseconds(1);
+  options.idle_timeout = std::chrono::milliseconds(20);
+
+  GIVEN("tasks blocking without announcing it")
+  {
+    elastic_thread_pool pool{options};
+    std::atomic<int> running{0};
+    std::atomic<bool> release{false};
+
+    WHEN("more tasks are blocked than the concurrency level")
+    {
+      for(int i = 0; i < 4; ++i)
+      {
+        pool([&running, &release]
+        {
+          ++running;
+          while(!release)
+          {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        });
+      }
+
+      THEN("the monitor starts threads up to max_threads")
+      {
+        REQUIRE(eventually([&] { return running == 4; }));
+        REQUIRE(pool.num_threads() == 4);
+        release = true;
+
+        AND_THEN("idle threads retire down to min_threads")
+        {
+          REQUIRE(eventually([&] { return pool.num_threads() == 1; }));
+
+          AND_THEN("the retired threads' slots are reused under new load")
+          {
+            running = 0;
+            release = false;
+            for(int i = 0; i < 4; ++i)
+            {
+              pool([&running, &release]
+              {
+                ++running;
+                while(!release)
+                {
+                  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+              });
+            }
+            REQUIRE(eventually([&] { return running == 4; }));
+            REQUIRE(pool.num_threads() == 4);
+            release = true;
+          }
+        }
+      }
+      release = true;
+    }
+  }
+  GIVEN("a task waiting inside a blocking_region on a task scheduled after it")
+  {
+    // Neither the monitor nor retirement interfere
+    options.spawn_delay = std::chrono::hours(1);
+    options.idle_timeout = std::chrono::hours(1);
+    elastic_thread_pool pool{options};
+    REQUIRE(pool.num_threads() == 1);
+    std::atomic<bool> first_done{false};
+    std::atomic<bool> second_done{false};
+    std::atomic<unsigned> threads_before{0};
+    std::atomic<unsigned> threads_inside{0};
+
+    pool([&]
+    {
+      pool([&second_done] { second_done = true; });
+      threads_before = pool.num_threads();
+      {
+        blocking_region region;
+        threads_inside = pool.num_threads();
+        while(!second_done)
+        {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+      first_done = true;
+    });
+
+    THEN("the pool starts a replacement thread right away")
+    {
+      REQUIRE(eventually([&] { return first_done.load(); }));
+      REQUIRE(threads_before == 1);
+      REQUIRE(threads_inside == 2);
+      REQUIRE(pool.num_threads() == 2);
+    }
+  }
+  GIVEN("a blocking_region outside of any elastic_thread_pool")
+  {
+    elastic_thread_pool pool{options};
+    REQUIRE(pool.num_threads() == 1);
+
+    THEN("it does nothing")
+    {
+      {
+        blocking_region region;
+      }
+      REQUIRE(pool.num_threads() == 1);
+    }
+  }
+}
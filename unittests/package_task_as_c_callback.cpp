@@ -210,3 +210,23 @@ TEST_CASE("The cv qualifiers of std::reference_wrapper<cv T> are preserved.", "[
   package_task_as_c_callback(forbidden_allocator<>{},std::ref(f_cv));
   package_task_as_c_callback(forbidden_allocator<>{},std::ref(f_v));
 }
+
+TEST_CASE("Large callables are stored in recycled blocks by default.", "[package_task_as_c_callback]")
+{
+  struct T
+  {
+    void operator()() { ++*counter; }
+    int* counter;
+    char data[sizeof(void*) * 8]; // Make sure we don't trigger alloc elision
+  };
+
+  int n = 0;
+  auto first = package_task_as_c_callback(T{&n, {}}).release();
+  const auto data = first.data;
+  first.callback(first.data);
+  // The block freed by the first callback is the next one handed out on this thread
+  auto second = package_task_as_c_callback(T{&n, {}}).release();
+  REQUIRE(second.data == data);
+  second.callback(second.data);
+  REQUIRE(n == 2);
+}
@@ -0,0 +1,164 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/parallel.hpp"
+#include "schedulers/schedulers.hpp"
+#include "test_tools.hpp"
+#include <numeric>
+
+using namespace schedulers;
+
+namespace
+{
+  // A scheduler without try_run_one() so the caller has to block
+  class forwarding_scheduler : public available_scheduler<forwarding_scheduler>
+  {
+  public:
+    explicit forwarding_scheduler(const thread_pool& pool) : _pool(pool) { }
+
+  private:
+    friend available_scheduler<forwarding_scheduler>;
+
+    template<class Alloc, class F>
+    void schedule(const Alloc& alloc, F&& f) const
+    {
+      _pool(alloc, std::forward<F>(f));
+    }
+
+    const thread_pool& _pool;
+  };
+
+  template<class Scheduler>
+  auto visits_every_index_once(const Scheduler& s, int n, int grain)
+  {
+    std::vector<std::atomic<int>> hits(n);
+    parallel_for(s, 0, n, grain, [&] (int i) { ++hits[i]; });
+    return std::all_of(hits.begin(), hits.end(), [] (const auto& x) { return x == 1; });
+  }
+}
+
+SCENARIO("parallel_for visits every index exactly once.", "[parallel]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{4};
+
+    THEN("every index is visited once")
+    {
+      REQUIRE(visits_every_index_once(pool, 0, 1));
+      REQUIRE(visits_every_index_once(pool, 1, 1));
+      REQUIRE(visits_every_index_once(pool, 10'000, 1));
+      REQUIRE(visits_every_index_once(pool, 10'000, 64));
+      REQUIRE(visits_every_index_once(pool, 10'000, 100'000));
+    }
+  }
+  GIVEN("a work stealing thread pool")
+  {
+    work_stealing_thread_pool pool{4};
+
+    THEN("every index is visited once")
+    {
+      REQUIRE(visits_every_index_once(pool, 10'000, 1));
+      REQUIRE(visits_every_index_once(pool, 10'000, 64));
+    }
+  }
+  GIVEN("a scheduler which cannot help while waiting")
+  {
+    thread_pool pool{4};
+    forwarding_scheduler s{pool};
+
+    THEN("every index is visited once")
+    {
+      REQUIRE(visits_every_index_once(s, 10'000, 1));
+      REQUIRE(visits_every_index_once(s, 10'000, 64));
+    }
+  }
+}
+
+SCENARIO("parallel_for can be nested.", "[parallel]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{2};
+    std::atomic<int> sum{0};
+
+    WHEN("running parallel_for inside parallel_for")
+    {
+      parallel_for(pool, 0, 100, 1, [&] (int)
+      {
+        parallel_for(pool, 0, 100, 1, [&] (int) { ++sum; });
+      });
+
+      THEN("all iterations are executed")
+      {
+        REQUIRE(sum == 100 * 100);
+      }
+    }
+  }
+}
+
+SCENARIO("parallel_for propagates exceptions.", "[parallel]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{4};
+
+    WHEN("an iteration throws")
+    {
+      THEN("the exception is rethrown")
+      {
+        REQUIRE_THROWS_AS(parallel_for(pool, 0, 10'000, 1, [] (int i)
+        {
+          if(i == 5'000)
+          {
+            throw exception_t{};
+          }
+        }), exception_t);
+      }
+    }
+  }
+}
+
+SCENARIO("parallel_reduce combines all values.", "[parallel]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{4};
+
+    THEN("the sum of a range is correct")
+    {
+      const auto sum = parallel_reduce(pool, 0, 100'000, 16, std::int64_t(0),
+                                       [] (int i) { return std::int64_t(i); },
+                                       std::plus<std::int64_t>());
+      REQUIRE(sum == std::int64_t(100'000) * 99'999 / 2);
+    }
+    THEN("an empty range returns the identity")
+    {
+      const auto sum = parallel_reduce(pool, 0, 0, 16, 42, [] (int i) { return i; }, std::plus<int>());
+      REQUIRE(sum == 42);
+    }
+    THEN("non-trivial value types are supported")
+    {
+      const auto v = parallel_reduce(pool, 0, 1'000, 8, std::vector<int>{},
+                                     [] (int i) { return std::vector<int>{i}; },
+                                     [] (std::vector<int> a, std::vector<int> b)
+                                     {
+                                       a.insert(a.end(), b.begin(), b.end());
+                                       return a;
+                                     });
+      REQUIRE(v.size() == 1'000);
+      REQUIRE(std::accumulate(v.begin(), v.end(), 0) == 1'000 * 999 / 2);
+    }
+  }
+}
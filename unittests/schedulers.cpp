@@ -12,8 +12,19 @@
 // ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
 // OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
+#include "schedulers/elastic_thread_pool.hpp"
 #include "schedulers/schedulers.hpp"
 #include "catch.hpp"
+#include "test_tools.hpp"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
 
 using namespace schedulers;
 
@@ -58,6 +69,1494 @@ SCENARIO("thread_pool shuts down properly.", "[thread_pool]")
   }
 }
 
+SCENARIO("work_stealing_thread_pool runs all tasks.", "[work_stealing_thread_pool]")
+{
+  GIVEN("a work stealing thread pool")
+  {
+    auto pool = std::make_unique<work_stealing_thread_pool>(std::thread::hardware_concurrency());
+    std::atomic<int> counter{0};
+
+    WHEN("enqueuing many tasks")
+    {
+      for(int i = 0; i < 100'000; ++i)
+      {
+        (*pool)([&counter] { ++counter; });
+      }
+      AND_WHEN("running its destructor")
+      {
+        pool.reset();
+
+        THEN("all tasks were executed")
+        {
+          REQUIRE(counter == 100'000);
+        }
+      }
+    }
+
+    WHEN("tasks enqueue more tasks")
+    {
+      std::function<void(int)> spawn = [&] (int depth)
+      {
+        ++counter;
+        if(depth > 0)
+        {
+          (*pool)([&spawn, depth] { spawn(depth - 1); });
+          (*pool)([&spawn, depth] { spawn(depth - 1); });
+        }
+      };
+      (*pool)([&spawn] { spawn(14); });
+      // Tasks refer to spawn until they return, so it must outlive all of them
+      pool->wait_idle();
+
+      THEN("all tasks are executed")
+      {
+        REQUIRE(counter == (1 << 15) - 1);
+      }
+    }
+  }
+}
+
+SCENARIO("thread_pool runs all tasks with any idle policy.", "[thread_pool]")
+{
+  GIVEN("thread pools with different idle policies")
+  {
+    const thread_pool_idle_policy policies[] = {{0, 0}, {0, 16}, {64, 0}};
+
+    WHEN("enqueuing tasks with pauses in between")
+    {
+      THEN("all tasks are executed")
+      {
+        for(auto policy : policies)
+        {
+          std::atomic<int> counter{0};
+          auto pool = std::make_unique<thread_pool>(2, policy);
+          for(int i = 0; i < 100; ++i)
+          {
+            (*pool)([&counter] { ++counter; });
+            if(i % 10 == 0)
+            {
+              std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+          }
+          pool.reset();
+          REQUIRE(counter == 100);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("sized_thread_pool runs tasks with large captures.", "[thread_pool]")
+{
+  GIVEN("a thread pool with one cache line per work item")
+  {
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<sized_thread_pool<64>>(2);
+
+    WHEN("enqueuing tasks capturing more than two pointers")
+    {
+      auto p = std::make_shared<int>(1);
+      for(int i = 0; i < 1000; ++i)
+      {
+        (*pool)([p, i, j = i + 1, &counter] { counter += j - i; });
+      }
+      pool.reset();
+
+      THEN("all tasks are executed")
+      {
+        REQUIRE(counter == 1000);
+        REQUIRE(p.use_count() == 1);
+      }
+    }
+  }
+}
+
+namespace
+{
+  // Occupies the pool's only thread until release() is called
+  template<class Pool>
+  class pool_blocker
+  {
+  public:
+    explicit pool_blocker(const Pool& pool)
+    {
+      pool([this]
+      {
+        _blocked = true;
+        while(!_release)
+        {
+          std::this_thread::yield();
+        }
+      });
+      while(!_blocked)
+      {
+        std::this_thread::yield();
+      }
+    }
+    ~pool_blocker() { release(); }
+
+    auto release() -> void { _release = true; }
+
+  private:
+    std::atomic<bool> _blocked{false};
+    std::atomic<bool> _release{false};
+  };
+}
+
+SCENARIO("Bounded thread pools apply backpressure when full.", "[bounded_thread_pool]")
+{
+  GIVEN("a full rejecting pool")
+  {
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<bounded_thread_pool<4, queue_full_policy::reject>>(1);
+    pool_blocker<bounded_thread_pool<4, queue_full_policy::reject>> blocker{*pool};
+    for(int i = 0; i < 4; ++i)
+    {
+      REQUIRE(pool->try_schedule([&counter] { ++counter; }));
+    }
+
+    THEN("try_schedule fails")
+    {
+      REQUIRE_FALSE(pool->try_schedule([&counter] { ++counter; }));
+    }
+    THEN("scheduling throws")
+    {
+      REQUIRE_THROWS_AS((*pool)([&counter] { ++counter; }), queue_full_error);
+    }
+    WHEN("the pool drains")
+    {
+      blocker.release();
+      pool.reset();
+
+      THEN("only the accepted tasks were executed")
+      {
+        REQUIRE(counter == 4);
+      }
+    }
+  }
+  GIVEN("a full pool running tasks on the caller")
+  {
+    using pool_t = bounded_thread_pool<4, queue_full_policy::run_on_caller>;
+    pool_t pool{1};
+    pool_blocker<pool_t> blocker{pool};
+    for(int i = 0; i < 4; ++i)
+    {
+      pool([] { });
+    }
+
+    THEN("the next task runs on the calling thread")
+    {
+      std::thread::id id;
+      pool([&id] { id = std::this_thread::get_id(); });
+      REQUIRE(id == std::this_thread::get_id());
+    }
+  }
+  GIVEN("a full blocking pool")
+  {
+    using pool_t = bounded_thread_pool<4, queue_full_policy::block>;
+    std::atomic<int> counter{0};
+    std::atomic<bool> submitted{false};
+    auto pool = std::make_unique<pool_t>(1);
+    pool_blocker<pool_t> blocker{*pool};
+    for(int i = 0; i < 4; ++i)
+    {
+      (*pool)([&counter] { ++counter; });
+    }
+
+    WHEN("scheduling another task")
+    {
+      std::thread producer{[&]
+      {
+        (*pool)([&counter] { ++counter; });
+        submitted = true;
+      }};
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+      THEN("the producer blocks until there is space")
+      {
+        REQUIRE_FALSE(submitted);
+        blocker.release();
+        producer.join();
+        REQUIRE(submitted);
+        pool.reset();
+        REQUIRE(counter == 5);
+      }
+    }
+  }
+  GIVEN("a blocking pool whose tasks schedule more tasks than fit")
+  {
+    using pool_t = bounded_thread_pool<4, queue_full_policy::block>;
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<pool_t>(1);
+
+    WHEN("a task fills its own queue")
+    {
+      const auto& p = *pool;
+      p([&]
+      {
+        for(int i = 0; i < 100; ++i)
+        {
+          p([&counter] { ++counter; });
+        }
+      });
+      pool.reset();
+
+      THEN("it does not deadlock")
+      {
+        REQUIRE(counter == 100);
+      }
+    }
+  }
+}
+
+namespace
+{
+  template<class Pool, class = void_t<>>
+  struct has_try_schedule : std::false_type { };
+
+  template<class Pool>
+  struct has_try_schedule<Pool, void_t<decltype(std::declval<const Pool&>().try_schedule(std::declval<void (*)()>()))>> : std::true_type { };
+
+  // Unbounded queues never refuse a task, so try_schedule() could never shed load
+  static_assert(!has_try_schedule<thread_pool>::value, "try_schedule() must only exist for bounded queues");
+  static_assert(!has_try_schedule<work_stealing_thread_pool>::value, "try_schedule() must only exist for bounded queues");
+  static_assert(has_try_schedule<bounded_thread_pool<4>>::value, "try_schedule() must exist for bounded queues");
+}
+
+SCENARIO("Bounded thread pools apply their policy only once all queues are full.", "[bounded_thread_pool]")
+{
+  GIVEN("a rejecting pool with one busy worker")
+  {
+    using pool_t = bounded_thread_pool<2, queue_full_policy::reject>;
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<pool_t>(2);
+    pool_blocker<pool_t> blocker{*pool};
+
+    WHEN("a task on the other worker fills its own queue and schedules another task")
+    {
+      std::atomic<bool> done{false};
+      std::atomic<bool> rejected{false};
+      const auto& p = *pool;
+      p([&]
+      {
+        try
+        {
+          for(int i = 0; i < 3; ++i)
+          {
+            p([&counter] { ++counter; });
+          }
+        }
+        catch(const queue_full_error&)
+        {
+          rejected = true;
+        }
+        done = true;
+      });
+      while(!done)
+      {
+        std::this_thread::yield();
+      }
+      blocker.release();
+      pool.reset();
+
+      THEN("it goes to the queue of the busy worker instead of being rejected")
+      {
+        REQUIRE_FALSE(rejected);
+        REQUIRE(counter == 3);
+      }
+    }
+  }
+}
+
+SCENARIO("Prioritized tasks run before lower priorities.", "[thread_pool][priority]")
+{
+  GIVEN("a blocked single-threaded priority pool")
+  {
+    std::mutex mutex;
+    std::vector<task_priority> order;
+    auto pool = std::make_unique<priority_thread_pool>(1);
+    pool_blocker<priority_thread_pool> blocker{*pool};
+
+    WHEN("tasks of all priorities are queued from lowest to highest")
+    {
+      for(auto priority : {task_priority::low, task_priority::normal, task_priority::high})
+      {
+        auto s = with_priority(*pool, priority);
+        for(int i = 0; i < 3; ++i)
+        {
+          s([&mutex, &order, priority]
+          {
+            std::lock_guard<std::mutex> lock{mutex};
+            order.push_back(priority);
+          });
+        }
+      }
+      blocker.release();
+      pool.reset();
+
+      THEN("they run from highest to lowest")
+      {
+        REQUIRE(order.size() == 9);
+        REQUIRE(std::is_sorted(order.begin(), order.end()));
+        REQUIRE(order.front() == task_priority::high);
+        REQUIRE(order.back() == task_priority::low);
+      }
+    }
+  }
+  GIVEN("a pool without priority lanes")
+  {
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<thread_pool>(2);
+
+    THEN("the priority is ignored")
+    {
+      auto s = with_priority(*pool, task_priority::high);
+      for(int i = 0; i < 100; ++i)
+      {
+        s([&counter] { ++counter; });
+      }
+      s.bulk(100, [&counter] (std::size_t) { ++counter; });
+      pool.reset();
+      REQUIRE(counter == 200);
+    }
+  }
+}
+
+SCENARIO("main_thread_task_queue pops higher priorities first.", "[priority]")
+{
+  GIVEN("tasks queued from lowest to highest priority")
+  {
+    const auto& queue = main_thread_task_queue::get();
+    std::vector<int> order;
+    auto record = [&order] (int i)
+    {
+      return detail::work_item{std::allocator_arg, std::allocator<char>{}, [&order, i] { order.push_back(i); }};
+    };
+    queue.push(record(3), task_priority::low);
+    queue.push(record(2));
+    queue.push(record(1), task_priority::high);
+
+    THEN("try_pop returns them from highest to lowest")
+    {
+      for(int i = 0; i < 3; ++i)
+      {
+        detail::work_item f;
+        REQUIRE(queue.try_pop(f));
+        move(f)();
+      }
+      REQUIRE(order == (std::vector<int>{1, 2, 3}));
+    }
+    queue.clear();
+  }
+}
+
+SCENARIO("main_thread_task_queue coalesces signals and drains in batches.", "[main_thread_task_queue]")
+{
+  GIVEN("an empty main thread queue")
+  {
+    const auto& queue = main_thread_task_queue::get();
+    int counter = 0;
+    auto task = [&counter]
+    {
+      return detail::work_item{std::allocator_arg, std::allocator<char>{}, [&counter] { ++counter; }};
+    };
+
+    WHEN("a burst of tasks is pushed")
+    {
+      std::vector<bool> signals;
+      for(int i = 0; i < 10; ++i)
+      {
+        signals.push_back(queue.push(task()));
+      }
+
+      THEN("only the first push asks for a signal")
+      {
+        REQUIRE(signals.front());
+        REQUIRE(std::count(signals.begin(), signals.end(), true) == 1);
+      }
+      THEN("drain runs at most one batch and asks to be signaled again while tasks are left")
+      {
+        REQUIRE(queue.drain(4));
+        REQUIRE(counter == 4);
+        REQUIRE_FALSE(queue.push(task()));
+        REQUIRE(queue.drain(4));
+        REQUIRE(counter == 8);
+        REQUIRE_FALSE(queue.drain(4));
+        REQUIRE(counter == 11);
+        AND_THEN("the next push asks for a signal again")
+        {
+          REQUIRE(queue.push(task()));
+        }
+      }
+      THEN("drain stops once the time budget is used up")
+      {
+        REQUIRE(queue.drain(100, std::chrono::nanoseconds(0)));
+        REQUIRE(counter == 1);
+      }
+    }
+    WHEN("a task pushes another task while being drained")
+    {
+      REQUIRE(queue.push({std::allocator_arg, std::allocator<char>{}, [&]
+      {
+        REQUIRE_FALSE(queue.push(task()));
+      }}));
+
+      THEN("the same drain runs it without another signal")
+      {
+        REQUIRE_FALSE(queue.drain());
+        REQUIRE(counter == 1);
+      }
+    }
+    queue.clear();
+  }
+}
+
+#if defined(__linux__)
+SCENARIO("linux_event_loop runs tasks and I/O handlers on its thread.", "[linux_event_loop]")
+{
+  GIVEN("an event loop")
+  {
+    linux_event_loop loop;
+
+    WHEN("scheduling tasks from another thread")
+    {
+      std::atomic<int> counter{0};
+      std::atomic<bool> on_loop{true};
+      std::thread t{[&]
+      {
+        for(int i = 0; i < 1000; ++i)
+        {
+          loop([&]
+          {
+            on_loop = on_loop && loop.running_in_this_thread();
+            ++counter;
+          });
+        }
+        loop.stop();
+      }};
+      loop.run();
+      t.join();
+
+      THEN("all of them ran on the loop's thread before it stopped")
+      {
+        REQUIRE(counter == 1000);
+        REQUIRE(on_loop);
+      }
+    }
+    WHEN("a pipe becomes readable")
+    {
+      int fds[2];
+      REQUIRE(pipe(fds) == 0);
+      char received = 0;
+      loop.add(fds[0], EPOLLIN, [&] (std::uint32_t events)
+      {
+        REQUIRE((events & EPOLLIN) != 0);
+        REQUIRE(read(fds[0], &received, 1) == 1);
+        loop.remove(fds[0]);
+        loop.stop();
+      });
+      ssize_t written = 0;
+      std::thread t{[&] { written = write(fds[1], "x", 1); }};
+      loop.run();
+      t.join();
+      close(fds[0]);
+      close(fds[1]);
+
+      THEN("its handler ran")
+      {
+        REQUIRE(written == 1);
+        REQUIRE(received == 'x');
+      }
+    }
+    WHEN("scheduling a delayed task")
+    {
+      const auto start = std::chrono::steady_clock::now();
+      auto elapsed = std::chrono::steady_clock::duration::zero();
+      loop.schedule_after(std::chrono::milliseconds(5), [&]
+      {
+        elapsed = std::chrono::steady_clock::now() - start;
+        loop.stop();
+      });
+      loop.run();
+
+      THEN("it ran once it was due")
+      {
+        REQUIRE(elapsed >= std::chrono::milliseconds(5));
+      }
+    }
+    WHEN("a delayed task throws")
+    {
+      auto second_ran = false;
+      auto posted_ran = false;
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+      loop.schedule_at(deadline, [] { throw std::runtime_error{"failed"}; });
+      loop.schedule_at(deadline, [&] { second_ran = true; });
+      REQUIRE_THROWS_AS(loop.run(), const std::runtime_error&);
+      loop([&]
+      {
+        posted_ran = true;
+        loop.stop();
+      });
+      loop.run();
+
+      THEN("the other due task and tasks posted later still run")
+      {
+        REQUIRE(second_ran);
+        REQUIRE(posted_ran);
+      }
+    }
+    WHEN("polling without anything to do")
+    {
+      loop.run_once(std::chrono::milliseconds(0));
+
+      THEN("it returns")
+      {
+        SUCCEED();
+      }
+    }
+  }
+}
+#endif
+
+SCENARIO("frame_scheduler runs queued tasks within the given budget.", "[frame_scheduler]")
+{
+  GIVEN("a frame_scheduler with queued tasks taking about 1ms each")
+  {
+    frame_scheduler s;
+    int counter = 0;
+    for(int i = 0; i < 20; ++i)
+    {
+      s([&counter]
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ++counter;
+      });
+    }
+
+    WHEN("draining for less time than all tasks need")
+    {
+      const auto left = s.drain_for(std::chrono::milliseconds(3));
+
+      THEN("the rest carries over to the next frame")
+      {
+        REQUIRE(left);
+        REQUIRE(counter > 0);
+        REQUIRE(counter < 20);
+        while(s.drain_for(std::chrono::milliseconds(3)))
+        { }
+        REQUIRE(counter == 20);
+      }
+    }
+    WHEN("the deadline has already passed")
+    {
+      const auto left = s.drain_until(std::chrono::steady_clock::now() - std::chrono::seconds(1));
+
+      THEN("one task still runs")
+      {
+        REQUIRE(left);
+        REQUIRE(counter == 1);
+      }
+    }
+    WHEN("high priority tasks are queued later")
+    {
+      std::vector<int> order;
+      with_priority(s, task_priority::high)([&] { order.push_back(counter); });
+      s.drain_until(std::chrono::steady_clock::now());
+
+      THEN("they run first")
+      {
+        REQUIRE(order == (std::vector<int>{0}));
+      }
+    }
+  }
+}
+
+SCENARIO("counting_instrumentation records pool activity.", "[thread_pool][instrumentation]")
+{
+  GIVEN("an instrumented thread pool")
+  {
+    using pool_t = basic_thread_pool<thread_pool_task_queue, std::thread, counting_instrumentation>;
+    pool_t pool{[] (unsigned, const auto&, auto&& f) { return std::thread(std::forward<decltype(f)>(f)); }, 2};
+
+    WHEN("running tasks scheduled from outside the pool")
+    {
+      std::atomic<int> counter{0};
+      for(int i = 0; i < 1000; ++i)
+      {
+        pool([&counter] { ++counter; });
+      }
+      // The run time is recorded after the task returns
+      auto stats = pool.stats();
+      while(stats.run_time.count() < 1000)
+      {
+        std::this_thread::yield();
+        stats = pool.stats();
+      }
+
+      THEN("all pushes and pops are counted")
+      {
+        REQUIRE(stats.workers.size() == 3);
+        REQUIRE(stats.queues.size() == 2);
+        REQUIRE(stats.workers.back().pushes == 1000);
+        std::uint64_t pops = 0;
+        for(auto& w : stats.workers)
+        {
+          pops += w.local_pops + w.steals;
+        }
+        REQUIRE(pops == 1000);
+        for(auto& q : stats.queues)
+        {
+          REQUIRE(q.depth == 0);
+        }
+        REQUIRE(std::max(stats.queues[0].max_depth, stats.queues[1].max_depth) > 0);
+      }
+      THEN("every task's latency is recorded")
+      {
+        REQUIRE(stats.queue_latency.count() == 1000);
+        REQUIRE(stats.run_time.count() == 1000);
+        REQUIRE(stats.queue_latency.quantile(0.5) <= stats.queue_latency.quantile(1));
+      }
+    }
+  }
+}
+
+SCENARIO("Instrumented thread pools store small tasks without allocating.", "[thread_pool][instrumentation]")
+{
+  GIVEN("a task capturing two pointers, which thread_pool stores inline")
+  {
+    std::atomic<int> counter{0};
+    int step = 1;
+    auto task = [&counter, &step] { counter += step; };
+
+    WHEN("scheduling it on pools with counting and tracing instrumentation")
+    {
+      {
+        instrumented_thread_pool<counting_instrumentation> counting{1};
+        instrumented_thread_pool<tracing_instrumentation<counting_instrumentation>> tracing{1};
+        counting(forbidden_allocator<>{}, task);
+        tracing(forbidden_allocator<>{}, task);
+      }
+
+      THEN("the wrapped task still fits into the work item and runs")
+      {
+        REQUIRE(counter == 2);
+      }
+    }
+  }
+}
+
+namespace
+{
+  // Tells the test which workers are blocked in their queue's pop()
+  std::atomic<bool> parked_workers[2];
+
+  struct park_watcher : no_instrumentation
+  {
+    auto on_park(unsigned worker) const noexcept -> void { parked_workers[worker] = true; }
+    auto on_wake(unsigned worker) const noexcept -> void { parked_workers[worker] = false; }
+  };
+}
+
+SCENARIO("Tasks scheduled from inside a thread pool stay on the submitting thread.", "[thread_pool]")
+{
+  GIVEN("a thread pool with two threads, one of them blocked")
+  {
+    for(auto& p : parked_workers)
+    {
+      p = false;
+    }
+    using pool_t = basic_thread_pool<thread_pool_task_queue, std::thread, park_watcher>;
+    pool_t pool{[] (unsigned, const auto&, auto&& f) { return std::thread(std::forward<decltype(f)>(f)); }, 2};
+    std::atomic<bool> release{false};
+    std::atomic<bool> finished{false};
+    std::thread::id parent_thread;
+    std::thread::id child_thread;
+
+    WHEN("a task schedules another task")
+    {
+      pool([&]
+      {
+        // A task scheduled while the other worker is parked is handed to it, which puts the parent on the free worker
+        const auto other = 1 - pool.current_worker();
+        while(!parked_workers[other])
+        {
+          std::this_thread::yield();
+        }
+        pool([&]
+        {
+          parent_thread = std::this_thread::get_id();
+          pool([&]
+          {
+            child_thread = std::this_thread::get_id();
+            finished = true;
+          });
+        });
+        // Without this worker parking the child can only go to the parent's own queue
+        while(!release)
+        {
+          std::this_thread::yield();
+        }
+      });
+      while(!finished)
+      {
+        std::this_thread::yield();
+      }
+      release = true;
+      pool.wait_idle();
+
+      THEN("the nested task runs on the same thread")
+      {
+        REQUIRE(parent_thread == child_thread);
+      }
+    }
+  }
+}
+
+namespace
+{
+  // Every task schedules the next one through s until n tasks ran
+  template<class Scheduler>
+  auto chain(const Scheduler& s, int n, std::atomic<int>& ran, std::atomic<unsigned>& max_depth) -> void
+  {
+    auto depth = schedulers::detail::inline_depth();
+    auto seen = max_depth.load();
+    while(depth > seen && !max_depth.compare_exchange_weak(seen, depth)) { }
+    if(++ran < n)
+    {
+      s([&s, n, &ran, &max_depth] { chain(s, n, ran, max_depth); });
+    }
+  }
+}
+
+SCENARIO("Thread pool workers run their hooks and know who they are.", "[thread_pool][hooks]")
+{
+  GIVEN("a thread pool with start and stop hooks")
+  {
+    constexpr unsigned n = 4;
+    std::mutex mutex;
+    std::vector<unsigned> started;
+    std::vector<unsigned> stopped;
+    std::vector<std::thread::id> start_threads(n);
+    std::vector<int> scratch(n, 0);
+    thread_pool_hooks hooks;
+    hooks.on_start = [&] (unsigned index)
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      started.push_back(index);
+      start_threads[index] = std::this_thread::get_id();
+    };
+    hooks.on_stop = [&] (unsigned index)
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopped.push_back(index);
+    };
+    auto pool = std::make_unique<thread_pool>(n, thread_pool_idle_policy{}, hooks);
+
+    THEN("the calling thread is no worker")
+    {
+      REQUIRE_FALSE(current_worker());
+      REQUIRE(pool->current_worker() == pool->num_threads());
+    }
+    WHEN("running tasks")
+    {
+      std::atomic<int> remaining{100};
+      std::atomic<bool> all_match{true};
+      for(int i = 0; i < 100; ++i)
+      {
+        (*pool)([&]
+        {
+          const auto worker = current_worker();
+          if(worker.pool != pool.get() || worker.index != pool->current_worker())
+          {
+            all_match = false;
+          }
+          {
+            std::lock_guard<std::mutex> lock{mutex};
+            if(start_threads[worker.index] != std::this_thread::get_id())
+            {
+              all_match = false;
+            }
+          }
+          // Every worker owns one slot so no synchronization is needed
+          ++scratch[worker.index];
+          --remaining;
+        });
+      }
+      while(remaining > 0)
+      {
+        std::this_thread::yield();
+      }
+      pool.reset();
+
+      THEN("every task found the pool and index of the thread it ran on")
+      {
+        REQUIRE(all_match);
+        REQUIRE(std::accumulate(scratch.begin(), scratch.end(), 0) == 100);
+      }
+      THEN("every worker ran both hooks once")
+      {
+        std::sort(started.begin(), started.end());
+        std::sort(stopped.begin(), stopped.end());
+        REQUIRE(started == (std::vector<unsigned>{0, 1, 2, 3}));
+        REQUIRE(stopped == (std::vector<unsigned>{0, 1, 2, 3}));
+      }
+    }
+  }
+}
+
+namespace
+{
+  // Shut down a single threaded pool with a backlog behind a running task, returning how many queued tasks ran and survived
+  template<class Pool>
+  auto discard_backlog(Pool& pool) -> std::pair<int, int>
+  {
+    std::atomic<bool> started{false};
+    std::atomic<bool> release{false};
+    std::atomic<int> ran{0};
+    int instances = 0;
+    pool([&]
+    {
+      started = true;
+      while(!release)
+      {
+        std::this_thread::yield();
+      }
+    });
+    while(!started)
+    {
+      std::this_thread::yield();
+    }
+    for(int i = 0; i < 100; ++i)
+    {
+      pool([&ran, t = tracked_callable{&instances}] { ++ran; });
+    }
+
+    std::thread t{[&pool] { pool.shutdown(shutdown_mode::discard); }};
+    // Give shutdown() time to stop the worker before its task returns
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    release = true;
+    t.join();
+    return {ran.load(), instances};
+  }
+}
+
+SCENARIO("Thread pools wait until they are idle and shut down without being destroyed.", "[thread_pool][shutdown]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{2};
+    std::atomic<int> counter{0};
+
+    WHEN("waiting for tasks which schedule more tasks")
+    {
+      for(int i = 0; i < 10; ++i)
+      {
+        pool([&]
+        {
+          for(int j = 0; j < 10; ++j)
+          {
+            pool([&] { ++counter; });
+          }
+          ++counter;
+        });
+      }
+      pool.wait_idle();
+
+      THEN("all of them have finished")
+      {
+        REQUIRE(counter == 110);
+      }
+    }
+    WHEN("draining the pool")
+    {
+      for(int i = 0; i < 100; ++i)
+      {
+        pool([&] { ++counter; });
+      }
+      pool.drain();
+
+      THEN("every task has finished")
+      {
+        REQUIRE(counter == 100);
+      }
+    }
+    WHEN("waiting while nothing is scheduled")
+    {
+      pool.wait_idle();
+
+      THEN("it returns right away")
+      {
+        REQUIRE(counter == 0);
+      }
+    }
+    WHEN("shutting down with shutdown_mode::drain")
+    {
+      for(int i = 0; i < 100; ++i)
+      {
+        pool([&] { ++counter; });
+      }
+      pool.shutdown();
+
+      THEN("every task has run")
+      {
+        REQUIRE(counter == 100);
+      }
+      AND_WHEN("scheduling more tasks")
+      {
+        pool([&] { ++counter; });
+        pool.wait_idle();
+        pool.shutdown();
+
+        THEN("they never run")
+        {
+          REQUIRE(counter == 100);
+        }
+      }
+    }
+  }
+  GIVEN("a thread pool with one worker busy")
+  {
+    thread_pool pool{1};
+
+    WHEN("shutting down with shutdown_mode::discard")
+    {
+      const auto result = discard_backlog(pool);
+
+      THEN("the backlog is destroyed without running")
+      {
+        REQUIRE(result.first == 0);
+        REQUIRE(result.second == 0);
+      }
+    }
+  }
+  GIVEN("a bounded thread pool with one worker busy")
+  {
+    bounded_thread_pool<128> pool{1};
+
+    WHEN("shutting down with shutdown_mode::discard")
+    {
+      const auto result = discard_backlog(pool);
+
+      THEN("the backlog is destroyed without running")
+      {
+        REQUIRE(result.first == 0);
+        REQUIRE(result.second == 0);
+      }
+    }
+  }
+  GIVEN("a priority thread pool with one worker busy")
+  {
+    priority_thread_pool pool{1};
+
+    WHEN("shutting down with shutdown_mode::discard")
+    {
+      const auto result = discard_backlog(pool);
+
+      THEN("the backlog is destroyed without running")
+      {
+        REQUIRE(result.first == 0);
+        REQUIRE(result.second == 0);
+      }
+    }
+  }
+  GIVEN("a work stealing thread pool with one worker busy")
+  {
+    work_stealing_thread_pool pool{1};
+
+    WHEN("shutting down with shutdown_mode::discard")
+    {
+      const auto result = discard_backlog(pool);
+
+      THEN("the backlog is destroyed without running")
+      {
+        REQUIRE(result.first == 0);
+        REQUIRE(result.second == 0);
+      }
+    }
+  }
+}
+
+SCENARIO("inline_or_schedule runs tasks inline on the threads of the scheduler.", "[thread_pool][inline]")
+{
+  GIVEN("a thread pool and an inlining adaptor")
+  {
+    thread_pool pool{2};
+    auto s = inline_or_schedule(pool, 4);
+
+    WHEN("scheduling from outside the pool")
+    {
+      std::atomic<bool> done{false};
+      std::thread::id runner;
+      s([&] { runner = std::this_thread::get_id(); done = true; });
+      while(!done)
+      {
+        std::this_thread::yield();
+      }
+
+      THEN("the task runs on the pool")
+      {
+        REQUIRE(runner != std::this_thread::get_id());
+        REQUIRE_FALSE(pool.running_in_this_thread());
+      }
+    }
+    WHEN("scheduling from a worker")
+    {
+      std::atomic<bool> done{false};
+      bool ran_inline = false;
+      pool([&]
+      {
+        auto id = std::this_thread::get_id();
+        std::thread::id runner;
+        s([&] { runner = std::this_thread::get_id(); });
+        ran_inline = runner == id;
+        done = true;
+      });
+      while(!done)
+      {
+        std::this_thread::yield();
+      }
+
+      THEN("the task runs before schedule returns")
+      {
+        REQUIRE(ran_inline);
+      }
+    }
+    WHEN("a long chain of continuations is scheduled from a worker")
+    {
+      std::atomic<int> ran{0};
+      std::atomic<unsigned> max_depth{0};
+      pool([&] { chain(s, 1000, ran, max_depth); });
+      while(ran < 1000)
+      {
+        std::this_thread::yield();
+      }
+
+      THEN("all of them ran without exceeding the depth bound")
+      {
+        REQUIRE(max_depth == 4);
+      }
+    }
+  }
+  GIVEN("an elastic thread pool and an inlining adaptor")
+  {
+    elastic_thread_pool pool;
+    auto s = inline_or_schedule(pool);
+
+    THEN("tasks scheduled from its workers run inline")
+    {
+      std::atomic<bool> done{false};
+      bool ran_inline = false;
+      pool([&]
+      {
+        auto id = std::this_thread::get_id();
+        std::thread::id runner;
+        s([&] { runner = std::this_thread::get_id(); });
+        ran_inline = runner == id;
+        done = true;
+      });
+      while(!done)
+      {
+        std::this_thread::yield();
+      }
+      REQUIRE(ran_inline);
+    }
+  }
+}
+
+namespace
+{
+  // Runs everything immediately on the calling thread
+  class inline_scheduler : public available_scheduler<inline_scheduler>
+  {
+  private:
+    friend available_scheduler<inline_scheduler>;
+
+    template<class Alloc, class F>
+    void schedule(const Alloc& alloc, F&& f) const
+    {
+      auto g = std::forward<F>(f);
+      std::move(g)();
+    }
+  };
+
+  template<class Scheduler>
+  auto check_bulk_indices(const Scheduler& s, std::size_t n)
+  {
+    std::vector<std::atomic<int>> hits(n);
+    std::atomic<std::size_t> done{0};
+    s.bulk(n, [&] (std::size_t i)
+    {
+      ++hits[i];
+      ++done;
+    });
+    while(done < n)
+    {
+      std::this_thread::yield();
+    }
+    return std::all_of(hits.begin(), hits.end(), [] (const auto& x) { return x == 1; });
+  }
+
+  template<class Scheduler>
+  auto check_bulk_range(const Scheduler& s, std::size_t n)
+  {
+    std::atomic<std::size_t> done{0};
+    std::vector<std::function<void()>> tasks(n, [&done] { ++done; });
+    s.bulk(tasks.begin(), tasks.end());
+    while(done < n)
+    {
+      std::this_thread::yield();
+    }
+    return done == n;
+  }
+}
+
+namespace
+{
+  // Schedule delayed tasks to the pool and record whether any of them ran early
+  template<class Pool>
+  auto run_delayed_tasks(const Pool& pool, int n, bool& early) -> void
+  {
+    using clock = std::chrono::steady_clock;
+    std::atomic<int> finished{0};
+    std::atomic<bool> too_early{false};
+    for(int i = 0; i < n; ++i)
+    {
+      const auto deadline = clock::now() + std::chrono::milliseconds(i % 20);
+      pool.schedule_at(deadline, [&finished, &too_early, deadline]
+      {
+        if(clock::now() < deadline)
+        {
+          too_early = true;
+        }
+        ++finished;
+      });
+    }
+    while(finished < n)
+    {
+      std::this_thread::yield();
+    }
+    early = too_early;
+  }
+}
+
+SCENARIO("Thread pools run delayed tasks once they are due.", "[thread_pool][timers]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{2};
+
+    WHEN("a task is scheduled with a delay")
+    {
+      using clock = std::chrono::steady_clock;
+      const auto scheduled = clock::now();
+      std::atomic<bool> ran{false};
+      clock::time_point started;
+      pool.schedule_after(std::chrono::milliseconds(20), [&]
+      {
+        started = clock::now();
+        ran = true;
+      });
+
+      THEN("it runs after the delay")
+      {
+        while(!ran)
+        {
+          std::this_thread::yield();
+        }
+        REQUIRE(started - scheduled >= std::chrono::milliseconds(20));
+      }
+    }
+    WHEN("a task is scheduled for a time in the past")
+    {
+      std::atomic<bool> ran{false};
+      pool.schedule_at(std::chrono::steady_clock::now() - std::chrono::seconds(1), [&ran] { ran = true; });
+
+      THEN("it runs right away")
+      {
+        while(!ran)
+        {
+          std::this_thread::yield();
+        }
+      }
+    }
+    WHEN("many tasks are scheduled with different delays")
+    {
+      bool early = true;
+      run_delayed_tasks(pool, 2000, early);
+
+      THEN("all of them run and none early")
+      {
+        REQUIRE_FALSE(early);
+      }
+    }
+  }
+  GIVEN("pools with other work queues")
+  {
+    bool early = true;
+
+    THEN("they support timers too")
+    {
+      run_delayed_tasks(work_stealing_thread_pool{2}, 500, early);
+      REQUIRE_FALSE(early);
+      run_delayed_tasks(priority_thread_pool{2}, 500, early);
+      REQUIRE_FALSE(early);
+      run_delayed_tasks(bounded_thread_pool<64>{2}, 500, early);
+      REQUIRE_FALSE(early);
+      run_delayed_tasks(make_shared_scheduler<thread_pool>(2), 500, early);
+      REQUIRE_FALSE(early);
+    }
+  }
+  GIVEN("an instrumented pool whose workers are parked")
+  {
+    using pool_t = basic_thread_pool<thread_pool_task_queue, std::thread, counting_instrumentation>;
+    pool_t pool{[] (unsigned, const auto&, auto&& f) { return std::thread(std::forward<decltype(f)>(f)); }, 2};
+    const auto parks = [&pool]
+    {
+      std::uint64_t n = 0;
+      for(auto& w : pool.stats().workers)
+      {
+        n += w.parks;
+      }
+      return n;
+    };
+    const auto pushes = [&pool]
+    {
+      std::uint64_t n = 0;
+      for(auto& w : pool.stats().workers)
+      {
+        n += w.pushes;
+      }
+      return n;
+    };
+    while(parks() < 2)
+    {
+      std::this_thread::yield();
+    }
+
+    WHEN("the worker waiting for a later timer has to wake up for an earlier one")
+    {
+      std::atomic<bool> ran{false};
+      pool.schedule_after(std::chrono::hours(1), [] { });
+      pool.schedule_after(std::chrono::milliseconds(5), [&ran] { ran = true; });
+      // The push is only counted after the task is queued, so it may already have run
+      while(!ran || pushes() == 0)
+      {
+        std::this_thread::yield();
+      }
+
+      THEN("it is woken up without pushing tasks to it")
+      {
+        REQUIRE(pushes() == 1);
+      }
+    }
+  }
+  GIVEN("delayed tasks that are not due when the pool is destroyed")
+  {
+    int instances = 0;
+    std::atomic<bool> ran{false};
+    {
+      thread_pool pool{2};
+      for(int i = 0; i < 10; ++i)
+      {
+        pool.schedule_after(std::chrono::hours(1), [t = tracked_callable{&instances}, &ran] { ran = true; });
+      }
+    }
+
+    THEN("they are discarded without running")
+    {
+      REQUIRE(instances == 0);
+      REQUIRE_FALSE(ran);
+    }
+  }
+}
+
+SCENARIO("Bulk scheduling invokes every index exactly once.", "[bulk]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{3};
+
+    THEN("bulk(n, f) calls f once for every index")
+    {
+      REQUIRE(check_bulk_indices(pool, 1));
+      REQUIRE(check_bulk_indices(pool, 2));
+      REQUIRE(check_bulk_indices(pool, 1000));
+    }
+    THEN("bulk(first, last) calls every function once")
+    {
+      REQUIRE(check_bulk_range(pool, 1));
+      REQUIRE(check_bulk_range(pool, 1000));
+    }
+  }
+
+  GIVEN("a work stealing thread pool")
+  {
+    work_stealing_thread_pool pool{3};
+
+    THEN("bulk(n, f) calls f once for every index")
+    {
+      REQUIRE(check_bulk_indices(pool, 1));
+      REQUIRE(check_bulk_indices(pool, 1000));
+    }
+    THEN("bulk(first, last) calls every function once")
+    {
+      REQUIRE(check_bulk_range(pool, 1));
+      REQUIRE(check_bulk_range(pool, 1000));
+    }
+  }
+
+  GIVEN("a scheduler without custom bulk support")
+  {
+    inline_scheduler s;
+
+    THEN("bulk(n, f) calls f once for every index")
+    {
+      REQUIRE(check_bulk_indices(s, 1));
+      REQUIRE(check_bulk_indices(s, 1000));
+    }
+    THEN("bulk(first, last) calls every function once")
+    {
+      REQUIRE(check_bulk_range(s, 1000));
+    }
+  }
+
+  GIVEN("a bulk call where the function is not copied")
+  {
+    thread_pool pool{2};
+    std::atomic<int> instances{0};
+    std::atomic<int> calls{0};
+    struct tracked_indexed
+    {
+      tracked_indexed(std::atomic<int>* instances, std::atomic<int>* calls) : instances(instances), calls(calls) { ++*instances; }
+      tracked_indexed(const tracked_indexed& other) : instances(other.instances), calls(other.calls) { ++*instances; }
+      ~tracked_indexed() { --*instances; }
+      auto operator()(std::size_t) const { ++*calls; }
+      std::atomic<int>* instances;
+      std::atomic<int>* calls;
+    };
+    pool.bulk(100, tracked_indexed{&instances, &calls});
+    while(calls < 100)
+    {
+      std::this_thread::yield();
+    }
+
+    THEN("the shared copy is eventually destroyed")
+    {
+      // The last chunk to finish destroys the function object after returning
+      while(instances != 0)
+      {
+        std::this_thread::yield();
+      }
+      REQUIRE(calls == 100);
+    }
+  }
+}
+
+namespace
+{
+  struct counted_element
+  {
+    counted_element() { ++constructed; }
+    ~counted_element() { --constructed; }
+    int value = 42;
+    static int constructed;
+  };
+  int counted_element::constructed = 0;
+}
+
+SCENARIO("cache_aligned_array puts every element on its own cache lines.", "[thread_pool]")
+{
+  GIVEN("an array of small elements")
+  {
+    {
+      detail::cache_aligned_array<counted_element> elements{5};
+
+      THEN("every element is constructed and starts on a separate cache line")
+      {
+        REQUIRE(counted_element::constructed == 5);
+        REQUIRE(elements.size() == 5);
+        for(std::size_t i = 0; i < elements.size(); ++i)
+        {
+          REQUIRE(elements[i].value == 42);
+          REQUIRE(reinterpret_cast<std::uintptr_t>(&elements[i]) % detail::cache_line_size == 0);
+        }
+        REQUIRE(reinterpret_cast<char*>(&elements[1]) - reinterpret_cast<char*>(&elements[0]) == static_cast<std::ptrdiff_t>(detail::cache_line_size));
+      }
+    }
+    THEN("all elements are destroyed with the array")
+    {
+      REQUIRE(counted_element::constructed == 0);
+    }
+  }
+}
+
+SCENARIO("work_stealing_deque ordering.", "[work_stealing_thread_pool]")
+{
+  GIVEN("a deque with more items than its initial capacity")
+  {
+    int values[10];
+    detail::work_stealing_deque<int*> deque{4};
+    for(auto& x : values)
+    {
+      deque.push(&x);
+    }
+
+    THEN("the owner takes items in LIFO order")
+    {
+      REQUIRE(deque.take() == &values[9]);
+      REQUIRE(deque.take() == &values[8]);
+    }
+    THEN("thieves steal items in FIFO order")
+    {
+      REQUIRE(deque.steal() == &values[0]);
+      REQUIRE(deque.steal() == &values[1]);
+    }
+    THEN("all items can be removed")
+    {
+      for(int i = 0; i < 5; ++i)
+      {
+        REQUIRE(deque.steal() == &values[i]);
+        REQUIRE(deque.take() == &values[9 - i]);
+      }
+      REQUIRE(deque.empty());
+      REQUIRE(deque.take() == nullptr);
+      REQUIRE(deque.steal() == nullptr);
+    }
+  }
+}
+
+SCENARIO("work_stealing_task_queue ordering.", "[work_stealing_thread_pool]")
+{
+  GIVEN("a queue owned by the calling thread")
+  {
+    work_stealing_task_queue queue;
+    queue.bind_owner();
+
+    WHEN("the owner pushes tasks without ever waiting on the queue")
+    {
+      std::vector<int> order;
+      for(int i = 0; i < 3; ++i)
+      {
+        queue.push(detail::work_item{std::allocator_arg, std::allocator<char>(), [&order, i] { order.push_back(i); }});
+      }
+      while(true)
+      {
+        detail::work_item f;
+        if(!queue.try_pop(f))
+        {
+          break;
+        }
+        move(f)();
+      }
+
+      THEN("it takes them in LIFO order")
+      {
+        REQUIRE(order == (std::vector<int>{2, 1, 0}));
+      }
+    }
+  }
+}
+
 // Compile tests for custom work queues
 namespace
 {
@@ -127,13 +1626,13 @@ template<class Alloc>
 struct std::uses_allocator<work_item_3, Alloc> : std::true_type { };
 
 template class schedulers::basic_thread_pool<test_work_queue<work_item_1>, std::thread>;
-template void schedulers::basic_thread_pool<test_work_queue<work_item_1>, std::thread>::operator()(some_fun&&) const;
+template void schedulers::available_scheduler<schedulers::basic_thread_pool<test_work_queue<work_item_1>, std::thread>>::operator()(some_fun&&) const;
 
 template class schedulers::basic_thread_pool<test_work_queue<work_item_2>, std::thread>;
-template void schedulers::basic_thread_pool<test_work_queue<work_item_2>, std::thread>::operator()(some_fun&&) const;
+template void schedulers::available_scheduler<schedulers::basic_thread_pool<test_work_queue<work_item_2>, std::thread>>::operator()(some_fun&&) const;
 
 template class schedulers::basic_thread_pool<test_work_queue<work_item_3>, std::thread>;
-template void schedulers::basic_thread_pool<test_work_queue<work_item_3>, std::thread>::operator()(some_fun&&) const;
+template void schedulers::available_scheduler<schedulers::basic_thread_pool<test_work_queue<work_item_3>, std::thread>>::operator()(some_fun&&) const;
 
 template class schedulers::basic_thread_pool<test_work_queue<work_item_4>, std::thread>;
-template void schedulers::basic_thread_pool<test_work_queue<work_item_4>, std::thread>::operator()(some_fun&&) const;
+template void schedulers::available_scheduler<schedulers::basic_thread_pool<test_work_queue<work_item_4>, std::thread>>::operator()(some_fun&&) const;
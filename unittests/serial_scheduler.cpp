@@ -0,0 +1,140 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/serial_scheduler.hpp"
+#include "catch.hpp"
+#include <mutex>
+#include <vector>
+
+using namespace schedulers;
+
+SCENARIO("serial_scheduler runs tasks one at a time in order.", "[serial_scheduler]")
+{
+  GIVEN("a serial_scheduler on a thread pool")
+  {
+    thread_pool pool{4};
+    auto strand = std::make_unique<serial_scheduler<thread_pool>>(pool, 4);
+
+    WHEN("several threads schedule tasks concurrently")
+    {
+      constexpr int num_producers = 4;
+      constexpr int num_tasks = 2000;
+      std::atomic<bool> inside{false};
+      std::atomic<bool> overlapped{false};
+      int counter = 0; // Only touched from tasks of the strand
+      std::atomic<int> finished{0};
+      std::vector<int> last_seen(num_producers, -1);
+      bool in_order = true;
+
+      std::vector<std::thread> producers;
+      for(int p = 0; p < num_producers; ++p)
+      {
+        producers.emplace_back([&, p]
+        {
+          for(int i = 0; i < num_tasks; ++i)
+          {
+            (*strand)([&, p, i]
+            {
+              if(inside.exchange(true))
+              {
+                overlapped = true;
+              }
+              ++counter;
+              in_order = in_order && last_seen[p] == i - 1;
+              last_seen[p] = i;
+              inside = false;
+              ++finished;
+            });
+          }
+        });
+      }
+      for(auto&& t : producers)
+      {
+        t.join();
+      }
+
+      THEN("tasks never overlap and keep their order")
+      {
+        // Pending tasks still run after the strand is gone
+        strand.reset();
+        while(finished < num_producers * num_tasks)
+        {
+          std::this_thread::yield();
+        }
+        REQUIRE_FALSE(overlapped);
+        REQUIRE(counter == num_producers * num_tasks);
+        REQUIRE(in_order);
+      }
+    }
+  }
+  GIVEN("a serial_scheduler with a batch size of 2 on a blocked single-threaded pool")
+  {
+    std::atomic<bool> release{false};
+    std::atomic<bool> blocked{false};
+    std::mutex mutex;
+    std::vector<int> order;
+    auto record = [&mutex, &order] (int i)
+    {
+      return [&mutex, &order, i]
+      {
+        std::lock_guard<std::mutex> lock{mutex};
+        order.push_back(i);
+      };
+    };
+
+    auto pool = std::make_unique<thread_pool>(1);
+    serial_scheduler<thread_pool> strand{*pool, 2};
+    (*pool)([&] { blocked = true; while(!release) { std::this_thread::yield(); } });
+    while(!blocked)
+    {
+      std::this_thread::yield();
+    }
+
+    WHEN("more tasks than the batch size are queued before other work")
+    {
+      for(int i = 0; i < 4; ++i)
+      {
+        strand(record(i));
+      }
+      (*pool)(record(-1));
+      release = true;
+      pool.reset();
+
+      THEN("the drain reschedules itself after every batch")
+      {
+        REQUIRE(order == (std::vector<int>{0, 1, -1, 2, 3}));
+      }
+    }
+  }
+  GIVEN("a serial_scheduler on a shared_scheduler")
+  {
+    std::atomic<int> counter{0};
+    auto pool = make_shared_scheduler<thread_pool>(2);
+    auto strand = std::make_unique<serial_scheduler<shared_scheduler<thread_pool>>>(pool);
+
+    THEN("it runs all tasks")
+    {
+      for(int i = 0; i < 100; ++i)
+      {
+        (*strand)([&counter] { ++counter; });
+      }
+      strand.reset();
+      while(counter < 100)
+      {
+        std::this_thread::yield();
+      }
+      REQUIRE(counter == 100);
+    }
+  }
+}
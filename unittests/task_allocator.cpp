@@ -0,0 +1,121 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/task_allocator.hpp"
+#include "test_tools.hpp"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using schedulers::task_allocator;
+
+SCENARIO("task_allocator reuses blocks on the same thread", "[task_allocator]")
+{
+  GIVEN("a task_allocator")
+  {
+    task_allocator<char> alloc;
+
+    WHEN("freeing a block and allocating one of the same size")
+    {
+      auto p = alloc.allocate(48);
+      alloc.deallocate(p, 48);
+      auto q = alloc.allocate(48);
+      alloc.deallocate(q, 48);
+
+      THEN("the same block is returned")
+      {
+        REQUIRE(p == q);
+      }
+    }
+    WHEN("allocating blocks of different size")
+    {
+      auto p = alloc.allocate(16);
+      auto q = alloc.allocate(400);
+      auto r = alloc.allocate(4000);
+
+      THEN("all blocks are distinct and usable")
+      {
+        REQUIRE(p != q);
+        std::fill_n(p, 16, 'a');
+        std::fill_n(q, 400, 'b');
+        std::fill_n(r, 4000, 'c');
+        REQUIRE(p[15] == 'a');
+        REQUIRE(q[399] == 'b');
+      }
+      alloc.deallocate(p, 16);
+      alloc.deallocate(q, 400);
+      alloc.deallocate(r, 4000);
+    }
+  }
+}
+
+SCENARIO("task_allocator returns blocks freed on other threads to their owner", "[task_allocator]")
+{
+  GIVEN("blocks allocated on this thread")
+  {
+    task_allocator<char> alloc;
+    std::vector<char*> blocks(100);
+    for(auto& p : blocks)
+    {
+      p = alloc.allocate(100);
+    }
+
+    WHEN("freeing them on another thread")
+    {
+      std::thread([&] { for(auto p : blocks) alloc.deallocate(p, 100); }).join();
+
+      THEN("they are available to this thread again")
+      {
+        std::vector<char*> again(100);
+        for(auto& p : again)
+        {
+          p = alloc.allocate(100);
+        }
+        std::sort(blocks.begin(), blocks.end());
+        std::sort(again.begin(), again.end());
+        REQUIRE(blocks == again);
+        for(auto p : again)
+        {
+          alloc.deallocate(p, 100);
+        }
+      }
+    }
+  }
+  GIVEN("blocks allocated on a thread which has exited")
+  {
+    task_allocator<int> alloc;
+    std::vector<int*> blocks(100);
+    std::thread([&] { for(auto& p : blocks) p = alloc.allocate(4); }).join();
+
+    THEN("they can be freed and reused safely")
+    {
+      for(auto p : blocks)
+      {
+        alloc.deallocate(p, 4);
+      }
+      std::thread([&]
+      {
+        for(auto& p : blocks)
+        {
+          p = alloc.allocate(4);
+          *p = 42;
+        }
+        for(auto p : blocks)
+        {
+          alloc.deallocate(p, 4);
+        }
+      }).join();
+    }
+  }
+}
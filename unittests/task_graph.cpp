@@ -0,0 +1,303 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/task_graph.hpp"
+#include "schedulers/schedulers.hpp"
+#include "test_tools.hpp"
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+using namespace schedulers;
+
+namespace
+{
+  // A scheduler without try_run_one() so the caller has to block
+  class forwarding_scheduler : public available_scheduler<forwarding_scheduler>
+  {
+  public:
+    explicit forwarding_scheduler(const thread_pool& pool) : _pool(pool) { }
+
+  private:
+    friend available_scheduler<forwarding_scheduler>;
+
+    template<class Alloc, class F>
+    void schedule(const Alloc& alloc, F&& f) const
+    {
+      _pool(alloc, std::forward<F>(f));
+    }
+
+    const thread_pool& _pool;
+  };
+
+  // Layers of tasks where every task depends on all tasks of the previous layer and records when it ran
+  struct layered_graph
+  {
+    layered_graph(int layers, int width)
+    : layers(layers)
+    , width(width)
+    , order(layers * width)
+    {
+      std::vector<task_graph::node> previous;
+      for(int l = 0; l < layers; ++l)
+      {
+        std::vector<task_graph::node> current;
+        for(int i = 0; i < width; ++i)
+        {
+          auto index = l * width + i;
+          current.push_back(graph.emplace([this, index] { order[index] = ++clock; }));
+          for(auto p : previous)
+          {
+            graph.precede(p, current.back());
+          }
+        }
+        previous = std::move(current);
+      }
+    }
+
+    auto dependencies_respected() const -> bool
+    {
+      for(int l = 1; l < layers; ++l)
+      {
+        for(int i = 0; i < width; ++i)
+        {
+          for(int p = 0; p < width; ++p)
+          {
+            if(order[(l - 1) * width + p] >= order[l * width + i])
+            {
+              return false;
+            }
+          }
+        }
+      }
+      return true;
+    }
+
+    int layers;
+    int width;
+    std::atomic<int> clock{0};
+    std::vector<std::atomic<int>> order;
+    task_graph graph;
+  };
+}
+
+SCENARIO("task_graph runs every task after its predecessors.", "[task_graph]")
+{
+  GIVEN("a thread pool")
+  {
+    thread_pool pool{4};
+
+    WHEN("running a layered graph")
+    {
+      layered_graph g{5, 8};
+      run(g.graph, pool);
+
+      THEN("every task ran once and after all of its predecessors")
+      {
+        REQUIRE(g.clock == 40);
+        REQUIRE(g.dependencies_respected());
+      }
+    }
+    WHEN("running a graph on a scheduler which cannot help")
+    {
+      layered_graph g{5, 8};
+      run(g.graph, forwarding_scheduler{pool});
+
+      THEN("every task ran once and after all of its predecessors")
+      {
+        REQUIRE(g.clock == 40);
+        REQUIRE(g.dependencies_respected());
+      }
+    }
+    WHEN("running a diamond")
+    {
+      std::vector<int> log;
+      std::mutex mutex;
+      auto append = [&] (int x) { std::lock_guard<std::mutex> lock{mutex}; log.push_back(x); };
+      task_graph graph;
+      auto a = graph.emplace([&] { append(1); });
+      auto b = graph.emplace([&] { append(2); });
+      auto c = graph.emplace([&] { append(2); });
+      auto d = graph.emplace([&] { append(3); });
+      graph.precede(a, b);
+      graph.precede(a, c);
+      graph.precede(b, d);
+      graph.precede(c, d);
+      run(graph, pool);
+
+      THEN("the tasks ran in dependency order")
+      {
+        REQUIRE(log == (std::vector<int>{1, 2, 2, 3}));
+      }
+    }
+    WHEN("running a graph without roots")
+    {
+      task_graph graph;
+      auto a = graph.emplace([] { });
+      auto b = graph.emplace([] { });
+      graph.precede(a, b);
+      graph.precede(b, a);
+
+      THEN("run throws")
+      {
+        REQUIRE_THROWS_AS(run(graph, pool), std::logic_error);
+      }
+    }
+    WHEN("running an empty graph")
+    {
+      task_graph graph;
+      run(graph, pool);
+
+      THEN("nothing happens")
+      {
+        REQUIRE(graph.size() == 0);
+      }
+    }
+  }
+}
+
+SCENARIO("task_graph can be run repeatedly.", "[task_graph]")
+{
+  GIVEN("a thread pool and a graph")
+  {
+    thread_pool pool{4};
+    layered_graph g{4, 16};
+
+    WHEN("running it many times")
+    {
+      for(int i = 0; i < 100; ++i)
+      {
+        run(g.graph, pool);
+        REQUIRE(g.dependencies_respected());
+      }
+
+      THEN("every run executed every task")
+      {
+        REQUIRE(g.clock == 100 * 64);
+      }
+    }
+    WHEN("adding tasks between runs")
+    {
+      run(g.graph, pool);
+      std::atomic<int> extra{0};
+      auto first = g.graph.emplace([&] { ++extra; });
+      auto second = g.graph.emplace([&] { ++extra; });
+      g.graph.precede(first, second);
+      run(g.graph, pool);
+
+      THEN("the new tasks run too")
+      {
+        REQUIRE(g.clock == 128);
+        REQUIRE(extra == 2);
+      }
+    }
+  }
+}
+
+SCENARIO("task_graph stores large and small callables.", "[task_graph]")
+{
+  GIVEN("a graph with callables of various sizes")
+  {
+    thread_pool pool{2};
+    std::atomic<int> sum{0};
+    task_graph graph;
+    auto previous = graph.emplace([&] { ++sum; });
+    for(int i = 0; i < 100; ++i)
+    {
+      std::array<char, 1000> small{};
+      std::array<char, 10000> large{};
+      small[0] = 1;
+      large[0] = 2;
+      auto a = graph.emplace([&sum, small] { sum += small[0]; });
+      auto b = graph.emplace([&sum, large] { sum += large[0]; });
+      graph.precede(previous, a);
+      graph.precede(a, b);
+      previous = b;
+    }
+
+    WHEN("running it")
+    {
+      run(graph, pool);
+
+      THEN("all of them ran with their captures intact")
+      {
+        REQUIRE(sum == 301);
+      }
+    }
+  }
+}
+
+SCENARIO("task_graph can be moved.", "[task_graph]")
+{
+  GIVEN("a graph with tasks")
+  {
+    thread_pool pool{2};
+    std::atomic<int> sum{0};
+    task_graph graph;
+    graph.precede(graph.emplace([&] { sum += 1; }), graph.emplace([&] { sum += 2; }));
+
+    WHEN("moving it into another graph")
+    {
+      task_graph moved{std::move(graph)};
+      run(moved, pool);
+
+      THEN("the new graph runs the tasks")
+      {
+        REQUIRE(sum == 3);
+        REQUIRE(graph.size() == 0);
+      }
+    }
+    WHEN("adding tasks to the moved-from graph")
+    {
+      task_graph moved{std::move(graph)};
+      graph.emplace([&] { sum += 4; });
+      run(graph, pool);
+
+      THEN("it can be run on its own")
+      {
+        REQUIRE(sum == 4);
+        REQUIRE(moved.size() == 2);
+      }
+    }
+  }
+}
+
+SCENARIO("task_graph propagates exceptions.", "[task_graph]")
+{
+  GIVEN("a chain of tasks where one throws")
+  {
+    thread_pool pool{2};
+    std::atomic<int> ran{0};
+    task_graph graph;
+    auto a = graph.emplace([&] { ++ran; });
+    auto b = graph.emplace([&] { ++ran; throw std::runtime_error("test"); });
+    auto c = graph.emplace([&] { ++ran; });
+    graph.precede(a, b);
+    graph.precede(b, c);
+
+    THEN("run rethrows it and skips the remaining tasks")
+    {
+      REQUIRE_THROWS_AS(run(graph, pool), std::runtime_error);
+      REQUIRE(ran == 2);
+    }
+    THEN("the graph can be run again afterwards")
+    {
+      REQUIRE_THROWS_AS(run(graph, pool), std::runtime_error);
+      REQUIRE_THROWS_AS(run(graph, pool), std::runtime_error);
+      REQUIRE(ran == 4);
+    }
+  }
+}
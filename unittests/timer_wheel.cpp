@@ -0,0 +1,154 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/timer_wheel.hpp"
+#include "catch.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace schedulers;
+using std::chrono::milliseconds;
+
+SCENARIO("timer_wheel expires timers at their deadline.", "[timer_wheel]")
+{
+  GIVEN("a wheel with millisecond ticks")
+  {
+    const auto start = std::chrono::steady_clock::now();
+    detail::timer_wheel<int> wheel{milliseconds(1), start};
+    std::vector<int> expired;
+
+    THEN("it starts empty")
+    {
+      REQUIRE(wheel.empty());
+      REQUIRE(wheel.next_deadline() == std::chrono::steady_clock::time_point::max());
+    }
+    WHEN("a timer is inserted")
+    {
+      auto value = 1;
+      REQUIRE(wheel.insert(start + milliseconds(10), value));
+      REQUIRE(wheel.size() == 1);
+
+      THEN("it does not expire early")
+      {
+        wheel.advance(start + milliseconds(9), expired);
+        REQUIRE(expired.empty());
+      }
+      THEN("it expires once its deadline is reached")
+      {
+        REQUIRE(wheel.next_deadline() == start + milliseconds(10));
+        wheel.advance(start + milliseconds(10), expired);
+        REQUIRE(expired == std::vector<int>{1});
+        REQUIRE(wheel.empty());
+      }
+    }
+    WHEN("a deadline is between two ticks")
+    {
+      auto value = 1;
+      wheel.insert(start + std::chrono::microseconds(2500), value);
+
+      THEN("it is rounded up to the next tick")
+      {
+        REQUIRE(wheel.next_deadline() == start + milliseconds(3));
+      }
+    }
+    WHEN("a deadline has already been processed")
+    {
+      wheel.advance(start + milliseconds(5), expired);
+      auto value = 1;
+
+      THEN("the timer is rejected")
+      {
+        REQUIRE_FALSE(wheel.insert(start + milliseconds(5), value));
+        REQUIRE_FALSE(wheel.insert(start, value));
+        REQUIRE(wheel.empty());
+      }
+    }
+    WHEN("timers are far apart")
+    {
+      // Deadlines on all levels: one tick, a minute, and over a day
+      const milliseconds delays[] = {milliseconds(1), milliseconds(64 * 64 * 16), milliseconds(100'000'000)};
+      for(int i = 2; i >= 0; --i)
+      {
+        auto value = i;
+        wheel.insert(start + delays[i], value);
+      }
+
+      THEN("each expires exactly at its deadline")
+      {
+        for(int i = 0; i < 3; ++i)
+        {
+          wheel.advance(start + delays[i] - milliseconds(1), expired);
+          REQUIRE(expired.size() == static_cast<std::size_t>(i));
+          wheel.advance(start + delays[i], expired);
+          REQUIRE(expired.size() == static_cast<std::size_t>(i + 1));
+          REQUIRE(expired.back() == i);
+        }
+        REQUIRE(wheel.empty());
+      }
+      THEN("next_deadline() never lies past the next expiry")
+      {
+        auto now = start;
+        while(!wheel.empty())
+        {
+          const auto next = wheel.next_deadline();
+          REQUIRE(next > now);
+          now = next;
+          wheel.advance(now, expired);
+        }
+        REQUIRE(expired == (std::vector<int>{0, 1, 2}));
+      }
+    }
+  }
+}
+
+SCENARIO("timer_wheel expires random timers in deadline order.", "[timer_wheel]")
+{
+  GIVEN("many timers with random deadlines")
+  {
+    const auto start = std::chrono::steady_clock::now();
+    detail::timer_wheel<int> wheel{milliseconds(1), start};
+    std::mt19937 random{42};
+    std::uniform_int_distribution<int> deadline{1, 300'000};
+
+    std::vector<int> deadlines;
+    for(int i = 0; i < 10'000; ++i)
+    {
+      auto d = deadline(random);
+      deadlines.push_back(d);
+      wheel.insert(start + milliseconds(d), d);
+    }
+
+    WHEN("the wheel is advanced in irregular steps")
+    {
+      std::vector<int> expired;
+      bool early = false;
+      for(int now = 0; now <= 300'000; now += 1 + now % 97)
+      {
+        const auto first = expired.size();
+        wheel.advance(start + milliseconds(now), expired);
+        early = early || std::any_of(expired.begin() + first, expired.end(), [now] (int d) { return d > now; });
+      }
+      wheel.advance(start + milliseconds(300'000), expired);
+
+      THEN("all timers expire in order and none early")
+      {
+        std::sort(deadlines.begin(), deadlines.end());
+        REQUIRE_FALSE(early);
+        REQUIRE(expired == deadlines);
+        REQUIRE(wheel.empty());
+      }
+    }
+  }
+}
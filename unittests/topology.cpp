@@ -0,0 +1,117 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/schedulers.hpp"
+#include "catch.hpp"
+#include <set>
+
+using namespace schedulers;
+
+SCENARIO("cpu_topology describes the available CPUs.", "[topology]")
+{
+  GIVEN("the detected topology")
+  {
+    const auto topology = cpu_topology::detect();
+
+    THEN("it has at least one CPU and contiguous, sorted node numbers")
+    {
+      REQUIRE_FALSE(topology.cpus.empty());
+      REQUIRE(topology.num_nodes >= 1);
+      REQUIRE(topology.cpus.front().node == 0);
+      REQUIRE(topology.cpus.back().node == topology.num_nodes - 1);
+      for(std::size_t i = 1; i < topology.cpus.size(); ++i)
+      {
+        const auto step = topology.cpus[i].node - topology.cpus[i - 1].node;
+        REQUIRE((step == 0 || step == 1));
+      }
+    }
+  }
+}
+
+SCENARIO("steal_order_by_node prefers workers on the same node.", "[topology]")
+{
+  GIVEN("two nodes with two workers each")
+  {
+    const auto order = detail::steal_order_by_node({0, 0, 1, 1});
+
+    THEN("every row starts with the worker and its neighbor")
+    {
+      REQUIRE(order.size() == 16);
+      REQUIRE((std::vector<unsigned>(order.begin(), order.begin() + 4)) == (std::vector<unsigned>{0, 1, 2, 3}));
+      REQUIRE((std::vector<unsigned>(order.begin() + 4, order.begin() + 8)) == (std::vector<unsigned>{1, 0, 3, 2}));
+      REQUIRE((std::vector<unsigned>(order.begin() + 8, order.begin() + 12)) == (std::vector<unsigned>{2, 3, 0, 1}));
+      REQUIRE((std::vector<unsigned>(order.begin() + 12, order.begin() + 16)) == (std::vector<unsigned>{3, 2, 1, 0}));
+    }
+  }
+  GIVEN("workers interleaved over three nodes")
+  {
+    const std::vector<unsigned> nodes{0, 1, 2, 0, 1, 2};
+    const auto order = detail::steal_order_by_node(nodes);
+
+    THEN("every row is a permutation visiting nodes in order")
+    {
+      for(unsigned i = 0; i < nodes.size(); ++i)
+      {
+        const std::vector<unsigned> row(order.begin() + i * nodes.size(), order.begin() + (i + 1) * nodes.size());
+        REQUIRE(row.front() == i);
+        REQUIRE(std::set<unsigned>(row.begin(), row.end()).size() == nodes.size());
+        for(std::size_t k = 0; k < row.size(); ++k)
+        {
+          REQUIRE(nodes[row[k]] == (nodes[i] + k / 2) % 3);
+        }
+      }
+    }
+  }
+}
+
+SCENARIO("pinned_thread_pool runs all tasks.", "[topology][thread_pool]")
+{
+  GIVEN("a pinned pool over a fake topology with two nodes")
+  {
+    cpu_topology topology;
+    const auto cpu = cpu_topology::detect().cpus.front();
+    topology.cpus = {{cpu.id, cpu.group, 0}, {cpu.id, cpu.group, 0}, {cpu.id, cpu.group, 1}, {cpu.id, cpu.group, 1}};
+    topology.num_nodes = 2;
+    std::atomic<int> counter{0};
+    auto pool = std::make_unique<pinned_thread_pool>(topology);
+
+    THEN("tasks scheduled from outside and inside all run")
+    {
+      for(int i = 0; i < 100; ++i)
+      {
+        (*pool)([&counter, &pool]
+        {
+          ++counter;
+          (*pool)([&counter] { ++counter; });
+        });
+      }
+      while(counter < 200)
+      {
+        std::this_thread::yield();
+      }
+      pool.reset();
+      REQUIRE(counter == 200);
+    }
+  }
+  GIVEN("a pinned_thread_factory")
+  {
+    const pinned_thread_factory factory;
+
+    THEN("workers wrap around the CPUs")
+    {
+      const auto n = static_cast<unsigned>(factory.topology().cpus.size());
+      REQUIRE(factory.node_of(n) == factory.node_of(0));
+    }
+  }
+}
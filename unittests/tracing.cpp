@@ -0,0 +1,278 @@
+// Copyright (c) 2016, Miroslav Knejp
+//
+// Permission to use, copy, modify, and/or distribute this software for any
+// purpose with or without fee is hereby granted, provided that the above
+// copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+// WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+// ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+// WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+// ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+// OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "schedulers/schedulers.hpp"
+#include "schedulers/tracing.hpp"
+#include "catch.hpp"
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace schedulers;
+
+namespace
+{
+  auto count(const std::string& haystack, const std::string& needle) -> std::size_t
+  {
+    std::size_t n = 0;
+    for(auto pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + needle.size()))
+    {
+      ++n;
+    }
+    return n;
+  }
+
+  auto chrome_trace(const trace_recorder& recorder) -> std::string
+  {
+    std::ostringstream out;
+    recorder.write_chrome_trace(out);
+    return out.str();
+  }
+
+  template<class Instrumentation>
+  using traced_pool = basic_thread_pool<thread_pool_task_queue, std::thread, Instrumentation>;
+
+  template<class Instrumentation>
+  auto make_traced_pool(unsigned num_threads)
+  {
+    return std::make_unique<traced_pool<Instrumentation>>([] (unsigned, const auto&, auto&& f) { return std::thread(std::forward<decltype(f)>(f)); }, num_threads);
+  }
+}
+
+SCENARIO("tracing_instrumentation records every task of a pool.", "[tracing]")
+{
+  GIVEN("an installed recorder and a traced pool")
+  {
+    trace_recorder recorder;
+    recorder.install();
+    recorder.set_thread_name("test \"main\"");
+    auto pool = make_traced_pool<tracing_instrumentation<>>(2);
+
+    WHEN("running labeled tasks scheduled from inside and outside the pool")
+    {
+      std::atomic<int> counter{0};
+      for(int i = 0; i < 100; ++i)
+      {
+        (*pool)(labeled("outer", [&]
+        {
+          (*pool)(labeled("inner", [&counter] { ++counter; }));
+        }));
+      }
+      (*pool)([&counter] { ++counter; });
+      pool->wait_idle();
+      const auto trace = chrome_trace(recorder);
+
+      THEN("every task becomes a slice named after its label")
+      {
+        REQUIRE(counter == 101);
+        REQUIRE(count(trace, "\"ph\":\"X\"") == 201);
+        REQUIRE(count(trace, "\"name\":\"outer\"") == 100);
+        REQUIRE(count(trace, "\"name\":\"inner\"") == 100);
+        REQUIRE(count(trace, "\"name\":\"task\"") == 1);
+      }
+      THEN("every slice is connected to the thread which scheduled it")
+      {
+        REQUIRE(count(trace, "\"ph\":\"s\"") == 201);
+        REQUIRE(count(trace, "\"ph\":\"f\"") == 201);
+      }
+      THEN("the tracks are named after the threads")
+      {
+        REQUIRE(count(trace, "\"name\":\"test \\\"main\\\"\"") == 1);
+        REQUIRE(count(trace, "\"name\":\"worker ") >= 1);
+        REQUIRE(trace.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0);
+        REQUIRE(trace.substr(trace.size() - 4) == "\n]}\n");
+      }
+    }
+  }
+  trace_recorder::uninstall();
+}
+
+SCENARIO("Only tasks scheduled while a recorder is installed are traced.", "[tracing]")
+{
+  GIVEN("a recorder and a traced pool")
+  {
+    trace_recorder recorder;
+    auto pool = make_traced_pool<tracing_instrumentation<>>(1);
+
+    WHEN("scheduling tasks before, during and after the recorder is installed")
+    {
+      std::atomic<int> counter{0};
+      (*pool)(labeled("before", [&counter] { ++counter; }));
+      recorder.install();
+      REQUIRE(trace_recorder::installed() == &recorder);
+      (*pool)(labeled("during", [&counter] { ++counter; }));
+      trace_recorder::uninstall();
+      (*pool)(labeled("after", [&counter] { ++counter; }));
+      pool->wait_idle();
+      const auto trace = chrome_trace(recorder);
+
+      THEN("all tasks run but only one is recorded")
+      {
+        REQUIRE(counter == 3);
+        REQUIRE(count(trace, "\"ph\":\"X\"") == 1);
+        REQUIRE(count(trace, "\"name\":\"during\"") == 1);
+      }
+    }
+  }
+  GIVEN("an installed recorder which is destroyed")
+  {
+    {
+      trace_recorder recorder;
+      recorder.install();
+    }
+
+    THEN("it is uninstalled")
+    {
+      REQUIRE(trace_recorder::installed() == nullptr);
+    }
+  }
+}
+
+SCENARIO("Every thread keeps the most recent events.", "[tracing]")
+{
+  GIVEN("a recorder with room for three events per thread")
+  {
+    trace_recorder recorder{3};
+    recorder.install();
+    tracing_instrumentation<> instrumentation;
+
+    WHEN("running more tasks on one thread")
+    {
+      for(int i = 0; i < 6; ++i)
+      {
+        instrumentation.wrap(labeled("old", [] { }))();
+      }
+      for(int i = 0; i < 3; ++i)
+      {
+        instrumentation.wrap(labeled("new", [] { }))();
+      }
+      const auto trace = chrome_trace(recorder);
+
+      THEN("only the last events are left")
+      {
+        REQUIRE(count(trace, "\"name\":\"old\"") == 0);
+        REQUIRE(count(trace, "\"name\":\"new\"") == 3);
+      }
+    }
+  }
+  trace_recorder::uninstall();
+}
+
+SCENARIO("Threads which start after others ended get their own track.", "[tracing]")
+{
+  GIVEN("a recorder")
+  {
+    trace_recorder recorder;
+
+    WHEN("registering threads one after another")
+    {
+      // Joined threads' ids are usually handed out again to the next one
+      std::vector<std::uint32_t> tracks;
+      for(int i = 0; i < 4; ++i)
+      {
+        std::thread{[&] { tracks.push_back(recorder.current_thread()); }}.join();
+      }
+
+      THEN("no thread writes into the buffer of an earlier one")
+      {
+        REQUIRE(tracks == (std::vector<std::uint32_t>{0, 1, 2, 3}));
+      }
+    }
+  }
+}
+
+SCENARIO("tracing_instrumentation marks stolen tasks.", "[tracing]")
+{
+  GIVEN("an installed recorder and a tracing policy")
+  {
+    trace_recorder recorder;
+    recorder.install();
+    tracing_instrumentation<> instrumentation;
+
+    WHEN("a task was popped from another worker's queue")
+    {
+      auto stolen = instrumentation.wrap(labeled("stolen", [] { }));
+      auto local = instrumentation.wrap(labeled("local", [] { }));
+      instrumentation.on_pop(0, 1);
+      stolen();
+      instrumentation.on_pop(1, 1);
+      local();
+      const auto trace = chrome_trace(recorder);
+
+      THEN("only its slice says so")
+      {
+        REQUIRE(count(trace, "\"stolen\":true") == 1);
+        REQUIRE(count(trace, "\"stolen\":false") == 1);
+        REQUIRE(trace.find("\"stolen\":true") < trace.find("\"name\":\"local\""));
+      }
+    }
+  }
+  trace_recorder::uninstall();
+}
+
+SCENARIO("tracing_instrumentation can be combined with counting_instrumentation.", "[tracing]")
+{
+  GIVEN("a pool with both policies")
+  {
+    trace_recorder recorder;
+    recorder.install();
+    auto pool = make_traced_pool<tracing_instrumentation<counting_instrumentation>>(2);
+
+    WHEN("running tasks")
+    {
+      for(int i = 0; i < 50; ++i)
+      {
+        (*pool)([] { });
+      }
+      pool->wait_idle();
+
+      THEN("tasks are both counted and traced")
+      {
+        const auto stats = pool->stats();
+        REQUIRE(stats.workers.back().pushes == 50);
+        REQUIRE(stats.run_time.count() == 50);
+        REQUIRE(count(chrome_trace(recorder), "\"ph\":\"X\"") == 50);
+      }
+    }
+  }
+  trace_recorder::uninstall();
+}
+
+#if defined(__linux__) && defined(SCHEDULERS_TRACING)
+SCENARIO("linux_event_loop traces its tasks when built with SCHEDULERS_TRACING.", "[tracing][linux_event_loop]")
+{
+  GIVEN("an installed recorder and an event loop")
+  {
+    trace_recorder recorder;
+    recorder.install();
+    linux_event_loop loop;
+
+    WHEN("running a scheduled task")
+    {
+      bool ran = false;
+      loop(labeled("looped", [&ran] { ran = true; }));
+      loop.run_once(std::chrono::milliseconds(0));
+
+      THEN("it is recorded")
+      {
+        REQUIRE(ran);
+        REQUIRE(count(chrome_trace(recorder), "\"name\":\"looped\"") == 1);
+      }
+    }
+  }
+  trace_recorder::uninstall();
+}
+#endif
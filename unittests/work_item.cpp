@@ -119,6 +119,57 @@ SCENARIO("work_item small-buffer-optimization selection strategy", "[work_item]"
   }
 }
 
+SCENARIO("basic_work_item inline buffer size is configurable", "[work_item]")
+{
+  // A typical task capturing a shared_ptr, a pointer and two ints
+  struct medium_function : tracked_callable
+  {
+    using tracked_callable::tracked_callable;
+
+    std::shared_ptr<int> p;
+    void* q;
+    int a, b;
+  };
+
+  GIVEN("a work_item with the default buffer size")
+  {
+    size_t bytes = 0;
+    int instances = 0;
+    work_item wi(std::allocator_arg, tracking_allocator<>{&bytes}, medium_function{&instances});
+
+    THEN("small-object-optimization is disabled")
+    {
+      REQUIRE(instances == 1);
+      REQUIRE(bytes > 0);
+    }
+  }
+
+  GIVEN("a work_item with a buffer of one cache line")
+  {
+    size_t bytes = 0;
+    int instances = 0;
+    schedulers::detail::basic_work_item<64> wi(std::allocator_arg, tracking_allocator<>{&bytes}, medium_function{&instances});
+
+    THEN("small-object-optimization is enabled")
+    {
+      REQUIRE(instances == 1);
+      REQUIRE(bytes == 0);
+    }
+
+    WHEN("moving it to a new work_item")
+    {
+      schedulers::detail::basic_work_item<64> wi2{std::move(wi)};
+
+      THEN("the function object is destructibly moved without allocating")
+      {
+        REQUIRE(instances == 1);
+        REQUIRE(bytes == 0);
+        REQUIRE(bool(wi2) == true);
+      }
+    }
+  }
+}
+
 SCENARIO("work_item behavior with small-object-optimization active", "[work_item]")
 {
   size_t bytes = 0;